@@ -1,12 +1,16 @@
 #include <AnimatedStrip.h>
 #include <FastLED.h>
-#include <Arduino.h>
 #include "AnimatedStrip.h"
 #include "SymmetricFillAnim.h"
 #include "BlinkingSymetricFillAnim.h"
+#include "EventLog.h"
 
 AnimatedStrip::AnimatedStrip(CRGB* leds, int num_leds)
-    : leds(leds), num_leds(num_leds) {}
+    : leds(leds), num_leds(num_leds) {
+    for (int i = ANIMATION_MAX_HANDLES - 1; i >= 0; i--) {
+        freeSlots[freeSlotCount++] = i;
+    }
+}
 
 // struct SymmetricFillAnim : public AnimatedStrip::Animation {
 //     int start_index, end_index;
@@ -73,8 +77,15 @@ void AnimatedStrip::update() {
     bool anyChanges = false;
 
     for (auto it = activeAnims.begin(); it != activeAnims.end(); ) {
-        bool animRunning = (*it)->update(leds);
+        if ((*it)->paused && !(*it)->isFinished()) {
+            ++it;
+            continue;
+        }
+
+        // finish() makes update() return early without reporting the end, so check both
+        bool animRunning = (*it)->update(leds) && !(*it)->isFinished();
         if (!animRunning) {
+            releaseSlot(*it);
             delete *it;
             it = activeAnims.erase(it);
             anyChanges = true;  // animation ended => LEDs changed on last frame
@@ -84,16 +95,107 @@ void AnimatedStrip::update() {
         }
     }
 
-    if (anyChanges) {
+    if (anyChanges || showPending) {
+        show();
+    }
+}
+
+void AnimatedStrip::setOutput(Ws2812Output* output) {
+    this->output = output;
+}
+
+void AnimatedStrip::show() {
+    if (output == nullptr) {
         FastLED.show();
+        return;
     }
+
+    showPending = !output->show(leds, num_leds, FastLED.getBrightness());
 }
 
-void AnimatedStrip::addAnimation(Animation* anim) {
+bool AnimatedStrip::isShowPending() const {
+    return showPending;
+}
+
+AnimatedStrip::Handle AnimatedStrip::addAnimation(Animation* anim) {
     activeAnims.push_back(anim);
+
+    if (freeSlotCount == 0) {
+        anim->slot = -1;
+        return NO_ANIMATION;
+    }
+
+    int slot = freeSlots[--freeSlotCount];
+    handleSlots[slot].anim = anim;
+    anim->slot = slot;
+    return (static_cast<Handle>(handleSlots[slot].generation) << 16) | slot;
+}
+
+bool AnimatedStrip::isActive(Handle handle) const {
+    Animation* anim = resolve(handle);
+    return anim != nullptr && !anim->isFinished();
+}
+
+bool AnimatedStrip::finish(Handle handle) {
+    Animation* anim = resolve(handle);
+    if (anim == nullptr) return false;
+
+    anim->finish();
+    return true;
 }
 
-void AnimatedStrip::startSymmetricFill(
+bool AnimatedStrip::pause(Handle handle, bool paused) {
+    Animation* anim = resolve(handle);
+    if (anim == nullptr) return false;
+
+    anim->paused = paused;
+    return true;
+}
+
+bool AnimatedStrip::retarget(Handle handle, int start_index, int end_index, const CRGB& color) {
+    Animation* anim = resolve(handle);
+    if (anim == nullptr || start_index < 0 || end_index >= num_leds || start_index > end_index) return false;
+
+    return anim->retarget(start_index, end_index, color);
+}
+
+int AnimatedStrip::finishRegion(int start_index, int end_index) {
+    int count = 0;
+    for (Animation* anim : activeAnims) {
+        int first, last;
+        if (anim->isFinished() || !anim->getRange(first, last)) continue;
+
+        if (first <= end_index && last >= start_index) {
+            anim->finish();
+            count++;
+        }
+    }
+    return count;
+}
+
+AnimatedStrip::Animation* AnimatedStrip::resolve(Handle handle) const {
+    uint32_t slot = handle & 0xFFFF;
+    if (handle == NO_ANIMATION || slot >= ANIMATION_MAX_HANDLES) return nullptr;
+
+    const HandleSlot& entry = handleSlots[slot];
+    return entry.generation == (handle >> 16) ? entry.anim : nullptr;
+}
+
+void AnimatedStrip::releaseSlot(Animation* anim) {
+    if (anim->slot < 0) return;
+
+    HandleSlot& entry = handleSlots[anim->slot];
+    entry.anim = nullptr;
+    if (++entry.generation == 0) entry.generation = 1; // 0 would make NO_ANIMATION valid
+    freeSlots[freeSlotCount++] = anim->slot;
+    anim->slot = -1;
+}
+
+size_t AnimatedStrip::getActiveCount() const {
+    return activeAnims.size();
+}
+
+AnimatedStrip::Handle AnimatedStrip::startSymmetricFill(
     int start_index,
     int end_index,
     const CRGB& color,
@@ -101,12 +203,9 @@ void AnimatedStrip::startSymmetricFill(
     int fps
 ) {
     // Log what's happening for debugging
-    Serial.printf(
-        "Starting symmetric fill from %d to %d with color %06X, duration %.2f ms, fps %d\n",
-        start_index, end_index, color.as_uint32_t(), duration_ms, fps
-    );
+    LOG_EVENT(LOG_STRIP_FILL, start_index, end_index, static_cast<unsigned long>(color.as_uint32_t()), duration_ms, fps);
 
     // Create animation and add it to the active list
     SymmetricFillAnim* anim = new SymmetricFillAnim(start_index, end_index, color, duration_ms, fps);
-    activeAnims.push_back(anim);
+    return addAnimation(anim);
 }
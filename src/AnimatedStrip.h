@@ -2,10 +2,22 @@
 #define ANIMATED_STRIP_H
 
 #include <FastLED.h>
+#include "Hal.h"
+#include "Ws2812Output.h"
 #include <vector>
 
+#define ANIMATION_MAX_HANDLES 32        // Animations that can be tracked by handle at once
+
 class AnimatedStrip {
 public:
+    /**
+     * @brief Generational handle of an animation: slot in the low 16 bits, generation
+     * in the high 16 bits. A handle goes stale when its animation is deleted, and
+     * every operation on a stale handle is a no-op.
+     */
+    typedef uint32_t Handle;
+    static const Handle NO_ANIMATION = 0;
+
     struct Animation {
         unsigned long last_update_ms = 0;
         int current_frame = 0;
@@ -18,6 +30,9 @@ public:
 
         bool perpetual = false; // If true, animation will loop indefinitely
         bool finished = false;
+        bool paused = false;    // Skipped by AnimatedStrip::update(), LEDs keep their state
+
+        int slot = -1;          // Handle slot, set by the strip
 
         virtual ~Animation() = default;
 
@@ -31,11 +46,21 @@ public:
             finished = true;
         }
 
+        /// @brief LEDs the animation writes, false if it does not say
+        virtual bool getRange(int& /*start_index*/, int& /*end_index*/) const {
+            return false;
+        }
+
+        /// @brief Move the animation to other LEDs or another color, false if it cannot
+        virtual bool retarget(int /*start_index*/, int /*end_index*/, const CRGB& /*color*/) {
+            return false;
+        }
+
     protected:
         bool shouldUpdate() {
             if (isFinished()) return false;
 
-            unsigned long now = millis();
+            unsigned long now = hal::millis();
 
             if (!started) {
                 if (created_at_ms == 0) created_at_ms = now;
@@ -58,10 +83,52 @@ public:
     };
 
     AnimatedStrip(CRGB* leds, int num_leds);
-    void addAnimation(Animation* anim);
+
+    /**
+     * @brief Takes ownership of an animation; it is deleted once it finishes.
+     * @return Handle for the operations below, NO_ANIMATION if all handle slots are in
+     * use (the animation still runs, it just cannot be reached).
+     */
+    Handle addAnimation(Animation* anim);
     void update();
+
+    /// @brief Whether the handle still refers to an unfinished animation
+    bool isActive(Handle handle) const;
+
+    /// @brief Ends the animation on the next update(), false if the handle is stale
+    bool finish(Handle handle);
+
+    /// @brief Stops or resumes updating the animation, false if the handle is stale
+    bool pause(Handle handle, bool paused);
+
+    /// @brief Changes the LEDs or color of the animation, false if stale or not supported
+    bool retarget(Handle handle, int start_index, int end_index, const CRGB& color);
+
+    /**
+     * @brief Ends every animation writing to any LED of [start_index, end_index].
+     * @return Number of animations finished.
+     */
+    int finishRegion(int start_index, int end_index);
+
+    /**
+     * @brief Send frames through a non-blocking output instead of FastLED.show().
+     * @param output  Output to use, nullptr for FastLED. Not owned by the strip.
+     */
+    void setOutput(Ws2812Output* output);
+
+    /**
+     * @brief Push the LED buffer out after writing it directly (not through an animation).
+     * With an output that is still busy, the frame goes out on a later update().
+     */
+    void show();
+
+    /// @brief Whether a frame is waiting for the output to be free
+    bool isShowPending() const;
+
+    /// @brief Number of animations still running
+    size_t getActiveCount() const;
     
-    void startSymmetricFill(
+    Handle startSymmetricFill(
         int start_index,
         int end_index,
         const CRGB& color,
@@ -73,6 +140,19 @@ private:
     CRGB* leds;
     int num_leds;
     std::vector<Animation*> activeAnims;
+
+    struct HandleSlot {
+        Animation* anim = nullptr;
+        uint16_t generation = 1;
+    };
+    HandleSlot handleSlots[ANIMATION_MAX_HANDLES];
+    int freeSlots[ANIMATION_MAX_HANDLES];
+    int freeSlotCount = 0;
+
+    Animation* resolve(Handle handle) const;
+    void releaseSlot(Animation* anim);
+    Ws2812Output* output = nullptr;
+    bool showPending = false;           // A frame the output refused while busy
 };
 
 
@@ -1,31 +1,44 @@
 #pragma once
 #include "AnimatedStrip.h"
+#include "LedZones.h"
 #include <FastLED.h>
 
 struct RadiatingSymmetricPulseAnim : public AnimatedStrip::Animation {
-    int start_index, end_index;
+    const LedZone* zone;
+    LedZone own_zone;       // Geometry of an index range, unused with a shared zone
     CRGB color;
-    float center_index;
-    float max_radius;
     const float gamma = 1.5;
+    std::vector<uint8_t> alpha;   // Per zone LED, filled each frame
     bool toInside = false;
     int max_loops = 0;      // 0 means infinite (perpetual)
     int loop_count = 0;
     int frames_per_pulse = 30; // Number of frames for one full pulse cycle
 
     RadiatingSymmetricPulseAnim(int s, int e, bool toInside, int maxLoops, const CRGB& c, float duration_ms, int fps, int fpp = 30)
-        : start_index(s), end_index(e), color(c), toInside(toInside), max_loops(maxLoops), frames_per_pulse(fpp)
+        : zone(&own_zone), color(c), toInside(toInside), max_loops(maxLoops), frames_per_pulse(fpp)
     {
-        int range = abs(end_index - start_index);
-        center_index = (start_index + end_index) / 2.0f;
-        max_radius = range / 2.0f;
+        own_zone.build(s, e);
+        init(duration_ms, fps);
+    }
 
-        total_frames = fps > 0 ? (duration_ms / 1000.0f) * fps : 1;
-        current_frame = 0;
-        frame_interval_ms = duration_ms / total_frames;
-        last_update_ms = millis();
+    /// @param z  Zone of the table, must outlive the animation
+    RadiatingSymmetricPulseAnim(const LedZone& z, bool toInside, int maxLoops, const CRGB& c, float duration_ms, int fps, int fpp = 30)
+        : zone(&z), color(c), toInside(toInside), max_loops(maxLoops), frames_per_pulse(fpp)
+    {
+        init(duration_ms, fps);
+    }
 
-        perpetual = true; // This animation loops indefinitely
+    bool getRange(int& start, int& end) const override {
+        start = zone->first;
+        end = zone->last;
+        return true;
+    }
+
+    bool retarget(int s, int e, const CRGB& c) override {
+        own_zone.build(s, e);
+        zone = &own_zone;
+        color = c;
+        return true;
     }
 
     bool update(CRGB* leds) override {
@@ -37,21 +50,25 @@ struct RadiatingSymmetricPulseAnim : public AnimatedStrip::Animation {
         CRGB target = to_color ? color : CRGB::Black;
 
         float blur = 3.0f;
-        float radius = cycle_progress * (max_radius + blur);
+        float radius = cycle_progress * (zone->max_radius + blur);
 
-        for (int i = start_index; i <= end_index; ++i) {
-            float dist = fabs(i - center_index);
-            if (toInside) dist = max_radius - dist;
+        alpha.resize(zone->size());
+        for (size_t k = 0; k < zone->size(); ++k) {
+            float dist = zone->distance[k];
+            if (toInside) dist = zone->max_radius - dist;
             float edge_dist = dist - (radius - blur);
 
             if (edge_dist <= 0) {
-                leds[i] = target;
+                alpha[k] = 255;
             } else if (edge_dist < blur) {
                 float t = 1.0f - (edge_dist / blur);
                 t = pow(t, gamma);
-                leds[i] = blend(leds[i], target, (uint8_t)(t * 255));
+                alpha[k] = (uint8_t)(t * 255);
+            } else {
+                alpha[k] = 0;
             }
         }
+        zone->blend(leds, target, alpha.data());
 
         current_frame++;
 
@@ -69,4 +86,14 @@ struct RadiatingSymmetricPulseAnim : public AnimatedStrip::Animation {
 
         return true;
     }
+
+private:
+    void init(float duration_ms, int fps) {
+        total_frames = fps > 0 ? (duration_ms / 1000.0f) * fps : 1;
+        current_frame = 0;
+        frame_interval_ms = duration_ms / total_frames;
+        last_update_ms = hal::millis();
+
+        perpetual = true; // This animation loops indefinitely
+    }
 };
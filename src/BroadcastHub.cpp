@@ -0,0 +1,257 @@
+#include "BroadcastHub.h"
+
+static const char* const topicNames[NUM_TOPICS] = {"orders", "telemetry", "humidity", "logs"};
+
+// Orders must reach the tablet, a newer humidity reading makes the queued one
+// useless, and telemetry and logs are asked for again when they matter
+static const BackpressurePolicy topicPolicies[NUM_TOPICS] = {
+    BACKPRESSURE_EVICT,
+    BACKPRESSURE_DROP_NEW,
+    BACKPRESSURE_COALESCE,
+    BACKPRESSURE_DROP_NEW,
+};
+
+BroadcastHub::BroadcastHub() {
+    for (int i = 0; i < BROADCAST_MAX_CLIENTS; i++) {
+        m_clients[i].used = false;
+        m_clients[i].count = 0;
+    }
+    resetStats();
+}
+
+void BroadcastHub::setTransport(CanSend can_send, Send send, void* context) {
+    m_canSend = can_send;
+    m_send = send;
+    m_context = context;
+}
+
+bool BroadcastHub::addClient(uint32_t client_id, uint8_t topics) {
+    Client* client = find(client_id);
+    if (client == nullptr) {
+        for (int i = 0; i < BROADCAST_MAX_CLIENTS && client == nullptr; i++) {
+            if (!m_clients[i].used) client = &m_clients[i];
+        }
+        if (client == nullptr) return false;
+    }
+
+    while (client->count > 0) removeAt(*client, 0);
+    client->used = true;
+    client->id = client_id;
+    client->topics = topics;
+    client->delivered = 0;
+    client->backpressure = 0;
+    return true;
+}
+
+void BroadcastHub::removeClient(uint32_t client_id) {
+    Client* client = find(client_id);
+    if (client == nullptr) return;
+
+    // Releases this client's references to the shared messages
+    while (client->count > 0) removeAt(*client, 0);
+    client->used = false;
+}
+
+bool BroadcastHub::subscribe(uint32_t client_id, uint8_t topics) {
+    Client* client = find(client_id);
+    if (client == nullptr) return false;
+
+    client->topics = topics & TOPIC_ALL;
+
+    // Queued messages of dropped topics are not wanted anymore
+    for (int i = client->count - 1; i >= 0; i--) {
+        if ((client->queue_topic[i] & client->topics) == 0) removeAt(*client, i);
+    }
+    return true;
+}
+
+void BroadcastHub::publish(uint8_t topic, const SharedMessage& message) {
+    int t = topicIndex(topic);
+    if (t < 0 || !message) return;
+    m_topics[t].published++;
+
+    for (int i = 0; i < BROADCAST_MAX_CLIENTS; i++) {
+        Client& client = m_clients[i];
+        if (client.used && (client.topics & topic)) enqueue(client, topic, message);
+    }
+}
+
+void BroadcastHub::enqueue(Client& client, uint8_t topic, const SharedMessage& message) {
+    TopicStats& stats = m_topics[topicIndex(topic)];
+
+    if (client.count < BROADCAST_CLIENT_QUEUE) {
+        client.queue[client.count] = message;
+        client.queue_topic[client.count] = topic;
+        client.count++;
+        return;
+    }
+
+    m_backpressure++;
+    client.backpressure++;
+
+    BackpressurePolicy policy = policyOf(topic);
+
+    if (policy == BACKPRESSURE_COALESCE) {
+        for (int i = client.count - 1; i >= 0; i--) {
+            if (client.queue_topic[i] == topic) {
+                client.queue[i] = message;
+                stats.coalesced++;
+                return;
+            }
+        }
+        // Nothing of this topic is waiting, the queue is full of others
+        stats.dropped++;
+        return;
+    }
+
+    if (policy == BACKPRESSURE_EVICT) {
+        // The oldest message of another topic, else the oldest of this one
+        int victim = 0;
+        for (int i = 0; i < client.count; i++) {
+            if (client.queue_topic[i] != topic) {
+                victim = i;
+                break;
+            }
+        }
+        m_topics[topicIndex(client.queue_topic[victim])].evicted++;
+        removeAt(client, victim);
+        client.queue[client.count] = message;
+        client.queue_topic[client.count] = topic;
+        client.count++;
+        return;
+    }
+
+    stats.dropped++;
+}
+
+void BroadcastHub::removeAt(Client& client, int index) {
+    for (int i = index; i + 1 < client.count; i++) {
+        client.queue[i] = client.queue[i + 1];
+        client.queue_topic[i] = client.queue_topic[i + 1];
+    }
+    client.count--;
+    client.queue[client.count].reset();
+}
+
+void BroadcastHub::pump() {
+    if (m_canSend == nullptr || m_send == nullptr) return;
+
+    for (int i = 0; i < BROADCAST_MAX_CLIENTS; i++) {
+        Client& client = m_clients[i];
+        if (!client.used) continue;
+
+        while (client.count > 0 && m_canSend(client.id, m_context)) {
+            if (!m_send(client.id, client.queue[0], m_context)) {
+                // Gone without a disconnect event
+                removeClient(client.id);
+                break;
+            }
+            m_topics[topicIndex(client.queue_topic[0])].delivered++;
+            client.delivered++;
+            removeAt(client, 0);
+        }
+    }
+}
+
+int BroadcastHub::getClientCount() const {
+    int count = 0;
+    for (int i = 0; i < BROADCAST_MAX_CLIENTS; i++) {
+        if (m_clients[i].used) count++;
+    }
+    return count;
+}
+
+uint32_t BroadcastHub::getBackpressureCount() const {
+    return m_backpressure;
+}
+
+String BroadcastHub::statsJson() const {
+    String out = "{\"broadcast\":{\"clients\":" + String(getClientCount());
+    out += ",\"queue_limit\":" + String(BROADCAST_CLIENT_QUEUE);
+    out += ",\"backpressure\":" + String(static_cast<unsigned long>(m_backpressure));
+
+    out += ",\"topics\":{";
+    for (int t = 0; t < NUM_TOPICS; t++) {
+        const TopicStats& s = m_topics[t];
+        if (t > 0) out += ',';
+        out += "\"" + String(topicNames[t]) + "\":{\"published\":" + String(static_cast<unsigned long>(s.published));
+        out += ",\"delivered\":" + String(static_cast<unsigned long>(s.delivered));
+        out += ",\"dropped\":" + String(static_cast<unsigned long>(s.dropped));
+        out += ",\"coalesced\":" + String(static_cast<unsigned long>(s.coalesced));
+        out += ",\"evicted\":" + String(static_cast<unsigned long>(s.evicted)) + "}";
+    }
+
+    out += "},\"per_client\":[";
+    bool first = true;
+    for (int i = 0; i < BROADCAST_MAX_CLIENTS; i++) {
+        const Client& c = m_clients[i];
+        if (!c.used) continue;
+        if (!first) out += ',';
+        first = false;
+        out += "{\"id\":" + String(static_cast<unsigned long>(c.id));
+        out += ",\"topics\":" + String(c.topics);
+        out += ",\"queued\":" + String(c.count);
+        out += ",\"delivered\":" + String(static_cast<unsigned long>(c.delivered));
+        out += ",\"backpressure\":" + String(static_cast<unsigned long>(c.backpressure)) + "}";
+    }
+    out += "]}}";
+    return out;
+}
+
+void BroadcastHub::resetStats() {
+    for (int t = 0; t < NUM_TOPICS; t++) m_topics[t] = TopicStats{0, 0, 0, 0, 0};
+    for (int i = 0; i < BROADCAST_MAX_CLIENTS; i++) {
+        m_clients[i].delivered = 0;
+        m_clients[i].backpressure = 0;
+    }
+    m_backpressure = 0;
+}
+
+uint8_t BroadcastHub::parseTopics(const String& list) {
+    uint8_t mask = 0;
+    unsigned int from = 0;
+
+    while (from <= list.length()) {
+        int comma = list.indexOf(',', from);
+        unsigned int to = comma < 0 ? list.length() : static_cast<unsigned int>(comma);
+        String name = list.substring(from, to);
+        name.trim();
+        from = to + 1;
+
+        if (name.length() == 0) continue;
+        if (name == "all") {
+            mask |= TOPIC_ALL;
+            continue;
+        }
+
+        int t = 0;
+        while (t < NUM_TOPICS && name != topicNames[t]) t++;
+        if (t == NUM_TOPICS) return 0;
+        mask |= 1 << t;
+    }
+    return mask;
+}
+
+const char* BroadcastHub::topicName(uint8_t topic) {
+    int t = topicIndex(topic);
+    return t < 0 ? "?" : topicNames[t];
+}
+
+BackpressurePolicy BroadcastHub::policyOf(uint8_t topic) {
+    int t = topicIndex(topic);
+    return t < 0 ? BACKPRESSURE_DROP_NEW : topicPolicies[t];
+}
+
+int BroadcastHub::topicIndex(uint8_t topic) {
+    for (int t = 0; t < NUM_TOPICS; t++) {
+        if (topic == (1 << t)) return t;
+    }
+    return -1;
+}
+
+BroadcastHub::Client* BroadcastHub::find(uint32_t client_id) {
+    for (int i = 0; i < BROADCAST_MAX_CLIENTS; i++) {
+        if (m_clients[i].used && m_clients[i].id == client_id) return &m_clients[i];
+    }
+    return nullptr;
+}
@@ -0,0 +1,127 @@
+#ifndef BROADCAST_HUB_H
+#define BROADCAST_HUB_H
+
+#include "Hal.h"
+#include <memory>
+
+// ——— Topics ———
+// Bit masks, a client receives the topics of its subscription
+#define TOPIC_ORDERS            0x01    // Order progress for the tablet ("Order finished")
+#define TOPIC_TELEMETRY         0x02    // Metrics, stats and profiler replies
+#define TOPIC_HUMIDITY          0x04
+#define TOPIC_LOGS              0x08
+#define TOPIC_ALL               0x0F
+#define NUM_TOPICS              4
+
+#define BROADCAST_MAX_CLIENTS   8
+#define BROADCAST_CLIENT_QUEUE  4       // Messages held per client before backpressure engages
+
+/// @brief What publish() does for a client whose queue is full
+enum BackpressurePolicy {
+    BACKPRESSURE_DROP_NEW,              // The new message is not queued
+    BACKPRESSURE_COALESCE,              // It replaces the newest queued message of its topic
+    BACKPRESSURE_EVICT                  // It takes the place of the oldest message of another topic
+};
+
+/// @brief One broadcast, shared by the queues of every client it goes to
+typedef std::shared_ptr<const String> SharedMessage;
+
+/**
+ * @brief Fans broadcasts out to WebSocket clients by topic, with a bounded queue per client.
+ *
+ * Every client has a topic mask (TOPIC_ALL until it subscribes) and a queue
+ * of at most BROADCAST_CLIENT_QUEUE shared messages. pump() hands them to
+ * the transport only while it reports room for that client, so a slow client
+ * never makes the web server buffer grow. When a queue is full the topic's
+ * policy decides: orders evict other topics, humidity coalesces to the latest
+ * reading, telemetry and logs drop the new message.
+ *
+ * Not thread safe: on the ESP32 only the network task uses it.
+ */
+class BroadcastHub {
+
+public:
+    /// @brief Whether the transport can take another message for the client now
+    typedef bool (*CanSend)(uint32_t client_id, void* context);
+
+    /**
+     * @brief Hands one message to the transport, false if the client is gone.
+     *
+     * Every client gets the same SharedMessage for a broadcast, so the
+     * transport can build its wire buffer once and share it too.
+     */
+    typedef bool (*Send)(uint32_t client_id, const SharedMessage& message, void* context);
+
+    BroadcastHub();
+
+    void setTransport(CanSend can_send, Send send, void* context);
+
+    /**
+     * @brief Starts tracking a client.
+     * @return false if all BROADCAST_MAX_CLIENTS slots are taken.
+     */
+    bool addClient(uint32_t client_id, uint8_t topics = TOPIC_ALL);
+    void removeClient(uint32_t client_id);
+
+    /// @brief Replaces the topic mask of a client, false if it is unknown
+    bool subscribe(uint32_t client_id, uint8_t topics);
+
+    /// @brief Queues a message for every client subscribed to the topic
+    void publish(uint8_t topic, const SharedMessage& message);
+
+    /// @brief Hands queued messages to the transport while it has room
+    void pump();
+
+    int getClientCount() const;
+
+    /// @brief Times a full client queue had to drop, coalesce or evict
+    uint32_t getBackpressureCount() const;
+
+    String statsJson() const;
+    void resetStats();
+
+    /**
+     * @brief Topic mask from a list like "orders,humidity" (or "all").
+     * @return 0 if a name is unknown.
+     */
+    static uint8_t parseTopics(const String& list);
+
+    static const char* topicName(uint8_t topic);
+    static BackpressurePolicy policyOf(uint8_t topic);
+
+private:
+    struct TopicStats {
+        uint32_t published;
+        uint32_t delivered;
+        uint32_t dropped;
+        uint32_t coalesced;
+        uint32_t evicted;
+    };
+
+    struct Client {
+        bool used;
+        uint32_t id;
+        uint8_t topics;
+        uint8_t count;
+        SharedMessage queue[BROADCAST_CLIENT_QUEUE];    // Oldest first
+        uint8_t queue_topic[BROADCAST_CLIENT_QUEUE];
+        uint32_t delivered;
+        uint32_t backpressure;
+    };
+
+    Client* find(uint32_t client_id);
+    void enqueue(Client& client, uint8_t topic, const SharedMessage& message);
+    void removeAt(Client& client, int index);
+
+    static int topicIndex(uint8_t topic);
+
+    Client m_clients[BROADCAST_MAX_CLIENTS];
+    TopicStats m_topics[NUM_TOPICS];
+    uint32_t m_backpressure = 0;
+
+    CanSend m_canSend = nullptr;
+    Send m_send = nullptr;
+    void* m_context = nullptr;
+};
+
+#endif
@@ -0,0 +1,186 @@
+#include <CalibrationEstimator.h>
+#include <math.h>
+
+CalibrationEstimator::CalibrationEstimator() {
+    reset(1.0f, 0.1f, 1.0f, 1.0f);
+}
+
+void CalibrationEstimator::reset(float gain, float gain_std, float offset_std, float noise_std) {
+    m_state.gain = gain;
+    m_state.offset = 0.0f;
+    m_state.max_var_gain = gain_std * gain_std;
+    m_state.max_var_offset = offset_std * offset_std;
+    m_state.var_gain = m_state.max_var_gain;
+    m_state.cov = 0.0f;
+    m_state.var_offset = m_state.max_var_offset;
+    m_state.noise_var = noise_std * noise_std;
+    m_state.min_noise_var = m_state.noise_var * 0.01f;
+    m_state.samples = 0;
+    m_state.outliers = 0;
+    m_outlierRun = 0;
+    m_revision++;
+}
+
+CalibrationEstimator::Result CalibrationEstimator::update(float commanded, float measured) {
+    if (!(commanded > 0.0f) || !(measured >= 0.0f) || isinf(commanded) || isinf(measured)) {
+        return CALIBRATION_INVALID;
+    }
+
+    CalibrationState& s = m_state;
+    CalibrationState before = s;
+    Result result = CALIBRATION_ACCEPTED;
+
+    float u = commanded;
+    float error = measured - predict(u);
+    float px0 = s.var_gain * u + s.cov;          // P x, with x = (u, 1)
+    float px1 = s.cov * u + s.var_offset;
+    float innovation = u * px0 + px1 + s.noise_var;
+
+    // The prior bounds the first samples too; a calibration that is far off
+    // shows up as a run of outliers on one side and is relearned
+    if (error * error > CALIBRATION_GATE_SIGMA * CALIBRATION_GATE_SIGMA * innovation) {
+        if (s.outliers < UINT16_MAX) s.outliers++;
+        m_revision++;
+
+        int side = error > 0.0f ? 1 : -1;
+        m_outlierRun = m_outlierRun * side > 0 ? m_outlierRun + side : side;
+        if (m_outlierRun * side < CALIBRATION_RELEARN_RUN) return CALIBRATION_OUTLIER;
+
+        // Not outliers anymore but a new level: forget the confidence, keep the estimate
+        s.var_gain = s.max_var_gain;
+        s.cov = 0.0f;
+        s.var_offset = s.max_var_offset;
+        px0 = s.var_gain * u;
+        px1 = s.var_offset;
+        innovation = u * px0 + px1 + s.noise_var;
+        result = CALIBRATION_RELEARNED;
+    }
+    m_outlierRun = 0;
+
+    s.gain += px0 / innovation * error;
+    s.offset += px1 / innovation * error;
+
+    s.var_gain = (s.var_gain - px0 * px0 / innovation) / CALIBRATION_FORGETTING;
+    s.cov = (s.cov - px0 * px1 / innovation) / CALIBRATION_FORGETTING;
+    s.var_offset = (s.var_offset - px1 * px1 / innovation) / CALIBRATION_FORGETTING;
+    limitCovariance();
+
+    // E[error^2] is the innovation variance, so this averages to the noise variance
+    float noise = s.noise_var * error * error / innovation;
+    s.noise_var += CALIBRATION_NOISE_WEIGHT * (noise - s.noise_var);
+    if (s.noise_var < s.min_noise_var) s.noise_var = s.min_noise_var;
+
+    if (!(s.gain > 0.0f) || isnan(s.offset)) {
+        s = before;
+        return CALIBRATION_INVALID;
+    }
+
+    if (s.samples < UINT16_MAX) s.samples++;
+    m_revision++;
+    return result;
+}
+
+float CalibrationEstimator::predict(float commanded) const {
+    return m_state.gain * commanded + m_state.offset;
+}
+
+float CalibrationEstimator::predictStd(float commanded) const {
+    const CalibrationState& s = m_state;
+    float u = commanded;
+    float fit = u * u * s.var_gain + 2.0f * u * s.cov + s.var_offset;
+    return sqrtf(fit + s.noise_var);
+}
+
+float CalibrationEstimator::commandFor(float measured) const {
+    if (!(m_state.gain > 0.0f) || measured <= 0.0f) return 0.0f;
+
+    float command = (measured - m_state.offset) / m_state.gain;
+    float floor = 0.5f * measured / m_state.gain;
+    return command > floor ? command : floor;
+}
+
+float CalibrationEstimator::getGain() const {
+    return m_state.gain;
+}
+
+float CalibrationEstimator::getOffset() const {
+    return m_state.offset;
+}
+
+float CalibrationEstimator::getGainStd() const {
+    return sqrtf(m_state.var_gain);
+}
+
+float CalibrationEstimator::getOffsetStd() const {
+    return sqrtf(m_state.var_offset);
+}
+
+float CalibrationEstimator::getNoiseStd() const {
+    return sqrtf(m_state.noise_var);
+}
+
+int CalibrationEstimator::getSampleCount() const {
+    return m_state.samples;
+}
+
+int CalibrationEstimator::getOutlierCount() const {
+    return m_state.outliers;
+}
+
+bool CalibrationEstimator::isConfident(float rel_std) const {
+    return m_state.samples >= CALIBRATION_MIN_SAMPLES && getGainStd() <= rel_std * m_state.gain;
+}
+
+uint32_t CalibrationEstimator::getRevision() const {
+    return m_revision;
+}
+
+const CalibrationState& CalibrationEstimator::getState() const {
+    return m_state;
+}
+
+bool CalibrationEstimator::setState(const CalibrationState& state) {
+    const float values[] = {
+        state.gain, state.offset, state.var_gain, state.cov, state.var_offset,
+        state.noise_var, state.max_var_gain, state.max_var_offset, state.min_noise_var
+    };
+    for (float v : values) {
+        if (isnan(v) || isinf(v)) return false;
+    }
+
+    if (!(state.gain > 0.0f) || !(state.var_gain > 0.0f) || !(state.var_offset > 0.0f) ||
+        !(state.max_var_gain > 0.0f) || !(state.max_var_offset > 0.0f) || !(state.min_noise_var > 0.0f) ||
+        state.noise_var < state.min_noise_var || state.cov * state.cov >= state.var_gain * state.var_offset) {
+        return false;
+    }
+
+    m_state = state;
+    m_outlierRun = 0;
+    m_revision++;
+    return true;
+}
+
+// -------------------- Private Helper Methods --------------------
+
+// Forgetting inflates directions no sample excites (the offset, when every
+// dispense is the same size) without bound; scaling a row and its column
+// together keeps the matrix positive definite
+void CalibrationEstimator::limitCovariance() {
+    CalibrationState& s = m_state;
+
+    if (!(s.var_gain > 0.0f)) s.var_gain = s.max_var_gain * 1e-6f;
+    if (!(s.var_offset > 0.0f)) s.var_offset = s.max_var_offset * 1e-6f;
+
+    if (s.var_gain > s.max_var_gain) {
+        s.cov *= sqrtf(s.max_var_gain / s.var_gain);
+        s.var_gain = s.max_var_gain;
+    }
+    if (s.var_offset > s.max_var_offset) {
+        s.cov *= sqrtf(s.max_var_offset / s.var_offset);
+        s.var_offset = s.max_var_offset;
+    }
+
+    float limit = 0.999f * sqrtf(s.var_gain * s.var_offset);
+    if (s.cov > limit) s.cov = limit;
+    if (s.cov < -limit) s.cov = -limit;
+}
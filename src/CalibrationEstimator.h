@@ -0,0 +1,115 @@
+#ifndef CALIBRATION_ESTIMATOR_H
+#define CALIBRATION_ESTIMATOR_H
+
+#include <stdint.h>
+
+#define CALIBRATION_FORGETTING      0.97f   // Weight an older sample keeps per newer one, about 30 samples of memory
+#define CALIBRATION_GATE_SIGMA      3.0f    // A sample further than this from the prediction is an outlier
+#define CALIBRATION_MIN_SAMPLES     3       // Never confident with fewer samples than this
+#define CALIBRATION_RELEARN_RUN     3       // Outliers in a row on the same side: the process itself moved
+#define CALIBRATION_NOISE_WEIGHT    0.1f    // EWMA weight of a new sample in the noise estimate
+
+/**
+ * @brief Everything the estimator knows, as stored in the config blob.
+ *
+ * The covariance is of (gain, offset). The max_* variances are the prior's,
+ * also the ceiling the forgetting factor cannot inflate past.
+ */
+struct CalibrationState {
+    float gain;
+    float offset;
+    float var_gain;
+    float cov;
+    float var_offset;
+    float noise_var;                    // Scatter of single outcomes around the line
+    float max_var_gain;
+    float max_var_offset;
+    float min_noise_var;
+    uint16_t samples;                   // Accepted since the last reset
+    uint16_t outliers;                  // Refused since the last reset
+};
+
+/**
+ * @brief Online fit of measured = gain * commanded + offset for one ingredient.
+ *
+ * Recursive least squares with a forgetting factor, so slow drift (tubing
+ * wear, a new powder batch) is followed without ever re-running a full
+ * calibration. Every outcome measured by whatever means (a scale, a flow
+ * meter) is one sample: what the actuator was told to do (seconds run, steps
+ * taken) against what came out (mL, grams).
+ *
+ * A sample further than CALIBRATION_GATE_SIGMA standard deviations from the
+ * prediction is refused, unless CALIBRATION_RELEARN_RUN of them in a row fall
+ * on the same side; then the confidence is dropped back to the prior and the
+ * fit starts over from the current estimate.
+ *
+ * Each pump and dispenser owns one, so only the motion task updates it.
+ */
+class CalibrationEstimator {
+
+public:
+    enum Result {
+        CALIBRATION_INVALID,            // Not a usable sample (non-positive, NaN)
+        CALIBRATION_ACCEPTED,
+        CALIBRATION_OUTLIER,            // Refused, the estimate is unchanged
+        CALIBRATION_RELEARNED           // Accepted after a run of outliers reset the confidence
+    };
+
+    CalibrationEstimator();
+
+    /**
+     * @brief Starts over from a prior with no offset.
+     * @param gain        Measured units per commanded unit, e.g. from a calibration run.
+     * @param gain_std    Standard deviation of the gain before any sample.
+     * @param offset_std  Standard deviation of the offset before any sample.
+     * @param noise_std   Expected scatter of one outcome; the estimate of it never goes below a tenth of this.
+     */
+    void reset(float gain, float gain_std, float offset_std, float noise_std);
+
+    /**
+     * @brief Folds in one outcome.
+     * @param commanded  What the actuator was told to do, > 0.
+     * @param measured   What came out, >= 0.
+     */
+    Result update(float commanded, float measured);
+
+    /// @brief Expected outcome of a command
+    float predict(float commanded) const;
+
+    /// @brief Standard deviation of one outcome of a command, fit and noise together
+    float predictStd(float commanded) const;
+
+    /// @brief Command expected to produce the outcome, never less than half of what the gain alone gives
+    float commandFor(float measured) const;
+
+    float getGain() const;
+    float getOffset() const;
+    float getGainStd() const;
+    float getOffsetStd() const;
+    float getNoiseStd() const;
+    int getSampleCount() const;
+    int getOutlierCount() const;
+
+    /// @brief Whether enough samples were taken and the gain is known within rel_std of itself
+    bool isConfident(float rel_std) const;
+
+    /// @brief Changes on every accepted or refused sample, reset and restore
+    uint32_t getRevision() const;
+
+    const CalibrationState& getState() const;
+
+    /**
+     * @brief Restores a stored state.
+     * @return false, leaving the estimate as it was, if the state is not a usable one.
+     */
+    bool setState(const CalibrationState& state);
+
+private:
+    void limitCovariance();
+
+    CalibrationState m_state;
+    int m_outlierRun = 0;               // Consecutive outliers, positive above the prediction, negative below
+    uint32_t m_revision = 0;
+};
+
+#endif
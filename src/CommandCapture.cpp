@@ -0,0 +1,118 @@
+#include "CommandCapture.h"
+
+CommandCapture commandCapture;
+
+CommandCapture::CommandCapture() {}
+
+void CommandCapture::setEnabled(bool enabled) {
+    m_enabled = enabled;
+}
+
+bool CommandCapture::isEnabled() const {
+    return m_enabled;
+}
+
+void CommandCapture::record(uint64_t time_us, const char* text, size_t length) {
+    if (length > COMMAND_CAPTURE_MAX_TEXT) length = COMMAND_CAPTURE_MAX_TEXT;
+    uint32_t size = COMMAND_CAPTURE_HEADER_SIZE + length;
+
+    while (m_used + size > COMMAND_CAPTURE_RING_SIZE) dropOldest();
+
+    uint8_t header[COMMAND_CAPTURE_HEADER_SIZE];
+    memcpy(header, &time_us, 8);
+    header[8] = static_cast<uint8_t>(length);
+
+    uint32_t head = (m_tail + m_used) % COMMAND_CAPTURE_RING_SIZE;
+    for (uint32_t i = 0; i < size; i++) {
+        uint8_t b = i < COMMAND_CAPTURE_HEADER_SIZE ? header[i] : text[i - COMMAND_CAPTURE_HEADER_SIZE];
+        m_buffer[(head + i) % COMMAND_CAPTURE_RING_SIZE] = b;
+    }
+    m_used += size;
+    m_count++;
+}
+
+void CommandCapture::dropOldest() {
+    uint32_t size = COMMAND_CAPTURE_HEADER_SIZE + byteAt(m_tail + 8);
+    m_tail = (m_tail + size) % COMMAND_CAPTURE_RING_SIZE;
+    m_used -= size;
+    m_count--;
+    m_evicted++;
+}
+
+void CommandCapture::clear() {
+    m_tail = 0;
+    m_used = 0;
+    m_count = 0;
+    m_evicted = 0;
+}
+
+void CommandCapture::forEach(Visitor visitor, void* context) const {
+    uint32_t offset = m_tail;
+    char text[COMMAND_CAPTURE_MAX_TEXT + 1];
+
+    for (uint32_t i = 0; i < m_count; i++) {
+        uint8_t header[COMMAND_CAPTURE_HEADER_SIZE];
+        copyOut(offset, header, sizeof(header));
+        uint64_t time_us;
+        memcpy(&time_us, header, 8);
+        size_t length = header[8];
+
+        copyOut(offset + COMMAND_CAPTURE_HEADER_SIZE, reinterpret_cast<uint8_t*>(text), length);
+        text[length] = 0;
+        visitor(time_us, text, length, context);
+
+        offset = (offset + COMMAND_CAPTURE_HEADER_SIZE + length) % COMMAND_CAPTURE_RING_SIZE;
+    }
+}
+
+String CommandCapture::exportText() const {
+    String out = COMMAND_TRACE_MAGIC ", " + String(static_cast<unsigned long>(m_count)) + " commands, " +
+        String(static_cast<unsigned long>(m_evicted)) + " evicted\n";
+    out.reserve(m_used + m_count * 12 + out.length());
+
+    forEach([](uint64_t time_us, const char* text, size_t length, void* context) {
+        String& out = *static_cast<String*>(context);
+        char stamp[24];
+        snprintf(stamp, sizeof(stamp), "%llu ", static_cast<unsigned long long>(time_us));
+        out += stamp;
+        out.concat(text, length);
+        out += '\n';
+    }, &out);
+    return out;
+}
+
+uint32_t CommandCapture::getCount() const {
+    return m_count;
+}
+
+uint32_t CommandCapture::getEvictedCount() const {
+    return m_evicted;
+}
+
+uint32_t CommandCapture::getUsedBytes() const {
+    return m_used;
+}
+
+bool CommandCapture::parseLine(const String& line, uint64_t& time_us, String& command) {
+    if (line.length() == 0 || line[0] == '#') return false;
+
+    int space = line.indexOf(' ');
+    if (space <= 0) return false;
+
+    const char* start = line.c_str();
+    char* end = nullptr;
+    time_us = strtoull(start, &end, 10);
+    if (end != start + space) return false;
+
+    command = line.substring(space + 1);
+    command.trim();
+    return command.length() > 0;
+}
+
+uint8_t CommandCapture::byteAt(uint32_t offset) const {
+    return m_buffer[offset % COMMAND_CAPTURE_RING_SIZE];
+}
+
+void CommandCapture::copyOut(uint32_t offset, uint8_t* out, size_t length) const {
+    for (size_t i = 0; i < length; i++) out[i] = byteAt(offset + i);
+}
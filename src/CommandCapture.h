@@ -0,0 +1,75 @@
+#ifndef COMMAND_CAPTURE_H
+#define COMMAND_CAPTURE_H
+
+#include "Hal.h"
+
+#define COMMAND_CAPTURE_RING_SIZE   4096    // Bytes, about 150 tablet commands
+#define COMMAND_CAPTURE_HEADER_SIZE 9       // u64 time_us, u8 length
+#define COMMAND_CAPTURE_MAX_TEXT    255
+
+// First line of an exported trace, checked by the replay tool
+#define COMMAND_TRACE_MAGIC "# command trace v1"
+
+/**
+ * @brief Optional record of every dispatched command, for replaying it on the host.
+ *
+ * Records are (microseconds since boot, command text) in a RAM ring; when it
+ * is full the oldest records make room and are counted as evicted. The time
+ * is taken at dispatch, which is when the state machine sees the command, so
+ * the replay tool (src/host/tools/replay.cpp) can hand it over at the same
+ * point. Off by default; on the ESP32 only the control task uses it.
+ *
+ * Exported traces are text, one command per line:
+ *
+ *   # command trace v1, 3 commands, 0 evicted
+ *   12034511 orderDetails
+ *   14112980 orderAskForBottle
+ *   16201377 prepare(1,30.00,2,25.00,0.00)
+ */
+class CommandCapture {
+
+public:
+    typedef void (*Visitor)(uint64_t time_us, const char* text, size_t length, void* context);
+
+    CommandCapture();
+
+    void setEnabled(bool enabled);
+    bool isEnabled() const;
+
+    /// @brief Adds one command, evicting the oldest ones if the ring is full
+    void record(uint64_t time_us, const char* text, size_t length);
+
+    void clear();
+
+    /// @brief Calls visitor for every record, oldest first
+    void forEach(Visitor visitor, void* context) const;
+
+    /// @brief Header line and one line per record
+    String exportText() const;
+
+    uint32_t getCount() const;
+    uint32_t getEvictedCount() const;
+    uint32_t getUsedBytes() const;
+
+    /**
+     * @brief Parses one trace line ("<time_us> <command>").
+     * @return false for the header, comments, empty or malformed lines.
+     */
+    static bool parseLine(const String& line, uint64_t& time_us, String& command);
+
+private:
+    void dropOldest();
+    uint8_t byteAt(uint32_t offset) const;
+    void copyOut(uint32_t offset, uint8_t* out, size_t length) const;
+
+    uint8_t m_buffer[COMMAND_CAPTURE_RING_SIZE];
+    uint32_t m_tail = 0;                // Offset of the oldest record
+    uint32_t m_used = 0;                // Bytes held
+    uint32_t m_count = 0;
+    uint32_t m_evicted = 0;
+    bool m_enabled = false;
+};
+
+extern CommandCapture commandCapture;
+
+#endif
@@ -0,0 +1,124 @@
+#include <ConfigStore.h>
+#include <stddef.h>
+
+#define CONFIG_KEY "config"
+
+ConfigStore::ConfigStore(const char* nvs_namespace)
+    : m_namespace(nvs_namespace)
+{
+    memset(&m_config, 0, sizeof(m_config));
+    memset(&m_persisted, 0, sizeof(m_persisted));
+}
+
+bool ConfigStore::begin() {
+    if (!m_prefs.begin(m_namespace, false)) {
+        hal::println("Error: could not open NVS namespace");
+        return false;
+    }
+
+    MachineConfig stored;
+    size_t read = m_prefs.getBytes(CONFIG_KEY, &stored, sizeof(stored));
+
+    m_loaded = read == sizeof(stored) && isValid(stored);
+    if (m_loaded) {
+        m_config = stored;
+        m_persisted = stored;
+    }
+
+    return m_loaded;
+}
+
+MachineConfig& ConfigStore::config() {
+    return m_config;
+}
+
+void ConfigStore::markDirty(unsigned long now_ms) {
+    m_dirty = true;
+    m_lastChangeMs = now_ms;
+}
+
+void ConfigStore::update(unsigned long now_ms) {
+    if (!m_dirty) return;
+
+    // Let a burst of changes settle before touching the flash
+    if (now_ms - m_lastChangeMs < CONFIG_COALESCE_MS) return;
+    if (m_hasWritten && now_ms - m_lastWriteMs < CONFIG_MIN_WRITE_INTERVAL_MS) return;
+
+    flush();
+    m_lastWriteMs = now_ms;
+    m_hasWritten = true;
+}
+
+bool ConfigStore::flush() {
+    seal(m_config);
+    m_dirty = false;
+
+    if (m_loaded && memcmp(&m_config, &m_persisted, sizeof(m_config)) == 0) {
+        m_skippedWriteCount++;
+        return true;
+    }
+
+    if (m_prefs.putBytes(CONFIG_KEY, &m_config, sizeof(m_config)) != sizeof(m_config)) {
+        hal::println("Error: could not write config to NVS");
+        return false;
+    }
+
+    m_persisted = m_config;
+    m_loaded = true;
+    m_writeCount++;
+    return true;
+}
+
+void ConfigStore::erase() {
+    m_prefs.remove(CONFIG_KEY);
+    memset(&m_persisted, 0, sizeof(m_persisted));
+    m_loaded = false;
+    m_dirty = false;
+}
+
+bool ConfigStore::isDirty() {
+    return m_dirty;
+}
+
+bool ConfigStore::wasLoaded() {
+    return m_loaded;
+}
+
+unsigned long ConfigStore::getWriteCount() {
+    return m_writeCount;
+}
+
+unsigned long ConfigStore::getSkippedWriteCount() {
+    return m_skippedWriteCount;
+}
+
+uint32_t ConfigStore::crc32(const uint8_t* data, size_t length) {
+    uint32_t crc = 0xFFFFFFFFUL;
+
+    for (size_t i = 0; i < length; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320UL & (0 - (crc & 1)));
+        }
+    }
+
+    return ~crc;
+}
+
+// -------------------- Private Helper Methods --------------------
+
+bool ConfigStore::isValid(const MachineConfig& cfg) {
+    if (cfg.magic != CONFIG_MAGIC) return false;
+    if (cfg.version != CONFIG_VERSION) return false;
+    if (cfg.size != sizeof(MachineConfig)) return false;
+    if (cfg.pump_count > CONFIG_MAX_PUMPS || cfg.dispenser_count > CONFIG_MAX_DISPENSERS) return false;
+
+    return cfg.crc == crc32(reinterpret_cast<const uint8_t*>(&cfg), offsetof(MachineConfig, crc));
+}
+
+void ConfigStore::seal(MachineConfig& cfg) {
+    cfg.magic = CONFIG_MAGIC;
+    cfg.version = CONFIG_VERSION;
+    cfg.size = sizeof(MachineConfig);
+    cfg.crc = crc32(reinterpret_cast<const uint8_t*>(&cfg), offsetof(MachineConfig, crc));
+}
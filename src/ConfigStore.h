@@ -0,0 +1,161 @@
+#ifndef CONFIG_STORE_H
+#define CONFIG_STORE_H
+
+#include "Hal.h"
+#include <Preferences.h>
+#include "HumidityCompensation.h"
+#include "CalibrationEstimator.h"
+
+#define CONFIG_MAGIC 0x31505542UL       // "BUP1" in little endian
+#define CONFIG_VERSION 8
+#define CONFIG_MAX_PUMPS 8
+#define CONFIG_MAX_DISPENSERS 4
+#define CONFIG_NAME_LENGTH 32           // Ingredient names, NUL terminated
+#define CONFIG_NO_PIN 0xFF              // Pin not wired to the ESP32
+
+#define CONFIG_COALESCE_MS 5000UL       // Wait this long after the last change before writing
+#define CONFIG_MIN_WRITE_INTERVAL_MS 60000UL // Never write the flash more often than this
+
+/*
+ * Each pump and dispenser record starts with the ingredient's identity (alias,
+ * pins, name), read once at boot to build the actuators, followed by the
+ * tunables that commands change at runtime.
+ */
+struct PumpConfig {
+    char alias;                         // One character, as used in commands
+    uint8_t drive_pin;
+    uint8_t negated_logic;
+    uint8_t flow_pin;                   // Flow meter output, CONFIG_NO_PIN without one
+    char name[CONFIG_NAME_LENGTH];
+    float mL_per_second;
+    float flow_pulses_per_mL;           // Flow meter K-factor
+    CalibrationState model;             // Online calibration, all zero until the first save
+    float prime_mL;                     // Idle priming pulse, 0 = the line is never primed
+};
+
+struct DispenserConfig {
+    char alias;
+    uint8_t step_pin;
+    uint8_t sleep_pin;
+    uint8_t dir_pin;
+    uint8_t ms_pins[3];                 // MS1..MS3 microstep select, CONFIG_NO_PIN if tied on the board
+    uint8_t reserved;
+    char name[CONFIG_NAME_LENGTH];
+    float steps_per_gram;
+    int32_t step_interval;              // microseconds between steps
+    int32_t pulse_duration;             // duration of pulse in microseconds
+    int32_t steps_per_revolution;
+    int32_t vibration_step_interval;    // microseconds between steps in vibration motion
+    int32_t vibration_pulse_duration;   // duration of pulse in microseconds in vibration motion
+    int32_t steps_per_vibration;
+    uint8_t dispense_is_CW;
+    uint8_t humidity_compensation;
+    uint8_t humidity_sample_count;
+    uint8_t vibration_policy;           // Index into the firmware's vibration policy table
+    uint8_t fine_microsteps;            // Resolution of the end of each dispense, 0 or 1 = full steps only
+    uint8_t reserved2[3];
+    float fine_grams;                   // Grams at the end of each dispense run in microsteps
+    float humidity_rh[HUMIDITY_CURVE_MAX_SAMPLES];            // %RH of each calibration sample
+    float humidity_steps_per_gram[HUMIDITY_CURVE_MAX_SAMPLES];
+    CalibrationState model;
+    uint32_t keep_awake_ms;             // Driver holds this long after a move
+    float max_awake_duty;               // Share of time awake above which the driver sleeps right after a move
+};
+
+/**
+ * @brief Binary configuration blob as stored in NVS.
+ *
+ * The layout is versioned; any change to it must bump CONFIG_VERSION so that
+ * older blobs are rejected instead of misread.
+ */
+struct MachineConfig {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t size;
+    uint8_t pump_count;
+    uint8_t dispenser_count;
+    uint8_t reserved[2];
+    PumpConfig pumps[CONFIG_MAX_PUMPS];
+    DispenserConfig dispensers[CONFIG_MAX_DISPENSERS];
+    uint32_t idle_prime_after_ms;       // Unused time after which a line is primed, 0 = never
+    uint32_t idle_settle_after_ms;      // Unused time after which a pre-staged column is agitated
+    uint8_t idle_prestage;
+    uint8_t reserved2[3];
+    uint32_t crc;                       // CRC32 of everything above
+};
+
+/**
+ * @brief Persists the machine configuration as a single CRC-checked blob in NVS.
+ *
+ * The blob is read once at boot. Changes are only marked dirty and written by
+ * update() after they stop coming in, and never if the bytes match what is
+ * already stored, to keep flash wear low.
+ */
+class ConfigStore {
+
+public:
+    /**
+     * @param nvs_namespace  NVS namespace holding the blob.
+     */
+    ConfigStore(const char* nvs_namespace = "boostup");
+
+    /**
+     * @brief Opens NVS and loads the stored blob with a single read.
+     * @return true if a valid blob was loaded, false if defaults must be used.
+     */
+    bool begin();
+
+    /// @brief Mutable access to the in-RAM configuration.
+    MachineConfig& config();
+
+    /**
+     * @brief Flags the configuration as changed so it gets written later.
+     * @param now_ms  Current millis() timestamp.
+     */
+    void markDirty(unsigned long now_ms);
+
+    /**
+     * @brief Call this frequently in your main loop to write coalesced changes.
+     * @param now_ms  Current millis() timestamp.
+     */
+    void update(unsigned long now_ms);
+
+    /**
+     * @brief Writes the configuration right away if it differs from NVS.
+     * @return true if the stored blob is up to date.
+     */
+    bool flush();
+
+    /// @brief Erases the stored blob so the next boot uses compiled-in defaults.
+    void erase();
+
+    bool isDirty();
+    bool wasLoaded();
+    unsigned long getWriteCount();
+    unsigned long getSkippedWriteCount();
+
+    /**
+     * @brief Computes the CRC32 (IEEE 802.3) of a buffer.
+     */
+    static uint32_t crc32(const uint8_t* data, size_t length);
+
+private:
+    bool isValid(const MachineConfig& cfg);
+    void seal(MachineConfig& cfg);
+
+    const char* m_namespace;
+    Preferences m_prefs;
+
+    MachineConfig m_config;
+    MachineConfig m_persisted;          // Copy of what is in NVS, to skip identical writes
+
+    bool m_loaded = false;
+    bool m_dirty = false;
+    unsigned long m_lastChangeMs = 0;
+    unsigned long m_lastWriteMs = 0;
+    bool m_hasWritten = false;
+    unsigned long m_writeCount = 0;
+    unsigned long m_skippedWriteCount = 0;
+};
+
+#endif
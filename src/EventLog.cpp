@@ -0,0 +1,330 @@
+#include <EventLog.h>
+#include <string.h>
+
+#define LOG_MESSAGE_LEVEL(id, level, format) level,
+static const uint8_t messageLevels[LOG_NUM_MESSAGES] = {LOG_MESSAGES(LOG_MESSAGE_LEVEL)};
+#undef LOG_MESSAGE_LEVEL
+
+#define LOG_MESSAGE_FORMAT(id, level, format) format,
+static const char* const messageFormats[LOG_NUM_MESSAGES] = {LOG_MESSAGES(LOG_MESSAGE_FORMAT)};
+#undef LOG_MESSAGE_FORMAT
+
+static const char levelLetters[] = {'D', 'I', 'W', 'E'};
+
+EventLog eventLog;
+
+// -------------------- EventRecord --------------------
+
+EventRecord::EventRecord(uint16_t id, uint8_t level) : m_length(EVENT_LOG_HEADER_SIZE) {
+    uint32_t timestamp = hal::micros();
+    m_data[0] = 0;
+    m_data[1] = 0;
+    m_data[2] = 0;                      // flags, set when committed
+    m_data[3] = level;
+    memcpy(&m_data[4], &timestamp, 4);
+    memcpy(&m_data[8], &id, 2);
+    m_data[10] = 0;                     // argc
+    m_data[11] = 0;
+}
+
+void EventRecord::putWord(uint8_t tag, uint32_t word) {
+    if (m_length + 5 > EVENT_LOG_MAX_RECORD) return;
+
+    m_data[m_length++] = tag;
+    memcpy(&m_data[m_length], &word, 4);
+    m_length += 4;
+    m_data[10]++;
+}
+
+void EventRecord::put(int value) {
+    putWord(EVENT_LOG_ARG_INT, static_cast<uint32_t>(value));
+}
+
+void EventRecord::put(unsigned int value) {
+    putWord(EVENT_LOG_ARG_UINT, value);
+}
+
+void EventRecord::put(long value) {
+    putWord(EVENT_LOG_ARG_INT, static_cast<uint32_t>(value));
+}
+
+void EventRecord::put(unsigned long value) {
+    putWord(EVENT_LOG_ARG_UINT, static_cast<uint32_t>(value));
+}
+
+void EventRecord::put(float value) {
+    uint32_t word;
+    memcpy(&word, &value, 4);
+    putWord(EVENT_LOG_ARG_FLOAT, word);
+}
+
+void EventRecord::put(double value) {
+    put(static_cast<float>(value));
+}
+
+void EventRecord::put(const char* value) {
+    if (value == nullptr) value = "";
+
+    if (m_length + 2 > EVENT_LOG_MAX_RECORD) return;
+
+    // Strings are cut to fit: 255 bytes, or what is left of the record
+    size_t length = strlen(value);
+    if (length > 255) length = 255;
+    if (m_length + 2 + length > EVENT_LOG_MAX_RECORD) length = EVENT_LOG_MAX_RECORD - m_length - 2;
+
+    m_data[m_length++] = EVENT_LOG_ARG_STRING;
+    m_data[m_length++] = static_cast<uint8_t>(length);
+    memcpy(&m_data[m_length], value, length);
+    m_length += length;
+    m_data[10]++;
+}
+
+void EventRecord::put(const String& value) {
+    put(value.c_str());
+}
+
+const uint8_t* EventRecord::data() const {
+    return m_data;
+}
+
+uint16_t EventRecord::length() const {
+    return m_length;
+}
+
+// -------------------- EventLog --------------------
+
+EventLog::EventLog()
+    : m_head(0), m_tail(0), m_level(LOG_LEVEL_INFO), m_written(0), m_dropped(0),
+      m_maxUsed(0), m_binaryOutput(false) {
+    memset(m_buffer, 0, sizeof(m_buffer));
+}
+
+void EventLog::setLevel(uint8_t level) {
+    m_level.store(level, std::memory_order_relaxed);
+}
+
+uint8_t EventLog::getLevel() const {
+    return m_level.load(std::memory_order_relaxed);
+}
+
+bool EventLog::write(const EventRecord& record) {
+    uint32_t length = record.length();
+    uint32_t size = (length + 3) & ~3U;
+
+    uint32_t head = m_head.load(std::memory_order_relaxed);
+    uint32_t offset;
+    uint32_t padding;
+
+    // Reserve contiguous space; a record never wraps, the end of the ring is padded instead
+    do {
+        offset = head & (EVENT_LOG_RING_SIZE - 1);
+        padding = offset + size > EVENT_LOG_RING_SIZE ? EVENT_LOG_RING_SIZE - offset : 0;
+
+        if (head + padding + size - m_tail.load(std::memory_order_acquire) > EVENT_LOG_RING_SIZE) {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+    } while (!m_head.compare_exchange_weak(head, head + padding + size, std::memory_order_acq_rel));
+
+    if (padding > 0) {
+        uint32_t word = padding | ((EVENT_LOG_FLAG_COMMITTED | EVENT_LOG_FLAG_PADDING) << 16);
+        __atomic_store_n(reinterpret_cast<uint32_t*>(&m_buffer[offset]), word, __ATOMIC_RELEASE);
+        offset = 0;
+    }
+
+    // Everything but the first word, which commits the record
+    uint8_t* slot = &m_buffer[offset];
+    memcpy(slot + 4, record.data() + 4, length - 4);
+
+    uint32_t word = size | (EVENT_LOG_FLAG_COMMITTED << 16) | (static_cast<uint32_t>(record.data()[3]) << 24);
+    __atomic_store_n(reinterpret_cast<uint32_t*>(slot), word, __ATOMIC_RELEASE);
+
+    m_written.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+int EventLog::drain(Sink sink, void* context) {
+    uint32_t tail = m_tail.load(std::memory_order_relaxed);
+    int drained = 0;
+
+    uint32_t used = m_head.load(std::memory_order_relaxed) - tail;
+    if (used > m_maxUsed) m_maxUsed = used;
+
+    while (tail != m_head.load(std::memory_order_acquire)) {
+        uint8_t* slot = &m_buffer[tail & (EVENT_LOG_RING_SIZE - 1)];
+        uint32_t word = __atomic_load_n(reinterpret_cast<uint32_t*>(slot), __ATOMIC_ACQUIRE);
+
+        uint8_t flags = (word >> 16) & 0xFF;
+        if (!(flags & EVENT_LOG_FLAG_COMMITTED)) break;     // Writer still copying, come back later
+
+        uint16_t size = word & 0xFFFF;
+        if (!(flags & EVENT_LOG_FLAG_PADDING)) {
+            sink(slot, size, context);
+            drained++;
+        }
+
+        // Zeroed space reads as "not committed" for the next writer
+        memset(slot, 0, size);
+        tail += size;
+        m_tail.store(tail, std::memory_order_release);
+    }
+
+    return drained;
+}
+
+void EventLog::setBinaryOutput(bool binary) {
+    m_binaryOutput = binary;
+}
+
+bool EventLog::isBinaryOutput() const {
+    return m_binaryOutput;
+}
+
+uint32_t EventLog::getWrittenCount() const {
+    return m_written.load(std::memory_order_relaxed);
+}
+
+uint32_t EventLog::getDroppedCount() const {
+    return m_dropped.load(std::memory_order_relaxed);
+}
+
+uint32_t EventLog::getMaxUsedBytes() const {
+    return m_maxUsed;
+}
+
+void EventLog::resetStats() {
+    m_written.store(0, std::memory_order_relaxed);
+    m_dropped.store(0, std::memory_order_relaxed);
+    m_maxUsed = 0;
+}
+
+String EventLog::statsJson() const {
+    String out = "{\"eventLog\":{\"level\":" + String(static_cast<int>(getLevel()));
+    out += ",\"binary\":";
+    out += m_binaryOutput ? "true" : "false";
+    out += ",\"written\":" + String(static_cast<unsigned long>(getWrittenCount()));
+    out += ",\"dropped\":" + String(static_cast<unsigned long>(getDroppedCount()));
+    out += ",\"max_used_bytes\":" + String(static_cast<unsigned long>(m_maxUsed));
+    out += ",\"ring_bytes\":" + String(EVENT_LOG_RING_SIZE) + "}}";
+    return out;
+}
+
+uint8_t EventLog::levelOf(uint16_t id) {
+    return id < LOG_NUM_MESSAGES ? messageLevels[id] : LOG_LEVEL_ERROR;
+}
+
+int EventLog::formatText(const uint8_t* record, uint16_t length, char* out, size_t size) {
+    if (size == 0) return 0;
+    out[0] = 0;
+    if (length < EVENT_LOG_HEADER_SIZE) return 0;
+
+    uint32_t timestamp;
+    uint16_t id;
+    memcpy(&timestamp, &record[4], 4);
+    memcpy(&id, &record[8], 2);
+    uint8_t level = record[3];
+    uint8_t argc = record[10];
+
+    size_t used = 0;
+    auto append = [&](int written) {
+        if (written > 0) used += static_cast<size_t>(written);
+        if (used >= size) used = size - 1;
+    };
+
+    const char* format = id < LOG_NUM_MESSAGES ? messageFormats[id] : nullptr;
+    if (format == nullptr) {
+        append(snprintf(out, size, "[%11.6f] ? unknown message %u\n", timestamp / 1e6, id));
+        return used;
+    }
+    if (id != LOG_TEXT) {
+        append(snprintf(out, size, "[%11.6f] %c ", timestamp / 1e6, levelLetters[level & 3]));
+    }
+
+    // Walk the format, substituting each conversion with the next argument
+    size_t pos = EVENT_LOG_HEADER_SIZE;
+    int argIndex = 0;
+
+    for (const char* f = format; *f != 0 && used < size - 1; f++) {
+        if (*f != '%') {
+            out[used++] = *f;
+            out[used] = 0;
+            continue;
+        }
+        if (f[1] == '%') {
+            out[used++] = '%';
+            out[used] = 0;
+            f++;
+            continue;
+        }
+
+        // Copy the conversion spec, e.g. "%06X" or "%.2f"
+        char spec[16];
+        size_t specLength = 0;
+        while (*f != 0 && specLength < sizeof(spec) - 2) {
+            spec[specLength++] = *f;
+            if (strchr("diuxXfFeEgGcs", *f) != nullptr && specLength > 1) break;
+            f++;
+        }
+        spec[specLength] = 0;
+        char conversion = spec[specLength - 1];
+
+        if (argIndex >= argc || pos >= length) {
+            append(snprintf(out + used, size - used, "<?>"));
+            continue;
+        }
+        argIndex++;
+
+        uint8_t tag = record[pos++];
+        if (tag == EVENT_LOG_ARG_STRING) {
+            uint8_t stringLength = record[pos++];
+            char text[256];
+            memcpy(text, &record[pos], stringLength);
+            text[stringLength] = 0;
+            pos += stringLength;
+            append(snprintf(out + used, size - used, conversion == 's' ? spec : "%s", text));
+            continue;
+        }
+
+        uint32_t word;
+        memcpy(&word, &record[pos], 4);
+        pos += 4;
+
+        float asFloat;
+        memcpy(&asFloat, &word, 4);
+
+        if (strchr("fFeEgG", conversion) != nullptr) {
+            append(snprintf(out + used, size - used, spec, tag == EVENT_LOG_ARG_FLOAT ? asFloat
+                : tag == EVENT_LOG_ARG_INT ? static_cast<float>(static_cast<int32_t>(word)) : static_cast<float>(word)));
+        } else if (conversion == 's') {
+            append(snprintf(out + used, size - used, "%ld", static_cast<long>(static_cast<int32_t>(word))));
+        } else if (tag == EVENT_LOG_ARG_FLOAT) {
+            append(snprintf(out + used, size - used, spec, static_cast<int>(asFloat)));
+        } else {
+            append(snprintf(out + used, size - used, spec, word));
+        }
+    }
+
+    if (id != LOG_TEXT && used < size - 1) {
+        out[used++] = '\n';
+        out[used] = 0;
+    }
+    return used;
+}
+
+#ifdef ARDUINO
+
+// Text from hal::println/printf; not filtered by the level, it answers commands
+void hal::logText(const char* text, bool newline) {
+    EventRecord record(LOG_TEXT, LOG_LEVEL_INFO);
+
+    char line[256];
+    size_t length = strnlen(text, newline ? sizeof(line) - 2 : sizeof(line) - 1);
+    memcpy(line, text, length);
+    if (newline) line[length++] = '\n';
+    line[length] = 0;
+
+    record.put(line);
+    eventLog.write(record);
+}
+
+#endif
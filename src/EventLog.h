@@ -0,0 +1,139 @@
+#ifndef EVENT_LOG_H
+#define EVENT_LOG_H
+
+#include "Hal.h"
+#include "LogMessages.h"
+#include <atomic>
+
+#define EVENT_LOG_RING_SIZE 8192        // Bytes, power of two
+#define EVENT_LOG_MAX_RECORD 272        // Header + one full-length string
+#define EVENT_LOG_HEADER_SIZE 12
+
+#define EVENT_LOG_FLAG_COMMITTED 0x01
+#define EVENT_LOG_FLAG_PADDING 0x02
+
+// Start of every record in the binary output, so the decoder can resync
+#define EVENT_LOG_FRAME_MAGIC_0 0xB1
+#define EVENT_LOG_FRAME_MAGIC_1 0x0C
+
+// Argument tags in the record payload
+#define EVENT_LOG_ARG_INT 'i'
+#define EVENT_LOG_ARG_UINT 'u'
+#define EVENT_LOG_ARG_FLOAT 'f'
+#define EVENT_LOG_ARG_STRING 's'
+
+/**
+ * @brief One record being built on the caller's stack.
+ *
+ * Layout, little endian, padded to 4 bytes:
+ *   u16 length, u8 flags, u8 level, u32 timestamp_us, u16 id, u8 argc, u8 reserved,
+ *   then per argument a tag byte and 4 bytes (int, uint, float) or u8 length + bytes (string).
+ */
+class EventRecord {
+
+public:
+    EventRecord(uint16_t id, uint8_t level);
+
+    void put(int value);
+    void put(unsigned int value);
+    void put(long value);
+    void put(unsigned long value);
+    void put(float value);
+    void put(double value);
+    void put(const char* value);
+    void put(const String& value);
+
+    inline void putAll() {}
+
+    template<typename T, typename... Rest>
+    inline void putAll(T first, Rest... rest) {
+        put(first);
+        putAll(rest...);
+    }
+
+    const uint8_t* data() const;
+    uint16_t length() const;
+
+private:
+    void putWord(uint8_t tag, uint32_t word);
+
+    uint8_t m_data[EVENT_LOG_MAX_RECORD];
+    uint16_t m_length;
+};
+
+/**
+ * @brief Deferred structured log: a lock-free ring of binary records.
+ *
+ * Any task (or ISR-free context) writes a record by reserving space with a
+ * CAS on the head, copying it in and setting its committed flag last. One
+ * drainer consumes committed records in order, formats them off the hot
+ * path and frees the space. A full ring drops the new record and counts it;
+ * writers never wait.
+ */
+class EventLog {
+
+public:
+    typedef void (*Sink)(const uint8_t* record, uint16_t length, void* context);
+
+    EventLog();
+
+    inline bool isEnabled(uint8_t level) const {
+        return level >= m_level.load(std::memory_order_relaxed);
+    }
+
+    /// @brief Records below this level are not written.
+    void setLevel(uint8_t level);
+    uint8_t getLevel() const;
+
+    /// @return false if the ring was full and the record was dropped.
+    bool write(const EventRecord& record);
+
+    /**
+     * @brief Drainer side: hands every committed record to the sink and frees it.
+     * @return Number of records drained.
+     */
+    int drain(Sink sink, void* context);
+
+    /// @brief Whether the drainer should send binary frames instead of text.
+    void setBinaryOutput(bool binary);
+    bool isBinaryOutput() const;
+
+    uint32_t getWrittenCount() const;
+    uint32_t getDroppedCount() const;
+    uint32_t getMaxUsedBytes() const;
+    void resetStats();
+
+    String statsJson() const;
+
+    /**
+     * @brief Turns one record back into text, e.g. "[   12.345678] I Chocolate: dispense complete".
+     * LOG_TEXT records come out raw, as they were printed.
+     * @return Characters written, excluding the terminator.
+     */
+    static int formatText(const uint8_t* record, uint16_t length, char* out, size_t size);
+
+    static uint8_t levelOf(uint16_t id);
+
+private:
+    alignas(4) uint8_t m_buffer[EVENT_LOG_RING_SIZE];
+    std::atomic<uint32_t> m_head;       // Bytes reserved by writers
+    std::atomic<uint32_t> m_tail;       // Bytes freed by the drainer
+    std::atomic<uint8_t> m_level;
+    std::atomic<uint32_t> m_written;
+    std::atomic<uint32_t> m_dropped;
+    uint32_t m_maxUsed;                 // Drainer side
+    bool m_binaryOutput;
+};
+
+extern EventLog eventLog;
+
+// Builds the record only when the level is enabled
+#define LOG_EVENT(id, ...) do { \
+        if (eventLog.isEnabled(EventLog::levelOf(id))) { \
+            EventRecord eventRecord_(id, EventLog::levelOf(id)); \
+            eventRecord_.putAll(__VA_ARGS__); \
+            eventLog.write(eventRecord_); \
+        } \
+    } while (0)
+
+#endif
@@ -0,0 +1,89 @@
+#include "FlowMeter.h"
+
+#ifdef ARDUINO
+#include <driver/pcnt.h>
+#include <driver/gpio.h>
+#endif
+
+int FlowMeter::s_unitsUsed = 0;
+
+FlowMeter::FlowMeter() {}
+
+bool FlowMeter::begin(int pin, float pulses_per_mL) {
+    if (isAttached() || pin < 0 || s_unitsUsed >= FLOW_METER_MAX_UNITS) return false;
+
+#ifdef ARDUINO
+    pcnt_unit_t unit = static_cast<pcnt_unit_t>(s_unitsUsed);
+
+    pcnt_config_t config = {};
+    config.pulse_gpio_num = pin;
+    config.ctrl_gpio_num = PCNT_PIN_NOT_USED;
+    config.channel = PCNT_CHANNEL_0;
+    config.unit = unit;
+    config.pos_mode = PCNT_COUNT_INC;
+    config.neg_mode = PCNT_COUNT_DIS;
+    config.lctrl_mode = PCNT_MODE_KEEP;
+    config.hctrl_mode = PCNT_MODE_KEEP;
+    config.counter_h_lim = FLOW_METER_PCNT_LIMIT;
+    config.counter_l_lim = 0;
+    if (pcnt_unit_config(&config) != ESP_OK) {
+        hal::println("Error: PCNT unit for the flow meter could not be configured");
+        return false;
+    }
+
+    // Open collector sensors
+    gpio_pullup_en(static_cast<gpio_num_t>(pin));
+
+    pcnt_set_filter_value(unit, FLOW_METER_FILTER_CYCLES);
+    pcnt_filter_enable(unit);
+    pcnt_counter_pause(unit);
+    pcnt_counter_clear(unit);
+    pcnt_counter_resume(unit);
+    m_lastRaw = 0;
+#else
+    m_lastRaw = hal::pulseCount(pin);
+#endif
+
+    m_unit = s_unitsUsed++;
+    m_pin = pin;
+    m_total = 0;
+    setPulsesPerMl(pulses_per_mL);
+    return true;
+}
+
+bool FlowMeter::isAttached() const {
+    return m_unit >= 0;
+}
+
+int FlowMeter::getPin() const {
+    return m_pin;
+}
+
+void FlowMeter::setPulsesPerMl(float pulses_per_mL) {
+    if (pulses_per_mL > 0.0f) m_pulsesPerMl = pulses_per_mL;
+}
+
+float FlowMeter::getPulsesPerMl() const {
+    return m_pulsesPerMl;
+}
+
+uint32_t FlowMeter::read() {
+    if (!isAttached()) return 0;
+
+#ifdef ARDUINO
+    int16_t value = 0;
+    pcnt_get_counter_value(static_cast<pcnt_unit_t>(m_unit), &value);
+    uint32_t raw = static_cast<uint16_t>(value);
+    m_total += raw >= m_lastRaw ? raw - m_lastRaw : raw + FLOW_METER_PCNT_LIMIT - m_lastRaw;
+#else
+    uint32_t raw = hal::pulseCount(m_pin);
+    m_total += raw - m_lastRaw;
+#endif
+
+    m_lastRaw = raw;
+    return m_total;
+}
+
+uint32_t FlowMeter::getLastCount() const {
+    return m_total;
+}
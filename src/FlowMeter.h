@@ -0,0 +1,52 @@
+#ifndef FLOW_METER_H
+#define FLOW_METER_H
+
+#include "Hal.h"
+
+#define FLOW_METER_MAX_UNITS    4       // PCNT units of the ESP32-S3
+#define FLOW_METER_PCNT_LIMIT   30000   // The counter returns to 0 here, far more pulses than between two reads
+#define FLOW_METER_FILTER_CYCLES 800    // APB cycles (10 us): hall sensors pulse below 1 kHz, glitches are shorter
+
+/**
+ * @brief Hall-effect flow sensor counted by the PCNT peripheral.
+ *
+ * The counter runs in hardware, no interrupt per pulse; read() folds the
+ * 16-bit counter into a 32-bit total, so it must run more often than the
+ * counter wraps (FLOW_METER_PCNT_LIMIT pulses, minutes at full flow). On the
+ * host the pulses come from hal::pulseCount(), fed by a simulated source
+ * (PlantModel::addFlowMeter).
+ */
+class FlowMeter {
+
+public:
+    FlowMeter();
+
+    /**
+     * @brief Claims a PCNT unit for the pin and starts counting rising edges.
+     * @return false if the pin is not valid or all units are taken.
+     */
+    bool begin(int pin, float pulses_per_mL);
+
+    bool isAttached() const;
+    int getPin() const;
+
+    void setPulsesPerMl(float pulses_per_mL);
+    float getPulsesPerMl() const;
+
+    /// @brief Pulses since begin(); call from one task only
+    uint32_t read();
+
+    /// @brief Total of the last read(), safe to look at from other tasks
+    uint32_t getLastCount() const;
+
+private:
+    int m_pin = -1;
+    int m_unit = -1;
+    float m_pulsesPerMl = 1.0f;
+    uint32_t m_total = 0;
+    uint32_t m_lastRaw = 0;
+
+    static int s_unitsUsed;
+};
+
+#endif
@@ -0,0 +1,158 @@
+#ifndef HAL_H
+#define HAL_H
+
+/**
+ * @brief Thin hardware abstraction (clock, GPIO, logger) used by the actuator and LED classes.
+ *
+ * On the ESP32 every call is an inline forward to the Arduino core, so it costs
+ * nothing. The native build (env:native) implements the same functions with a
+ * virtual clock and a recording GPIO, see src/host/include/HalNative.h.
+ */
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#include <soc/gpio_reg.h>
+#include <esp_timer.h>
+#else
+#include "HostArduino.h"
+#endif
+
+#include <stdarg.h>
+
+namespace hal {
+
+#ifdef ARDUINO
+
+// ——— Clock ———
+inline unsigned long millis() { return ::millis(); }
+inline unsigned long micros() { return ::micros(); }
+/// @brief Microseconds since boot that do not wrap (micros() does after ~71 min)
+inline uint64_t micros64() { return esp_timer_get_time(); }
+inline void delayMs(unsigned long ms) { ::delay(ms); }
+inline void delayUs(unsigned int us) { ::delayMicroseconds(us); }
+
+/// @brief Free-running CPU cycle counter (CCOUNT), wraps every ~18 s at 240 MHz
+inline uint32_t cycles() { return ESP.getCycleCount(); }
+inline uint32_t cpuMhz() { return getCpuFrequencyMhz(); }
+
+// ——— GPIO ———
+inline void gpioMode(int pin, int mode) { ::pinMode(pin, mode); }
+inline void gpioWrite(int pin, int level) { ::digitalWrite(pin, level); }
+inline int gpioRead(int pin) { return ::digitalRead(pin); }
+
+// ——— Logger ———
+// Deferred: the text goes into the event log as a LOG_TEXT record and the log
+// task prints it, so callers never wait on the UART. Implemented in EventLog.cpp.
+void logText(const char* text, bool newline);
+
+inline void println(const char* line) { logText(line, true); }
+inline void println(const String& line) { logText(line.c_str(), true); }
+
+inline void printf(const char* format, ...) __attribute__((format(printf, 1, 2)));
+inline void printf(const char* format, ...) {
+    char buffer[192];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    logText(buffer, false);
+}
+
+#else
+
+// ——— Clock ———
+unsigned long millis();
+unsigned long micros();
+uint64_t micros64();
+void delayMs(unsigned long ms);
+void delayUs(unsigned int us);
+
+/// @brief Host wall clock in ns, reported as a 1000 MHz cycle counter
+uint32_t cycles();
+uint32_t cpuMhz();
+
+// ——— GPIO ———
+void gpioMode(int pin, int mode);
+void gpioWrite(int pin, int level);
+int gpioRead(int pin);
+
+/// @brief Host only: rising edges counted on an input pin, as the PCNT would, from the simulated pulse source
+uint32_t pulseCount(int pin);
+
+// ——— Logger ———
+void println(const char* line);
+void println(const String& line);
+void printf(const char* format, ...) __attribute__((format(printf, 1, 2)));
+
+#endif
+
+/**
+ * @brief Output pin with its registers and polarity resolved once, for pins
+ * toggled in hot paths (STEP edges, pump drive).
+ *
+ * On the ESP32 on()/off()/write() are one store to the GPIO W1TS/W1TC
+ * register: no pin lookup and no polarity branch per edge. Pins come from the
+ * ingredient table at boot, so they are resolved in attach() rather than at
+ * compile time. On the host every write goes through the recording gpioWrite.
+ */
+class OutputPin {
+
+public:
+    OutputPin() {}
+
+    /// @brief Makes the pin an OUTPUT and resolves its registers. active_low: on() drives LOW.
+    inline void attach(int pin, bool active_low = false) {
+        m_pin = pin;
+        gpioMode(pin, OUTPUT);
+#ifdef ARDUINO
+        bool high_bank = pin >= 32;
+        m_mask = 1UL << (pin & 31);
+        m_set = reinterpret_cast<volatile uint32_t*>(high_bank ? GPIO_OUT1_W1TS_REG : GPIO_OUT_W1TS_REG);
+        m_clear = reinterpret_cast<volatile uint32_t*>(high_bank ? GPIO_OUT1_W1TC_REG : GPIO_OUT_W1TC_REG);
+#endif
+        setActiveLow(active_low);
+    }
+
+    inline void setActiveLow(bool active_low) {
+#ifdef ARDUINO
+        m_on = active_low ? m_clear : m_set;
+        m_off = active_low ? m_set : m_clear;
+#else
+        m_on_level = active_low ? LOW : HIGH;
+#endif
+    }
+
+#ifdef ARDUINO
+    inline void on() { *m_on = m_mask; }
+    inline void off() { *m_off = m_mask; }
+    inline void write(int level) { *(level ? m_set : m_clear) = m_mask; }
+#else
+    inline void on() { gpioWrite(m_pin, m_on_level); }
+    inline void off() { gpioWrite(m_pin, !m_on_level); }
+    inline void write(int level) { gpioWrite(m_pin, level); }
+#endif
+
+    /// @brief on() when active, off() otherwise
+    inline void set(bool active) {
+        if (active) on();
+        else off();
+    }
+
+    inline int pin() const { return m_pin; }
+
+private:
+    int m_pin = -1;
+#ifdef ARDUINO
+    uint32_t m_mask = 0;
+    volatile uint32_t* m_set = nullptr;
+    volatile uint32_t* m_clear = nullptr;
+    volatile uint32_t* m_on = nullptr;
+    volatile uint32_t* m_off = nullptr;
+#else
+    int m_on_level = HIGH;
+#endif
+};
+
+} // namespace hal
+
+#endif
@@ -0,0 +1,114 @@
+#include <HumidityCompensation.h>
+#include <math.h>
+
+HumidityCurve::HumidityCurve() {
+    clear();
+}
+
+bool HumidityCurve::addSample(float relative_humidity, float steps_per_gram) {
+    if (!(relative_humidity >= 0.0f && relative_humidity <= 100.0f) || !(steps_per_gram > 0.0f)) {
+        return false;
+    }
+
+    // Find the existing sample closest in humidity
+    int closest = -1;
+    float closest_distance = 0.0f;
+    for (int i = 0; i < m_count; i++) {
+        float distance = fabsf(m_samples[i].relative_humidity - relative_humidity);
+        if (closest < 0 || distance < closest_distance) {
+            closest = i;
+            closest_distance = distance;
+        }
+    }
+
+    int slot;
+    if (closest >= 0 && (closest_distance < HUMIDITY_CURVE_MERGE_RH || m_count == HUMIDITY_CURVE_MAX_SAMPLES)) {
+        slot = closest;
+    } else {
+        slot = m_count++;
+    }
+    m_samples[slot] = {relative_humidity, steps_per_gram};
+
+    // Keep the samples sorted by humidity (insertion sort, the array is tiny)
+    for (int i = 1; i < m_count; i++) {
+        Sample s = m_samples[i];
+        int j = i - 1;
+        while (j >= 0 && m_samples[j].relative_humidity > s.relative_humidity) {
+            m_samples[j + 1] = m_samples[j];
+            j--;
+        }
+        m_samples[j + 1] = s;
+    }
+
+    fit();
+    return true;
+}
+
+void HumidityCurve::clear() {
+    m_count = 0;
+    m_slope = 0.0f;
+    m_intercept = 0.0f;
+    m_min_rh = 0.0f;
+    m_max_rh = 0.0f;
+}
+
+void HumidityCurve::fit() {
+    if (m_count == 0) {
+        m_slope = 0.0f;
+        m_intercept = 0.0f;
+        return;
+    }
+
+    m_min_rh = m_samples[0].relative_humidity;
+    m_max_rh = m_samples[m_count - 1].relative_humidity;
+
+    float mean_rh = 0.0f;
+    float mean_spg = 0.0f;
+    for (int i = 0; i < m_count; i++) {
+        mean_rh += m_samples[i].relative_humidity;
+        mean_spg += m_samples[i].steps_per_gram;
+    }
+    mean_rh /= m_count;
+    mean_spg /= m_count;
+
+    float covariance = 0.0f;
+    float variance = 0.0f;
+    for (int i = 0; i < m_count; i++) {
+        float d_rh = m_samples[i].relative_humidity - mean_rh;
+        covariance += d_rh * (m_samples[i].steps_per_gram - mean_spg);
+        variance += d_rh * d_rh;
+    }
+
+    // A single sample (or all at the same humidity) gives a flat curve
+    m_slope = variance > 1e-6f ? covariance / variance : 0.0f;
+    m_intercept = mean_spg - m_slope * mean_rh;
+}
+
+float HumidityCurve::evaluate(float relative_humidity, float fallback) const {
+    if (m_count == 0 || isnan(relative_humidity)) return fallback;
+
+    float rh = relative_humidity;
+    if (rh < m_min_rh) rh = m_min_rh;
+    if (rh > m_max_rh) rh = m_max_rh;
+
+    float steps_per_gram = m_intercept + m_slope * rh;
+    return steps_per_gram > 0.0f ? steps_per_gram : fallback;
+}
+
+int HumidityCurve::getSampleCount() const {
+    return m_count;
+}
+
+const HumidityCurve::Sample& HumidityCurve::getSample(int index) const {
+    if (index < 0) index = 0;
+    if (index >= HUMIDITY_CURVE_MAX_SAMPLES) index = HUMIDITY_CURVE_MAX_SAMPLES - 1;
+    return m_samples[index];
+}
+
+float HumidityCurve::getSlope() const {
+    return m_slope;
+}
+
+float HumidityCurve::getIntercept() const {
+    return m_intercept;
+}
@@ -0,0 +1,65 @@
+#ifndef HUMIDITY_COMPENSATION_H
+#define HUMIDITY_COMPENSATION_H
+
+#define HUMIDITY_CURVE_MAX_SAMPLES 8
+#define HUMIDITY_CURVE_MERGE_RH 2.0f   // Samples closer than this in %RH replace each other
+
+/**
+ * @brief Steps-per-gram of a powder as a function of relative humidity.
+ *
+ * Calibration runs are stored as (humidity, steps per gram) samples and a
+ * least-squares line is fitted through them. Evaluation is clamped to the
+ * humidity range that was actually calibrated, so the curve never extrapolates.
+ *
+ * The samples are stored in the config blob, HUMIDITY_CURVE_MAX_SAMPLES per
+ * dispenser.
+ */
+class HumidityCurve {
+
+public:
+    struct Sample {
+        float relative_humidity;
+        float steps_per_gram;
+    };
+
+    HumidityCurve();
+
+    /**
+     * @brief Adds a calibration sample and refits the curve.
+     * A sample within HUMIDITY_CURVE_MERGE_RH of an existing one replaces it. When
+     * the curve is full, the sample closest in humidity is replaced.
+     * @param relative_humidity  Humidity during the calibration run in %.
+     * @param steps_per_gram     Measured steps per gram.
+     * @return false if the sample is out of range.
+     */
+    bool addSample(float relative_humidity, float steps_per_gram);
+
+    /// @brief Removes every sample.
+    void clear();
+
+    /// @brief Least-squares fit of steps per gram over humidity. Called by addSample().
+    void fit();
+
+    /**
+     * @brief Steps per gram at the given humidity.
+     * @param relative_humidity  Current humidity in %, NaN if unknown.
+     * @param fallback           Returned when there are no samples or the humidity is unknown.
+     */
+    float evaluate(float relative_humidity, float fallback) const;
+
+    int getSampleCount() const;
+    const Sample& getSample(int index) const;
+    float getSlope() const;             // steps per gram per %RH
+    float getIntercept() const;         // steps per gram at 0 %RH
+
+private:
+    Sample m_samples[HUMIDITY_CURVE_MAX_SAMPLES];   // Sorted by humidity
+    int m_count;
+
+    float m_slope;
+    float m_intercept;
+    float m_min_rh;
+    float m_max_rh;
+};
+
+#endif
@@ -0,0 +1,202 @@
+#include <IdleScheduler.h>
+
+IdleScheduler::IdleScheduler() {
+    for (int i = 0; i < IDLE_MAX_LINES; i++) m_primeMl[i] = IDLE_PRIME_DEFAULT_ML;
+}
+
+void IdleScheduler::begin(int lines, int powders, unsigned long now_ms) {
+    m_lines = constrain(lines, 0, IDLE_MAX_LINES);
+    m_powders = constrain(powders, 0, IDLE_MAX_POWDERS);
+
+    for (int i = 0; i < IDLE_MAX_LINES; i++) m_lineRunMs[i] = now_ms;
+    for (int i = 0; i < IDLE_MAX_POWDERS; i++) m_powderRunMs[i] = now_ms;
+    m_lastActivityMs = now_ms;
+}
+
+void IdleScheduler::setPrimeAfter(unsigned long prime_after_ms) {
+    m_primeAfterMs = prime_after_ms;
+}
+
+unsigned long IdleScheduler::getPrimeAfterMs() const {
+    return m_primeAfterMs;
+}
+
+void IdleScheduler::setPrimeVolume(int line, float milliliters) {
+    if (line < 0 || line >= IDLE_MAX_LINES || !(milliliters >= 0.0f)) return;
+    m_primeMl[line] = milliliters;
+}
+
+float IdleScheduler::getPrimeVolume(int line) const {
+    return line >= 0 && line < IDLE_MAX_LINES ? m_primeMl[line] : 0.0f;
+}
+
+void IdleScheduler::setPrestage(bool enabled, unsigned long settle_after_ms) {
+    m_prestage = enabled;
+    m_settleAfterMs = settle_after_ms;
+}
+
+bool IdleScheduler::isPrestageEnabled() const {
+    return m_prestage;
+}
+
+unsigned long IdleScheduler::getSettleAfterMs() const {
+    return m_settleAfterMs;
+}
+
+void IdleScheduler::noteActivity(uint32_t line_mask, uint32_t powder_mask, unsigned long now_ms) {
+    for (int i = 0; i < m_lines; i++) {
+        if ((line_mask >> i) & 1) m_lineRunMs[i] = now_ms;
+    }
+    for (int i = 0; i < m_powders; i++) {
+        if ((powder_mask >> i) & 1) m_powderRunMs[i] = now_ms;
+    }
+    if (line_mask != 0 || powder_mask != 0) m_lastActivityMs = now_ms;
+}
+
+void IdleScheduler::orderPending(unsigned long now_ms) {
+    // orderDetails then orderAskForBottle: the same order, keep what was pre-staged for it
+    if (!isOrderPending(now_ms)) m_prestaged = -1;
+
+    m_pending = true;
+    m_pendingSinceMs = now_ms;
+    m_lastActivityMs = now_ms;
+}
+
+void IdleScheduler::orderClosed(unsigned long now_ms) {
+    m_pending = false;
+    m_prestaged = -1;
+    m_lastActivityMs = now_ms;
+}
+
+bool IdleScheduler::isOrderPending(unsigned long now_ms) const {
+    return m_pending && now_ms - m_pendingSinceMs < IDLE_PENDING_TIMEOUT_MS;
+}
+
+void IdleScheduler::noteOrder(int powder) {
+    if (powder < 0 || powder >= m_powders) return;
+
+    if (m_prestaged >= 0) {
+        if (m_prestaged == powder) m_prestageHits++;
+        else m_prestageMisses++;
+        m_prestaged = -1;
+    }
+
+    for (int i = 0; i < m_powders; i++) m_popularity[i] *= IDLE_POPULARITY_DECAY;
+    m_popularity[powder] += 1.0f;
+    m_lastOrdered = powder;
+}
+
+int IdleScheduler::nextPrime(bool quiescent, unsigned long now_ms) {
+    if (!quiescent) {
+        m_lastActivityMs = now_ms;
+        return -1;
+    }
+    if (m_primeAfterMs == 0 || isOrderPending(now_ms) || now_ms - m_lastActivityMs < IDLE_PRIME_QUIET_MS) {
+        return -1;
+    }
+
+    int due = -1;
+    unsigned long longest = 0;
+    for (int i = 0; i < m_lines; i++) {
+        unsigned long idle = now_ms - m_lineRunMs[i];
+        if (m_primeMl[i] > 0.0f && idle >= m_primeAfterMs && idle >= longest) {
+            due = i;
+            longest = idle;
+        }
+    }
+    if (due < 0) return -1;
+
+    // The pulse itself resets the quiet time, so the next line waits for another quiet spell
+    m_lineRunMs[due] = now_ms;
+    m_lastActivityMs = now_ms;
+    m_primeCount[due]++;
+    return due;
+}
+
+int IdleScheduler::predictPowder() const {
+    int best = m_lastOrdered;
+    for (int i = 0; i < m_powders; i++) {
+        if (best < 0 || m_popularity[i] > m_popularity[best]) best = i;
+    }
+    return best >= 0 && m_popularity[best] > 0.0f ? best : -1;
+}
+
+bool IdleScheduler::isSettled(int powder, unsigned long now_ms) const {
+    return powder >= 0 && powder < m_powders && now_ms - m_powderRunMs[powder] >= m_settleAfterMs;
+}
+
+void IdleScheduler::notePrestage(int powder, bool agitated, unsigned long now_ms) {
+    if (powder < 0 || powder >= m_powders) return;
+
+    m_prestaged = powder;
+    m_prestageCount++;
+    if (agitated) {
+        m_agitateCount++;
+        m_powderRunMs[powder] = now_ms;
+    }
+}
+
+unsigned long IdleScheduler::getLineIdleMs(int line, unsigned long now_ms) const {
+    return line >= 0 && line < m_lines ? now_ms - m_lineRunMs[line] : 0;
+}
+
+unsigned long IdleScheduler::getPowderIdleMs(int powder, unsigned long now_ms) const {
+    return powder >= 0 && powder < m_powders ? now_ms - m_powderRunMs[powder] : 0;
+}
+
+unsigned long IdleScheduler::getPrimeCount(int line) const {
+    return line >= 0 && line < IDLE_MAX_LINES ? m_primeCount[line] : 0;
+}
+
+unsigned long IdleScheduler::getPrestageCount() const {
+    return m_prestageCount;
+}
+
+unsigned long IdleScheduler::getAgitateCount() const {
+    return m_agitateCount;
+}
+
+unsigned long IdleScheduler::getPrestageHits() const {
+    return m_prestageHits;
+}
+
+unsigned long IdleScheduler::getPrestageMisses() const {
+    return m_prestageMisses;
+}
+
+void IdleScheduler::resetStats() {
+    for (int i = 0; i < IDLE_MAX_LINES; i++) m_primeCount[i] = 0;
+    m_prestageCount = 0;
+    m_agitateCount = 0;
+    m_prestageHits = 0;
+    m_prestageMisses = 0;
+}
+
+String IdleScheduler::toJson(unsigned long now_ms) const {
+    String out = "{\"idle\":{\"prime_after_ms\":" + String(m_primeAfterMs);
+    out += ",\"prestage\":" + String(m_prestage ? "true" : "false");
+    out += ",\"settle_after_ms\":" + String(m_settleAfterMs);
+    out += ",\"order_pending\":" + String(isOrderPending(now_ms) ? "true" : "false");
+
+    out += ",\"lines\":[";
+    for (int i = 0; i < m_lines; i++) {
+        if (i > 0) out += ',';
+        out += "{\"idle_ms\":" + String(getLineIdleMs(i, now_ms));
+        out += ",\"prime_mL\":" + String(m_primeMl[i], 2);
+        out += ",\"primes\":" + String(m_primeCount[i]) + "}";
+    }
+
+    out += "],\"powders\":[";
+    for (int i = 0; i < m_powders; i++) {
+        if (i > 0) out += ',';
+        out += "{\"idle_ms\":" + String(getPowderIdleMs(i, now_ms));
+        out += ",\"popularity\":" + String(m_popularity[i], 2) + "}";
+    }
+
+    out += "],\"predicted\":" + String(predictPowder());
+    out += ",\"prestaged\":" + String(m_prestageCount);
+    out += ",\"agitated\":" + String(m_agitateCount);
+    out += ",\"hits\":" + String(m_prestageHits);
+    out += ",\"misses\":" + String(m_prestageMisses) + "}}";
+    return out;
+}
@@ -0,0 +1,137 @@
+#ifndef IDLE_SCHEDULER_H
+#define IDLE_SCHEDULER_H
+
+#include "Hal.h"
+
+#define IDLE_MAX_LINES 8                    // Pumps, as in CONFIG_MAX_PUMPS
+#define IDLE_MAX_POWDERS 4                  // Dispensers, as in CONFIG_MAX_DISPENSERS
+
+#define IDLE_PRIME_AFTER_MS 600000UL        // A line unused this long has taken in air, for idleSetPriming
+#define IDLE_PRIME_QUIET_MS 60000UL         // No priming this soon after anything ran, the bottle may still be there
+#define IDLE_PRIME_DEFAULT_ML 1.0f          // Pushed through a line per priming pulse
+#define IDLE_SETTLE_AFTER_MS 60000UL        // A powder column unused this long has settled
+#define IDLE_PRESTAGE_CYCLES 10             // Vibration cycles that loosen a settled column
+#define IDLE_PENDING_TIMEOUT_MS 300000UL    // An order set up on the tablet and never prepared
+#define IDLE_POPULARITY_DECAY 0.8f          // Weight an older order keeps per newer one in the prediction
+
+/**
+ * @brief Decides what the machine does with its idle time.
+ *
+ * Two jobs, both meant to make the first drink after a quiet spell like any other:
+ *
+ * - Priming: a peristaltic line left unused for prime_after_ms drains back and
+ *   takes in air, which the next dispense then pumps instead of fluid. Once a
+ *   line is due and the machine has been quiet for IDLE_PRIME_QUIET_MS with no
+ *   order being set up on the tablet, nextPrime() hands it out for a short
+ *   pulse into the drip tray, one line at a time. Off until setPrimeAfter()
+ *   is given a time, as it pumps fluid on its own.
+ * - Pre-staging: when the tablet opens an order, predictPowder() names the
+ *   powder most likely to be asked for (recent orders weigh more), so its
+ *   driver can be woken and, if the column settled, agitated before prepare.
+ *
+ * The control step feeds it which actuators are running; the machine does the
+ * pulses and the agitation. Only the control task uses it.
+ */
+class IdleScheduler {
+
+public:
+    IdleScheduler();
+
+    /// @brief Starts tracking this many lines and powders, all counted as just run.
+    void begin(int lines, int powders, unsigned long now_ms);
+
+    /// @param prime_after_ms  Unused time after which a line is primed, 0 (the default) to never prime.
+    void setPrimeAfter(unsigned long prime_after_ms);
+    unsigned long getPrimeAfterMs() const;
+
+    /// @param milliliters  Volume of one priming pulse on the line, 0 to never prime it.
+    void setPrimeVolume(int line, float milliliters);
+    float getPrimeVolume(int line) const;
+
+    /**
+     * @param enabled          Pre-stage the predicted powder when an order opens.
+     * @param settle_after_ms  Unused time after which its column is agitated too.
+     */
+    void setPrestage(bool enabled, unsigned long settle_after_ms);
+    bool isPrestageEnabled() const;
+    unsigned long getSettleAfterMs() const;
+
+    /**
+     * @brief What is running right now, as published by the motion step.
+     * @param line_mask    Bit per line.
+     * @param powder_mask  Bit per powder.
+     */
+    void noteActivity(uint32_t line_mask, uint32_t powder_mask, unsigned long now_ms);
+
+    /// @brief The tablet is setting up an order; no priming until it is closed or times out.
+    void orderPending(unsigned long now_ms);
+
+    /// @brief The order was prepared or canceled.
+    void orderClosed(unsigned long now_ms);
+
+    bool isOrderPending(unsigned long now_ms) const;
+
+    /// @brief An order for this powder was prepared; feeds the prediction and the hit counter.
+    void noteOrder(int powder);
+
+    /**
+     * @brief The line to prime now, if any.
+     * @param quiescent  Nothing is running (no order, actuator or animation).
+     * @return The longest unused line that is due, counted as run from now on; -1 if none.
+     */
+    int nextPrime(bool quiescent, unsigned long now_ms);
+
+    /// @brief Powder most likely to be ordered next, -1 before the first order.
+    int predictPowder() const;
+
+    /// @brief Whether the powder's column had time to settle since it last moved.
+    bool isSettled(int powder, unsigned long now_ms) const;
+
+    /**
+     * @brief The powder was pre-staged for the pending order.
+     * @param agitated  Its column was loosened, so it counts as run from now on.
+     */
+    void notePrestage(int powder, bool agitated, unsigned long now_ms);
+
+    unsigned long getLineIdleMs(int line, unsigned long now_ms) const;
+    unsigned long getPowderIdleMs(int powder, unsigned long now_ms) const;
+    unsigned long getPrimeCount(int line) const;
+    unsigned long getPrestageCount() const;
+    unsigned long getAgitateCount() const;
+
+    /// @brief Orders that were for the pre-staged powder, and orders that were not
+    unsigned long getPrestageHits() const;
+    unsigned long getPrestageMisses() const;
+
+    void resetStats();
+
+    String toJson(unsigned long now_ms) const;
+
+private:
+    int m_lines = 0;
+    int m_powders = 0;
+
+    unsigned long m_primeAfterMs = 0;
+    float m_primeMl[IDLE_MAX_LINES];
+    bool m_prestage = true;
+    unsigned long m_settleAfterMs = IDLE_SETTLE_AFTER_MS;
+
+    unsigned long m_lineRunMs[IDLE_MAX_LINES] = {0};        // Last millis() the line was seen running
+    unsigned long m_powderRunMs[IDLE_MAX_POWDERS] = {0};
+    unsigned long m_lastActivityMs = 0;
+    bool m_pending = false;
+    unsigned long m_pendingSinceMs = 0;
+
+    float m_popularity[IDLE_MAX_POWDERS] = {0};             // Decayed order count
+    int m_lastOrdered = -1;
+    int m_prestaged = -1;                                   // For the order being set up
+
+    // Stats
+    unsigned long m_primeCount[IDLE_MAX_LINES] = {0};
+    unsigned long m_prestageCount = 0;
+    unsigned long m_agitateCount = 0;
+    unsigned long m_prestageHits = 0;
+    unsigned long m_prestageMisses = 0;
+};
+
+#endif
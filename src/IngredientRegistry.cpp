@@ -0,0 +1,131 @@
+#include <IngredientRegistry.h>
+
+IngredientRegistry::IngredientRegistry()
+    : m_pumpCount(0), m_dispenserCount(0), m_built(false)
+{
+    memset(m_pumps, 0, sizeof(m_pumps));
+    memset(m_dispensers, 0, sizeof(m_dispensers));
+    memset(m_pumpAliases, 0, sizeof(m_pumpAliases));
+    memset(m_dispenserAliases, 0, sizeof(m_dispenserAliases));
+    memset(m_pumpSlot, 0, sizeof(m_pumpSlot));
+    memset(m_dispenserSlot, 0, sizeof(m_dispenserSlot));
+}
+
+int IngredientRegistry::build(const MachineConfig& cfg) {
+    if (m_built) return 0;
+    m_built = true;
+
+    int skipped = 0;
+    char name[CONFIG_NAME_LENGTH + 1];
+
+    for (int i = 0; i < cfg.pump_count && i < CONFIG_MAX_PUMPS; i++) {
+        const PumpConfig& pc = cfg.pumps[i];
+        uint8_t key = static_cast<uint8_t>(pc.alias);
+
+        if (key == 0 || key >= INGREDIENT_ALIAS_RANGE || m_pumpSlot[key] != 0 || !validPin(pc.drive_pin)) {
+            hal::printf("Error: skipping pump record %d (alias or pin invalid)\n", i);
+            skipped++;
+            continue;
+        }
+
+        memcpy(name, pc.name, CONFIG_NAME_LENGTH);
+        name[CONFIG_NAME_LENGTH] = 0;
+
+        m_pumps[m_pumpCount] = new Pump(name, pc.drive_pin, pc.mL_per_second, pc.negated_logic);
+        m_pumpAliases[m_pumpCount] = pc.alias;
+        m_pumpSlot[key] = ++m_pumpCount;
+
+        if (validPin(pc.flow_pin) && !attachFlowMeter(m_pumpCount - 1, pc.flow_pin, pc.flow_pulses_per_mL)) {
+            hal::printf("Error: no flow meter for pump %c on GPIO %d, dispensing by time\n", pc.alias, pc.flow_pin);
+        }
+    }
+
+    for (int i = 0; i < cfg.dispenser_count && i < CONFIG_MAX_DISPENSERS; i++) {
+        const DispenserConfig& dc = cfg.dispensers[i];
+        uint8_t key = static_cast<uint8_t>(dc.alias);
+
+        if (key == 0 || key >= INGREDIENT_ALIAS_RANGE || m_dispenserSlot[key] != 0 ||
+            !validPin(dc.step_pin) || !validPin(dc.sleep_pin) || !validPin(dc.dir_pin)) {
+            hal::printf("Error: skipping dispenser record %d (alias or pin invalid)\n", i);
+            skipped++;
+            continue;
+        }
+
+        memcpy(name, dc.name, CONFIG_NAME_LENGTH);
+        name[CONFIG_NAME_LENGTH] = 0;
+
+        m_dispensers[m_dispenserCount] = new StepperPowderDispenser(name, dc.step_pin, dc.sleep_pin, dc.dir_pin,
+            dc.dispense_is_CW, dc.steps_per_gram, dc.step_interval, dc.pulse_duration, dc.steps_per_revolution,
+            dc.vibration_step_interval, dc.vibration_pulse_duration, dc.steps_per_vibration);
+        if (validPin(dc.ms_pins[0]) || validPin(dc.ms_pins[1]) || validPin(dc.ms_pins[2])) {
+            m_dispensers[m_dispenserCount]->setMicrostepPins(
+                validPin(dc.ms_pins[0]) ? dc.ms_pins[0] : STEPPER_NO_PIN,
+                validPin(dc.ms_pins[1]) ? dc.ms_pins[1] : STEPPER_NO_PIN,
+                validPin(dc.ms_pins[2]) ? dc.ms_pins[2] : STEPPER_NO_PIN);
+        }
+        m_dispenserAliases[m_dispenserCount] = dc.alias;
+        m_dispenserSlot[key] = ++m_dispenserCount;
+    }
+
+    return skipped;
+}
+
+Pump* IngredientRegistry::pump(const String& alias) const {
+    return alias.length() == 1 ? pump(alias[0]) : nullptr;
+}
+
+StepperPowderDispenser* IngredientRegistry::dispenser(const String& alias) const {
+    return alias.length() == 1 ? dispenser(alias[0]) : nullptr;
+}
+
+int IngredientRegistry::getPumpCount() const {
+    return m_pumpCount;
+}
+
+int IngredientRegistry::getDispenserCount() const {
+    return m_dispenserCount;
+}
+
+Pump* IngredientRegistry::getPump(int index) const {
+    return index >= 0 && index < m_pumpCount ? m_pumps[index] : nullptr;
+}
+
+StepperPowderDispenser* IngredientRegistry::getDispenser(int index) const {
+    return index >= 0 && index < m_dispenserCount ? m_dispensers[index] : nullptr;
+}
+
+char IngredientRegistry::getPumpAlias(int index) const {
+    return index >= 0 && index < m_pumpCount ? m_pumpAliases[index] : 0;
+}
+
+char IngredientRegistry::getDispenserAlias(int index) const {
+    return index >= 0 && index < m_dispenserCount ? m_dispenserAliases[index] : 0;
+}
+
+bool IngredientRegistry::attachFlowMeter(int index, int pin, float pulses_per_mL) {
+    if (index < 0 || index >= m_pumpCount || !validPin(pin) || pulses_per_mL <= 0.0f) return false;
+    if (m_flowMeters[index].isAttached() || !m_flowMeters[index].begin(pin, pulses_per_mL)) return false;
+
+    m_pumps[index]->setFlowMeter(&m_flowMeters[index]);
+    return true;
+}
+
+int IngredientRegistry::indexOf(const Pump* pump) const {
+    for (int i = 0; i < m_pumpCount; i++) {
+        if (m_pumps[i] == pump) return i;
+    }
+    return -1;
+}
+
+int IngredientRegistry::indexOf(const StepperPowderDispenser* dispenser) const {
+    for (int i = 0; i < m_dispenserCount; i++) {
+        if (m_dispensers[i] == dispenser) return i;
+    }
+    return -1;
+}
+
+// -------------------- Private Helper Methods --------------------
+
+bool IngredientRegistry::validPin(int pin) {
+    return pin >= 0 && pin <= INGREDIENT_MAX_GPIO;
+}
@@ -0,0 +1,82 @@
+#ifndef INGREDIENT_REGISTRY_H
+#define INGREDIENT_REGISTRY_H
+
+#include "Hal.h"
+#include "ConfigStore.h"
+#include "Pump.h"
+#include "StepperPowderDispenser.h"
+#include "FlowMeter.h"
+
+#define INGREDIENT_ALIAS_RANGE 128      // Aliases are ASCII characters
+#define INGREDIENT_MAX_GPIO 48          // Highest GPIO of the ESP32-S3
+
+/**
+ * @brief Table of the machine's ingredients, built from the configuration at boot.
+ *
+ * Every pump and dispenser record of the MachineConfig becomes one actuator,
+ * with the pins, polarity and calibration of the record. Commands name an
+ * ingredient by a one-character alias, looked up by indexing a table with the
+ * alias byte; pumps and dispensers have separate aliases ("1" can be both).
+ */
+class IngredientRegistry {
+
+public:
+    IngredientRegistry();
+
+    /**
+     * @brief Creates the actuators of every valid record. Only the first call
+     * builds anything: pins are claimed once and never released.
+     * @return Number of records skipped (duplicate alias, bad pin, table full).
+     */
+    int build(const MachineConfig& cfg);
+
+    inline Pump* pump(char alias) const {
+        uint8_t key = static_cast<uint8_t>(alias);
+        return key < INGREDIENT_ALIAS_RANGE && m_pumpSlot[key] != 0 ? m_pumps[m_pumpSlot[key] - 1] : nullptr;
+    }
+
+    inline StepperPowderDispenser* dispenser(char alias) const {
+        uint8_t key = static_cast<uint8_t>(alias);
+        return key < INGREDIENT_ALIAS_RANGE && m_dispenserSlot[key] != 0 ? m_dispensers[m_dispenserSlot[key] - 1] : nullptr;
+    }
+
+    /// @brief Command argument lookups; anything but a single character is unknown.
+    Pump* pump(const String& alias) const;
+    StepperPowderDispenser* dispenser(const String& alias) const;
+
+    int getPumpCount() const;
+    int getDispenserCount() const;
+    Pump* getPump(int index) const;
+    StepperPowderDispenser* getDispenser(int index) const;
+    char getPumpAlias(int index) const;
+    char getDispenserAlias(int index) const;
+
+    /**
+     * @brief Counts a flow meter on pin and lets the pump dispense by volume.
+     * A pump gets one meter; moving it takes a restart.
+     * @return false if the pump already has one, the pin is invalid or no PCNT unit is left.
+     */
+    bool attachFlowMeter(int index, int pin, float pulses_per_mL);
+
+    /// @brief Slot of an actuator, -1 if it is not in the table.
+    int indexOf(const Pump* pump) const;
+    int indexOf(const StepperPowderDispenser* dispenser) const;
+
+private:
+    static bool validPin(int pin);
+
+    Pump* m_pumps[CONFIG_MAX_PUMPS];
+    FlowMeter m_flowMeters[CONFIG_MAX_PUMPS];
+    StepperPowderDispenser* m_dispensers[CONFIG_MAX_DISPENSERS];
+    char m_pumpAliases[CONFIG_MAX_PUMPS];
+    char m_dispenserAliases[CONFIG_MAX_DISPENSERS];
+    int m_pumpCount;
+    int m_dispenserCount;
+
+    // Alias byte to slot + 1, 0 when unknown
+    uint8_t m_pumpSlot[INGREDIENT_ALIAS_RANGE];
+    uint8_t m_dispenserSlot[INGREDIENT_ALIAS_RANGE];
+    bool m_built;
+};
+
+#endif
@@ -0,0 +1,160 @@
+#include "LedSpanKernels.h"
+#include <string.h>
+
+namespace ledspan {
+
+// ——— Scalar reference ———
+
+void scalar::fill(CRGB* dst, size_t count, const CRGB& color) {
+    for (size_t i = 0; i < count; i++) dst[i] = color;
+}
+
+void scalar::blendToColor(CRGB* dst, size_t count, const CRGB& color, const uint8_t* alpha) {
+    for (size_t i = 0; i < count; i++) {
+        dst[i].r = blend8(dst[i].r, color.r, alpha[i]);
+        dst[i].g = blend8(dst[i].g, color.g, alpha[i]);
+        dst[i].b = blend8(dst[i].b, color.b, alpha[i]);
+    }
+}
+
+void scalar::add(CRGB* dst, const CRGB* src, size_t count) {
+    uint8_t* d = dst[0].raw;
+    const uint8_t* s = src[0].raw;
+    for (size_t i = 0; i < count * 3; i++) {
+        unsigned sum = d[i] + s[i];
+        d[i] = sum > 255 ? 255 : sum;
+    }
+}
+
+void scalar::scale(CRGB* dst, size_t count, uint8_t scale) {
+    uint8_t* d = dst[0].raw;
+    for (size_t i = 0; i < count * 3; i++) d[i] = scale8(d[i], scale);
+}
+
+// ——— Wide ———
+// CRGB runs are byte arrays with no alignment, words go through memcpy
+
+static inline uint32_t load32(const uint8_t* p) {
+    uint32_t w;
+    memcpy(&w, p, sizeof(w));
+    return w;
+}
+
+static inline void store32(uint8_t* p, uint32_t w) {
+    memcpy(p, &w, sizeof(w));
+}
+
+void wide::fill(CRGB* dst, size_t count, const CRGB& color) {
+    // Four pixels are three words
+    uint8_t pattern[12];
+    for (int i = 0; i < 4; i++) memcpy(pattern + 3 * i, color.raw, 3);
+
+    uint8_t* d = dst[0].raw;
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4, d += 12) memcpy(d, pattern, 12);
+    for (; i < count; i++, d += 3) memcpy(d, color.raw, 3);
+}
+
+void wide::blendToColor(CRGB* dst, size_t count, const CRGB& color, const uint8_t* alpha) {
+    // blend8(a, b, x) = (a * (256 - x) + b * (1 + x)) >> 8, and that sum never
+    // passes 65535, so r and b share a word as two 16-bit lanes
+    const uint32_t color_rb = (static_cast<uint32_t>(color.r) << 16) | color.b;
+    const uint32_t color_g = color.g;
+
+    for (size_t i = 0; i < count; i++) {
+        uint32_t x = alpha[i];
+        if (x == 0) continue;
+
+        uint32_t keep = 256 - x;
+        uint32_t take = 1 + x;
+        uint32_t rb = (static_cast<uint32_t>(dst[i].r) << 16) | dst[i].b;
+        uint32_t mixed_rb = rb * keep + color_rb * take;
+        uint32_t mixed_g = dst[i].g * keep + color_g * take;
+
+        dst[i].r = mixed_rb >> 24;
+        dst[i].g = mixed_g >> 8;
+        dst[i].b = (mixed_rb >> 8) & 0xFF;
+    }
+}
+
+void wide::add(CRGB* dst, const CRGB* src, size_t count) {
+    uint8_t* d = dst[0].raw;
+    const uint8_t* s = src[0].raw;
+    size_t bytes = count * 3;
+    size_t i = 0;
+
+    for (; i + 4 <= bytes; i += 4) {
+        uint32_t x = load32(d + i);
+        uint32_t y = load32(s + i);
+        // Add the low 7 bits of each byte, then put the top bits back and saturate
+        uint32_t low = (x & 0x7F7F7F7FUL) + (y & 0x7F7F7F7FUL);
+        uint32_t carry = ((x & y) | ((x ^ y) & low)) & 0x80808080UL;
+        uint32_t sum = low ^ ((x ^ y) & 0x80808080UL);
+        store32(d + i, sum | ((carry >> 7) * 0xFF));
+    }
+
+    for (; i < bytes; i++) {
+        unsigned sum = d[i] + s[i];
+        d[i] = sum > 255 ? 255 : sum;
+    }
+}
+
+void wide::scale(CRGB* dst, size_t count, uint8_t scale) {
+    uint8_t* d = dst[0].raw;
+    size_t bytes = count * 3;
+    size_t i = 0;
+    uint32_t factor = 1 + static_cast<uint32_t>(scale);
+
+    // Every product fits its 16-bit lane (255 * 256), even and odd bytes in turn
+    for (; i + 4 <= bytes; i += 4) {
+        uint32_t w = load32(d + i);
+        uint32_t even = (((w & 0x00FF00FFUL) * factor) >> 8) & 0x00FF00FFUL;
+        uint32_t odd = (((w >> 8) & 0x00FF00FFUL) * factor) & 0xFF00FF00UL;
+        store32(d + i, even | odd);
+    }
+
+    for (; i < bytes; i++) d[i] = scale8(d[i], scale);
+}
+
+// ——— Dispatch ———
+
+void fill(CRGB* dst, size_t count, const CRGB& color) {
+#if LED_SPAN_WIDE
+    wide::fill(dst, count, color);
+#else
+    scalar::fill(dst, count, color);
+#endif
+}
+
+void blendToColor(CRGB* dst, size_t count, const CRGB& color, const uint8_t* alpha) {
+#if LED_SPAN_WIDE
+    wide::blendToColor(dst, count, color, alpha);
+#else
+    scalar::blendToColor(dst, count, color, alpha);
+#endif
+}
+
+void blendToColorIndexed(CRGB* leds, const uint8_t* index, size_t count, const CRGB& color, const uint8_t* alpha) {
+    for (size_t i = 0; i < count; i++) {
+        if (alpha[i] == 0) continue;
+        blendToColor(&leds[index[i]], 1, color, &alpha[i]);
+    }
+}
+
+void add(CRGB* dst, const CRGB* src, size_t count) {
+#if LED_SPAN_WIDE
+    wide::add(dst, src, count);
+#else
+    scalar::add(dst, src, count);
+#endif
+}
+
+void scale(CRGB* dst, size_t count, uint8_t scale) {
+#if LED_SPAN_WIDE
+    wide::scale(dst, count, scale);
+#else
+    scalar::scale(dst, count, scale);
+#endif
+}
+
+}
@@ -0,0 +1,55 @@
+#ifndef LED_SPAN_KERNELS_H
+#define LED_SPAN_KERNELS_H
+
+#include <FastLED.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Use the wide (two or four channels per 32-bit operation) kernels. Both paths
+// give the same bytes; the scalar one is the reference the harness checks against.
+#ifndef LED_SPAN_WIDE
+#define LED_SPAN_WIDE 1
+#endif
+
+/*
+ * Span operations over contiguous CRGB runs. Animations work out a per-pixel
+ * alpha for their LEDs first and then make one call here, instead of one
+ * blend() and its branches per pixel. Results are bit for bit those of
+ * FastLED's blend8(), scale8() and qadd8() (FIXED variants, the defaults).
+ */
+namespace ledspan {
+
+/// @brief Every pixel to color
+void fill(CRGB* dst, size_t count, const CRGB& color);
+
+/// @brief dst[i] = blend(dst[i], color, alpha[i]); alpha 0 keeps the pixel, 255 replaces it
+void blendToColor(CRGB* dst, size_t count, const CRGB& color, const uint8_t* alpha);
+
+/// @brief Same for scattered pixels: leds[index[i]] with alpha[i]
+void blendToColorIndexed(CRGB* leds, const uint8_t* index, size_t count, const CRGB& color, const uint8_t* alpha);
+
+/// @brief dst[i] += src[i], saturating per channel
+void add(CRGB* dst, const CRGB* src, size_t count);
+
+/// @brief Every channel to scale8(channel, scale)
+void scale(CRGB* dst, size_t count, uint8_t scale);
+
+/// @brief One pixel at a time, the reference for the wide kernels
+namespace scalar {
+void fill(CRGB* dst, size_t count, const CRGB& color);
+void blendToColor(CRGB* dst, size_t count, const CRGB& color, const uint8_t* alpha);
+void add(CRGB* dst, const CRGB* src, size_t count);
+void scale(CRGB* dst, size_t count, uint8_t scale);
+}
+
+/// @brief Several channels per 32-bit operation (16-bit lanes for products, 8-bit lanes otherwise)
+namespace wide {
+void fill(CRGB* dst, size_t count, const CRGB& color);
+void blendToColor(CRGB* dst, size_t count, const CRGB& color, const uint8_t* alpha);
+void add(CRGB* dst, const CRGB* src, size_t count);
+void scale(CRGB* dst, size_t count, uint8_t scale);
+}
+
+}
+
+#endif
@@ -0,0 +1,85 @@
+#include "LedZones.h"
+#include "LedSpanKernels.h"
+
+void LedZone::build(const LedSpan* spans, int span_count) {
+    leds.clear();
+    first = 0x7FFF;
+    last = -1;
+
+    for (int s = 0; s < span_count; s++) {
+        int step = spans[s].last >= spans[s].first ? 1 : -1;
+        for (int i = spans[s].first; ; i += step) {
+            leds.push_back(static_cast<uint8_t>(i));
+            if (i < first) first = i;
+            if (i > last) last = i;
+            if (i == spans[s].last) break;
+        }
+    }
+
+    if (leds.empty()) {
+        first = 0;
+        last = -1;
+    }
+
+    center = (first + last) / 2.0f;
+    max_radius = (last - first) / 2.0f;
+
+    size_t count = leds.size();
+    contiguous = true;
+    for (size_t k = 0; k < count; k++) {
+        if (leds[k] != first + static_cast<int>(k)) contiguous = false;
+    }
+
+    distance.resize(count);
+    normalized.resize(count);
+    position.resize(count);
+    for (size_t k = 0; k < count; k++) {
+        distance[k] = fabs(leds[k] - center);
+        normalized[k] = max_radius > 0.0f ? distance[k] / max_radius : 0.0f;
+        position[k] = count > 1 ? static_cast<float>(k) / (count - 1) : 0.0f;
+    }
+}
+
+void LedZone::blend(CRGB* strip, const CRGB& color, const uint8_t* alpha) const {
+    if (contiguous) {
+        ledspan::blendToColor(strip + first, leds.size(), color, alpha);
+    } else {
+        ledspan::blendToColorIndexed(strip, leds.data(), leds.size(), color, alpha);
+    }
+}
+
+void LedZone::fill(CRGB* strip, const CRGB& color) const {
+    if (contiguous) {
+        ledspan::fill(strip + first, leds.size(), color);
+        return;
+    }
+    for (uint8_t i : leds) strip[i] = color;
+}
+
+void LedZone::build(int first_index, int last_index) {
+    LedSpan span = {first_index, last_index};
+    build(&span, 1);
+}
+
+LedZoneTable::LedZoneTable(const LedZoneDef* defs, int count) {
+    m_zones.resize(count);
+    for (int i = 0; i < count; i++) {
+        m_zones[i].name = defs[i].name;
+        m_zones[i].build(defs[i].spans, defs[i].span_count);
+    }
+}
+
+const LedZone& LedZoneTable::get(int id) const {
+    return m_zones[id];
+}
+
+const LedZone* LedZoneTable::find(const String& name) const {
+    for (const LedZone& zone : m_zones) {
+        if (zone.name == name) return &zone;
+    }
+    return nullptr;
+}
+
+int LedZoneTable::getCount() const {
+    return static_cast<int>(m_zones.size());
+}
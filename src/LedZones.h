@@ -0,0 +1,81 @@
+#ifndef LED_ZONES_H
+#define LED_ZONES_H
+
+#include "Hal.h"
+#include <FastLED.h>
+#include <vector>
+
+#define LED_ZONE_MAX_SPANS 4
+
+/// @brief Inclusive run of LEDs; last < first walks the strip backwards (mirrored)
+struct LedSpan {
+    int first;
+    int last;
+};
+
+/// @brief Compiled-in description of a zone
+struct LedZoneDef {
+    const char* name;
+    LedSpan spans[LED_ZONE_MAX_SPANS];
+    uint8_t span_count;
+};
+
+/**
+ * @brief Named set of LEDs with its geometry worked out once.
+ *
+ * The LEDs are stored in zone order (span by span), each with its distance to
+ * the zone center and its position along the zone, so animations only look
+ * these up per frame. The center is the middle of the outermost LEDs, which
+ * makes two mirrored spans behave like one symmetric region.
+ */
+struct LedZone {
+    String name;
+    std::vector<uint8_t> leds;          // LED indices in zone order
+    std::vector<float> distance;        // |index - center| in pixels
+    std::vector<float> normalized;      // distance / max_radius, 0 at the center, 1 at the ends
+    std::vector<float> position;        // 0 .. 1 along the zone order
+    float center = 0.0f;
+    float max_radius = 0.0f;
+    int first = 0;                      // Lowest and highest LED index
+    int last = -1;
+    bool contiguous = true;             // leds is first, first + 1, ... last
+
+    /// @brief Rebuilds the tables for other spans
+    void build(const LedSpan* spans, int span_count);
+
+    /// @brief Zone of the single run [first, last]
+    void build(int first_index, int last_index);
+
+    size_t size() const {
+        return leds.size();
+    }
+
+    /// @brief Blends every LED of the zone toward color by its alpha (zone order)
+    void blend(CRGB* strip, const CRGB& color, const uint8_t* alpha) const;
+
+    /// @brief Sets every LED of the zone to color
+    void fill(CRGB* strip, const CRGB& color) const;
+};
+
+/**
+ * @brief Zone table of the strip, built once from LedZoneDef records.
+ * Code addresses zones by their index in the table, commands by name.
+ */
+class LedZoneTable {
+
+public:
+    LedZoneTable(const LedZoneDef* defs, int count);
+
+    /// @brief Zone by index in the definition table
+    const LedZone& get(int id) const;
+
+    /// @brief Zone by name, nullptr if unknown
+    const LedZone* find(const String& name) const;
+
+    int getCount() const;
+
+private:
+    std::vector<LedZone> m_zones;
+};
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef LOG_MESSAGES_H
+#define LOG_MESSAGES_H
+
+#include <stdint.h>
+
+/*
+ * Catalogue of event log messages, shared by the firmware and the host decoder.
+ * Only the id and the arguments are stored; the format is applied when the
+ * record is drained or decoded. Append new messages at the end so old
+ * captures still decode.
+ *
+ * Arguments: %d/%u/%x take ints, %f floats, %s strings (up to 255 bytes).
+ */
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO  1
+#define LOG_LEVEL_WARN  2
+#define LOG_LEVEL_ERROR 3
+
+#define LOG_MESSAGES(X) \
+    X(LOG_TEXT,             LOG_LEVEL_INFO,  "%s") \
+    X(LOG_PUMP_DONE,        LOG_LEVEL_INFO,  "%s: dispense complete") \
+    X(LOG_STEPPER_SPIN,     LOG_LEVEL_INFO,  "%s: spinning %d steps") \
+    X(LOG_STEPPER_DONE,     LOG_LEVEL_DEBUG, "%s: move done, %u vibrations so far") \
+    X(LOG_STRIP_FILL,       LOG_LEVEL_DEBUG, "Symmetric fill %d..%d color %06X, %.2f ms, %d fps") \
+    X(LOG_STATE_CHANGE,     LOG_LEVEL_INFO,  "State %d -> %d") \
+    X(LOG_COMMAND,          LOG_LEVEL_INFO,  "Command received: %s") \
+    X(LOG_QUEUE_DROP,       LOG_LEVEL_WARN,  "%s queue full, dropped a request") \
+    X(LOG_PUMP_FLOW_DONE,   LOG_LEVEL_DEBUG, "%s: %u flow pulses in %u ms, %.2f of the calibrated rate") \
+    X(LOG_PUMP_FLOW_TIMEOUT, LOG_LEVEL_WARN, "%s: flow meter counted %.1f of %.1f mL, stopped on time") \
+    X(LOG_PUMP_FLOW_FAULT,  LOG_LEVEL_WARN,  "%s: flow meter silent (%u pulses), dispensing by time") \
+    X(LOG_CALIBRATION_SAMPLE, LOG_LEVEL_DEBUG, "%s: measured %.3f, predicted %.3f, gain %.6f +- %.6f, offset %.3f") \
+    X(LOG_CALIBRATION_OUTLIER, LOG_LEVEL_WARN, "%s: measured %.3f against %.3f predicted, refused as an outlier") \
+    X(LOG_CALIBRATION_RELEARN, LOG_LEVEL_INFO, "%s: outliers on one side, calibration relearning") \
+    X(LOG_IDLE_PRIME,       LOG_LEVEL_INFO,  "%s: priming the line, %d ms for %.2f mL") \
+    X(LOG_IDLE_PRESTAGE,    LOG_LEVEL_INFO,  "%s: pre-staged for the next order, agitated %d")
+
+#define LOG_MESSAGE_ID(id, level, format) id,
+enum LogMessageId : uint16_t {
+    LOG_MESSAGES(LOG_MESSAGE_ID)
+    LOG_NUM_MESSAGES
+};
+#undef LOG_MESSAGE_ID
+
+#endif
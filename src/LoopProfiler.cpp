@@ -0,0 +1,95 @@
+#include <LoopProfiler.h>
+
+// -------------------- Probe --------------------
+
+void LoopProfiler::Probe::add(uint32_t cycles) {
+    if (count == 0 || cycles < min_cycles) min_cycles = cycles;
+    if (cycles > max_cycles) max_cycles = cycles;
+    count++;
+    sum_cycles += cycles;
+
+    int bucket = cycles == 0 ? 0 : 31 - __builtin_clz(cycles);
+    buckets[bucket]++;
+}
+
+void LoopProfiler::Probe::clear() {
+    const char* keep = name;
+    *this = Probe();
+    name = keep;
+}
+
+// -------------------- LoopProfiler --------------------
+
+LoopProfiler::LoopProfiler(const char* const* names, int count)
+    : m_count(constrain(count, 0, LOOP_PROFILER_MAX_PROBES)), m_sinceMs(0) {
+    for (int i = 0; i < m_count; i++) {
+        m_probes[i].name = names[i];
+    }
+}
+
+void LoopProfiler::reset() {
+    for (int i = 0; i < m_count; i++) {
+        m_probes[i].clear();
+    }
+    m_sinceMs = hal::millis();
+}
+
+int LoopProfiler::getProbeCount() const {
+    return m_count;
+}
+
+const LoopProfiler::Probe& LoopProfiler::getProbe(int probe) const {
+    return m_probes[constrain(probe, 0, LOOP_PROFILER_MAX_PROBES - 1)];
+}
+
+String LoopProfiler::toJson() const {
+    float mhz = hal::cpuMhz();
+
+    String out = "{\"loopProfile\":{\"enabled\":";
+    out += LOOP_PROFILER_ENABLED ? "true" : "false";
+    out += ",\"cpu_mhz\":" + String(static_cast<unsigned long>(mhz));
+    out += ",\"window_ms\":" + String(hal::millis() - m_sinceMs);
+    out += ",\"probes\":{";
+
+    for (int i = 0; i < m_count; i++) {
+        const Probe& p = m_probes[i];
+        if (i > 0) out += ',';
+
+        out += "\"" + String(p.name) + "\":{\"count\":" + String(p.count);
+        out += ",\"min_us\":" + String(p.min_cycles / mhz, 2);
+        out += ",\"avg_us\":" + String(p.count ? p.sum_cycles / p.count / mhz : 0.0f, 2);
+        out += ",\"max_us\":" + String(p.max_cycles / mhz, 2);
+        out += ",\"total_ms\":" + String(p.sum_cycles / mhz / 1000.0f, 1);
+
+        // Histogram from the first to the last non-empty bucket, keyed by its lower bound in cycles
+        int first = 0;
+        int last = LOOP_PROFILER_NUM_BUCKETS - 1;
+        while (first < last && p.buckets[first] == 0) first++;
+        while (last > first && p.buckets[last] == 0) last--;
+
+        out += ",\"log2_first\":" + String(first) + ",\"log2_buckets\":[";
+        for (int b = first; b <= last; b++) {
+            if (b > first) out += ',';
+            out += String(p.buckets[b]);
+        }
+        out += "]}";
+    }
+
+    out += "}}}";
+    return out;
+}
+
+void LoopProfiler::printReport() const {
+    float mhz = hal::cpuMhz();
+
+    hal::printf("Loop profile over %lu ms at %lu MHz%s\n", hal::millis() - m_sinceMs,
+        static_cast<unsigned long>(mhz), LOOP_PROFILER_ENABLED ? "" : " (disabled at compile time)");
+    hal::printf("%-16s %10s %10s %10s %10s %10s\n", "probe", "count", "min us", "avg us", "max us", "total ms");
+
+    for (int i = 0; i < m_count; i++) {
+        const Probe& p = m_probes[i];
+        hal::printf("%-16s %10lu %10.2f %10.2f %10.2f %10.1f\n", p.name, static_cast<unsigned long>(p.count),
+            p.min_cycles / mhz, p.count ? p.sum_cycles / p.count / mhz : 0.0f, p.max_cycles / mhz,
+            p.sum_cycles / mhz / 1000.0f);
+    }
+}
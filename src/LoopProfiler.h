@@ -0,0 +1,96 @@
+#ifndef LOOP_PROFILER_H
+#define LOOP_PROFILER_H
+
+#include "Hal.h"
+
+// Build with -DLOOP_PROFILER_ENABLED=0 to compile every probe out
+#ifndef LOOP_PROFILER_ENABLED
+#define LOOP_PROFILER_ENABLED 1
+#endif
+
+#define LOOP_PROFILER_MAX_PROBES 16
+#define LOOP_PROFILER_NUM_BUCKETS 32    // Bucket i counts samples with 2^i <= cycles < 2^(i+1)
+
+/**
+ * @brief Cycle-counter profiler for the main loop.
+ *
+ * Each probe is a fixed slot with a name. A ProfileScope reads the CPU cycle
+ * counter when it is created and adds the elapsed cycles to its probe when it
+ * goes out of scope, so a probe costs two counter reads and a few additions.
+ * Every probe keeps min/avg/max and a log2 histogram of the cycles.
+ */
+class LoopProfiler {
+
+public:
+    struct Probe {
+        const char* name = nullptr;
+        uint32_t count = 0;
+        uint32_t min_cycles = 0;
+        uint32_t max_cycles = 0;
+        uint64_t sum_cycles = 0;
+        uint32_t buckets[LOOP_PROFILER_NUM_BUCKETS] = {0};
+
+        void add(uint32_t cycles);
+        void clear();
+    };
+
+    /**
+     * @param names  Probe names, indexed like the probes. Must outlive the profiler.
+     * @param count  Number of probes (at most LOOP_PROFILER_MAX_PROBES).
+     */
+    LoopProfiler(const char* const* names, int count);
+
+    inline void record(int probe, uint32_t cycles) {
+        if (probe >= 0 && probe < m_count) m_probes[probe].add(cycles);
+    }
+
+    /// @brief Runtime switch on top of the compile-time one, e.g. for host tools.
+    inline void setEnabled(bool enabled) { m_enabled = enabled; }
+    inline bool isEnabled() const { return m_enabled; }
+
+    /// @brief Clears every probe, keeping the names.
+    void reset();
+
+    int getProbeCount() const;
+    const Probe& getProbe(int probe) const;
+
+    /// @brief All probes as JSON, times converted with the current CPU frequency.
+    String toJson() const;
+
+    /// @brief Human readable table on the HAL logger (Serial on the ESP32).
+    void printReport() const;
+
+private:
+    Probe m_probes[LOOP_PROFILER_MAX_PROBES];
+    int m_count;
+    unsigned long m_sinceMs;
+    bool m_enabled = true;
+};
+
+/// @brief Times its own lifetime into one probe.
+class ProfileScope {
+
+public:
+    inline ProfileScope(LoopProfiler& profiler, int probe)
+        : m_profiler(profiler), m_probe(probe), m_start(profiler.isEnabled() ? hal::cycles() : 0) {}
+
+    inline ~ProfileScope() {
+        if (m_profiler.isEnabled()) m_profiler.record(m_probe, hal::cycles() - m_start);
+    }
+
+private:
+    LoopProfiler& m_profiler;
+    int m_probe;
+    uint32_t m_start;
+};
+
+#define LOOP_PROFILER_CONCAT_(a, b) a##b
+#define LOOP_PROFILER_CONCAT(a, b) LOOP_PROFILER_CONCAT_(a, b)
+
+#if LOOP_PROFILER_ENABLED
+#define PROFILE_SCOPE(profiler, probe) ProfileScope LOOP_PROFILER_CONCAT(profileScope_, __LINE__)(profiler, probe)
+#else
+#define PROFILE_SCOPE(profiler, probe) ((void)0)
+#endif
+
+#endif
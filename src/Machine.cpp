@@ -0,0 +1,2578 @@
+#include <Machine.h>
+#include "customColors.h"
+#include "StepperPowderDispenser.h"
+#include "SymmetricFillAnim.h"
+#include "BlinkingSymetricFillAnim.h"
+#include "Pump.h"
+#include "ConfigStore.h"
+#include "VibrationPolicy.h"
+#include "TaskMailbox.h"
+#include "IngredientRegistry.h"
+#include "EventLog.h"
+#include "CommandCapture.h"
+#include <map>
+#include <functional>
+#include <limits.h>
+
+// helper: split a String by ‘,’ and trim whitespace
+std::vector<String> splitArgs(const String& s) {
+    std::vector<String> parts;
+    int start = 0;
+
+    while (start < s.length()) {
+        int comma = s.indexOf(',', start);
+        if (comma < 0) comma = s.length();
+        String part = s.substring(start, comma);
+        part.trim();
+        parts.push_back(part);
+        start = comma + 1;
+    }
+
+    return parts;
+}
+
+static std::map<String, CmdHandler> commandMap;
+
+void machineAddCommand(const String& name, CmdHandler handler) {
+    commandMap[name] = handler;
+}
+
+// ——— Platform hooks ———
+static BroadcastHandler broadcastHandler = nullptr;
+static HumiditySensorReader humiditySensorReader = nullptr;
+
+void machineSetBroadcastHandler(BroadcastHandler handler) {
+    broadcastHandler = handler;
+}
+
+void machineSetHumiditySensor(HumiditySensorReader reader) {
+    humiditySensorReader = reader;
+}
+
+// Sends a message to the clients subscribed to its topic
+static void broadcast(uint8_t topic, const String& message) {
+    if (broadcastHandler != nullptr) broadcastHandler(topic, message);
+}
+
+// One humidity reading in %RH, NaN if there is no sensor or it failed
+static float readHumiditySensor() {
+    return humiditySensorReader != nullptr ? humiditySensorReader() : NAN;
+}
+
+int state = NOT_PREPARING;
+
+// ——— Order metrics ———
+static const char* const stageNames[ORDER_METRICS_NUM_STAGES] = {
+    "START_ORDER",
+    "WATER_PUMPING",
+    "PROTEIN_DISPENSING",
+    "FLAVOR_PUMPING",
+    "TUMERIC_DISPENSING",
+    "FINISH_ORDER"
+};
+
+OrderMetrics orderMetrics;
+
+static const char* const probeNames[NUM_PROBES] = {
+    "loop", "wsCleanup", "stateMachine", "strip",
+    "pumps", "dispensers", "humidity", "config"
+};
+LoopProfiler loopProfiler(probeNames, NUM_PROBES);
+
+// Every state change goes through here so each transition is timestamped
+void setState(int newState) {
+    unsigned long now = hal::millis();
+
+    if (newState == NOT_PREPARING) {
+        orderMetrics.endOrder(now);
+    } else {
+        if (newState == START_ORDER) orderMetrics.beginOrder(now);
+        orderMetrics.enterStage(newState, now);
+    }
+
+    LOG_EVENT(LOG_STATE_CHANGE, state, newState);
+    state = newState;
+}
+
+CRGB leds[NUM_LEDS];
+AnimatedStrip strip(leds, NUM_LEDS);
+
+// Spans may be disjoint or run backwards; the geometry is built once, at boot
+static const LedZoneDef ledZoneDefs[NUM_ZONES] = {
+    {"all", {{0, NUM_LEDS - 1}}, 1},
+    {"front", {{26, 59}}, 1},
+    {"tablet", {{49, 56}}, 1},
+    {"tablet_area", {{49 - 5, 56 + 5}}, 1},
+    {"bottle", {{33, 43}}, 1},
+    {"bottle_area", {{33 - 5, 43 + 5}}, 1},
+};
+
+LedZoneTable ledZones(ledZoneDefs, NUM_ZONES);
+
+// ——— Ingredients ———
+// Compiled-in ingredient table. It goes into the config blob on the first boot
+// and is read back from NVS after that, so a new flavor pump is a new record
+// (ingredientSetPump) instead of a firmware change.
+static const PumpConfig defaultPumps[] = {
+    // alias, pin, negated, flow meter pin, name, mL per second, flow meter pulses per mL
+    {'1', PERISTALTIC_A, 0, CONFIG_NO_PIN, "Saborizante de Chocolate", 1.8f, 0.0f},
+    {'2', PERISTALTIC_B, 0, CONFIG_NO_PIN, "Saborizante de Vainilla", 1.53f, 0.0f},
+    {'3', PERISTALTIC_C, 0, CONFIG_NO_PIN, "Saborizante de Fresa", 1.56f, 0.0f},
+    {WATER_ALIAS, WATER_PUMP, 1, CONFIG_NO_PIN, "Agua", 32.83f, 0.0f},     // Negated logic, LOW = on, HIGH = off
+    {TUMERIC_ALIAS, TUMERIC, 0, CONFIG_NO_PIN, "Tumeric", 8.7575f, 0.0f},  // Non calibrated
+};
+
+static const DispenserConfig defaultDispensers[] = {
+    // alias, step, sleep and dir pins, microstep select pins, reserved, name, steps per gram, step interval us,
+    // pulse us, steps per revolution, vibration step interval us, vibration pulse us, steps per vibration, clockwise
+    {'1', STEPPER_B_STEP, STEPPER_B_SLEEP, STEPPER_B_DIR, {CONFIG_NO_PIN, CONFIG_NO_PIN, CONFIG_NO_PIN}, 0,
+        "Birdman", 32.5415f, 3000, 3000, 200, 1000, 100, 84, 0},
+    {'2', STEPPER_A_STEP, STEPPER_A_SLEEP, STEPPER_A_DIR, {CONFIG_NO_PIN, CONFIG_NO_PIN, CONFIG_NO_PIN}, 0,
+        "Pure Health", 71.8602f, 3000, 3000, 200, 1000, 100, 84, 0},
+};
+
+#define NUM_DEFAULT_PUMPS (sizeof(defaultPumps) / sizeof(defaultPumps[0]))
+#define NUM_DEFAULT_DISPENSERS (sizeof(defaultDispensers) / sizeof(defaultDispensers[0]))
+
+static IngredientRegistry ingredients;
+
+// Vibration policies, shared by the dispensers. Index is what gets persisted.
+static FixedVibrationPolicy fixedVibration;
+static HumidityScaledVibrationPolicy humidityVibration;
+static FlowFeedbackVibrationPolicy feedbackVibration;
+static VibrationPolicy* const vibrationPolicies[] = {&fixedVibration, &humidityVibration, &feedbackVibration};
+#define NUM_VIBRATION_POLICIES (sizeof(vibrationPolicies) / sizeof(vibrationPolicies[0]))
+
+int vibrationPolicyIndex(VibrationPolicy* policy) {
+    for (size_t i = 0; i < NUM_VIBRATION_POLICIES; i++) {
+        if (vibrationPolicies[i] == policy) return i;
+    }
+    return 0;
+}
+
+// ——— Power ———
+// The governor lives on the control side, other tasks read the mirrored state
+PowerGovernor powerGovernor;
+static std::atomic<int> powerState(POWER_ACTIVE);
+static PowerStateHandler powerHandler = nullptr;
+
+void machineSetPowerHandler(PowerStateHandler handler) {
+    powerHandler = handler;
+}
+
+int machinePowerState() {
+    return powerState.load(std::memory_order_relaxed);
+}
+
+void machineWake() {
+    powerGovernor.wake(hal::millis());
+}
+
+void machineRecordWakeLatency(unsigned long latency_us) {
+    powerGovernor.recordWakeLatency(latency_us);
+}
+
+// ——— Task ownership ———
+// The pumps and dispensers belong to the motion step, the strip to the UI step.
+// Control code (commands, state machine) never drives them directly: it posts
+// work to their mailbox and reads actuator state from the motion snapshot.
+// Without tasks, machineUpdate() runs all three steps in turn, same rules.
+static TaskMailbox motionMailbox;
+static TaskMailbox uiMailbox;
+
+// Published by the motion step once per iteration
+#define MOTION_DISPENSER_BIT CONFIG_MAX_PUMPS
+static std::atomic<uint32_t> motionBusyMask(0);     // bit per pump slot, dispensers from MOTION_DISPENSER_BIT
+static std::atomic<uint32_t> motionAppliedSeq(0);   // last motion work item run before the mask was taken
+static std::atomic<uint32_t> motionModelRevision(0); // sum of the calibration model revisions
+static uint32_t savedModelRevision = 0;             // control side, what the config last captured
+static std::atomic<uint32_t> motionFirstGramCount(0); // sum of the dispensers' first-gram counts
+static std::atomic<uint32_t> motionFirstGramMs(0);  // millis() of the latest first gram
+static uint32_t seenFirstGramCount = 0;             // control side
+static uint32_t motionPostedSeq = 0;                // control side only
+
+static bool onMotion(TaskMailbox::Work work) {
+    uint32_t seq = motionMailbox.post(work);
+    if (seq == 0) {
+        LOG_EVENT(LOG_QUEUE_DROP, "Motion");
+        return false;
+    }
+    motionPostedSeq = seq;
+    return true;
+}
+
+// Published by the UI step once per iteration
+static std::atomic<uint32_t> uiActiveAnimations(0);
+static std::atomic<uint32_t> uiAppliedSeq(0);
+static uint32_t uiPostedSeq = 0;                    // control side only
+
+static void onUi(TaskMailbox::Work work) {
+    uint32_t seq = uiMailbox.post(work);
+    if (seq == 0) {
+        LOG_EVENT(LOG_QUEUE_DROP, "UI");
+        return;
+    }
+    uiPostedSeq = seq;
+}
+
+// Whether an animation runs or a UI request is still queued
+static bool uiBusy() {
+    if ((int32_t)(uiAppliedSeq.load(std::memory_order_acquire) - uiPostedSeq) < 0) return true;
+    return uiActiveAnimations.load(std::memory_order_relaxed) > 0;
+}
+
+// Until the motion step has run our last request, report the actuator as busy
+static bool motionBusyBit(int bit) {
+    if ((int32_t)(motionAppliedSeq.load(std::memory_order_acquire) - motionPostedSeq) < 0) return true;
+    return (motionBusyMask.load(std::memory_order_relaxed) >> bit) & 1;
+}
+
+static bool motionBusy(const Pump* pump) {
+    int index = ingredients.indexOf(pump);
+    return index >= 0 && motionBusyBit(index);
+}
+
+static bool motionBusy(const StepperPowderDispenser* dispenser) {
+    int index = ingredients.indexOf(dispenser);
+    return index >= 0 && motionBusyBit(MOTION_DISPENSER_BIT + index);
+}
+
+// Motion side helpers
+static void disableDispensers() {
+    for (int i = 0; i < ingredients.getDispenserCount(); i++) ingredients.getDispenser(i)->disable();
+}
+
+// Drivers off now, without the keep-awake window
+static void sleepDispensers() {
+    for (int i = 0; i < ingredients.getDispenserCount(); i++) ingredients.getDispenser(i)->sleep();
+}
+
+static void disableAllIngredients() {
+    for (int i = 0; i < ingredients.getPumpCount(); i++) ingredients.getPump(i)->disable();
+    disableDispensers();
+}
+
+// Changes whenever any calibration model took a sample or was reset
+static uint32_t calibrationModelRevision() {
+    uint32_t revision = 0;
+    for (int i = 0; i < ingredients.getPumpCount(); i++) {
+        revision += ingredients.getPump(i)->getCalibrationModel().getRevision();
+    }
+    for (int i = 0; i < ingredients.getDispenserCount(); i++) {
+        revision += ingredients.getDispenser(i)->getCalibrationModel().getRevision();
+    }
+    return revision;
+}
+
+// ——— Idle time ———
+// Priming pulses and pre-staging, decided on the control side from the motion snapshot
+IdleScheduler idleScheduler;
+static int primingLine = -1;                        // control side, the pump slot a priming pulse runs on
+
+// Nothing but a priming pulse running; the governor does not count it as activity
+static bool onlyPriming() {
+    if (primingLine < 0 || state != NOT_PREPARING) return false;
+    return (motionBusyMask.load(std::memory_order_relaxed) & ~(1UL << primingLine)) == 0;
+}
+
+// Governor transitions: park the stepper drivers below POWER_ACTIVE, the platform does the rest
+static void onPowerState(int newState) {
+    powerState.store(newState, std::memory_order_relaxed);
+
+    if (newState != POWER_ACTIVE) {
+        onMotion(sleepDispensers);
+    }
+
+    hal::printf("Power state: %s\n", PowerGovernor::stateName(newState));
+    if (powerHandler != nullptr) powerHandler(newState);
+}
+
+ConfigStore configStore;
+static MachineConfig defaultConfig; // Compiled-in values, used by configReset
+
+// Set once the stored ingredient table was edited; the edit applies at the next boot.
+// Saves only ever update the records of the live ingredients, matched by alias.
+static std::atomic<bool> ingredientTableEdited(false);
+
+static PumpConfig* findPumpRecord(MachineConfig& cfg, char alias) {
+    for (int i = 0; i < cfg.pump_count && i < CONFIG_MAX_PUMPS; i++) {
+        if (cfg.pumps[i].alias == alias) return &cfg.pumps[i];
+    }
+    return nullptr;
+}
+
+static DispenserConfig* findDispenserRecord(MachineConfig& cfg, char alias) {
+    for (int i = 0; i < cfg.dispenser_count && i < CONFIG_MAX_DISPENSERS; i++) {
+        if (cfg.dispensers[i].alias == alias) return &cfg.dispensers[i];
+    }
+    return nullptr;
+}
+
+// Tunables of the live ingredients into their records, matched by alias
+void captureConfig(MachineConfig& cfg) {
+    for (int i = 0; i < ingredients.getPumpCount(); i++) {
+        PumpConfig* pc = findPumpRecord(cfg, ingredients.getPumpAlias(i));
+        if (pc == nullptr) continue;
+
+        pc->mL_per_second = ingredients.getPump(i)->getCalibration();
+        pc->negated_logic = ingredients.getPump(i)->isNegatedLogic();
+        pc->model = ingredients.getPump(i)->getCalibrationModel().getState();
+        FlowMeter* meter = ingredients.getPump(i)->getFlowMeter();
+        if (meter != nullptr) pc->flow_pulses_per_mL = meter->getPulsesPerMl();
+    }
+
+    for (int i = 0; i < ingredients.getDispenserCount(); i++) {
+        DispenserConfig* dc = findDispenserRecord(cfg, ingredients.getDispenserAlias(i));
+        if (dc == nullptr) continue;
+
+        StepperPowderDispenser* d = ingredients.getDispenser(i);
+        dc->steps_per_gram = d->getStepsPerGram();
+        dc->step_interval = d->getStepInterval();
+        dc->pulse_duration = d->getPulseDuration();
+        dc->steps_per_revolution = d->getStepsPerRevolution();
+        dc->vibration_step_interval = d->getVibrationStepInterval();
+        dc->vibration_pulse_duration = d->getVibrationPulseDuration();
+        dc->steps_per_vibration = d->getStepsPerVibration();
+        dc->dispense_is_CW = d->isDispenseCW();
+
+        dc->vibration_policy = vibrationPolicyIndex(d->getVibrationPolicy());
+        dc->fine_microsteps = d->getFineMicrosteps();
+        dc->fine_grams = d->getFineGrams();
+        dc->model = d->getCalibrationModel().getState();
+        dc->keep_awake_ms = d->getKeepAwakeMs();
+        dc->max_awake_duty = d->getMaxAwakeDuty();
+
+        HumidityCurve& curve = d->getHumidityCurve();
+        dc->humidity_compensation = d->isHumidityCompensated();
+        dc->humidity_sample_count = curve.getSampleCount();
+        for (int s = 0; s < HUMIDITY_CURVE_MAX_SAMPLES; s++) {
+            bool used = s < curve.getSampleCount();
+            dc->humidity_rh[s] = used ? curve.getSample(s).relative_humidity : 0.0f;
+            dc->humidity_steps_per_gram[s] = used ? curve.getSample(s).steps_per_gram : 0.0f;
+        }
+    }
+}
+
+// Tunables of the records onto the live ingredients; pins and names only change at boot
+void applyConfig(const MachineConfig& cfg) {
+    MachineConfig& records = const_cast<MachineConfig&>(cfg);
+
+    for (int i = 0; i < ingredients.getPumpCount(); i++) {
+        const PumpConfig* pc = findPumpRecord(records, ingredients.getPumpAlias(i));
+        if (pc == nullptr) continue;
+
+        // The stored model, if there is one, takes over from the prior set_calibration() starts
+        ingredients.getPump(i)->set_calibration(pc->mL_per_second);
+        ingredients.getPump(i)->setCalibrationModel(pc->model);
+        ingredients.getPump(i)->setNegatedLogic(pc->negated_logic);
+        FlowMeter* meter = ingredients.getPump(i)->getFlowMeter();
+        if (meter != nullptr) meter->setPulsesPerMl(pc->flow_pulses_per_mL);
+    }
+
+    for (int i = 0; i < ingredients.getDispenserCount(); i++) {
+        const DispenserConfig* dc = findDispenserRecord(records, ingredients.getDispenserAlias(i));
+        if (dc == nullptr) continue;
+
+        StepperPowderDispenser* d = ingredients.getDispenser(i);
+        d->setStepsPerGram(dc->steps_per_gram);
+        d->setCalibrationModel(dc->model);
+        d->setStepTiming(dc->step_interval, dc->pulse_duration);
+        d->setVibrationTiming(dc->vibration_step_interval, dc->vibration_pulse_duration, dc->steps_per_vibration);
+        d->setFineDispense(dc->fine_microsteps > 1 ? dc->fine_microsteps : 1, dc->fine_grams);
+        d->setPowerPolicy(dc->keep_awake_ms, dc->max_awake_duty);
+
+        HumidityCurve& curve = d->getHumidityCurve();
+        curve.clear();
+        for (int s = 0; s < dc->humidity_sample_count && s < HUMIDITY_CURVE_MAX_SAMPLES; s++) {
+            curve.addSample(dc->humidity_rh[s], dc->humidity_steps_per_gram[s]);
+        }
+        d->setHumidityCompensation(dc->humidity_compensation);
+
+        if (dc->vibration_policy < NUM_VIBRATION_POLICIES) {
+            d->setVibrationPolicy(vibrationPolicies[dc->vibration_policy]);
+        }
+    }
+}
+
+static bool validIngredientAlias(const String& alias) {
+    return alias.length() == 1 && alias[0] > ' ' && static_cast<uint8_t>(alias[0]) < INGREDIENT_ALIAS_RANGE;
+}
+
+static bool validIngredientPin(int pin) {
+    return pin >= 0 && pin <= INGREDIENT_MAX_GPIO;
+}
+
+// Compiled-in ingredient table as a config blob
+static void buildDefaultConfig(MachineConfig& cfg) {
+    memset(&cfg, 0, sizeof(cfg));
+
+    cfg.pump_count = NUM_DEFAULT_PUMPS;
+    for (size_t i = 0; i < NUM_DEFAULT_PUMPS; i++) {
+        cfg.pumps[i] = defaultPumps[i];
+        cfg.pumps[i].prime_mL = IDLE_PRIME_DEFAULT_ML;
+    }
+
+    cfg.dispenser_count = NUM_DEFAULT_DISPENSERS;
+    for (size_t i = 0; i < NUM_DEFAULT_DISPENSERS; i++) {
+        cfg.dispensers[i] = defaultDispensers[i];
+        cfg.dispensers[i].keep_awake_ms = STEPPER_DEFAULT_KEEP_AWAKE_MS;
+        cfg.dispensers[i].max_awake_duty = STEPPER_DEFAULT_MAX_AWAKE_DUTY;
+    }
+
+    // No idle priming until idleSetPriming
+    cfg.idle_prime_after_ms = 0;
+    cfg.idle_settle_after_ms = IDLE_SETTLE_AFTER_MS;
+    cfg.idle_prestage = 1;
+}
+
+// Idle settings of the records onto the scheduler, control side; lines matched by alias
+static void applyIdleConfig(const MachineConfig& cfg) {
+    MachineConfig& records = const_cast<MachineConfig&>(cfg);
+
+    idleScheduler.setPrimeAfter(cfg.idle_prime_after_ms);
+    idleScheduler.setPrestage(cfg.idle_prestage != 0, cfg.idle_settle_after_ms);
+    for (int i = 0; i < ingredients.getPumpCount(); i++) {
+        const PumpConfig* pc = findPumpRecord(records, ingredients.getPumpAlias(i));
+        idleScheduler.setPrimeVolume(i, pc != nullptr ? pc->prime_mL : 0.0f);
+    }
+}
+
+// ——— Config capture ———
+// The live tunables, calibration models included, belong to the motion step, so
+// it takes the snapshot: control copies the records into captureBuffer, motion
+// fills in the tunables, and control takes the buffer back once the motion step
+// has run the request. An edit of the records meanwhile starts the capture over.
+static MachineConfig captureBuffer;                 // motion side while a capture is pending
+static bool captureWanted = false;                  // control side
+static bool capturePending = false;                 // control side
+static bool captureFlush = false;                   // control side, write through once captured
+static uint32_t captureSeq = 0;                     // control side, mailbox sequence of the pending capture
+static uint32_t configEditSeq = 0;                  // control side, bumped by every direct edit of the records
+static uint32_t captureEditSeq = 0;                 // control side, configEditSeq the buffer was copied at
+
+// Control side: the records, for an edit a pending capture must not overwrite
+static MachineConfig& editConfig() {
+    configEditSeq++;
+    if (capturePending) captureWanted = true;
+    return configStore.config();
+}
+
+// Control side: nothing captured so far gets stored, for a reset to the defaults
+static void cancelConfigCapture() {
+    configEditSeq++;
+    captureWanted = false;
+    captureFlush = false;
+}
+
+// Snapshots the live values; the write itself is coalesced by configStore.update()
+void saveConfigLater() {
+    captureWanted = true;
+}
+
+// Snapshots the live values and writes them right away
+static void saveConfigNow() {
+    captureWanted = true;
+    captureFlush = true;
+}
+
+static void updateConfigCapture() {
+    if (capturePending) {
+        if ((int32_t)(motionAppliedSeq.load(std::memory_order_acquire) - captureSeq) < 0) return;
+        capturePending = false;
+
+        // Superseded by an edit or a later request, which takes it again below
+        if (!captureWanted && captureEditSeq == configEditSeq) {
+            configStore.config() = captureBuffer;
+            if (!captureFlush) {
+                configStore.markDirty(hal::millis());
+            } else if (configStore.flush()) {
+                hal::println("Config saved");
+            }
+            captureFlush = false;
+        }
+    }
+    if (!captureWanted) return;
+
+    captureBuffer = configStore.config();
+    captureEditSeq = configEditSeq;
+    if (!onMotion([] { captureConfig(captureBuffer); })) return; // Mailbox full, again next iteration
+
+    captureWanted = false;
+    capturePending = true;
+    captureSeq = motionPostedSeq;
+}
+
+void initConfig() {
+    buildDefaultConfig(defaultConfig);
+
+    if (configStore.begin()) {
+        ingredients.build(configStore.config());
+        applyConfig(configStore.config());
+        hal::println("Config loaded from NVS");
+    } else {
+        ingredients.build(defaultConfig);
+        configStore.config() = defaultConfig;
+        configStore.flush();
+        hal::println("No valid config in NVS, stored defaults");
+    }
+
+    idleScheduler.begin(ingredients.getPumpCount(), ingredients.getDispenserCount(), hal::millis());
+    applyIdleConfig(configStore.config());
+
+    savedModelRevision = calibrationModelRevision();
+    motionModelRevision.store(savedModelRevision, std::memory_order_relaxed);
+
+    hal::printf("%d pumps, %d dispensers\n", ingredients.getPumpCount(), ingredients.getDispenserCount());
+}
+
+// Pump commands
+void onCommandPumpFluid(Pump* pump, float milliliters) {
+    if (milliliters <= 0.0f) {
+        hal::println("Error: duration must be > 0");
+        return;
+    }
+
+    hal::printf(
+        "Pumping %.2f mL of %s\n",
+        milliliters,
+        pump->getFluidName().c_str()
+    );
+
+    onMotion([pump, milliliters] {
+        pump->enable();
+        pump->dispense(milliliters);
+    });
+}
+
+void onCommandFluidSpin(Pump* pump, float milliseconds) {
+    if (milliseconds <= 0.0f) {
+        hal::println("Error: duration must be > 0");
+        return;
+    }
+
+    hal::printf(
+        "Dispensing %s over %.2f ms\n",
+        pump->getFluidName().c_str(),
+        milliseconds
+    );
+
+    onMotion([pump, milliseconds] {
+        pump->enable();
+        pump->spin(milliseconds);
+    });
+}
+
+// Powder dispenser commands
+void onCommandDispenserSpin(StepperPowderDispenser* dispenser, int steps) {
+    if (steps <= 0) {
+        hal::println("Error: steps must be > 0");
+        return;
+    }
+
+    hal::printf("Spinning %s for %d steps\n", dispenser->getPowderName().c_str(), steps);
+    
+    onMotion([dispenser, steps] {
+        dispenser->enable();
+        dispenser->spin(steps);
+    });
+}
+
+void onCommandDispensePowder(StepperPowderDispenser* dispenser, float grams) {
+    if (grams <= 0.0f) {
+        hal::println("Error: grams must be > 0");
+        return;
+    }
+
+    hal::printf("Dispensing %.2f grams of %s\n", grams, dispenser->getPowderName().c_str());
+    
+    onMotion([dispenser, grams] {
+        dispenser->enable();
+        dispenser->dispense(grams);
+    });
+}
+
+// ——— Humidity cache ———
+#define HUMIDITY_REFRESH_MS 60000UL // Re-read the DHT11 this often while idle
+
+static float cachedHumidity = NAN;
+static unsigned long lastHumidityReadMs = 0;
+static bool humidityReadAttempted = false;
+static bool humidityPosted = true;                  // the dispensers have cachedHumidity
+
+// Hands the cached humidity to the powder dispensers for compensation
+static void postHumidity() {
+    float humidity = cachedHumidity;
+    humidityPosted = onMotion([humidity] {
+        for (int i = 0; i < ingredients.getDispenserCount(); i++) {
+            ingredients.getDispenser(i)->setAmbientHumidity(humidity);
+        }
+    });
+}
+
+// Stores the latest humidity; the dispensers get it through the motion mailbox
+void setCachedHumidity(float humidity) {
+    cachedHumidity = humidity;
+    lastHumidityReadMs = hal::millis();
+    postHumidity();
+}
+
+// Single DHT read, only between orders so it never stalls a dispense
+void updateHumidityCache() {
+    if (!humidityPosted) postHumidity();
+    if (state != NOT_PREPARING) return;
+    if (humidityReadAttempted && hal::millis() - lastHumidityReadMs < HUMIDITY_REFRESH_MS) return;
+
+    humidityReadAttempted = true;
+    float humidity = readHumiditySensor();
+    if (isnan(humidity)) {
+        lastHumidityReadMs = hal::millis(); // Don't retry on every loop
+        return;
+    }
+
+    setCachedHumidity(humidity);
+}
+
+void onCommandReadHumidity() {
+    float averageHumidity = 0.0f;
+
+    // Make 10 readings to get an average
+    for (int i = 0; i < 10; i++) {
+        float humidity = readHumiditySensor();
+        if (isnan(humidity)) {
+            hal::println("Error reading humidity!");
+            return;
+        }
+        averageHumidity += humidity;
+        hal::delayMs(100); // wait a bit between readings
+    }
+    
+    averageHumidity /= 10.0f;
+    setCachedHumidity(averageHumidity);
+    hal::printf("Average Humidity: %.2f%%\n", averageHumidity);
+    // Send average humidity data over WebSocket
+    String humidityData = String(averageHumidity);
+    broadcast(TOPIC_HUMIDITY, humidityData);
+}
+
+// Order to prepare variables
+static StepperPowderDispenser* orderDispenser = nullptr; 
+static float orderGrams = 0.0f;
+static Pump* orderPump = nullptr;
+static float orderMilliliters = 0.0f;
+static float orderTumericMl = 0.0f;
+
+// Receives the dispenser, the amount in grams, the pump, the amount in mL, and ammount of tumeric in grams
+void onCommandPrepareDrink(StepperPowderDispenser* dispenser, float grams, Pump* pump, float milliliters, float tumericMl) {
+    if (grams <= 0.0f || milliliters <= 0.0f) {
+        hal::println("Error: grams and ml amounts must be > 0");
+        return;
+    }
+
+    hal::printf("Preparing drink with %.2f grams of %s, %.2f mL of %s, and %.2f grams of Tumeric\n",
+        grams, dispenser->getPowderName().c_str(),
+        milliliters, pump->getFluidName().c_str(),
+        tumericMl
+    );
+
+    idleScheduler.noteOrder(ingredients.indexOf(dispenser));
+
+    // Start the preparation process
+    setState(START_ORDER);
+    // Set lastOrderVariables
+    orderDispenser = dispenser;
+    orderGrams = grams;
+    orderPump = pump;
+    orderMilliliters = milliliters;
+    orderTumericMl = tumericMl;
+    hal::println("Drink preparation started");
+}
+
+void onCommandOrderMetrics() {
+    broadcast(TOPIC_TELEMETRY, orderMetrics.toJson(hal::millis(), stageNames));
+}
+
+// ——— Reports ———
+// The ones below read pump and dispenser state, so they run on the motion side
+// (posted with onMotion) and broadcast from there.
+
+// store: the store's own fields, taken on the control side
+void onCommandConfigShow(const String& store) {
+    String out = "{\"config\":{\"pumps\":[";
+    for (int i = 0; i < ingredients.getPumpCount(); i++) {
+        Pump* pump = ingredients.getPump(i);
+        if (i > 0) out += ',';
+        out += "{\"alias\":\"" + String(ingredients.getPumpAlias(i)) + "\",\"name\":\"" + pump->getFluidName();
+        out += "\",\"mL_per_second\":";
+        out += String(pump->getCalibration(), 4);
+        out += ",\"negated_logic\":";
+        out += pump->isNegatedLogic() ? "true" : "false";
+        if (pump->getFlowMeter() != nullptr) {
+            out += ",\"flow_pin\":";
+            out += pump->getFlowMeter()->getPin();
+            out += ",\"flow_pulses_per_mL\":";
+            out += String(pump->getFlowMeter()->getPulsesPerMl(), 3);
+        }
+        out += '}';
+    }
+
+    out += "],\"dispensers\":[";
+    for (int i = 0; i < ingredients.getDispenserCount(); i++) {
+        StepperPowderDispenser* d = ingredients.getDispenser(i);
+        if (i > 0) out += ',';
+        out += "{\"alias\":\"" + String(ingredients.getDispenserAlias(i)) + "\",\"name\":\"" + d->getPowderName();
+        out += "\",\"steps_per_gram\":";
+        out += String(d->getStepsPerGram(), 4);
+        out += ",\"step_interval\":";
+        out += d->getStepInterval();
+        out += ",\"pulse_duration\":";
+        out += d->getPulseDuration();
+        out += ",\"steps_per_vibration\":";
+        out += d->getStepsPerVibration();
+        out += ",\"grams_per_revolution\":";
+        out += String(d->getGramsPerRevolution(), 4);
+        out += ",\"fine_microsteps\":";
+        out += d->getFineMicrosteps();
+        out += ",\"fine_grams\":";
+        out += String(d->getFineGrams(), 3);
+        out += '}';
+    }
+
+    out += "],";
+    out += store;
+    out += "}}";
+
+    broadcast(TOPIC_TELEMETRY, out);
+}
+
+void onCommandHumidityCurve(StepperPowderDispenser* dispenser) {
+    HumidityCurve& curve = dispenser->getHumidityCurve();
+
+    String out = "{\"humidityCurve\":\"" + dispenser->getPowderName() + "\",\"enabled\":";
+    out += dispenser->isHumidityCompensated() ? "true" : "false";
+    out += ",\"humidity\":";
+    float humidity = dispenser->getAmbientHumidity();
+    out += isnan(humidity) ? String("null") : String(humidity, 1);
+    out += ",\"steps_per_gram\":";
+    out += String(dispenser->getStepsPerGram(), 4);
+    out += ",\"effective_steps_per_gram\":";
+    out += String(dispenser->getEffectiveStepsPerGram(), 4);
+    out += ",\"slope\":";
+    out += String(curve.getSlope(), 4);
+    out += ",\"intercept\":";
+    out += String(curve.getIntercept(), 4);
+    out += ",\"samples\":[";
+    for (int i = 0; i < curve.getSampleCount(); i++) {
+        if (i > 0) out += ',';
+        out += '[';
+        out += String(curve.getSample(i).relative_humidity, 1);
+        out += ',';
+        out += String(curve.getSample(i).steps_per_gram, 4);
+        out += ']';
+    }
+    out += "]}";
+
+    broadcast(TOPIC_TELEMETRY, out);
+}
+
+void onCommandVibrationStats(StepperPowderDispenser* dispenser) {
+    String out = "{\"vibrationStats\":\"" + dispenser->getPowderName() + "\",\"policy\":\"";
+    out += dispenser->getVibrationPolicy()->getName();
+    out += "\",\"vibrations\":";
+    out += dispenser->getVibrationCount();
+    out += ",\"vibration_ms\":";
+    out += (unsigned long)(dispenser->getVibrationTimeUs() / 1000ULL);
+    out += ",\"grams\":";
+    out += String(dispenser->getGramsDispensed(), 2);
+    out += ",\"vibration_ms_per_gram\":";
+    out += String(dispenser->getVibrationMsPerGram(), 1);
+    out += '}';
+
+    broadcast(TOPIC_TELEMETRY, out);
+}
+
+void onCommandDispenserPowerStats(StepperPowderDispenser* dispenser) {
+    String out = "{\"powerStats\":\"" + dispenser->getPowderName() + "\",\"awake\":";
+    out += dispenser->isAwake() ? "true" : "false";
+    out += ",\"keep_awake_ms\":";
+    out += dispenser->getKeepAwakeMs();
+    out += ",\"awake_duty\":";
+    out += String(dispenser->getAwakeDuty(), 3);
+    out += ",\"max_awake_duty\":";
+    out += String(dispenser->getMaxAwakeDuty(), 2);
+    out += ",\"wakes\":";
+    out += dispenser->getWakeCount();
+    out += ",\"warm_starts\":";
+    out += dispenser->getWarmStartCount();
+    out += ",\"thermal_sleeps\":";
+    out += dispenser->getThermalSleepCount();
+    out += ",\"first_step_us\":{\"last\":";
+    out += dispenser->getLastWakeLatencyUs();
+    out += ",\"mean\":";
+    out += dispenser->getMeanWakeLatencyUs();
+    out += ",\"max\":";
+    out += dispenser->getMaxWakeLatencyUs();
+    out += "}}";
+
+    broadcast(TOPIC_TELEMETRY, out);
+}
+
+void onCommandFlowStats(Pump* pump) {
+    FlowMeter* meter = pump->getFlowMeter();
+    String out = "{\"flowStats\":\"" + pump->getFluidName() + "\",\"metered\":";
+    out += meter != nullptr ? "true" : "false";
+    if (meter != nullptr) {
+        out += ",\"pin\":";
+        out += meter->getPin();
+        out += ",\"pulses_per_mL\":";
+        out += String(meter->getPulsesPerMl(), 3);
+        out += ",\"pulses\":";
+        out += (unsigned long)meter->getLastCount();
+    }
+    out += ",\"last_mL\":";
+    out += String(pump->getLastDispensedMl(), 1);
+    out += ",\"overrun_mL\":";
+    out += String(pump->getFlowOverrunMl(), 2);
+    out += ",\"timeouts\":";
+    out += pump->getFlowTimeoutCount();
+    out += ",\"faults\":";
+    out += pump->getFlowFaultCount();
+    out += '}';
+
+    broadcast(TOPIC_TELEMETRY, out);
+}
+
+// Gain in measured units per commanded unit: mL per second, grams per step
+void onCommandCalibrationModel(const String& name, const CalibrationEstimator& model, bool applied) {
+    String out = "{\"calibrationModel\":\"" + name + "\",\"applied\":";
+    out += applied ? "true" : "false";
+    out += ",\"gain\":";
+    out += String(model.getGain(), 6);
+    out += ",\"gain_std\":";
+    out += String(model.getGainStd(), 6);
+    out += ",\"offset\":";
+    out += String(model.getOffset(), 3);
+    out += ",\"offset_std\":";
+    out += String(model.getOffsetStd(), 3);
+    out += ",\"noise_std\":";
+    out += String(model.getNoiseStd(), 3);
+    out += ",\"samples\":";
+    out += model.getSampleCount();
+    out += ",\"outliers\":";
+    out += model.getOutlierCount();
+    out += '}';
+
+    broadcast(TOPIC_TELEMETRY, out);
+}
+
+void onCommandSetRGB(const String& args) {
+    auto parts = splitArgs(args);
+    if (parts.size() < 3) {
+        hal::println("Usage: setRGB(red,green,blue)");
+        return;
+    }
+
+    int red = parts[0].toInt();
+    int green = parts[1].toInt();
+    int blue = parts[2].toInt();
+
+    // Clamp values to 0-255
+    red = constrain(red, 0, 255);
+    green = constrain(green, 0, 255);
+    blue = constrain(blue, 0, 255);
+
+    fill_solid(leds, NUM_LEDS, CRGB(red, green, blue));
+    FastLED.setBrightness(255); // Set brightness to maximum
+    
+    leds[0] = CRGB::Black;
+
+    strip.show();
+    hal::printf("Set RGB to (%d,%d,%d)\n", red, green, blue);
+}
+
+void onCommandSymetric(const String& args) {
+    auto parts = splitArgs(args);
+    if (parts.size() < 6) {
+        hal::println("Usage: symetric(startIndex,endIndex,r,g,b,animationDurationMs)");
+        return;
+    }
+
+    int startIndex = parts[0].toInt();
+    int endIndex = parts[1].toInt();
+    CRGB color = CRGB(
+        parts[2].toInt(), // Red
+        parts[3].toInt(), // Green
+        parts[4].toInt()  // Blue
+    );
+    float durationMs = parts[5].toFloat();
+
+    if (startIndex < 0 || endIndex >= NUM_LEDS || startIndex > endIndex) {
+        hal::println("Error: Invalid indices for symetric animation");
+        return;
+    }
+
+    // SymmetricFillAnim* cmdSymAnim = new SymmetricFillAnim(
+    //     startIndex,
+    //     endIndex,
+    //     color,
+    //     durationMs,
+    //     60 // FPS
+    // );
+
+    RadiatingSymmetricPulseAnim* cmdSymAnim = new RadiatingSymmetricPulseAnim(
+        startIndex,
+        endIndex,
+        true,
+        3,
+        color,
+        durationMs,
+        60 // FPS
+    );
+
+    strip.addAnimation(cmdSymAnim);
+}
+
+// The tablet is setting up an order: wake the powder it will most likely ask
+// for and, if its column settled, loosen it, so prepare starts on a warm driver.
+// Later steps of the same order only renew the keep-awake window.
+static void prestageNextOrder() {
+    unsigned long now = hal::millis();
+    bool opening = !idleScheduler.isOrderPending(now);
+    idleScheduler.orderPending(now);
+    if (!idleScheduler.isPrestageEnabled() || machineIsBusy()) return;
+
+    int index = idleScheduler.predictPowder();
+    if (index < 0 || index >= ingredients.getDispenserCount()) return;
+    StepperPowderDispenser* dispenser = ingredients.getDispenser(index);
+
+    if (!opening) {
+        onMotion([dispenser] { dispenser->wake(); });
+        return;
+    }
+
+    bool agitate = idleScheduler.isSettled(index, now);
+    idleScheduler.notePrestage(index, agitate, now);
+    LOG_EVENT(LOG_IDLE_PRESTAGE, dispenser->getPowderName(), agitate ? 1 : 0);
+    onMotion([dispenser, agitate] {
+        dispenser->enable();
+        if (agitate) dispenser->vibrate(IDLE_PRESTAGE_CYCLES);
+        dispenser->disable(); // Holds for the keep-awake window
+    });
+}
+
+// A line that is due gets a short pulse into the drip tray, one at a time
+static void updateIdleWork() {
+    unsigned long now = hal::millis();
+    uint32_t mask = motionBusyMask.load(std::memory_order_relaxed);
+    idleScheduler.noteActivity(mask & ((1UL << MOTION_DISPENSER_BIT) - 1), mask >> MOTION_DISPENSER_BIT, now);
+
+    if (primingLine >= 0) {
+        if (motionBusy(ingredients.getPump(primingLine))) return;
+        primingLine = -1;
+    }
+
+    int line = idleScheduler.nextPrime(!machineIsBusy() && !uiBusy(), now);
+    if (line < 0) return;
+
+    Pump* pump = ingredients.getPump(line);
+    float milliliters = idleScheduler.getPrimeVolume(line);
+    float rate = pump->getCalibration();
+    int milliseconds = rate > 0.0f ? static_cast<int>(milliliters / rate * 1000.0f) : 0;
+    if (milliseconds <= 0) return;
+
+    if (!onMotion([pump, milliseconds] {
+        pump->enable();
+        pump->spin(milliseconds);
+    })) return;
+
+    LOG_EVENT(LOG_IDLE_PRIME, pump->getFluidName(), milliseconds, milliliters);
+    primingLine = line;
+}
+
+// Handles of the perpetual order animations; stale handles are harmless
+static AnimatedStrip::Handle tabletPulse = AnimatedStrip::NO_ANIMATION;
+static AnimatedStrip::Handle bottlePulse = AnimatedStrip::NO_ANIMATION;
+static AnimatedStrip::Handle preparingPulse = AnimatedStrip::NO_ANIMATION;
+
+void onCommandOrderDetails() {
+    strip.finish(tabletPulse);
+
+    RadiatingSymmetricPulseAnim* tabletPulseAnim = new RadiatingSymmetricPulseAnim(
+        ledZones.get(ZONE_TABLET),
+        true,
+        0,
+        TABLET_INTERACT_YELLOW,
+        300,
+        60 // FPS
+    );
+
+    tabletPulse = strip.addAnimation(tabletPulseAnim);
+
+    hal::println("Waiting for user to check their order");
+}
+
+void onCommandOrderCanceled() {
+    // Stop the tablet animation
+    strip.finish(tabletPulse);
+
+    SymmetricFillAnim *fixTablet = new SymmetricFillAnim(
+        ledZones.get(ZONE_TABLET_AREA),
+        DIM_BOOSTUP_PURPLE, // Color
+        500, // Duration in milliseconds
+        60 // FPS
+    );
+
+    SymmetricFillAnim *fixBottle = new SymmetricFillAnim(
+        ledZones.get(ZONE_BOTTLE_AREA),
+        DIM_BOOSTUP_PURPLE, // Color
+        500, // Duration in milliseconds
+        60 // FPS
+    );
+
+    strip.finish(bottlePulse);
+    
+    strip.addAnimation(fixTablet);
+    strip.addAnimation(fixBottle);
+
+    hal::println("Order cancelled, returning to idle state");
+}
+
+void onCommandOrderAskForBottle() {
+    // Stop the tablet animation
+    strip.finish(tabletPulse);
+
+    strip.finish(bottlePulse);
+
+    RadiatingSymmetricPulseAnim* bottlePulseAnim = new RadiatingSymmetricPulseAnim(
+        ledZones.get(ZONE_BOTTLE),
+        true,
+        0,
+        INSERT_BOTTLE_YELLOW,
+        300,
+        60 // FPS
+    );
+
+
+    SymmetricFillAnim *fixTablet = new SymmetricFillAnim(
+        ledZones.get(ZONE_TABLET_AREA),
+        DIM_BOOSTUP_PURPLE, // Color
+        500, // Duration in milliseconds
+        60 // FPS
+    );
+
+    strip.addAnimation(fixTablet);
+
+    bottlePulse = strip.addAnimation(bottlePulseAnim);
+    hal::println("Asking user to insert bottle");
+}
+
+void onCommandProgressBar() {
+    strip.finish(bottlePulse);
+
+    strip.finish(preparingPulse);
+
+    RadiatingSymmetricPulseAnim* preparingPulseAnim = new RadiatingSymmetricPulseAnim(
+        ledZones.get(ZONE_BOTTLE),
+        true,
+        0,
+        PROGRESS_BLUE,
+        1000,
+        60, // FPS,
+        60
+    );
+
+    SymmetricFillAnim *fixBottle = new SymmetricFillAnim(
+        ledZones.get(ZONE_BOTTLE_AREA),
+        DIM_BOOSTUP_PURPLE, // Color
+        500, // Duration in milliseconds
+        60 // FPS
+    );
+    strip.addAnimation(fixBottle);
+
+    preparingPulse = strip.addAnimation(preparingPulseAnim);
+
+    hal::println("Order preparation animation started");
+}
+
+void onCommandOrderFinish() {
+    strip.finish(preparingPulse);
+
+    // Finish the order preparation animation
+
+    RadiatingSymmetricPulseAnim *takeBottle = new RadiatingSymmetricPulseAnim(
+        ledZones.get(ZONE_BOTTLE),
+        false,
+        5,
+        REMOVE_BOTTLE_GREEN,
+        300,
+        60 // FPS
+    );
+
+    SymmetricFillAnim *fixBottle = new SymmetricFillAnim(
+        ledZones.get(ZONE_BOTTLE_AREA),
+        DIM_BOOSTUP_PURPLE, // Color
+        500, // Duration in milliseconds
+        60 // FPS
+    );
+
+    fixBottle->start_delay_ms = 6000; // Wait 3 seconds before starting the fix animation
+
+    strip.addAnimation(takeBottle);
+    
+    strip.addAnimation(fixBottle);
+    
+    hal::println("Order preparation finished");
+}
+
+// Initialize commands and their handlers
+void initCommands() {
+    powerGovernor.setHandler(onPowerState);
+
+    commandMap["rgb"] = [](const String& args){
+        onUi([args] { onCommandSetRGB(args); });
+    };
+
+    commandMap["symetric"] = [](const String& args){
+        onUi([args] { onCommandSymetric(args); });
+    };
+
+    commandMap["zoneFill"] = [](const String& args){
+        auto parts = splitArgs(args);
+        if (parts.size() < 5) {
+            hal::println("Usage: zoneFill(zone,r,g,b,animationDurationMs)");
+            return;
+        }
+
+        const LedZone* zone = ledZones.find(parts[0]);
+        if (zone == nullptr) {
+            hal::println("Error: unknown zone " + parts[0]);
+            return;
+        }
+
+        CRGB color = CRGB(parts[1].toInt(), parts[2].toInt(), parts[3].toInt());
+        float durationMs = parts[4].toFloat();
+        onUi([zone, color, durationMs] {
+            strip.addAnimation(new SymmetricFillAnim(*zone, color, durationMs, 60));
+        });
+    };
+
+    commandMap["zonePulse"] = [](const String& args){
+        auto parts = splitArgs(args);
+        if (parts.size() < 6) {
+            hal::println("Usage: zonePulse(zone,r,g,b,pulseDurationMs,loops), 0 loops until zoneFinish");
+            return;
+        }
+
+        const LedZone* zone = ledZones.find(parts[0]);
+        if (zone == nullptr) {
+            hal::println("Error: unknown zone " + parts[0]);
+            return;
+        }
+
+        CRGB color = CRGB(parts[1].toInt(), parts[2].toInt(), parts[3].toInt());
+        float durationMs = parts[4].toFloat();
+        int loops = parts[5].toInt();
+        onUi([zone, color, durationMs, loops] {
+            strip.addAnimation(new RadiatingSymmetricPulseAnim(*zone, true, loops, color, durationMs, 60));
+        });
+    };
+
+    commandMap["zoneFinish"] = [](const String& args){
+        auto parts = splitArgs(args);
+        const LedZone* zone = parts.empty() ? nullptr : ledZones.find(parts[0]);
+        if (zone == nullptr) {
+            hal::println("Usage: zoneFinish(zone) with a known zone");
+            return;
+        }
+
+        onUi([zone] {
+            int count = strip.finishRegion(zone->first, zone->last);
+            hal::printf("Finished %d animations on zone %s\n", count, zone->name.c_str());
+        });
+    };
+
+    commandMap["stripFinishRegion"] = [](const String& args){
+        auto parts = splitArgs(args);
+        if (parts.size() < 2) {
+            hal::println("Usage: stripFinishRegion(startIndex,endIndex)");
+            return;
+        }
+
+        int startIndex = parts[0].toInt();
+        int endIndex = parts[1].toInt();
+        onUi([startIndex, endIndex] {
+            int count = strip.finishRegion(startIndex, endIndex);
+            hal::printf("Finished %d animations on LEDs %d-%d\n", count, startIndex, endIndex);
+        });
+    };
+
+    // Animation commands
+    commandMap["orderDetails"] = [](const String& args){
+        onUi(onCommandOrderDetails);
+        prestageNextOrder();
+    };
+
+    commandMap["orderCanceled"] = [](const String& args){
+        onUi(onCommandOrderCanceled);
+        idleScheduler.orderClosed(hal::millis());
+    };
+
+    commandMap["orderAskForBottle"] = [](const String& args){
+        onUi(onCommandOrderAskForBottle);
+        prestageNextOrder();
+    };
+
+    commandMap["orderProgressBar"] = [](const String& args){
+        onUi(onCommandProgressBar);
+    };
+
+    commandMap["orderFinish"] = [](const String& args){
+        onUi(onCommandOrderFinish);
+    };
+
+    // Pump commands
+    commandMap["fluidPump"] = [](const String& args){
+        auto parts = splitArgs(args);
+
+        if (parts.size() < 2) {
+            hal::println("Usage: fluidPump(fluidAlias,milliliters)");
+            return;
+        }
+
+        String fluid = parts[0];
+        float milliliters = parts[1].toFloat();
+
+        Pump* pump = ingredients.pump(fluid);
+        
+        if (pump == nullptr) {
+            hal::println("Error: unknown fluid " + fluid);
+            return;
+        }
+
+        onCommandPumpFluid(pump, milliliters);
+    };
+
+    commandMap["fluidSpin"] = [](const String& args){
+        auto parts = splitArgs(args);
+
+        if (parts.size() < 2) {
+            hal::println("Usage: fluidSpin(fluidAlias,milliseconds)");
+            return;
+        }
+
+        String fluid = parts[0];
+        float milliseconds = parts[1].toFloat();
+
+        Pump* pump = ingredients.pump(fluid);
+        
+        if (pump == nullptr) {
+            hal::println("Error: unknown fluid " + fluid);
+            return;
+        }
+
+        onCommandFluidSpin(pump, milliseconds);
+    };
+
+    commandMap["pumpCalibrate"] = [](const String& args){
+        auto parts = splitArgs(args);
+
+        if (parts.size() < 3) {
+            hal::println("Usage: pumpCalibrate(fluidAlias,millisecondsRun,milliliters)");
+            return;
+        }
+
+        String fluid = parts[0];
+        int milliseconds = parts[1].toInt();
+        float milliliters = parts[2].toFloat();
+
+        Pump* pump = ingredients.pump(fluid);
+        
+        if (pump == nullptr) {
+            hal::println("Error: unknown fluid " + fluid);
+            return;
+        }
+
+        onMotion([pump, fluid, milliseconds, milliliters] {
+            pump->calibrate(milliseconds, milliliters);
+            hal::printf("Calibrated %s to %.4f mL/s\n", fluid.c_str(), pump->getCalibration());
+        });
+        saveConfigLater();
+    };
+
+    commandMap["pumpSetCalibration"] = [](const String& args){
+        auto parts = splitArgs(args);
+
+        if (parts.size() < 2) {
+            hal::println("Usage: pumpSetCalibration(fluidAlias,mLPerSecond)");
+            return;
+        }
+
+        String fluid = parts[0];
+        float mLPerSecond = parts[1].toFloat();
+
+        Pump* pump = ingredients.pump(fluid);
+        
+        if (pump == nullptr) {
+            hal::println("Error: unknown fluid " + fluid);
+            return;
+        }
+
+        onMotion([pump, fluid, mLPerSecond] {
+            pump->set_calibration(mLPerSecond);
+            hal::printf("Set %s calibration to %.4f mL/s\n", fluid.c_str(), pump->getCalibration());
+        });
+        saveConfigLater();
+    };
+
+    commandMap["flowStats"] = [](const String& args){
+        auto parts = splitArgs(args);
+        Pump* pump = parts.size() > 0 ? ingredients.pump(parts[0]) : nullptr;
+        if (pump == nullptr) {
+            hal::println("Usage: flowStats(fluidAlias)");
+            return;
+        }
+
+        onMotion([pump] { onCommandFlowStats(pump); });
+    };
+
+    // Measured outcome of the last run (or of one of the given length), e.g. weighed on a scale
+    commandMap["pumpMeasured"] = [](const String& args){
+        auto parts = splitArgs(args);
+        if (parts.size() < 2) {
+            hal::println("Usage: pumpMeasured(fluidAlias,milliliters[,millisecondsRun])");
+            return;
+        }
+
+        String fluid = parts[0];
+        float milliliters = parts[1].toFloat();
+
+        Pump* pump = ingredients.pump(fluid);
+
+        if (pump == nullptr) {
+            hal::println("Error: unknown fluid " + fluid);
+            return;
+        }
+        if (motionBusy(pump)) {
+            hal::println("Error: " + fluid + " is still dispensing");
+            return;
+        }
+
+        // Without a length, the last run as the motion step knows it
+        long given = parts.size() > 2 ? parts[2].toInt() : -1;
+        onMotion([pump, fluid, given, milliliters] {
+            unsigned long milliseconds = given >= 0 ? given : pump->getLastRunMs();
+            if (milliseconds == 0 || milliliters < 0.0f) {
+                hal::println("Error: no run to measure for " + fluid);
+                return;
+            }
+            pump->addMeasurement(milliseconds, milliliters);
+        });
+    };
+
+    commandMap["pumpCalibrationModel"] = [](const String& args){
+        auto parts = splitArgs(args);
+        Pump* pump = parts.size() > 0 ? ingredients.pump(parts[0]) : nullptr;
+        if (pump == nullptr) {
+            hal::println("Usage: pumpCalibrationModel(fluidAlias)");
+            return;
+        }
+
+        onMotion([pump] { onCommandCalibrationModel(pump->getFluidName(), pump->getCalibrationModel(), pump->isModelApplied()); });
+    };
+
+    commandMap["pumpSetLogic"] = [](const String& args){
+        auto parts = splitArgs(args);
+
+        if (parts.size() < 2) {
+            hal::println("Usage: pumpSetLogic(fluidAlias,negated)");
+            return;
+        }
+
+        String fluid = parts[0];
+        bool negated = parts[1].toInt() != 0;
+
+        Pump* pump = ingredients.pump(fluid);
+        
+        if (pump == nullptr) {
+            hal::println("Error: unknown fluid " + fluid);
+            return;
+        }
+
+        onMotion([pump, negated] { pump->setNegatedLogic(negated); });
+        saveConfigLater();
+        hal::printf("Set %s logic to %s\n", fluid.c_str(), negated ? "negated" : "normal");
+    };
+
+    // Powder dispenser commands
+    commandMap["powderSpin"] = [](const String& args){
+        auto parts = splitArgs(args);
+        if (parts.size() < 2) {
+            hal::println("Usage: powderSpin(powderAlias,steps)");
+            return;
+        }
+
+        String powderAlias = parts[0];
+        int steps = parts[1].toInt();
+
+        StepperPowderDispenser* dispenser = ingredients.dispenser(powderAlias);
+        
+        if (dispenser == nullptr) {
+            hal::println("Error: unknown powder " + powderAlias);
+            return;
+        }
+
+        onCommandDispenserSpin(dispenser, steps);
+    };
+
+    commandMap["powderDispense"] = [](const String& args){
+        auto parts = splitArgs(args);
+        if (parts.size() < 2) {
+            hal::println("Usage: powderDispense(powderAlias,grams)");
+            return;
+        }
+
+        String powderAlias = parts[0];
+        float grams = parts[1].toFloat();
+
+        StepperPowderDispenser* dispenser = ingredients.dispenser(powderAlias);
+        
+        if (dispenser == nullptr) {
+            hal::println("Error: unknown powder " + powderAlias);
+            return;
+        }
+
+        onCommandDispensePowder(dispenser, grams);
+    };
+
+    commandMap["dispenserSetStepsPerGram"] = [](const String& args){
+        auto parts = splitArgs(args);
+        if (parts.size() < 2) {
+            hal::println("Usage: dispenserSetStepsPerGram(powderAlias,stepsPerGram)");
+            return;
+        }
+
+        String powderAlias = parts[0];
+        float stepsPerGram = parts[1].toFloat();
+
+        StepperPowderDispenser* dispenser = ingredients.dispenser(powderAlias);
+        
+        if (dispenser == nullptr) {
+            hal::println("Error: unknown powder " + powderAlias);
+            return;
+        }
+
+        onMotion([dispenser, stepsPerGram] { dispenser->setStepsPerGram(stepsPerGram); });
+        saveConfigLater();
+        hal::printf("Set %s steps per gram to %.4f\n", powderAlias.c_str(), stepsPerGram);
+    };
+
+    commandMap["dispenserCalibrate"] = [](const String& args){
+        auto parts = splitArgs(args);
+        if (parts.size() < 3) {
+            hal::println("Usage: dispenserCalibrate(powderAlias,steps,grams)");
+            return;
+        }
+
+        String powderAlias = parts[0];
+        int steps = parts[1].toInt();
+        float grams = parts[2].toFloat();
+
+        StepperPowderDispenser* dispenser = ingredients.dispenser(powderAlias);
+        
+        if (dispenser == nullptr) {
+            hal::println("Error: unknown powder " + powderAlias);
+            return;
+        }
+
+        onMotion([dispenser, powderAlias, steps, grams] {
+            dispenser->calibrate(steps, grams);
+            hal::printf("Calibrated %s to %.4f steps per gram\n", powderAlias.c_str(), dispenser->getStepsPerGram());
+        });
+        saveConfigLater();
+    };
+
+    commandMap["dispenserSetTiming"] = [](const String& args){
+        auto parts = splitArgs(args);
+        if (parts.size() < 3) {
+            hal::println("Usage: dispenserSetTiming(powderAlias,stepIntervalUs,pulseDurationUs)");
+            return;
+        }
+
+        String powderAlias = parts[0];
+        int stepInterval = parts[1].toInt();
+        int pulseDuration = parts[2].toInt();
+
+        StepperPowderDispenser* dispenser = ingredients.dispenser(powderAlias);
+        
+        if (dispenser == nullptr) {
+            hal::println("Error: unknown powder " + powderAlias);
+            return;
+        }
+
+        onMotion([dispenser, stepInterval, pulseDuration] { dispenser->setStepTiming(stepInterval, pulseDuration); });
+        saveConfigLater();
+        hal::printf("Set %s step interval to %d us, pulse to %d us\n", powderAlias.c_str(), stepInterval, pulseDuration);
+    };
+
+    commandMap["dispenserSetGramsPerRevolution"] = [](const String& args){
+        auto parts = splitArgs(args);
+        if (parts.size() < 2) {
+            hal::println("Usage: dispenserSetGramsPerRevolution(powderAlias,gramsPerRevolution)");
+            return;
+        }
+
+        String powderAlias = parts[0];
+        float gramsPerRevolution = parts[1].toFloat();
+
+        StepperPowderDispenser* dispenser = ingredients.dispenser(powderAlias);
+
+        if (dispenser == nullptr) {
+            hal::println("Error: unknown powder " + powderAlias);
+            return;
+        }
+
+        onMotion([dispenser, powderAlias, gramsPerRevolution] {
+            dispenser->setGramsPerRevolution(gramsPerRevolution);
+            hal::printf("Set %s to %.4f grams per revolution (%.4f steps per gram)\n", powderAlias.c_str(),
+                dispenser->getGramsPerRevolution(), dispenser->getStepsPerGram());
+        });
+        saveConfigLater();
+    };
+
+    commandMap["dispenserSetMicrostepping"] = [](const String& args){
+        auto parts = splitArgs(args);
+        if (parts.size() < 3) {
+            hal::println("Usage: dispenserSetMicrostepping(powderAlias,fineMicrosteps,fineGrams)");
+            return;
+        }
+
+        String powderAlias = parts[0];
+        int microsteps = parts[1].toInt();
+        float fineGrams = parts[2].toFloat();
+
+        StepperPowderDispenser* dispenser = ingredients.dispenser(powderAlias);
+
+        if (dispenser == nullptr) {
+            hal::println("Error: unknown powder " + powderAlias);
+            return;
+        }
+
+        onMotion([dispenser, powderAlias, microsteps, fineGrams] {
+            if (!dispenser->setFineDispense(microsteps, fineGrams)) {
+                hal::println("Error: microsteps must be 1, 2, 4, 8 or 16 and its select pins wired (ingredientSetMicrostepPins)");
+                return;
+            }
+            hal::printf("Set %s to finish the last %.3f g in 1/%d steps\n", powderAlias.c_str(), fineGrams, microsteps);
+        });
+        saveConfigLater();
+    };
+
+    commandMap["dispenserSetVibration"] = [](const String& args){
+        auto parts = splitArgs(args);
+        if (parts.size() < 4) {
+            hal::println("Usage: dispenserSetVibration(powderAlias,stepIntervalUs,pulseDurationUs,stepsPerVibration)");
+            return;
+        }
+
+        String powderAlias = parts[0];
+        int stepInterval = parts[1].toInt();
+        int pulseDuration = parts[2].toInt();
+        int stepsPerVibration = parts[3].toInt();
+
+        StepperPowderDispenser* dispenser = ingredients.dispenser(powderAlias);
+        
+        if (dispenser == nullptr) {
+            hal::println("Error: unknown powder " + powderAlias);
+            return;
+        }
+
+        onMotion([dispenser, stepInterval, pulseDuration, stepsPerVibration] {
+            dispenser->setVibrationTiming(stepInterval, pulseDuration, stepsPerVibration);
+        });
+        saveConfigLater();
+        hal::printf("Set %s vibration every %d steps\n", powderAlias.c_str(), stepsPerVibration);
+    };
+
+    commandMap["enableDispenser"] = [](const String& args){
+        auto parts = splitArgs(args);
+        if (parts.size() < 1) {
+            hal::println("Usage: enableDispenser(powderAlias)");
+            return;
+        }
+
+        String powderAlias = parts[0];
+        StepperPowderDispenser* dispenser = ingredients.dispenser(powderAlias);
+        
+        if (dispenser == nullptr) {
+            hal::println("Error: unknown powder " + powderAlias);
+            return;
+        }
+
+        onMotion([dispenser] { dispenser->enable(); });
+        hal::printf("Enabled %s dispenser\n", powderAlias.c_str());
+    };
+
+    commandMap["disableDispenser"] = [](const String& args){
+        auto parts = splitArgs(args);
+        if (parts.size() < 1) {
+            hal::println("Usage: disableDispenser(powderAlias)");
+            return;
+        }
+
+        String powderAlias = parts[0];
+        StepperPowderDispenser* dispenser = ingredients.dispenser(powderAlias);
+        
+        if (dispenser == nullptr) {
+            hal::println("Error: unknown powder " + powderAlias);
+            return;
+        }
+
+        onMotion([dispenser] { dispenser->sleep(); });
+        hal::printf("Disabled %s dispenser\n", powderAlias.c_str());
+    };
+
+    // DHT commands
+    commandMap["readHumidity"] = [](const String& args){
+        onCommandReadHumidity();
+    };
+
+    // Vibration commands
+    commandMap["dispenserVibrationPolicy"] = [](const String& args){
+        auto parts = splitArgs(args);
+        if (parts.size() < 2) {
+            hal::println("Usage: dispenserVibrationPolicy(powderAlias,fixed|humidity|feedback)");
+            return;
+        }
+
+        String powderAlias = parts[0];
+        String policyName = parts[1];
+
+        StepperPowderDispenser* dispenser = ingredients.dispenser(powderAlias);
+        
+        if (dispenser == nullptr) {
+            hal::println("Error: unknown powder " + powderAlias);
+            return;
+        }
+
+        VibrationPolicy* policy = nullptr;
+        for (size_t i = 0; i < NUM_VIBRATION_POLICIES; i++) {
+            if (policyName == vibrationPolicies[i]->getName()) policy = vibrationPolicies[i];
+        }
+
+        if (policy == nullptr) {
+            hal::println("Error: unknown vibration policy " + policyName);
+            return;
+        }
+
+        onMotion([dispenser, policy] { dispenser->setVibrationPolicy(policy); });
+        saveConfigLater();
+        hal::printf("Set %s vibration policy to %s\n", powderAlias.c_str(), policy->getName());
+    };
+
+    commandMap["dispenserVibrationStats"] = [](const String& args){
+        auto parts = splitArgs(args);
+        if (parts.size() < 1) {
+            hal::println("Usage: dispenserVibrationStats(powderAlias[,reset])");
+            return;
+        }
+
+        String powderAlias = parts[0];
+        StepperPowderDispenser* dispenser = ingredients.dispenser(powderAlias);
+        
+        if (dispenser == nullptr) {
+            hal::println("Error: unknown powder " + powderAlias);
+            return;
+        }
+
+        onMotion([dispenser] { onCommandVibrationStats(dispenser); });
+        if (parts.size() > 1 && parts[1].toInt() != 0) {
+            onMotion([dispenser] { dispenser->resetVibrationStats(); });
+        }
+    };
+
+    commandMap["dispenserSetPower"] = [](const String& args){
+        auto parts = splitArgs(args);
+        if (parts.size() < 3) {
+            hal::println("Usage: dispenserSetPower(powderAlias,keepAwakeMs,maxAwakeDuty)");
+            return;
+        }
+
+        String powderAlias = parts[0];
+        long keepAwakeMs = parts[1].toInt();
+        float maxAwakeDuty = parts[2].toFloat();
+
+        StepperPowderDispenser* dispenser = ingredients.dispenser(powderAlias);
+
+        if (dispenser == nullptr) {
+            hal::println("Error: unknown powder " + powderAlias);
+            return;
+        }
+        if (keepAwakeMs < 0 || !(maxAwakeDuty > 0.0f && maxAwakeDuty <= 1.0f)) {
+            hal::println("Error: keepAwakeMs must be >= 0 and maxAwakeDuty in (0, 1]");
+            return;
+        }
+
+        onMotion([dispenser, keepAwakeMs, maxAwakeDuty] { dispenser->setPowerPolicy(keepAwakeMs, maxAwakeDuty); });
+        saveConfigLater();
+        hal::printf("%s driver holds %ld ms after a move, up to %.0f%% of the time\n",
+            powderAlias.c_str(), keepAwakeMs, maxAwakeDuty * 100.0f);
+    };
+
+    commandMap["dispenserPowerStats"] = [](const String& args){
+        auto parts = splitArgs(args);
+        if (parts.size() < 1) {
+            hal::println("Usage: dispenserPowerStats(powderAlias[,reset])");
+            return;
+        }
+
+        String powderAlias = parts[0];
+        StepperPowderDispenser* dispenser = ingredients.dispenser(powderAlias);
+
+        if (dispenser == nullptr) {
+            hal::println("Error: unknown powder " + powderAlias);
+            return;
+        }
+
+        onMotion([dispenser] { onCommandDispenserPowerStats(dispenser); });
+        if (parts.size() > 1 && parts[1].toInt() != 0) {
+            onMotion([dispenser] { dispenser->resetPowerStats(); });
+        }
+    };
+
+    // Flow signal, e.g. a scale under the bottle reporting grams since the dose started
+    commandMap["dispenserReportGrams"] = [](const String& args){
+        auto parts = splitArgs(args);
+        if (parts.size() < 2) {
+            hal::println("Usage: dispenserReportGrams(powderAlias,gramsSinceStart)");
+            return;
+        }
+
+        String powderAlias = parts[0];
+        float grams = parts[1].toFloat();
+
+        StepperPowderDispenser* dispenser = ingredients.dispenser(powderAlias);
+        
+        if (dispenser == nullptr) {
+            hal::println("Error: unknown powder " + powderAlias);
+            return;
+        }
+
+        onMotion([dispenser, grams] { dispenser->reportDispensedGrams(grams); });
+    };
+
+    // Weighed outcome of the last motion (or of the given steps)
+    commandMap["dispenserMeasured"] = [](const String& args){
+        auto parts = splitArgs(args);
+        if (parts.size() < 2) {
+            hal::println("Usage: dispenserMeasured(powderAlias,grams[,steps])");
+            return;
+        }
+
+        String powderAlias = parts[0];
+        float grams = parts[1].toFloat();
+
+        StepperPowderDispenser* dispenser = ingredients.dispenser(powderAlias);
+
+        if (dispenser == nullptr) {
+            hal::println("Error: unknown powder " + powderAlias);
+            return;
+        }
+        if (motionBusy(dispenser)) {
+            hal::println("Error: " + powderAlias + " is still dispensing");
+            return;
+        }
+
+        // Without a step count, the last motion as the motion step knows it
+        float given = parts.size() > 2 ? parts[2].toFloat() : NAN;
+        onMotion([dispenser, powderAlias, given, grams] {
+            float steps = isnan(given) ? dispenser->getLastMotionSteps() : given;
+            if (steps <= 0.0f || grams < 0.0f) {
+                hal::println("Error: no motion to measure for " + powderAlias);
+                return;
+            }
+            dispenser->addMeasurement(steps, grams);
+        });
+    };
+
+    commandMap["dispenserCalibrationModel"] = [](const String& args){
+        auto parts = splitArgs(args);
+        StepperPowderDispenser* dispenser = parts.size() > 0 ? ingredients.dispenser(parts[0]) : nullptr;
+        if (dispenser == nullptr) {
+            hal::println("Usage: dispenserCalibrationModel(powderAlias)");
+            return;
+        }
+
+        onMotion([dispenser] {
+            onCommandCalibrationModel(dispenser->getPowderName(), dispenser->getCalibrationModel(), dispenser->isModelApplied());
+        });
+    };
+
+    // Humidity compensation commands
+    commandMap["dispenserHumidityCompensation"] = [](const String& args){
+        auto parts = splitArgs(args);
+        if (parts.size() < 2) {
+            hal::println("Usage: dispenserHumidityCompensation(powderAlias,enabled)");
+            return;
+        }
+
+        String powderAlias = parts[0];
+        bool enabled = parts[1].toInt() != 0;
+
+        StepperPowderDispenser* dispenser = ingredients.dispenser(powderAlias);
+        
+        if (dispenser == nullptr) {
+            hal::println("Error: unknown powder " + powderAlias);
+            return;
+        }
+
+        onMotion([dispenser, enabled] { dispenser->setHumidityCompensation(enabled); });
+        saveConfigLater();
+        hal::printf("Humidity compensation for %s %s\n", powderAlias.c_str(), enabled ? "on" : "off");
+    };
+
+    commandMap["dispenserAddHumiditySample"] = [](const String& args){
+        auto parts = splitArgs(args);
+        if (parts.size() < 2) {
+            hal::println("Usage: dispenserAddHumiditySample(powderAlias,stepsPerGram,humidity)");
+            return;
+        }
+
+        String powderAlias = parts[0];
+        float stepsPerGram = parts[1].toFloat();
+        float humidity = parts.size() > 2 ? parts[2].toFloat() : cachedHumidity;
+
+        StepperPowderDispenser* dispenser = ingredients.dispenser(powderAlias);
+        
+        if (dispenser == nullptr) {
+            hal::println("Error: unknown powder " + powderAlias);
+            return;
+        }
+
+        onMotion([dispenser, powderAlias, stepsPerGram, humidity] {
+            if (!dispenser->getHumidityCurve().addSample(humidity, stepsPerGram)) {
+                hal::println("Error: invalid humidity sample");
+                return;
+            }
+            hal::printf("Added %.4f steps per gram at %.1f%% to %s\n", stepsPerGram, humidity, powderAlias.c_str());
+        });
+        saveConfigLater();
+    };
+
+    commandMap["dispenserClearHumidityCurve"] = [](const String& args){
+        auto parts = splitArgs(args);
+        if (parts.size() < 1) {
+            hal::println("Usage: dispenserClearHumidityCurve(powderAlias)");
+            return;
+        }
+
+        String powderAlias = parts[0];
+        StepperPowderDispenser* dispenser = ingredients.dispenser(powderAlias);
+        
+        if (dispenser == nullptr) {
+            hal::println("Error: unknown powder " + powderAlias);
+            return;
+        }
+
+        onMotion([dispenser] { dispenser->getHumidityCurve().clear(); });
+        saveConfigLater();
+        hal::printf("Cleared humidity curve of %s\n", powderAlias.c_str());
+    };
+
+    commandMap["dispenserHumidityCurve"] = [](const String& args){
+        auto parts = splitArgs(args);
+        if (parts.size() < 1) {
+            hal::println("Usage: dispenserHumidityCurve(powderAlias)");
+            return;
+        }
+
+        String powderAlias = parts[0];
+        StepperPowderDispenser* dispenser = ingredients.dispenser(powderAlias);
+        
+        if (dispenser == nullptr) {
+            hal::println("Error: unknown powder " + powderAlias);
+            return;
+        }
+
+        onMotion([dispenser] { onCommandHumidityCurve(dispenser); });
+    };
+
+    // Config commands
+    commandMap["configSave"] = [](const String& args){
+        saveConfigNow();
+    };
+
+    commandMap["configReset"] = [](const String& args){
+        cancelConfigCapture();
+        configStore.erase();
+        onMotion([] { applyConfig(defaultConfig); });
+        applyIdleConfig(defaultConfig);
+        configStore.config() = defaultConfig;
+        hal::println("Config reset to defaults");
+    };
+
+    commandMap["configShow"] = [](const String& args){
+        String store = "\"nvs_writes\":";
+        store += configStore.getWriteCount();
+        store += ",\"nvs_skipped_writes\":";
+        store += configStore.getSkippedWriteCount();
+        store += ",\"dirty\":";
+        store += configStore.isDirty() ? "true" : "false";
+        store += ",\"table_edited\":";
+        store += ingredientTableEdited ? "true" : "false";
+        onMotion([store] { onCommandConfigShow(store); });
+    };
+
+    // Ingredient table commands; they edit the stored table, which is built at boot
+    commandMap["ingredientSetPump"] = [](const String& args){
+        auto parts = splitArgs(args);
+        if (parts.size() < 5) {
+            hal::println("Usage: ingredientSetPump(alias,drivePin,negated,mLPerSecond,name)");
+            return;
+        }
+
+        int pin = parts[1].toInt();
+        if (!validIngredientAlias(parts[0]) || !validIngredientPin(pin)) {
+            hal::println("Error: alias must be one character and the pin a GPIO number");
+            return;
+        }
+
+        MachineConfig& cfg = editConfig();
+        PumpConfig* pc = findPumpRecord(cfg, parts[0][0]);
+        if (pc == nullptr) {
+            if (cfg.pump_count >= CONFIG_MAX_PUMPS) {
+                hal::println("Error: ingredient table has no room for another pump");
+                return;
+            }
+            pc = &cfg.pumps[cfg.pump_count++];
+        }
+
+        memset(pc, 0, sizeof(*pc));
+        pc->alias = parts[0][0];
+        pc->drive_pin = pin;
+        pc->flow_pin = CONFIG_NO_PIN;
+        pc->negated_logic = parts[2].toInt() != 0;
+        pc->mL_per_second = parts[3].toFloat();
+        pc->prime_mL = IDLE_PRIME_DEFAULT_ML;
+        strncpy(pc->name, parts[4].c_str(), CONFIG_NAME_LENGTH - 1);
+
+        ingredientTableEdited = true;
+        configStore.markDirty(hal::millis());
+        hal::printf("Pump %c stored on GPIO %d, active after a restart\n", pc->alias, pin);
+    };
+
+    commandMap["ingredientSetDispenser"] = [](const String& args){
+        auto parts = splitArgs(args);
+        if (parts.size() < 6) {
+            hal::println("Usage: ingredientSetDispenser(alias,stepPin,sleepPin,dirPin,stepsPerGram,name)");
+            return;
+        }
+
+        int stepPin = parts[1].toInt();
+        int sleepPin = parts[2].toInt();
+        int dirPin = parts[3].toInt();
+        if (!validIngredientAlias(parts[0]) || !validIngredientPin(stepPin) ||
+            !validIngredientPin(sleepPin) || !validIngredientPin(dirPin)) {
+            hal::println("Error: alias must be one character and the pins GPIO numbers");
+            return;
+        }
+
+        MachineConfig& cfg = editConfig();
+        DispenserConfig* dc = findDispenserRecord(cfg, parts[0][0]);
+        if (dc == nullptr) {
+            if (cfg.dispenser_count >= CONFIG_MAX_DISPENSERS) {
+                hal::println("Error: ingredient table has no room for another dispenser");
+                return;
+            }
+            // New dispensers start from the timing of the first compiled-in one
+            dc = &cfg.dispensers[cfg.dispenser_count++];
+            *dc = defaultConfig.dispensers[0];
+            memset(&dc->model, 0, sizeof(dc->model));
+        }
+
+        dc->alias = parts[0][0];
+        dc->step_pin = stepPin;
+        dc->sleep_pin = sleepPin;
+        dc->dir_pin = dirPin;
+        dc->steps_per_gram = parts[4].toFloat();
+        memset(dc->name, 0, sizeof(dc->name));
+        strncpy(dc->name, parts[5].c_str(), CONFIG_NAME_LENGTH - 1);
+
+        ingredientTableEdited = true;
+        configStore.markDirty(hal::millis());
+        hal::printf("Dispenser %c stored on GPIO %d/%d/%d, active after a restart\n", dc->alias, stepPin, sleepPin, dirPin);
+    };
+
+    commandMap["ingredientSetMicrostepPins"] = [](const String& args){
+        auto parts = splitArgs(args);
+        if (parts.size() < 4) {
+            hal::println("Usage: ingredientSetMicrostepPins(alias,ms1Pin,ms2Pin,ms3Pin), -1 for a pin tied on the board");
+            return;
+        }
+
+        uint8_t pins[3];
+        for (int i = 0; i < 3; i++) {
+            int pin = parts[i + 1].toInt();
+            if (pin != -1 && !validIngredientPin(pin)) {
+                hal::println("Error: pins must be GPIO numbers or -1");
+                return;
+            }
+            pins[i] = pin == -1 ? CONFIG_NO_PIN : pin;
+        }
+
+        MachineConfig& cfg = editConfig();
+        DispenserConfig* dc = validIngredientAlias(parts[0]) ? findDispenserRecord(cfg, parts[0][0]) : nullptr;
+        if (dc == nullptr) {
+            hal::println("Error: no dispenser with alias " + parts[0]);
+            return;
+        }
+
+        memcpy(dc->ms_pins, pins, sizeof(dc->ms_pins));
+
+        ingredientTableEdited = true;
+        configStore.markDirty(hal::millis());
+        hal::printf("Dispenser %c microstep pins stored, active after a restart\n", dc->alias);
+    };
+
+    commandMap["ingredientSetFlowMeter"] = [](const String& args){
+        auto parts = splitArgs(args);
+        if (parts.size() < 3) {
+            hal::println("Usage: ingredientSetFlowMeter(alias,pin,pulsesPerMl), -1 for no meter");
+            return;
+        }
+
+        int pin = parts[1].toInt();
+        float pulsesPerMl = parts[2].toFloat();
+        if ((pin != -1 && !validIngredientPin(pin)) || (pin != -1 && pulsesPerMl <= 0.0f)) {
+            hal::println("Error: pin must be a GPIO number or -1, pulses per mL > 0");
+            return;
+        }
+
+        MachineConfig& cfg = editConfig();
+        PumpConfig* pc = validIngredientAlias(parts[0]) ? findPumpRecord(cfg, parts[0][0]) : nullptr;
+        if (pc == nullptr) {
+            hal::println("Error: no pump with alias " + parts[0]);
+            return;
+        }
+
+        pc->flow_pin = pin == -1 ? CONFIG_NO_PIN : pin;
+        pc->flow_pulses_per_mL = pin == -1 ? 0.0f : pulsesPerMl;
+        configStore.markDirty(hal::millis());
+
+        // A first meter on an idle pump starts counting right away, like the K-factor of one already counting
+        // The meter pointer only changes here and at boot; the meter itself is the motion step's
+        char alias = pc->alias;
+        Pump* pump = ingredients.pump(alias);
+        FlowMeter* meter = pump != nullptr ? pump->getFlowMeter() : nullptr;
+        if (meter != nullptr && meter->getPin() == pin) {
+            onMotion([meter, alias, pulsesPerMl] {
+                meter->setPulsesPerMl(pulsesPerMl);
+                hal::printf("Pump %c flow meter set to %.3f pulses/mL\n", alias, pulsesPerMl);
+            });
+        } else if (meter == nullptr && pin != -1 && pump != nullptr && !motionBusy(pump)) {
+            int index = ingredients.indexOf(pump);
+            onMotion([index, alias, pin, pulsesPerMl] {
+                if (ingredients.attachFlowMeter(index, pin, pulsesPerMl)) {
+                    hal::printf("Pump %c now dispenses by flow meter on GPIO %d\n", alias, pin);
+                } else {
+                    ingredientTableEdited = true;
+                    hal::printf("Pump %c flow meter stored, active after a restart\n", alias);
+                }
+            });
+        } else {
+            ingredientTableEdited = true;
+            hal::printf("Pump %c flow meter stored, active after a restart\n", alias);
+        }
+    };
+
+    commandMap["ingredientRemove"] = [](const String& args){
+        auto parts = splitArgs(args);
+        if (parts.size() < 2 || (parts[0] != "pump" && parts[0] != "dispenser") || !validIngredientAlias(parts[1])) {
+            hal::println("Usage: ingredientRemove(pump|dispenser,alias)");
+            return;
+        }
+
+        MachineConfig& cfg = editConfig();
+        char alias = parts[1][0];
+        bool removed = false;
+
+        if (parts[0] == "pump") {
+            PumpConfig* pc = findPumpRecord(cfg, alias);
+            if (pc != nullptr) {
+                int index = pc - cfg.pumps;
+                memmove(pc, pc + 1, (cfg.pump_count - index - 1) * sizeof(PumpConfig));
+                memset(&cfg.pumps[--cfg.pump_count], 0, sizeof(PumpConfig));
+                removed = true;
+            }
+        } else {
+            DispenserConfig* dc = findDispenserRecord(cfg, alias);
+            if (dc != nullptr) {
+                int index = dc - cfg.dispensers;
+                memmove(dc, dc + 1, (cfg.dispenser_count - index - 1) * sizeof(DispenserConfig));
+                memset(&cfg.dispensers[--cfg.dispenser_count], 0, sizeof(DispenserConfig));
+                removed = true;
+            }
+        }
+
+        if (!removed) {
+            hal::println("Error: no " + parts[0] + " with alias " + parts[1]);
+            return;
+        }
+
+        ingredientTableEdited = true;
+        configStore.markDirty(hal::millis());
+        hal::printf("Removed %s %c, takes effect after a restart\n", parts[0].c_str(), alias);
+    };
+
+    // Metrics commands
+    commandMap["orderMetrics"] = [](const String& args){
+        onCommandOrderMetrics();
+    };
+
+    commandMap["orderMetricsReset"] = [](const String& args){
+        orderMetrics.reset();
+        hal::println("Order metrics reset");
+    };
+
+    // Power commands
+    commandMap["powerStats"] = [](const String& args){
+        broadcast(TOPIC_TELEMETRY, powerGovernor.toJson(hal::millis()));
+    };
+
+    commandMap["powerStatsReset"] = [](const String& args){
+        powerGovernor.resetStats(hal::millis());
+        hal::println("Power stats reset");
+    };
+
+    commandMap["powerSetTimeouts"] = [](const String& args){
+        auto parts = splitArgs(args);
+        if (parts.size() < 2) {
+            hal::println("Usage: powerSetTimeouts(idleAfterMs,sleepAfterMs)");
+            return;
+        }
+
+        long idleAfterMs = parts[0].toInt();
+        long sleepAfterMs = parts[1].toInt();
+        if (idleAfterMs <= 0 || sleepAfterMs < 0 || (sleepAfterMs > 0 && sleepAfterMs < idleAfterMs)) {
+            hal::println("Error: need idleAfterMs > 0 and sleepAfterMs 0 (never) or >= idleAfterMs");
+            return;
+        }
+
+        powerGovernor.setTimeouts(idleAfterMs, sleepAfterMs);
+        hal::printf("Idle after %ld ms, sleep after %ld ms\n", idleAfterMs, sleepAfterMs);
+    };
+
+    // Idle time commands, see IdleScheduler.h
+    commandMap["idleStats"] = [](const String& args){
+        broadcast(TOPIC_TELEMETRY, idleScheduler.toJson(hal::millis()));
+    };
+
+    commandMap["idleStatsReset"] = [](const String& args){
+        idleScheduler.resetStats();
+        hal::println("Idle stats reset");
+    };
+
+    commandMap["idleSetPriming"] = [](const String& args){
+        auto parts = splitArgs(args);
+        if (parts.size() < 1) {
+            hal::println("Usage: idleSetPriming(primeAfterMs), 0 to never prime (the default)");
+            return;
+        }
+
+        long primeAfterMs = parts[0].toInt();
+        if (primeAfterMs < 0) {
+            hal::println("Error: primeAfterMs must be >= 0");
+            return;
+        }
+
+        idleScheduler.setPrimeAfter(primeAfterMs);
+        editConfig().idle_prime_after_ms = primeAfterMs;
+        configStore.markDirty(hal::millis());
+        hal::printf("Lines primed after %ld ms unused\n", primeAfterMs);
+    };
+
+    commandMap["idleSetPrimeVolume"] = [](const String& args){
+        auto parts = splitArgs(args);
+        if (parts.size() < 2) {
+            hal::println("Usage: idleSetPrimeVolume(fluidAlias,milliliters), 0 to never prime the line");
+            return;
+        }
+
+        Pump* pump = ingredients.pump(parts[0]);
+        if (pump == nullptr) {
+            hal::println("Error: unknown fluid " + parts[0]);
+            return;
+        }
+
+        float milliliters = parts[1].toFloat();
+        if (milliliters < 0.0f) {
+            hal::println("Error: milliliters must be >= 0");
+            return;
+        }
+
+        int line = ingredients.indexOf(pump);
+        idleScheduler.setPrimeVolume(line, milliliters);
+        PumpConfig* pc = findPumpRecord(editConfig(), ingredients.getPumpAlias(line));
+        if (pc != nullptr) pc->prime_mL = milliliters;
+        configStore.markDirty(hal::millis());
+        hal::printf("%s primed with %.2f mL\n", pump->getFluidName().c_str(), milliliters);
+    };
+
+    commandMap["idleSetPrestage"] = [](const String& args){
+        auto parts = splitArgs(args);
+        if (parts.size() < 1) {
+            hal::println("Usage: idleSetPrestage(0|1[,settleAfterMs])");
+            return;
+        }
+
+        bool enabled = parts[0].toInt() != 0;
+        long settleAfterMs = parts.size() > 1 ? parts[1].toInt() : (long)idleScheduler.getSettleAfterMs();
+        if (settleAfterMs < 0) {
+            hal::println("Error: settleAfterMs must be >= 0");
+            return;
+        }
+
+        idleScheduler.setPrestage(enabled, settleAfterMs);
+        MachineConfig& cfg = editConfig();
+        cfg.idle_prestage = enabled;
+        cfg.idle_settle_after_ms = settleAfterMs;
+        configStore.markDirty(hal::millis());
+        hal::printf("Pre-staging %s, columns agitated after %ld ms unused\n", enabled ? "on" : "off", settleAfterMs);
+    };
+
+    commandMap["loopProfile"] = [](const String& args){
+        loopProfiler.printReport();
+        broadcast(TOPIC_TELEMETRY, loopProfiler.toJson());
+    };
+
+    commandMap["loopProfileReset"] = [](const String& args){
+        loopProfiler.reset();
+        hal::println("Loop profile reset");
+    };
+
+    // Event log commands
+    commandMap["logLevel"] = [](const String& args){
+        auto parts = splitArgs(args);
+        if (parts.size() < 1) {
+            hal::println("Usage: logLevel(0=debug|1=info|2=warn|3=error)");
+            return;
+        }
+
+        long level = parts[0].toInt();
+        if (level < LOG_LEVEL_DEBUG || level > LOG_LEVEL_ERROR) {
+            hal::println("Error: log level must be 0..3");
+            return;
+        }
+
+        eventLog.setLevel(level);
+        hal::printf("Log level set to %ld\n", level);
+    };
+
+    commandMap["logMode"] = [](const String& args){
+        auto parts = splitArgs(args);
+        if (parts.size() < 1 || (parts[0] != "text" && parts[0] != "binary")) {
+            hal::println("Usage: logMode(text|binary)");
+            return;
+        }
+
+        eventLog.setBinaryOutput(parts[0] == "binary");
+        hal::printf("Log output set to %s\n", parts[0].c_str());
+    };
+
+    commandMap["logStats"] = [](const String& args){
+        broadcast(TOPIC_LOGS, eventLog.statsJson());
+        if (args.length() > 0 && args.toInt() != 0) eventLog.resetStats();
+    };
+
+    // Command trace for the host replay tool, see CommandCapture.h
+    commandMap["captureStart"] = [](const String& args){
+        commandCapture.clear();
+        commandCapture.setEnabled(true);
+        hal::printf("Command capture started, %d byte ring\n", COMMAND_CAPTURE_RING_SIZE);
+    };
+
+    commandMap["captureStop"] = [](const String& args){
+        commandCapture.setEnabled(false);
+        hal::printf("Command capture stopped, %lu commands held, %lu evicted\n",
+            (unsigned long)commandCapture.getCount(), (unsigned long)commandCapture.getEvictedCount());
+    };
+
+    commandMap["captureExport"] = [](const String& args){
+        broadcast(TOPIC_LOGS, commandCapture.exportText());
+        hal::printf("Command trace exported, %lu commands\n", (unsigned long)commandCapture.getCount());
+    };
+
+    commandMap["prepare"] = [](const String& args){
+        auto parts = splitArgs(args);
+        if (parts.size() < 4) {
+            hal::println("Usage: prepare(powderAlias,grams,fluidAlias,milliliters,tumericGrams)");
+            return;
+        }
+
+        String powderAlias = parts[0];
+        float grams = parts[1].toFloat();
+        String fluidAlias = parts[2];
+        float milliliters = parts[3].toFloat();
+        float tumericGrams = parts.size() > 4 ? parts[4].toFloat() : 0.0f;
+
+        StepperPowderDispenser* dispenser = ingredients.dispenser(powderAlias);
+        if (dispenser == nullptr) {
+            hal::println("Error: unknown powder " + powderAlias);
+            return;
+        }
+
+        Pump* pump = ingredients.pump(fluidAlias);
+        if (pump == nullptr) {
+            hal::println("Error: unknown fluid " + fluidAlias);
+            return;
+        }
+
+        // Every order also uses these two
+        if (ingredients.pump(WATER_ALIAS) == nullptr || ingredients.pump(TUMERIC_ALIAS) == nullptr) {
+            hal::println("Error: no water or tumeric pump in the ingredient table");
+            return;
+        }
+
+        onCommandPrepareDrink(dispenser, grams, pump, milliliters, tumericGrams);
+    };
+
+    // more commands can be added here
+    hal::println("Commands initialized");
+}
+
+void updateStateMachine(){
+    // Each step moves on once its motion work is queued; with the mailbox full it is tried again next time
+    if (state == NOT_PREPARING) {
+        // Not preparing anything
+        return;
+    } else if (state == START_ORDER) {
+        // Start the order
+        StepperPowderDispenser* dispenser = orderDispenser;
+        float grams = orderGrams;
+        if (!onMotion([dispenser, grams] {
+            dispenser->enable();
+            dispenser->dispense(grams);
+        })) return;
+
+        onUi(onCommandProgressBar);
+
+        hal::println("Starting order preparation");
+        setState(PROTEIN_DISPENSING);
+        
+     } else if (state == PROTEIN_DISPENSING) {
+        if (!motionBusy(orderDispenser)) {
+            StepperPowderDispenser* dispenser = orderDispenser;
+            Pump* water = ingredients.pump(WATER_ALIAS);
+            if (!onMotion([dispenser, water] {
+                dispenser->disable();
+                water->enable();
+                water->dispense(275.0f); // Dispense 275 mL of water
+            })) return;
+            hal::println("Protein dispensing done, pumping flavor");
+            setState(WATER_PUMPING);
+        }
+    } else if (state == WATER_PUMPING) {
+        if (!motionBusy(ingredients.pump(WATER_ALIAS))) {
+            hal::delayMs(500); // Half a second delay before dispensing protein
+            Pump* pump = orderPump;
+            float milliliters = orderMilliliters;
+            if (!onMotion([pump, milliliters] {
+                pump->enable();
+                pump->dispense(milliliters);
+            })) return;
+            hal::println("Water pumping done, dispensing protein");
+            setState(FLAVOR_PUMPING);
+        }
+    } else if (state == FLAVOR_PUMPING) {
+        if (!motionBusy(orderPump)) {
+            // Start dispensing tumeric
+            float milliliters = orderTumericMl;
+            Pump* tumeric = ingredients.pump(TUMERIC_ALIAS);
+            if (!onMotion([tumeric, milliliters] {
+                tumeric->enable();
+                tumeric->dispense(milliliters);
+            })) return;
+            hal::println("Flavor pumping done, dispensing Tumeric");
+            setState(TUMERIC_DISPENSING);
+        }
+    } else if (state == TUMERIC_DISPENSING) {
+        Pump* tumeric = ingredients.pump(TUMERIC_ALIAS);
+        if (!motionBusy(tumeric)) {
+            Pump* pump = orderPump;
+            if (!onMotion([pump, tumeric] {
+                pump->disable(); // Disable flavor pump
+                tumeric->disable(); // Disable tumeric pump
+            })) return;
+            // Tumeric dispensing is done
+            hal::println("Tumeric dispensing done");
+            setState(FINISH_ORDER);
+        }
+    } else if (state == FINISH_ORDER) {
+        // Disable all dispensers and pumps
+        if (!onMotion(disableAllIngredients)) return;
+
+        // Order finished, reset state
+        hal::println("Order finished");
+
+        onUi(onCommandOrderFinish);
+        
+        // Let the websocket clients know
+        broadcast(TOPIC_ORDERS, "Order finished");
+        // Reset order variables
+        orderDispenser = nullptr;
+        orderGrams = 0.0f;
+        orderPump = nullptr;
+        orderMilliliters = 0.0f;
+        orderTumericMl = 0.0f;
+
+        setState(NOT_PREPARING);
+        idleScheduler.orderClosed(hal::millis());
+    }
+}
+
+// Parses "name(arg1,arg2,...)" and runs the matching command handler
+void dispatchCommand(const String& msg) {
+    // Any command counts as activity
+    machineWake();
+
+    // The capture commands themselves stay out of the trace
+    if (commandCapture.isEnabled() && !msg.startsWith("capture")) {
+        commandCapture.record(hal::micros64(), msg.c_str(), msg.length());
+    }
+
+    // parse name and args
+    String name = msg;
+    String args = "";
+    int p = msg.indexOf('(');
+    if (p >= 0) {
+        name = msg.substring(0, p);
+        int q = msg.indexOf(')', p+1);
+        if (q > p) args = msg.substring(p+1, q);
+    }
+
+    // dispatch
+    auto it = commandMap.find(name);
+    if (it != commandMap.end()) {
+        it->second(args);
+    } else {
+        hal::println("Unknown command: " + name);
+    }
+}
+
+void machineUpdateControl() {
+    { PROFILE_SCOPE(loopProfiler, PROBE_STATE_MACHINE); updateStateMachine(); }
+
+    powerGovernor.update((!machineIsBusy() || onlyPriming()) && !uiBusy(), hal::millis());
+    updateIdleWork();
+
+    // First gram of the order, as the motion step saw it
+    uint32_t firstGrams = motionFirstGramCount.load(std::memory_order_acquire);
+    if (firstGrams != seenFirstGramCount) {
+        seenFirstGramCount = firstGrams;
+        orderMetrics.recordFirstGram(motionFirstGramMs.load(std::memory_order_relaxed));
+    }
+
+    { PROFILE_SCOPE(loopProfiler, PROBE_HUMIDITY); updateHumidityCache(); }
+
+    // Calibration models learn on the motion side, the config picks them up here
+    uint32_t modelRevision = motionModelRevision.load(std::memory_order_relaxed);
+    if (modelRevision != savedModelRevision) {
+        savedModelRevision = modelRevision;
+        saveConfigLater();
+    }
+    {
+        PROFILE_SCOPE(loopProfiler, PROBE_CONFIG);
+        updateConfigCapture();
+        // A flash write stalls the other core for milliseconds: held until the order is done
+        if (!machineIsBusy()) configStore.update(hal::millis());
+    }
+}
+
+void machineUpdateMotion() {
+    uint32_t applied = motionMailbox.drain();
+
+    uint32_t mask = 0;
+    uint32_t firstGrams = 0;
+    uint32_t firstGramMs = motionFirstGramMs.load(std::memory_order_relaxed);
+    {
+        PROFILE_SCOPE(loopProfiler, PROBE_PUMPS);
+        for (int i = 0; i < ingredients.getPumpCount(); i++) {
+            Pump* pump = ingredients.getPump(i);
+            pump->update();
+            if (pump->isDispensing()) mask |= 1UL << i;
+        }
+    }
+    {
+        PROFILE_SCOPE(loopProfiler, PROBE_DISPENSERS);
+        for (int i = 0; i < ingredients.getDispenserCount(); i++) {
+            StepperPowderDispenser* dispenser = ingredients.getDispenser(i);
+            dispenser->update();
+            if (dispenser->isDispensing()) mask |= 1UL << (MOTION_DISPENSER_BIT + i);
+
+            firstGrams += dispenser->getFirstGramCount();
+            if ((int32_t)(dispenser->getFirstGramMs() - firstGramMs) > 0) firstGramMs = dispenser->getFirstGramMs();
+        }
+    }
+
+    motionModelRevision.store(calibrationModelRevision(), std::memory_order_relaxed);
+
+    // Time first, so a reader that sees the new count also sees it
+    motionFirstGramMs.store(firstGramMs, std::memory_order_relaxed);
+    motionFirstGramCount.store(firstGrams, std::memory_order_release);
+
+    // Mask first: a reader that sees the new sequence also sees this mask
+    motionBusyMask.store(mask, std::memory_order_relaxed);
+    motionAppliedSeq.store(applied, std::memory_order_release);
+}
+
+void machineUpdateUi() {
+    uint32_t applied = uiMailbox.drain();
+    { PROFILE_SCOPE(loopProfiler, PROBE_STRIP); strip.update(); }
+
+    uiActiveAnimations.store(strip.getActiveCount(), std::memory_order_relaxed);
+    uiAppliedSeq.store(applied, std::memory_order_release);
+}
+
+void machineUpdate() {
+    machineUpdateControl();
+    machineUpdateUi();
+    machineUpdateMotion();
+}
+
+bool machineMotionIsStepping() {
+    uint32_t dispenserBits = ((1UL << CONFIG_MAX_DISPENSERS) - 1) << MOTION_DISPENSER_BIT;
+    return (motionBusyMask.load(std::memory_order_relaxed) & dispenserBits) != 0;
+}
+
+unsigned long machineMotionNextEdgeUs() {
+    unsigned long next = ULONG_MAX;
+    for (int i = 0; i < ingredients.getDispenserCount(); i++) {
+        unsigned long us = ingredients.getDispenser(i)->getMicrosUntilNextEdge();
+        if (us < next) next = us;
+    }
+    return next;
+}
+
+bool machineIsStepping() {
+    for (int i = 0; i < ingredients.getDispenserCount(); i++) {
+        if (motionBusyBit(MOTION_DISPENSER_BIT + i)) return true;
+    }
+    return false;
+}
+
+bool machineIsBusy() {
+    if (state != NOT_PREPARING) return true;
+
+    if ((int32_t)(motionAppliedSeq.load(std::memory_order_acquire) - motionPostedSeq) < 0) return true;
+    return motionBusyMask.load(std::memory_order_relaxed) != 0;
+}
+
+uint32_t machineDroppedRequests() {
+    return motionMailbox.getDropCount() + uiMailbox.getDropCount();
+}
+
+StepperPowderDispenser* machineDispenser(const String& alias) {
+    return ingredients.dispenser(alias);
+}
+
+Pump* machinePump(const String& alias) {
+    return ingredients.pump(alias);
+}
@@ -0,0 +1,174 @@
+#ifndef MACHINE_H
+#define MACHINE_H
+
+#include "Hal.h"
+#include <FastLED.h>
+#include <vector>
+#include <functional>
+#include "AnimatedStrip.h"
+#include "LedZones.h"
+#include "OrderMetrics.h"
+#include "LoopProfiler.h"
+#include "PowerGovernor.h"
+#include "IdleScheduler.h"
+#include "BroadcastHub.h"
+
+class Pump;
+class StepperPowderDispenser;
+
+/*
+ * Order state machine, ingredients and WebSocket command handlers of the machine.
+ *
+ * Everything here only depends on the HAL, so the same code runs on the ESP32
+ * (driven by main.cpp) and on the host (simulator and other native tools).
+ * Network and sensor access is injected through the platform hooks below.
+ */
+
+// ——— Pin definitions ———
+// Defaults of the compiled-in ingredient table, the stored table can move them
+#define PERISTALTIC_A  46
+#define PERISTALTIC_B   9 
+#define PERISTALTIC_C  10
+#define WATER_PUMP      2
+#define TUMERIC 35
+
+#define STEPPER_A_STEP   14   // STEP pin   14
+#define STEPPER_A_SLEEP  13   // SLEEP pin  13
+#define STEPPER_A_DIR     5   // DIR pin     5 
+
+#define STEPPER_B_STEP    15  // STEP pin   12
+#define STEPPER_B_SLEEP    7  // SLEEP pin  11
+#define STEPPER_B_DIR      6  // DIR pin     6
+
+// Aliases of the ingredients every order uses
+#define WATER_ALIAS 'a'
+#define TUMERIC_ALIAS 'c'
+
+#define DHTPIN 17
+
+#define RGB_DATA 48
+
+// ——— State machine ——— 
+#define NOT_PREPARING -1
+#define START_ORDER 0
+#define WATER_PUMPING 1
+#define PROTEIN_DISPENSING 2
+#define FLAVOR_PUMPING 3
+#define TUMERIC_DISPENSING 4
+#define FINISH_ORDER 5
+
+#define NUM_LEDS 84
+
+// ——— LED zones ———
+// Index into the zone table in Machine.cpp; commands use the zone names
+#define ZONE_ALL                0   // "all"
+#define ZONE_FRONT              1   // "front", lit at boot
+#define ZONE_TABLET             2   // "tablet"
+#define ZONE_TABLET_AREA        3   // "tablet_area", tablet with 5 LEDs of padding
+#define ZONE_BOTTLE             4   // "bottle"
+#define ZONE_BOTTLE_AREA        5   // "bottle_area", bottle with 5 LEDs of padding
+#define NUM_ZONES               6
+
+// ——— Loop profiler probes ———
+#define PROBE_LOOP              0   // Whole loop() iteration, or motion task iteration with tasks
+#define PROBE_WS_CLEANUP        1
+#define PROBE_STATE_MACHINE     2
+#define PROBE_STRIP             3
+#define PROBE_PUMPS             4   // Every pump of the ingredient table
+#define PROBE_DISPENSERS        5   // Every powder dispenser
+#define PROBE_HUMIDITY          6
+#define PROBE_CONFIG            7
+#define NUM_PROBES              8
+
+extern int state;
+extern CRGB leds[NUM_LEDS];
+extern AnimatedStrip strip;
+extern LedZoneTable ledZones;
+extern OrderMetrics orderMetrics;
+extern LoopProfiler loopProfiler;
+extern PowerGovernor powerGovernor;   // Control side only
+extern IdleScheduler idleScheduler;   // Control side only
+
+// ——— Platform hooks ———
+typedef void (*BroadcastHandler)(uint8_t topic, const String& message);
+typedef float (*HumiditySensorReader)();
+
+/// @brief Where messages for the WebSocket clients go, each with its TOPIC_* (BroadcastHub.h)
+void machineSetBroadcastHandler(BroadcastHandler handler);
+
+/// @brief Single humidity reading in %RH, NaN on error
+void machineSetHumiditySensor(HumiditySensorReader reader);
+
+/// @brief Applies a PowerGovernor state (CPU clock, light sleep), called from the control side
+typedef void (*PowerStateHandler)(int state);
+void machineSetPowerHandler(PowerStateHandler handler);
+
+// ——— Commands ———
+using CmdHandler = std::function<void(const String& args)>;
+
+/// @brief Split a String by ',' and trim whitespace
+std::vector<String> splitArgs(const String& s);
+
+/// @brief Register a command from outside the machine (platform specific commands)
+void machineAddCommand(const String& name, CmdHandler handler);
+
+/// @brief Load the stored configuration over the compiled-in defaults
+void initConfig();
+
+/// @brief Register every command handler
+void initCommands();
+
+/// @brief Run a "name(arg1,arg2,...)" command
+void dispatchCommand(const String& msg);
+
+// ——— Control loop ———
+void updateStateMachine();
+
+/*
+ * The loop is split in three steps that can run on separate tasks. Only the
+ * motion step touches the pumps and dispensers and only the UI step touches
+ * the strip; commands and the state machine reach them through mailboxes.
+ */
+
+/// @brief State machine, humidity cache and config writes. Commands run on this side.
+void machineUpdateControl();
+
+/// @brief Runs queued actuator requests, updates pumps and dispensers, publishes their state
+void machineUpdateMotion();
+
+/// @brief Runs queued animation requests and renders the strip
+void machineUpdateUi();
+
+/// @brief One cooperative loop iteration: control, UI and motion steps in turn
+void machineUpdate();
+
+// ——— Power ———
+/// @brief Current PowerGovernor state (POWER_ACTIVE ...), readable from any task
+int machinePowerState();
+
+/// @brief Control side: back to POWER_ACTIVE right away, e.g. a command arrived
+void machineWake();
+
+/// @brief Control side: time from a command arriving while not active to its handler starting
+void machineRecordWakeLatency(unsigned long latency_us);
+
+/// @brief Motion and UI requests dropped because a mailbox was full
+uint32_t machineDroppedRequests();
+
+/// @brief Whether a powder dispenser is stepping right now (or is about to, for a queued request)
+bool machineIsStepping();
+
+/// @brief Motion side: whether a dispenser stepped in the last motion step
+bool machineMotionIsStepping();
+
+/// @brief Motion side: microseconds until a dispenser's next STEP edge is due, ULONG_MAX if none moves
+unsigned long machineMotionNextEdgeUs();
+
+/// @brief Whether an order is in progress or any actuator is running
+bool machineIsBusy();
+
+/// @brief Look up an ingredient of the table by its one-character alias, nullptr if unknown
+StepperPowderDispenser* machineDispenser(const String& alias);
+Pump* machinePump(const String& alias);
+
+#endif
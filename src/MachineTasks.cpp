@@ -0,0 +1,386 @@
+#include <MachineTasks.h>
+#include "LoopProfiler.h"
+#include "EventLog.h"
+#include <WiFi.h>
+#include <esp_pm.h>
+
+enum NetworkEventKind {
+    NETWORK_BROADCAST,
+    NETWORK_CLIENT_CONNECTED,
+    NETWORK_CLIENT_DISCONNECTED,
+    NETWORK_SUBSCRIBE,
+    NETWORK_STATS,
+    NETWORK_STATS_RESET
+};
+
+// Entry of the outgoing queue; a broadcast String is owned by the receiver
+struct NetworkEvent {
+    uint8_t kind;
+    uint8_t topics;
+    uint32_t client_id;
+    String* message;
+};
+
+struct CommandMessage {
+    unsigned long received_us;
+    char text[COMMAND_MAX_LENGTH];
+};
+
+// Busy time is measured around the work of each iteration, waits excluded
+struct TaskStats {
+    const char* name;
+    TaskHandle_t handle;
+    int core;               // -1 when not pinned
+    uint32_t stack_size;
+    uint64_t busy_us;       // Written by the task itself, read for reports only
+    uint32_t iterations;
+};
+
+enum { TASK_MOTION, TASK_CONTROL, TASK_NETWORK, TASK_UI, TASK_LOG, NUM_TASKS };
+
+static TaskStats taskStats[NUM_TASKS] = {
+    {"motion", nullptr, MOTION_TASK_CORE, MOTION_TASK_STACK, 0, 0},
+    {"control", nullptr, -1, CONTROL_TASK_STACK, 0, 0},
+    {"network", nullptr, NETWORK_TASK_CORE, NETWORK_TASK_STACK, 0, 0},
+    {"ui", nullptr, -1, UI_TASK_STACK, 0, 0},
+    {"log", nullptr, LOG_TASK_CORE, LOG_TASK_STACK, 0, 0},
+};
+static uint64_t statsSinceUs = 0;       // 64-bit, micros() wraps after 71 minutes
+
+static QueueHandle_t commandQueue = nullptr;
+static QueueHandle_t broadcastQueue = nullptr;
+static NetworkService networkService = nullptr;
+static BroadcastHub broadcastHub;     // Network task only
+
+static volatile uint32_t droppedCommands = 0;
+static volatile uint32_t droppedBroadcasts = 0;
+
+bool machineTasksRunning() {
+    return commandQueue != nullptr;
+}
+
+bool machineTasksPostCommand(const char* text, size_t length) {
+    if (commandQueue == nullptr || length >= COMMAND_MAX_LENGTH) {
+        droppedCommands++;
+        return false;
+    }
+
+    CommandMessage message;
+    message.received_us = micros();
+    memcpy(message.text, text, length);
+    message.text[length] = 0;
+
+    if (xQueueSend(commandQueue, &message, 0) != pdTRUE) {
+        droppedCommands++;
+        return false;
+    }
+    return true;
+}
+
+static bool postNetworkEvent(uint8_t kind, uint32_t client_id, uint8_t topics, TickType_t wait) {
+    if (broadcastQueue == nullptr) return false;
+    NetworkEvent event = {kind, topics, client_id, nullptr};
+    return xQueueSend(broadcastQueue, &event, wait) == pdTRUE;
+}
+
+// Machine broadcast handler once the tasks run: the String is handed over to the
+// network task, where it becomes the one buffer all subscribed clients share
+static void queueBroadcast(uint8_t topic, const String& message) {
+    NetworkEvent event = {NETWORK_BROADCAST, topic, 0, new String(message)};
+    if (xQueueSend(broadcastQueue, &event, 0) != pdTRUE) {
+        delete event.message;
+        droppedBroadcasts++;
+    }
+}
+
+bool machineTasksClientConnected(uint32_t client_id) {
+    return postNetworkEvent(NETWORK_CLIENT_CONNECTED, client_id, TOPIC_ALL, pdMS_TO_TICKS(CLIENT_EVENT_WAIT_MS));
+}
+
+void machineTasksClientDisconnected(uint32_t client_id) {
+    postNetworkEvent(NETWORK_CLIENT_DISCONNECTED, client_id, 0, pdMS_TO_TICKS(CLIENT_EVENT_WAIT_MS));
+}
+
+bool machineTasksSubscribe(uint32_t client_id, uint8_t topics) {
+    return postNetworkEvent(NETWORK_SUBSCRIBE, client_id, topics, pdMS_TO_TICKS(CLIENT_EVENT_WAIT_MS));
+}
+
+// -------------------- Power --------------------
+
+// Outside POWER_ACTIVE the tasks poll this slowly, so the idle task gets long
+// stretches in which the tickless idle can light sleep
+static TickType_t pollTicks(TickType_t active_ticks) {
+    return machinePowerState() == POWER_ACTIVE ? active_ticks : pdMS_TO_TICKS(POWER_IDLE_POLL_MS);
+}
+
+static bool configureLightSleep(bool enable) {
+#if ESP_IDF_VERSION_MAJOR >= 5
+    esp_pm_config_t pm;
+#else
+    esp_pm_config_esp32s3_t pm;
+#endif
+    pm.max_freq_mhz = enable ? POWER_IDLE_CPU_MHZ : POWER_ACTIVE_CPU_MHZ;
+    pm.min_freq_mhz = enable ? POWER_SLEEP_MIN_CPU_MHZ : POWER_ACTIVE_CPU_MHZ;
+    pm.light_sleep_enable = enable;
+    return esp_pm_configure(&pm) == ESP_OK;
+}
+
+static bool lightSleepConfigured = false;
+
+static void applyPowerState(int state) {
+    if (state == POWER_ACTIVE) {
+        if (lightSleepConfigured) {
+            configureLightSleep(false);
+            lightSleepConfigured = false;
+        }
+        setCpuFrequencyMhz(POWER_ACTIVE_CPU_MHZ);
+
+        // Motion and UI may be waiting out a long idle poll
+        if (taskStats[TASK_MOTION].handle != nullptr) xTaskNotifyGive(taskStats[TASK_MOTION].handle);
+        if (taskStats[TASK_UI].handle != nullptr) xTaskNotifyGive(taskStats[TASK_UI].handle);
+    } else if (state == POWER_IDLE) {
+        setCpuFrequencyMhz(POWER_IDLE_CPU_MHZ);
+    } else if (state == POWER_SLEEP) {
+        // Modem sleep keeps the AP association through light sleep
+        WiFi.setSleep(true);
+        lightSleepConfigured = configureLightSleep(true);
+        if (!lightSleepConfigured) {
+            hal::println("Light sleep not supported by this build (needs CONFIG_PM_ENABLE and tickless idle), staying in idle clock");
+        }
+    }
+}
+
+// -------------------- Tasks --------------------
+
+static void motionTask(void* parameter) {
+    TaskStats& stats = taskStats[TASK_MOTION];
+
+    for (;;) {
+        unsigned long start = micros();
+        {
+            PROFILE_SCOPE(loopProfiler, PROBE_LOOP);
+            machineUpdateMotion();
+        }
+        stats.busy_us += micros() - start;
+        stats.iterations++;
+
+        // While a dispenser steps, block for the whole ticks before its next
+        // STEP edge and spin only through the last one, so the rest of core 1
+        // (IDLE1 included) runs between steps
+        if (!machineMotionIsStepping()) {
+            ulTaskNotifyTake(pdTRUE, pollTicks(1));
+        } else {
+            TickType_t ticks = machineMotionNextEdgeUs() / (portTICK_PERIOD_MS * 1000UL);
+            if (ticks > 1) ulTaskNotifyTake(pdTRUE, ticks - 1);
+        }
+    }
+}
+
+static void controlTask(void* parameter) {
+    TaskStats& stats = taskStats[TASK_CONTROL];
+    CommandMessage message;
+
+    for (;;) {
+        bool received = xQueueReceive(commandQueue, &message, pollTicks(pdMS_TO_TICKS(CONTROL_PERIOD_MS))) == pdTRUE;
+
+        unsigned long start = micros();
+        if (received) {
+            if (machinePowerState() != POWER_ACTIVE) {
+                machineWake();
+                machineRecordWakeLatency(micros() - message.received_us);
+            }
+
+            LOG_EVENT(LOG_COMMAND, message.text);
+            dispatchCommand(String(message.text));
+        }
+        machineUpdateControl();
+        stats.busy_us += micros() - start;
+        stats.iterations++;
+    }
+}
+
+static void handleNetworkEvent(const NetworkEvent& event) {
+    switch (event.kind) {
+    case NETWORK_BROADCAST:
+        broadcastHub.publish(event.topics, SharedMessage(event.message));
+        break;
+
+    case NETWORK_CLIENT_CONNECTED:
+        if (!broadcastHub.addClient(event.client_id, event.topics)) {
+            hal::printf("WebSocket client #%u gets no broadcasts, %d clients tracked\n",
+                (unsigned)event.client_id, BROADCAST_MAX_CLIENTS);
+        }
+        break;
+
+    case NETWORK_CLIENT_DISCONNECTED:
+        broadcastHub.removeClient(event.client_id);
+        break;
+
+    case NETWORK_SUBSCRIBE:
+        broadcastHub.subscribe(event.client_id, event.topics);
+        break;
+
+    case NETWORK_STATS:
+        broadcastHub.publish(TOPIC_TELEMETRY, SharedMessage(new String(broadcastHub.statsJson())));
+        break;
+
+    case NETWORK_STATS_RESET:
+        broadcastHub.resetStats();
+        break;
+    }
+}
+
+static void networkTask(void* parameter) {
+    TaskStats& stats = taskStats[TASK_NETWORK];
+    NetworkEvent event;
+
+    for (;;) {
+        bool received = xQueueReceive(broadcastQueue, &event, pdMS_TO_TICKS(NETWORK_PERIOD_MS)) == pdTRUE;
+
+        unsigned long start = micros();
+        while (received) {
+            handleNetworkEvent(event);
+            received = xQueueReceive(broadcastQueue, &event, 0) == pdTRUE;
+        }
+
+        // Also when nothing came in: a client whose queue was full may have room again
+        broadcastHub.pump();
+        {
+            PROFILE_SCOPE(loopProfiler, PROBE_WS_CLEANUP);
+            networkService();
+        }
+        stats.busy_us += micros() - start;
+        stats.iterations++;
+    }
+}
+
+static void uiTask(void* parameter) {
+    TaskStats& stats = taskStats[TASK_UI];
+
+    for (;;) {
+        unsigned long start = micros();
+        machineUpdateUi();
+        stats.busy_us += micros() - start;
+        stats.iterations++;
+
+        ulTaskNotifyTake(pdTRUE, pollTicks(pdMS_TO_TICKS(UI_PERIOD_MS)));
+    }
+}
+
+// Text mode prints each record as a line, binary mode sends the raw record behind the frame magic
+static void writeLogRecord(const uint8_t* record, uint16_t length, void* context) {
+    if (eventLog.isBinaryOutput()) {
+        static const uint8_t magic[2] = {EVENT_LOG_FRAME_MAGIC_0, EVENT_LOG_FRAME_MAGIC_1};
+        Serial.write(magic, sizeof(magic));
+        Serial.write(record, length);
+        return;
+    }
+
+    char line[320];
+    int n = EventLog::formatText(record, length, line, sizeof(line));
+    Serial.write(reinterpret_cast<const uint8_t*>(line), n);
+}
+
+static void logTask(void* parameter) {
+    TaskStats& stats = taskStats[TASK_LOG];
+
+    for (;;) {
+        unsigned long start = micros();
+        eventLog.drain(writeLogRecord, nullptr);
+        stats.busy_us += micros() - start;
+        stats.iterations++;
+
+        vTaskDelay(pollTicks(pdMS_TO_TICKS(LOG_PERIOD_MS)));
+    }
+}
+
+// -------------------- Reporting --------------------
+
+static String taskStatsJson() {
+    float window = hal::micros64() - statsSinceUs;
+
+    String out = "{\"tasks\":{";
+    for (int i = 0; i < NUM_TASKS; i++) {
+        const TaskStats& t = taskStats[i];
+        if (i > 0) out += ',';
+
+        out += "\"" + String(t.name) + "\":{\"core\":" + String(t.core);
+        out += ",\"priority\":" + String((int)uxTaskPriorityGet(t.handle));
+        out += ",\"stack\":" + String(t.stack_size);
+        out += ",\"stack_free_min\":" + String((unsigned long)uxTaskGetStackHighWaterMark(t.handle));
+        out += ",\"cpu_share\":" + String(window > 0 ? t.busy_us / window : 0.0f, 4);
+        out += ",\"iterations\":" + String(t.iterations) + "}";
+    }
+
+    out += "},\"dropped_commands\":" + String(droppedCommands);
+    out += ",\"dropped_broadcasts\":" + String(droppedBroadcasts);
+    out += ",\"dropped_requests\":" + String(machineDroppedRequests());
+    out += ",\"free_heap\":" + String(ESP.getFreeHeap());
+    out += ",\"window_ms\":" + String((unsigned long)(window / 1000.0f)) + "}";
+    return out;
+}
+
+static void printTaskStats() {
+    float window = hal::micros64() - statsSinceUs;
+
+    hal::printf("%-8s %6s %6s %12s %8s %10s\n", "task", "core", "prio", "stack free", "cpu %", "iterations");
+    for (int i = 0; i < NUM_TASKS; i++) {
+        const TaskStats& t = taskStats[i];
+        hal::printf("%-8s %6d %6u %6u/%-5u %8.2f %10u\n", t.name, t.core,
+            (unsigned)uxTaskPriorityGet(t.handle), (unsigned)uxTaskGetStackHighWaterMark(t.handle),
+            (unsigned)t.stack_size, window > 0 ? 100.0f * t.busy_us / window : 0.0f, (unsigned)t.iterations);
+    }
+    hal::printf("dropped: %u commands, %u broadcasts, %u requests; free heap %u\n", (unsigned)droppedCommands,
+        (unsigned)droppedBroadcasts, (unsigned)machineDroppedRequests(), (unsigned)ESP.getFreeHeap());
+}
+
+// -------------------- Startup --------------------
+
+void machineTasksStart(BroadcastHub::CanSend can_send, BroadcastHub::Send send, NetworkService service) {
+    networkService = service;
+    broadcastHub.setTransport(can_send, send, nullptr);
+
+    broadcastQueue = xQueueCreate(BROADCAST_QUEUE_LENGTH, sizeof(NetworkEvent));
+    machineSetBroadcastHandler(queueBroadcast);
+    machineSetPowerHandler(applyPowerState);
+
+    machineAddCommand("taskStats", [](const String& args) {
+        printTaskStats();
+        queueBroadcast(TOPIC_TELEMETRY, taskStatsJson());
+    });
+
+    // The hub belongs to the network task, which answers these
+    machineAddCommand("broadcastStats", [](const String& args) {
+        if (!postNetworkEvent(NETWORK_STATS, 0, 0, 0)) droppedBroadcasts++;
+    });
+
+    machineAddCommand("broadcastStatsReset", [](const String& args) {
+        if (postNetworkEvent(NETWORK_STATS_RESET, 0, 0, 0)) hal::println("Broadcast stats reset");
+    });
+
+    machineAddCommand("taskStatsReset", [](const String& args) {
+        for (int i = 0; i < NUM_TASKS; i++) {
+            taskStats[i].busy_us = 0;
+            taskStats[i].iterations = 0;
+        }
+        statsSinceUs = hal::micros64();
+        hal::println("Task stats reset");
+    });
+
+    statsSinceUs = hal::micros64();
+
+    xTaskCreatePinnedToCore(motionTask, "motion", MOTION_TASK_STACK, nullptr, MOTION_TASK_PRIORITY,
+        &taskStats[TASK_MOTION].handle, MOTION_TASK_CORE);
+    xTaskCreatePinnedToCore(networkTask, "network", NETWORK_TASK_STACK, nullptr, NETWORK_TASK_PRIORITY,
+        &taskStats[TASK_NETWORK].handle, NETWORK_TASK_CORE);
+    xTaskCreate(uiTask, "ui", UI_TASK_STACK, nullptr, UI_TASK_PRIORITY, &taskStats[TASK_UI].handle);
+    xTaskCreatePinnedToCore(logTask, "log", LOG_TASK_STACK, nullptr, LOG_TASK_PRIORITY,
+        &taskStats[TASK_LOG].handle, LOG_TASK_CORE);
+
+    // Last: once the command queue exists, the web server starts handing commands over
+    commandQueue = xQueueCreate(COMMAND_QUEUE_LENGTH, sizeof(CommandMessage));
+    xTaskCreate(controlTask, "control", CONTROL_TASK_STACK, nullptr, CONTROL_TASK_PRIORITY,
+        &taskStats[TASK_CONTROL].handle);
+
+    hal::println("Tasks started");
+}
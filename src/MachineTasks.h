@@ -0,0 +1,89 @@
+#ifndef MACHINE_TASKS_H
+#define MACHINE_TASKS_H
+
+#include <Arduino.h>
+#include "Machine.h"
+
+/*
+ * FreeRTOS task layout of the machine (ESP32 only, the host tools keep
+ * calling machineUpdate() from a single thread).
+ *
+ *   motion   core 1, highest   pumps and dispensers (machineUpdateMotion)
+ *   control  any core, medium  commands and state machine (machineUpdateControl)
+ *   network  core 0, medium    BroadcastHub: per-client topics and queues, client cleanup
+ *   ui       any core, low     animations, hands LED frames to the RMT (machineUpdateUi)
+ *   log      core 0, lowest    drains the event log to Serial
+ *
+ * The AsyncTCP task only copies incoming commands into the command queue, and
+ * broadcasts from any task go through the outgoing queue, so the web server
+ * never touches machine state. Client connects, disconnects and subscriptions
+ * take the outgoing queue too, which keeps the hub on the network task alone.
+ * Between the machine tasks, work goes through the mailboxes and the motion
+ * snapshot in Machine.cpp.
+ *
+ * Power: the PowerGovernor (control side) steps down after a quiet period.
+ * POWER_IDLE lowers the clock to 80 MHz, POWER_SLEEP enables automatic light
+ * sleep with WiFi modem sleep. Below POWER_ACTIVE the tasks poll every
+ * POWER_IDLE_POLL_MS; a command wakes the control task through its queue,
+ * which restores the clock and notifies the other tasks.
+ */
+
+#define MOTION_TASK_PRIORITY    (configMAX_PRIORITIES - 2)
+#define CONTROL_TASK_PRIORITY   5
+#define NETWORK_TASK_PRIORITY   4
+#define UI_TASK_PRIORITY        2
+#define LOG_TASK_PRIORITY       1
+
+#define MOTION_TASK_CORE        1
+#define NETWORK_TASK_CORE       0
+#define LOG_TASK_CORE           0
+
+#define MOTION_TASK_STACK       4096    // Bytes
+#define CONTROL_TASK_STACK      8192    // Commands build JSON Strings
+#define NETWORK_TASK_STACK      4096
+#define UI_TASK_STACK           4096
+#define LOG_TASK_STACK          3072
+
+#define CONTROL_PERIOD_MS       5       // Longest wait for a command before the state machine runs again
+#define UI_PERIOD_MS            5
+#define NETWORK_PERIOD_MS       20
+#define LOG_PERIOD_MS           10
+
+#define POWER_ACTIVE_CPU_MHZ    240
+#define POWER_IDLE_CPU_MHZ      80      // Lowest clock that keeps WiFi running
+#define POWER_SLEEP_MIN_CPU_MHZ 40      // XTAL, between light sleeps
+#define POWER_IDLE_POLL_MS      50      // Task poll period below POWER_ACTIVE
+
+#define COMMAND_QUEUE_LENGTH    8
+#define COMMAND_MAX_LENGTH      192
+#define BROADCAST_QUEUE_LENGTH  16
+#define CLIENT_EVENT_WAIT_MS    10      // Client events are not dropped as readily as broadcasts
+
+/// @brief Periodic network housekeeping, run on the network task (ws.cleanupClients)
+typedef void (*NetworkService)();
+
+/**
+ * @brief Creates the queues and starts the machine tasks. From here on, broadcasts
+ * from the machine are queued and the network task hands them to each subscribed
+ * client through send, as long as can_send reports room in that client's queue.
+ */
+void machineTasksStart(BroadcastHub::CanSend can_send, BroadcastHub::Send send, NetworkService service);
+
+/// @brief A WebSocket client connected; it gets every topic until it subscribes
+bool machineTasksClientConnected(uint32_t client_id);
+
+void machineTasksClientDisconnected(uint32_t client_id);
+
+/// @brief Replaces the TOPIC_* mask of a client
+bool machineTasksSubscribe(uint32_t client_id, uint8_t topics);
+
+/**
+ * @brief Queues a command for the control task. Safe from any task, never blocks.
+ * @return false if the queue is full or the command is too long.
+ */
+bool machineTasksPostCommand(const char* text, size_t length);
+
+/// @brief Whether the tasks are running
+bool machineTasksRunning();
+
+#endif
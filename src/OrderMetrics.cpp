@@ -0,0 +1,191 @@
+#include <OrderMetrics.h>
+
+const unsigned long OrderMetrics::BUCKET_LIMITS_MS[ORDER_METRICS_NUM_BUCKETS] = {
+    100, 250, 500, 1000, 2000, 5000, 10000, 20000, 30000, 60000, 120000, 0xFFFFFFFFUL
+};
+
+// -------------------- Histogram --------------------
+
+void OrderMetrics::Histogram::add(unsigned long duration_ms) {
+    if (count == 0 || duration_ms < min_ms) min_ms = duration_ms;
+    if (duration_ms > max_ms) max_ms = duration_ms;
+    count++;
+    sum_ms += duration_ms;
+
+    int bucket = 0;
+    while (bucket < ORDER_METRICS_NUM_BUCKETS - 1 && duration_ms > BUCKET_LIMITS_MS[bucket]) {
+        bucket++;
+    }
+    buckets[bucket]++;
+}
+
+void OrderMetrics::Histogram::clear() {
+    *this = Histogram();
+}
+
+// -------------------- OrderMetrics --------------------
+
+OrderMetrics::OrderMetrics() {
+    reset();
+}
+
+void OrderMetrics::beginOrder(unsigned long now_ms) {
+    if (m_orderActive) {
+        closeStage(now_ms);
+        m_abortedOrders++;
+    }
+
+    m_orderActive = true;
+    m_currentStage = -1;
+    m_orderStartMs = now_ms;
+    m_firstGramRecorded = false;
+}
+
+void OrderMetrics::enterStage(int stage, unsigned long now_ms) {
+    if (!m_orderActive || stage < 0 || stage >= ORDER_METRICS_NUM_STAGES) return;
+
+    closeStage(now_ms);
+    m_currentStage = stage;
+    m_stageEnteredMs[stage] = now_ms;
+}
+
+void OrderMetrics::endOrder(unsigned long now_ms) {
+    if (!m_orderActive) return;
+
+    closeStage(now_ms);
+    m_orders.add(now_ms - m_orderStartMs);
+    countCompletedOrder(now_ms);
+    m_orderActive = false;
+}
+
+void OrderMetrics::recordFirstGram(unsigned long at_ms) {
+    if (!m_orderActive || m_firstGramRecorded) return;
+
+    m_firstGram.add(at_ms - m_orderStartMs);
+    m_firstGramRecorded = true;
+}
+
+void OrderMetrics::reset() {
+    for (int i = 0; i < ORDER_METRICS_NUM_STAGES; i++) {
+        m_stages[i].clear();
+        m_stageEnteredMs[i] = 0;
+    }
+    m_orders.clear();
+    m_firstGram.clear();
+
+    m_orderActive = false;
+    m_currentStage = -1;
+    m_orderStartMs = 0;
+    m_firstGramRecorded = false;
+
+    m_completedOrders = 0;
+    m_abortedOrders = 0;
+    for (int i = 0; i < ORDER_METRICS_RATE_WINDOW; i++) {
+        m_rateMinute[i] = 0;
+        m_rateCount[i] = 0;
+    }
+}
+
+bool OrderMetrics::isOrderActive() const {
+    return m_orderActive;
+}
+
+const OrderMetrics::Histogram& OrderMetrics::stageHistogram(int stage) const {
+    return m_stages[constrain(stage, 0, ORDER_METRICS_NUM_STAGES - 1)];
+}
+
+const OrderMetrics::Histogram& OrderMetrics::orderHistogram() const {
+    return m_orders;
+}
+
+const OrderMetrics::Histogram& OrderMetrics::firstGramHistogram() const {
+    return m_firstGram;
+}
+
+unsigned long OrderMetrics::drinksLastHour(unsigned long now_ms) const {
+    unsigned long minute = now_ms / 60000UL;
+    unsigned long total = 0;
+
+    for (int i = 0; i < ORDER_METRICS_RATE_WINDOW; i++) {
+        if (m_rateCount[i] > 0 && minute - m_rateMinute[i] < ORDER_METRICS_RATE_WINDOW) {
+            total += m_rateCount[i];
+        }
+    }
+    return total;
+}
+
+static void appendHistogramJson(String& out, const OrderMetrics::Histogram& h) {
+    out += "{\"count\":";
+    out += h.count;
+    out += ",\"avg_ms\":";
+    out += h.count > 0 ? h.sum_ms / h.count : 0;
+    out += ",\"min_ms\":";
+    out += h.min_ms;
+    out += ",\"max_ms\":";
+    out += h.max_ms;
+    out += ",\"buckets\":[";
+    for (int i = 0; i < ORDER_METRICS_NUM_BUCKETS; i++) {
+        if (i > 0) out += ',';
+        out += h.buckets[i];
+    }
+    out += "]}";
+}
+
+String OrderMetrics::toJson(unsigned long now_ms, const char* const* stage_names) const {
+    String out;
+    out.reserve(1024);
+
+    out += "{\"metrics\":\"orders\",\"uptime_ms\":";
+    out += now_ms;
+    out += ",\"completed\":";
+    out += m_completedOrders;
+    out += ",\"aborted\":";
+    out += m_abortedOrders;
+    out += ",\"drinks_last_hour\":";
+    out += drinksLastHour(now_ms);
+    out += ",\"drinks_per_hour_since_boot\":";
+    out += now_ms > 0 ? String(m_completedOrders * 3600000.0f / now_ms, 2) : String("0");
+
+    out += ",\"bucket_limits_ms\":[";
+    for (int i = 0; i < ORDER_METRICS_NUM_BUCKETS - 1; i++) {
+        if (i > 0) out += ',';
+        out += BUCKET_LIMITS_MS[i];
+    }
+    out += "],\"order\":";
+    appendHistogramJson(out, m_orders);
+    out += ",\"first_gram\":";
+    appendHistogramJson(out, m_firstGram);
+
+    out += ",\"stages\":{";
+    for (int i = 0; i < ORDER_METRICS_NUM_STAGES; i++) {
+        if (i > 0) out += ',';
+        out += '"';
+        out += stage_names[i];
+        out += "\":";
+        appendHistogramJson(out, m_stages[i]);
+    }
+    out += "}}";
+
+    return out;
+}
+
+// -------------------- Private Helper Methods --------------------
+
+void OrderMetrics::closeStage(unsigned long now_ms) {
+    if (m_currentStage < 0) return;
+
+    m_stages[m_currentStage].add(now_ms - m_stageEnteredMs[m_currentStage]);
+    m_currentStage = -1;
+}
+
+void OrderMetrics::countCompletedOrder(unsigned long now_ms) {
+    m_completedOrders++;
+
+    unsigned long minute = now_ms / 60000UL;
+    int slot = minute % ORDER_METRICS_RATE_WINDOW;
+    if (m_rateMinute[slot] != minute) {
+        m_rateMinute[slot] = minute;
+        m_rateCount[slot] = 0;
+    }
+    m_rateCount[slot]++;
+}
@@ -0,0 +1,110 @@
+#ifndef ORDER_METRICS_H
+#define ORDER_METRICS_H
+
+#include "Hal.h"
+
+#define ORDER_METRICS_NUM_STAGES 6      // START_ORDER .. FINISH_ORDER
+#define ORDER_METRICS_NUM_BUCKETS 12    // Fixed histogram buckets, last one is overflow
+#define ORDER_METRICS_RATE_WINDOW 60    // One-minute slots kept for the drinks/hour counter
+
+/**
+ * @brief Records per-order stage timings and keeps aggregated histograms in RAM.
+ *
+ * Every state machine transition is timestamped with millis(). When a stage is
+ * left, its duration is added to that stage's histogram. Completed orders feed
+ * a total-duration histogram and the drinks/hour counters. The time from the
+ * start of an order to its first gram of powder has its own histogram: it is
+ * what the customer waits for before anything visibly happens.
+ */
+class OrderMetrics {
+
+public:
+    struct Histogram {
+        unsigned long count = 0;
+        unsigned long sum_ms = 0;
+        unsigned long min_ms = 0;
+        unsigned long max_ms = 0;
+        unsigned long buckets[ORDER_METRICS_NUM_BUCKETS] = {0};
+
+        void add(unsigned long duration_ms);
+        void clear();
+    };
+
+    OrderMetrics();
+
+    /**
+     * @brief Starts timing a new order. An order still in progress is counted as aborted.
+     * @param now_ms  Current millis() timestamp.
+     */
+    void beginOrder(unsigned long now_ms);
+
+    /**
+     * @brief Records a transition into a state machine stage.
+     * @param stage   Stage index (START_ORDER .. FINISH_ORDER).
+     * @param now_ms  Current millis() timestamp.
+     */
+    void enterStage(int stage, unsigned long now_ms);
+
+    /**
+     * @brief Closes the current stage and the order, updating the throughput counters.
+     * @param now_ms  Current millis() timestamp.
+     */
+    void endOrder(unsigned long now_ms);
+
+    /**
+     * @brief Records the first gram of powder of the current order; later ones are ignored.
+     * @param at_ms  millis() timestamp at which it was dispensed.
+     */
+    void recordFirstGram(unsigned long at_ms);
+
+    /// @brief Clears all histograms and counters.
+    void reset();
+
+    /// @brief Whether an order is being timed right now.
+    bool isOrderActive() const;
+
+    /// @brief Histogram of the time spent in a stage.
+    const Histogram& stageHistogram(int stage) const;
+
+    /// @brief Histogram of the total order duration.
+    const Histogram& orderHistogram() const;
+
+    /// @brief Histogram of the time from the start of an order to its first gram of powder.
+    const Histogram& firstGramHistogram() const;
+
+    /// @brief Orders completed during the last hour.
+    unsigned long drinksLastHour(unsigned long now_ms) const;
+
+    /**
+     * @brief Serializes every histogram and counter as a JSON object.
+     * @param now_ms  Current millis() timestamp.
+     * @param stage_names  Names for each stage, indexed like the histograms.
+     */
+    String toJson(unsigned long now_ms, const char* const* stage_names) const;
+
+    /// @brief Upper bound in milliseconds of each histogram bucket (the last one is open-ended).
+    static const unsigned long BUCKET_LIMITS_MS[ORDER_METRICS_NUM_BUCKETS];
+
+private:
+    void closeStage(unsigned long now_ms);
+    void countCompletedOrder(unsigned long now_ms);
+
+    Histogram m_stages[ORDER_METRICS_NUM_STAGES];
+    Histogram m_orders;
+    Histogram m_firstGram;
+
+    // Current order
+    bool m_orderActive = false;
+    int m_currentStage = -1;
+    unsigned long m_orderStartMs = 0;
+    bool m_firstGramRecorded = false;
+    unsigned long m_stageEnteredMs[ORDER_METRICS_NUM_STAGES] = {0};
+
+    // Throughput counters
+    unsigned long m_completedOrders = 0;
+    unsigned long m_abortedOrders = 0;
+    unsigned long m_rateMinute[ORDER_METRICS_RATE_WINDOW] = {0}; // minute number each slot belongs to
+    unsigned long m_rateCount[ORDER_METRICS_RATE_WINDOW] = {0};  // orders completed during that minute
+};
+
+#endif
@@ -0,0 +1,117 @@
+#include <PowerGovernor.h>
+
+static const char* const powerStateNames[NUM_POWER_STATES] = {"active", "idle", "sleep"};
+
+PowerGovernor::PowerGovernor() {}
+
+void PowerGovernor::setHandler(StateHandler handler) {
+    m_handler = handler;
+}
+
+void PowerGovernor::setTimeouts(unsigned long idle_after_ms, unsigned long sleep_after_ms) {
+    m_idleAfterMs = idle_after_ms;
+    m_sleepAfterMs = sleep_after_ms;
+}
+
+unsigned long PowerGovernor::getIdleAfterMs() const {
+    return m_idleAfterMs;
+}
+
+unsigned long PowerGovernor::getSleepAfterMs() const {
+    return m_sleepAfterMs;
+}
+
+void PowerGovernor::update(bool quiescent, unsigned long now_ms) {
+    if (!quiescent) {
+        m_lastActivityMs = now_ms;
+        if (m_state != POWER_ACTIVE) enter(POWER_ACTIVE, now_ms);
+        return;
+    }
+
+    unsigned long quietMs = now_ms - m_lastActivityMs;
+
+    if (m_state == POWER_ACTIVE && quietMs >= m_idleAfterMs) {
+        enter(POWER_IDLE, now_ms);
+    } else if (m_state == POWER_IDLE && m_sleepAfterMs > 0 && quietMs >= m_sleepAfterMs) {
+        enter(POWER_SLEEP, now_ms);
+    }
+}
+
+void PowerGovernor::wake(unsigned long now_ms) {
+    m_lastActivityMs = now_ms;
+    if (m_state != POWER_ACTIVE) enter(POWER_ACTIVE, now_ms);
+}
+
+void PowerGovernor::recordWakeLatency(unsigned long latency_us) {
+    LatencyStats& s = m_wakeLatency;
+    if (s.count == 0 || latency_us < s.min_us) s.min_us = latency_us;
+    if (latency_us > s.max_us) s.max_us = latency_us;
+    s.count++;
+    s.sum_us += latency_us;
+}
+
+int PowerGovernor::getState() const {
+    return m_state;
+}
+
+unsigned long PowerGovernor::timeInState(int state, unsigned long now_ms) const {
+    if (state < 0 || state >= NUM_POWER_STATES) return 0;
+    return m_timeMs[state] + (state == m_state ? now_ms - m_enteredMs : 0);
+}
+
+unsigned long PowerGovernor::getTransitionCount(int state) const {
+    return state >= 0 && state < NUM_POWER_STATES ? m_transitions[state] : 0;
+}
+
+const PowerGovernor::LatencyStats& PowerGovernor::getWakeLatency() const {
+    return m_wakeLatency;
+}
+
+void PowerGovernor::resetStats(unsigned long now_ms) {
+    for (int i = 0; i < NUM_POWER_STATES; i++) {
+        m_timeMs[i] = 0;
+        m_transitions[i] = 0;
+    }
+    m_wakeLatency = LatencyStats();
+    m_enteredMs = now_ms;
+}
+
+String PowerGovernor::toJson(unsigned long now_ms) const {
+    String out = "{\"power\":{\"state\":\"" + String(stateName(m_state)) + "\"";
+    out += ",\"idle_after_ms\":" + String(m_idleAfterMs);
+    out += ",\"sleep_after_ms\":" + String(m_sleepAfterMs);
+
+    out += ",\"time_ms\":{";
+    for (int i = 0; i < NUM_POWER_STATES; i++) {
+        if (i > 0) out += ',';
+        out += "\"" + String(powerStateNames[i]) + "\":" + String(timeInState(i, now_ms));
+    }
+
+    out += "},\"entries\":{";
+    for (int i = 0; i < NUM_POWER_STATES; i++) {
+        if (i > 0) out += ',';
+        out += "\"" + String(powerStateNames[i]) + "\":" + String(m_transitions[i]);
+    }
+
+    const LatencyStats& s = m_wakeLatency;
+    out += "},\"wake_latency_us\":{\"count\":" + String(s.count);
+    out += ",\"min\":" + String(s.min_us);
+    out += ",\"avg\":" + String(s.count ? (unsigned long)(s.sum_us / s.count) : 0UL);
+    out += ",\"max\":" + String(s.max_us) + "}}}";
+    return out;
+}
+
+const char* PowerGovernor::stateName(int state) {
+    return state >= 0 && state < NUM_POWER_STATES ? powerStateNames[state] : "unknown";
+}
+
+// -------------------- Private Helper Methods --------------------
+
+void PowerGovernor::enter(int state, unsigned long now_ms) {
+    m_timeMs[m_state] += now_ms - m_enteredMs;
+    m_enteredMs = now_ms;
+    m_state = state;
+    m_transitions[state]++;
+
+    if (m_handler != nullptr) m_handler(state);
+}
@@ -0,0 +1,86 @@
+#ifndef POWER_GOVERNOR_H
+#define POWER_GOVERNOR_H
+
+#include "Hal.h"
+
+#define POWER_ACTIVE 0          // Full speed
+#define POWER_IDLE 1            // Steppers parked, CPU clock lowered
+#define POWER_SLEEP 2           // Light sleep allowed between ticks, WiFi kept associated
+#define NUM_POWER_STATES 3
+
+#define POWER_IDLE_AFTER_MS 30000UL     // Quiet time before POWER_IDLE
+#define POWER_SLEEP_AFTER_MS 300000UL   // Quiet time before POWER_SLEEP
+
+/**
+ * @brief Decides the power state from how long the machine has been quiet.
+ *
+ * The control step calls update() with whether anything is running; after
+ * idle_after_ms of quiet it steps down to POWER_IDLE, after sleep_after_ms to
+ * POWER_SLEEP. wake() (any command) goes back to POWER_ACTIVE at once. The
+ * platform applies each state through the handler, the governor only keeps
+ * time per state and the wake-to-command latency.
+ */
+class PowerGovernor {
+
+public:
+    typedef void (*StateHandler)(int state);
+
+    struct LatencyStats {
+        unsigned long count = 0;
+        unsigned long min_us = 0;
+        unsigned long max_us = 0;
+        unsigned long long sum_us = 0;
+    };
+
+    PowerGovernor();
+
+    void setHandler(StateHandler handler);
+
+    /**
+     * @param idle_after_ms   Quiet time before POWER_IDLE.
+     * @param sleep_after_ms  Quiet time before POWER_SLEEP, 0 to never sleep.
+     */
+    void setTimeouts(unsigned long idle_after_ms, unsigned long sleep_after_ms);
+    unsigned long getIdleAfterMs() const;
+    unsigned long getSleepAfterMs() const;
+
+    /**
+     * @brief Steps down when the machine has been quiet long enough.
+     * @param quiescent  Nothing is running (no order, actuator or animation).
+     */
+    void update(bool quiescent, unsigned long now_ms);
+
+    /// @brief Back to POWER_ACTIVE right away, e.g. a command arrived.
+    void wake(unsigned long now_ms);
+
+    /// @brief Time from a command arriving while not active to its handler starting.
+    void recordWakeLatency(unsigned long latency_us);
+
+    int getState() const;
+    unsigned long timeInState(int state, unsigned long now_ms) const;
+    unsigned long getTransitionCount(int state) const;
+    const LatencyStats& getWakeLatency() const;
+
+    void resetStats(unsigned long now_ms);
+
+    String toJson(unsigned long now_ms) const;
+
+    static const char* stateName(int state);
+
+private:
+    void enter(int state, unsigned long now_ms);
+
+    StateHandler m_handler = nullptr;
+    unsigned long m_idleAfterMs = POWER_IDLE_AFTER_MS;
+    unsigned long m_sleepAfterMs = POWER_SLEEP_AFTER_MS;
+
+    int m_state = POWER_ACTIVE;
+    unsigned long m_enteredMs = 0;
+    unsigned long m_lastActivityMs = 0;
+
+    unsigned long m_timeMs[NUM_POWER_STATES] = {0};
+    unsigned long m_transitions[NUM_POWER_STATES] = {0};
+    LatencyStats m_wakeLatency;
+};
+
+#endif
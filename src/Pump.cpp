@@ -1,4 +1,5 @@
 #include <Pump.h>
+#include "EventLog.h"
 
 Pump::Pump(String fluid_name, int drive_pin, float calibration_K, bool negated_logic)
     : m_fluid_name(fluid_name),
@@ -7,8 +8,9 @@ Pump::Pump(String fluid_name, int drive_pin, float calibration_K, bool negated_l
       m_negated_logic(negated_logic),
       m_isEnabled(false)
 {
-    pinMode(m_drive_pin, OUTPUT);
+    m_drive.attach(m_drive_pin, m_negated_logic);
     pumpOff(); // Make sure pump is off initially
+    resetModel();
 }
 
 Pump::Pump(String fluid_name, int drive_pin, bool negated_logic)
@@ -30,23 +32,132 @@ void Pump::disable() {
 
 void Pump::calibrate(int milliseconds_run, float milliliters_dispensed) {
     if (milliseconds_run > 0) {
-        m_calibration_K = (milliliters_dispensed * 1000.0f) / milliseconds_run;
+        set_calibration((milliliters_dispensed * 1000.0f) / milliseconds_run);
     }
 }
 
 void Pump::set_calibration(float mL_per_second) {
     if (mL_per_second > 0) {
         m_calibration_K = mL_per_second;
+        resetModel();
     }
 }
 
+float Pump::getCalibration() {
+    return m_calibration_K;
+}
+
+void Pump::setNegatedLogic(bool negated_logic) {
+    m_negated_logic = negated_logic;
+    m_drive.setActiveLow(negated_logic);
+    if (!m_isDispensing) {
+        pumpOff();
+    }
+}
+
+bool Pump::isNegatedLogic() {
+    return m_negated_logic;
+}
+
+void Pump::setFlowMeter(FlowMeter* meter) {
+    FlowMeter* attached = meter != nullptr && meter->isAttached() ? meter : nullptr;
+    if (attached == m_flowMeter) return;
+
+    // Pulses counted so far belong to the old meter: no overrun reading, and a
+    // metered dispense finishes on its timed duration without a measurement
+    m_settling = false;
+    if (m_isDispensing) {
+        m_flowFaulted = true;
+        if (m_flowActive) {
+            m_flowActive = false;
+            m_dispenseDurationMs = m_expectedMs;
+        }
+    }
+    m_flowMeter = attached;
+}
+
+FlowMeter* Pump::getFlowMeter() {
+    return m_flowMeter;
+}
+
+float Pump::getLastDispensedMl() {
+    return m_lastDispensedMl;
+}
+
+float Pump::getFlowOverrunMl() {
+    return m_overrunMl;
+}
+
+unsigned long Pump::getFlowTimeoutCount() {
+    return m_flowTimeouts;
+}
+
+unsigned long Pump::getFlowFaultCount() {
+    return m_flowFaults;
+}
+
+unsigned long Pump::getLastRunMs() {
+    return m_lastRunMs;
+}
+
+CalibrationEstimator::Result Pump::addMeasurement(unsigned long milliseconds_run, float milliliters) {
+    float expected = m_model.predict(milliseconds_run / 1000.0f);
+    CalibrationEstimator::Result result = m_model.update(milliseconds_run / 1000.0f, milliliters);
+
+    if (result == CalibrationEstimator::CALIBRATION_OUTLIER) {
+        LOG_EVENT(LOG_CALIBRATION_OUTLIER, m_fluid_name, milliliters, expected);
+    } else if (result != CalibrationEstimator::CALIBRATION_INVALID) {
+        if (result == CalibrationEstimator::CALIBRATION_RELEARNED) LOG_EVENT(LOG_CALIBRATION_RELEARN, m_fluid_name);
+        LOG_EVENT(LOG_CALIBRATION_SAMPLE, m_fluid_name, milliliters, expected,
+            m_model.getGain(), m_model.getGainStd(), m_model.getOffset());
+        applyModel();
+    }
+    return result;
+}
+
+const CalibrationEstimator& Pump::getCalibrationModel() {
+    return m_model;
+}
+
+bool Pump::setCalibrationModel(const CalibrationState& state) {
+    if (!m_model.setState(state)) return false;
+    applyModel();
+    return true;
+}
+
+bool Pump::isModelApplied() {
+    return m_modelApplied;
+}
+
 void Pump::dispense(float milliliters) {
     if (!m_isEnabled || milliliters <= 0 || m_calibration_K <= 0) {
         return;
     }
 
-    m_dispenseDurationMs = static_cast<unsigned long>((milliliters / m_calibration_K) * 1000);
-    m_dispenseStartTime = millis();
+    float seconds = m_modelApplied ? m_model.commandFor(milliliters) : milliliters / m_calibration_K;
+    m_expectedMs = static_cast<unsigned long>(seconds * 1000);
+    m_dispenseDurationMs = m_expectedMs;
+    m_dispenseStartTime = hal::millis();
+    m_requestedMl = milliliters;
+    m_lastDispensedMl = milliliters;
+    startMetering();
+
+    m_flowActive = m_flowMeter != nullptr;
+    if (m_flowActive) {
+        float pulses_per_mL = m_flowMeter->getPulsesPerMl();
+        float target = milliliters - m_overrunMl;
+        m_targetPulses = target > 0.0f ? static_cast<uint32_t>(target * pulses_per_mL + 0.5f) : 0;
+        if (m_targetPulses == 0) m_targetPulses = 1;
+        m_flowChecked = false;
+
+        // A trusted model bounds the volume by its prediction interval, tighter than the fixed ratio
+        float margin = PUMP_FLOW_TIMEOUT_RATIO - 1.0f;
+        if (m_modelApplied) {
+            float spread = CALIBRATION_GATE_SIGMA * m_model.predictStd(seconds) / milliliters;
+            margin = spread < PUMP_FLOW_MIN_MARGIN ? PUMP_FLOW_MIN_MARGIN : spread < margin ? spread : margin;
+        }
+        m_dispenseDurationMs = static_cast<unsigned long>(m_expectedMs * (1.0f + margin));
+    }
 
     pumpOn();
     m_isDispensing = true;
@@ -58,7 +169,11 @@ void Pump::spin(int milliseconds) {
     }
 
     m_dispenseDurationMs = milliseconds;
-    m_dispenseStartTime = millis();
+    m_dispenseStartTime = hal::millis();
+    m_requestedMl = m_modelApplied ? m_model.predict(milliseconds / 1000.0f) : milliseconds * m_calibration_K / 1000.0f;
+    m_lastDispensedMl = m_requestedMl;
+    m_flowActive = false;
+    startMetering();
 
     pumpOn();
     m_isDispensing = true;
@@ -66,14 +181,55 @@ void Pump::spin(int milliseconds) {
 
 void Pump::update() {
     if (m_isDispensing) {
-        unsigned long now = millis();
-        if ((now - m_dispenseStartTime) >= m_dispenseDurationMs) {
-            pumpOff();
-            m_isDispensing = false;
-            Serial.println("Dispense complete.");
-            disable();
+        unsigned long elapsed = hal::millis() - m_dispenseStartTime;
+        if (m_flowActive) {
+            updateFlow(elapsed);
+        } else if (elapsed >= m_dispenseDurationMs) {
+            finish();
+        }
+    } else if (m_settling && hal::millis() - m_stopMs >= PUMP_FLOW_SETTLE_MS) {
+        // What came after the stop is the overrun of the next dispense
+        uint32_t pulses = m_flowMeter->read();
+        float pulses_per_mL = m_flowMeter->getPulsesPerMl();
+        float overrun = (pulses - m_stopPulses) / pulses_per_mL;
+        m_overrunMl = m_overrunMl > 0.0f ? 0.5f * (m_overrunMl + overrun) : overrun;
+        if (m_overrunMl > 0.5f * m_requestedMl) m_overrunMl = 0.5f * m_requestedMl;
+        m_lastDispensedMl = (pulses - m_startPulses) / pulses_per_mL;
+        m_settling = false;
+        addMeasurement(m_lastRunMs, m_lastDispensedMl);
+    }
+}
+
+void Pump::updateFlow(unsigned long elapsed_ms) {
+    uint32_t counted = m_flowMeter->read() - m_startPulses;
+
+    if (counted >= m_targetPulses) {
+        unsigned long rate_ms = elapsed_ms > 0 ? elapsed_ms : 1;
+        float rate = counted / m_flowMeter->getPulsesPerMl() / (m_calibration_K * rate_ms / 1000.0f);
+        LOG_EVENT(LOG_PUMP_FLOW_DONE, m_fluid_name, counted, rate_ms, rate);
+        finish();
+        return;
+    }
+
+    // Cross-check against the calibration: a meter that barely counts is unplugged or stuck
+    if (!m_flowChecked && elapsed_ms >= m_expectedMs * PUMP_FLOW_CHECK_RATIO) {
+        m_flowChecked = true;
+        float expected = m_calibration_K * elapsed_ms / 1000.0f * m_flowMeter->getPulsesPerMl();
+        if (counted < expected * PUMP_FLOW_MIN_RATIO) {
+            LOG_EVENT(LOG_PUMP_FLOW_FAULT, m_fluid_name, counted);
+            m_flowFaults++;
+            m_flowFaulted = true;
+            m_flowActive = false;
+            m_dispenseDurationMs = m_expectedMs;
+            return;
         }
     }
+
+    if (elapsed_ms >= m_dispenseDurationMs) {
+        LOG_EVENT(LOG_PUMP_FLOW_TIMEOUT, m_fluid_name, counted / m_flowMeter->getPulsesPerMl(), m_requestedMl);
+        m_flowTimeouts++;
+        finish();
+    }
 }
 
 bool Pump::isDispensing() {
@@ -94,10 +250,44 @@ void Pump::setFluidName(String fluid_name) {
 
 // -------------------- Private Helper Methods --------------------
 
+void Pump::startMetering() {
+    m_settling = false;
+    m_flowFaulted = false;
+    if (m_flowMeter != nullptr) m_startPulses = m_flowMeter->read();
+}
+
+void Pump::finish() {
+    pumpOff();
+    m_isDispensing = false;
+    m_lastRunMs = hal::millis() - m_dispenseStartTime;
+
+    // Metered or timed, a pump with a working meter measures what it delivered
+    if (m_flowMeter != nullptr && !m_flowFaulted) {
+        m_stopPulses = m_flowMeter->read();
+        m_stopMs = hal::millis();
+        m_settling = true;
+    }
+
+    LOG_EVENT(LOG_PUMP_DONE, m_fluid_name);
+    disable();
+}
+
+void Pump::resetModel() {
+    float K = m_calibration_K > 0 ? m_calibration_K : 1.0f;
+    m_model.reset(K, PUMP_MODEL_GAIN_STD * K, PUMP_MODEL_OFFSET_STD_S * K, PUMP_MODEL_NOISE_S * K);
+    m_modelApplied = false;
+}
+
+// The rate follows the model once it is trusted; the offset is applied by commandFor()
+void Pump::applyModel() {
+    m_modelApplied = m_model.isConfident(PUMP_MODEL_CONFIDENT);
+    if (m_modelApplied) m_calibration_K = m_model.getGain();
+}
+
 void Pump::pumpOn() {
-    digitalWrite(m_drive_pin, m_negated_logic ? LOW : HIGH);
+    m_drive.on();
 }
 
 void Pump::pumpOff() {
-    digitalWrite(m_drive_pin, m_negated_logic ? HIGH : LOW);
+    m_drive.off();
 }
\ No newline at end of file
@@ -1,10 +1,37 @@
 #ifndef PERISTALTIC_PUMP_H
 #define PERISTALTIC_PUMP_H
 
-#include <Arduino.h>
+#include "Hal.h"
+#include "FlowMeter.h"
+#include "CalibrationEstimator.h"
+
+#define PUMP_FLOW_TIMEOUT_RATIO 1.5f    // With a flow meter, stop on time at this multiple of the calibrated time
+#define PUMP_FLOW_CHECK_RATIO   0.25f   // Share of the calibrated time at which the meter is cross-checked
+#define PUMP_FLOW_MIN_RATIO     0.2f    // Below this share of the calibrated volume there, the meter is not trusted
+#define PUMP_FLOW_SETTLE_MS     2000    // Pulses counted this long after the stop are the overrun
+#define PUMP_FLOW_MIN_MARGIN    0.1f    // Tightest metered timeout over the expected time, once the model is trusted
+
+// Prior of the online calibration model, in seconds of flow at the calibrated rate
+#define PUMP_MODEL_GAIN_STD     0.1f    // Share of the calibrated rate
+#define PUMP_MODEL_OFFSET_STD_S 1.0f
+#define PUMP_MODEL_NOISE_S      0.2f
+#define PUMP_MODEL_CONFIDENT    0.02f   // The model times dispenses once it knows the rate this well
 
 /**
  * @brief Controls a peristaltic pump for fluid dispensing.
+ *
+ * By default a dispense runs for volume / calibration. With a flow meter it
+ * stops on the counted volume instead, less the overrun (what still flows
+ * after the stop, learned from the pulses counted while settling). The
+ * calibrated time stays as the fallback: a dispense that has not counted its
+ * volume by PUMP_FLOW_TIMEOUT_RATIO times it stops anyway, and one whose meter
+ * stays nearly silent in the first PUMP_FLOW_CHECK_RATIO of it finishes on time.
+ *
+ * Every measured outcome (a settled flow meter count, a volume the operator
+ * weighed) goes into an online model of volume = rate * seconds + offset.
+ * Once it knows the rate within PUMP_MODEL_CONFIDENT, dispenses are timed by
+ * the model and the metered timeout shrinks to its prediction interval.
+ * calibrate() and set_calibration() start the model over from the new rate.
  */
 class Pump {
 
@@ -38,6 +65,53 @@ public:
      */
     void set_calibration(float mL_per_second);
 
+    /**
+     * @brief Returns the calibration factor.
+     * @return Calibration factor in mL per second.
+     */
+    float getCalibration();
+
+    /**
+     * @brief Changes the drive logic. The pump is switched off with the new polarity unless it is dispensing.
+     * @param negated_logic  Whether the pump uses negated logic (LOW = on, HIGH = off).
+     */
+    void setNegatedLogic(bool negated_logic);
+    bool isNegatedLogic();
+
+    /// @brief Dispenses by counted volume from now on; nullptr goes back to time alone
+    void setFlowMeter(FlowMeter* meter);
+    FlowMeter* getFlowMeter();
+
+    /// @brief Volume of the last dispense, counted once settled, else the calibrated estimate
+    float getLastDispensedMl();
+
+    /// @brief Flow expected to follow a stop, subtracted from metered dispenses
+    float getFlowOverrunMl();
+
+    /// @brief Metered dispenses stopped on time because the volume was not reached
+    unsigned long getFlowTimeoutCount();
+
+    /// @brief Metered dispenses finished on time because the meter stayed silent
+    unsigned long getFlowFaultCount();
+
+    /// @brief How long the pump ran in its last dispense or spin
+    unsigned long getLastRunMs();
+
+    /**
+     * @brief Folds a measured outcome into the calibration model.
+     * @param milliseconds_run  Time the pump ran.
+     * @param milliliters       Volume that came out.
+     */
+    CalibrationEstimator::Result addMeasurement(unsigned long milliseconds_run, float milliliters);
+
+    const CalibrationEstimator& getCalibrationModel();
+
+    /// @brief Restores a stored model, false if it is not a usable one
+    bool setCalibrationModel(const CalibrationState& state);
+
+    /// @brief Whether dispenses are timed by the model rather than the plain calibration
+    bool isModelApplied();
+
     /**
      * @brief Dispenses a precise amount of fluid.
      * @param milliliters  Volume in mL to dispense.
@@ -77,9 +151,15 @@ public:
 private:
     void pumpOn();
     void pumpOff();
+    void startMetering();
+    void finish();
+    void updateFlow(unsigned long elapsed_ms);
+    void resetModel();
+    void applyModel();
 
     String m_fluid_name = "Default Fluid Name";
     int m_drive_pin;
+    hal::OutputPin m_drive;             // Polarity resolved, on() runs the pump
     float m_calibration_K; // in mL per second
     bool m_negated_logic;
 
@@ -87,6 +167,28 @@ private:
     bool m_isDispensing = false;
     unsigned long m_dispenseStartTime = 0;
     unsigned long m_dispenseDurationMs = 0;
+
+    // Flow metering, all on the task that calls update()
+    FlowMeter* m_flowMeter = nullptr;
+    bool m_flowActive = false;          // This dispense stops on counted volume
+    bool m_flowChecked = false;
+    bool m_flowFaulted = false;         // The meter failed the cross-check of this dispense
+    bool m_settling = false;
+    unsigned long m_expectedMs = 0;     // Calibrated time of the dispense
+    unsigned long m_stopMs = 0;
+    uint32_t m_startPulses = 0;
+    uint32_t m_targetPulses = 0;
+    uint32_t m_stopPulses = 0;
+    float m_requestedMl = 0.0f;
+    float m_lastDispensedMl = 0.0f;
+    float m_overrunMl = 0.0f;
+    unsigned long m_flowTimeouts = 0;
+    unsigned long m_flowFaults = 0;
+    unsigned long m_lastRunMs = 0;
+
+    // Online calibration, m_calibration_K follows it once it is trusted
+    CalibrationEstimator m_model;
+    bool m_modelApplied = false;
 };
 
 #endif
@@ -1,5 +1,20 @@
 #include <StepperPowderDispenser.h>
-#include <Arduino.h>
+#include "EventLog.h"
+#include <limits.h>
+
+// MS1..MS3 levels (bit 0 = MS1) of the A4988 for 1, 2, 4, 8 and 16 microsteps
+static const uint8_t MICROSTEP_SELECT[] = {0b000, 0b001, 0b010, 0b011, 0b111};
+
+static int microstepIndex(int microsteps) {
+    switch (microsteps) {
+        case 1:  return 0;
+        case 2:  return 1;
+        case 4:  return 2;
+        case 8:  return 3;
+        case 16: return 4;
+        default: return -1;
+    }
+}
 
 StepperPowderDispenser::StepperPowderDispenser(
     String powder_name,
@@ -28,130 +43,370 @@ StepperPowderDispenser::StepperPowderDispenser(
     s_vibration_pulse_duration(vibration_pulse_duration),
     s_steps_per_vibration(steps_per_vibration),
     s_steps_till_vibration(steps_per_vibration),
-    s_steps_remaining(0),
+    s_ticks_remaining(0),
     s_stepStartTime(0),
     s_pulseStartTime(0),
     s_isPulsing(false),
     s_isEnabled(false)
 {
-    pinMode(s_step_pin, OUTPUT);
-    digitalWrite(s_step_pin, LOW); // Make sure step pin is LOW initially
-    pinMode(s_dir_pin, OUTPUT);
-    digitalWrite(s_dir_pin, s_dispense_is_CW ? HIGH : LOW); // Make sure step pin is LOW initially
-    pinMode(s_sleep_pin, OUTPUT);
-    digitalWrite(s_sleep_pin, LOW); // Make sure step pin is LOW initially;
+    s_step.attach(s_step_pin);
+    s_step.off(); // Make sure step pin is LOW initially
+    s_dir.attach(s_dir_pin, !s_dispense_is_CW);
+    s_dir.on(); // Dispensing direction
+    s_sleep.attach(s_sleep_pin);
+    s_sleep.off(); // Driver asleep until enabled
+    resetModel();
 }
 
 void StepperPowderDispenser::enable() {
-    digitalWrite(s_dir_pin, s_dispense_is_CW ? HIGH : LOW); // Set direction
-    digitalWrite(s_sleep_pin, HIGH); // Wake up the stepper driver
-    delay(5); // Wait for the driver to wake up
+    s_dir.on(); // Set direction
+    wake(); // The first step waits for the driver, nothing blocks here
 
+    s_holding = false;
     s_isEnabled = true;
 }
 
 void StepperPowderDispenser::disable() {
     s_isEnabled = false;
-    s_steps_remaining = 0;
-    digitalWrite(s_step_pin, LOW);
-    digitalWrite(s_sleep_pin, LOW); // Put the stepper driver to sleep
+    s_ticks_remaining = 0;
+    s_step.off();
     s_isPulsing = false;
+    s_first_step_pending = false;
+    holdOrSleep();
+}
+
+void StepperPowderDispenser::sleep() {
+    s_isEnabled = false;
+    s_ticks_remaining = 0;
+    s_step.off();
+    s_isPulsing = false;
+    s_first_step_pending = false;
+    s_holding = false;
+
+    if (s_awake) {
+        updateDuty();
+        s_awake = false;
+        s_waking = false;
+    }
+    s_sleep.off(); // Put the stepper driver to sleep
+}
+
+void StepperPowderDispenser::wake() {
+    if (!s_awake) {
+        updateDuty();
+        s_sleep.on(); // Wake up the stepper driver
+        s_awake = true;
+        s_waking = true;
+        s_wake_start_us = hal::micros();
+        s_wake_count++;
+    }
+
+    // Woken ahead of a move: hold for the window, as after one
+    if (!s_isEnabled) {
+        s_holding = true;
+        s_hold_start_ms = hal::millis();
+    }
+}
+
+bool StepperPowderDispenser::isAwake() {
+    return s_awake;
+}
+
+void StepperPowderDispenser::setPowerPolicy(unsigned long keep_awake_ms, float max_awake_duty) {
+    if (!(max_awake_duty > 0.0f && max_awake_duty <= 1.0f)) return;
+
+    s_keep_awake_ms = keep_awake_ms;
+    s_max_awake_duty = max_awake_duty;
+}
+
+unsigned long StepperPowderDispenser::getKeepAwakeMs() {
+    return s_keep_awake_ms;
+}
+
+float StepperPowderDispenser::getMaxAwakeDuty() {
+    return s_max_awake_duty;
+}
+
+float StepperPowderDispenser::getAwakeDuty() {
+    return dutyAt(hal::millis());
+}
+
+unsigned long StepperPowderDispenser::getWakeCount() {
+    return s_wake_count;
+}
+
+unsigned long StepperPowderDispenser::getWarmStartCount() {
+    return s_warm_start_count;
+}
+
+unsigned long StepperPowderDispenser::getThermalSleepCount() {
+    return s_thermal_sleep_count;
+}
+
+unsigned long StepperPowderDispenser::getLastWakeLatencyUs() {
+    return s_last_wake_latency_us;
+}
+
+unsigned long StepperPowderDispenser::getMeanWakeLatencyUs() {
+    return s_latency_count > 0 ? static_cast<unsigned long>(s_total_wake_latency_us / s_latency_count) : 0;
+}
+
+unsigned long StepperPowderDispenser::getMaxWakeLatencyUs() {
+    return s_max_wake_latency_us;
+}
+
+void StepperPowderDispenser::resetPowerStats() {
+    s_wake_count = 0;
+    s_warm_start_count = 0;
+    s_thermal_sleep_count = 0;
+    s_last_wake_latency_us = 0;
+    s_max_wake_latency_us = 0;
+    s_total_wake_latency_us = 0;
+    s_latency_count = 0;
 }
 
 void StepperPowderDispenser::calibrate(int steps, float grams_dispensed) {
-    if (grams_dispensed > 0) {
+    if (grams_dispensed > 0 && steps > 0) {
         s_steps_per_gram = static_cast<float>(steps) / grams_dispensed;
+        resetModel();
+        if (!isnan(s_ambient_humidity)) {
+            s_humidity_curve.addSample(s_ambient_humidity, s_steps_per_gram);
+        }
+    }
+}
+
+CalibrationEstimator::Result StepperPowderDispenser::addMeasurement(float steps, float grams) {
+    float expected = s_model.predict(steps);
+    CalibrationEstimator::Result result = s_model.update(steps, grams);
+
+    if (result == CalibrationEstimator::CALIBRATION_OUTLIER) {
+        LOG_EVENT(LOG_CALIBRATION_OUTLIER, s_powder_name, grams, expected);
+        return result;
     }
+    if (result == CalibrationEstimator::CALIBRATION_INVALID) return result;
+
+    if (result == CalibrationEstimator::CALIBRATION_RELEARNED) LOG_EVENT(LOG_CALIBRATION_RELEARN, s_powder_name);
+    LOG_EVENT(LOG_CALIBRATION_SAMPLE, s_powder_name, grams, expected,
+        s_model.getGain(), s_model.getGainStd(), s_model.getOffset());
+    applyModel();
+    return result;
+}
+
+const CalibrationEstimator& StepperPowderDispenser::getCalibrationModel() {
+    return s_model;
+}
+
+bool StepperPowderDispenser::setCalibrationModel(const CalibrationState& state) {
+    if (!s_model.setState(state)) return false;
+    applyModel();
+    return true;
+}
+
+bool StepperPowderDispenser::isModelApplied() {
+    return s_model_applied;
+}
+
+float StepperPowderDispenser::getLastMotionSteps() {
+    return (s_position_ticks - s_motion_start_ticks) / static_cast<float>(STEPPER_MAX_MICROSTEPS);
+}
+
+unsigned long StepperPowderDispenser::getFirstGramCount() {
+    return s_first_gram_count;
+}
+
+unsigned long StepperPowderDispenser::getFirstGramMs() {
+    return s_first_gram_ms;
 }
 
 void StepperPowderDispenser::dispense(float grams) {
-    if (!s_isEnabled || grams <= 0 || s_steps_per_gram <= 0) return;
+    float steps_per_gram = getEffectiveStepsPerGram();
+    if (!s_isEnabled || grams <= 0 || steps_per_gram <= 0) return;
+
+    // What the auger moves beyond its gain (powder left in the spout, a
+    // partly filled first turn) is known once the model is trusted
+    if (s_model_applied) grams = s_model.commandFor(grams) * s_model.getGain();
 
-    digitalWrite(s_dir_pin, s_dispense_is_CW ? HIGH : LOW); // Set direction
+    s_dir.on(); // Set direction
     
     // s_steps_till_vibration = s_steps_per_vibration;
-    
-    s_steps_remaining = static_cast<int>(grams * s_steps_per_gram);
-    s_stepStartTime = micros();
+
+    if (s_has_microstep_pins && s_fine_microsteps > 1 && s_fine_grams > 0) {
+        // End on the fine grid, counted from where the rotor is now
+        long ticks_per_microstep = STEPPER_MAX_MICROSTEPS / s_fine_microsteps;
+        float target = s_tick_phase + grams * steps_per_gram * STEPPER_MAX_MICROSTEPS;
+        long ticks = lroundf(target / ticks_per_microstep) * ticks_per_microstep - s_tick_phase;
+        if (ticks <= 0) return;
+        long fine_ticks = static_cast<long>(s_fine_grams * steps_per_gram * STEPPER_MAX_MICROSTEPS);
+        startMotion(ticks, steps_per_gram, s_fine_microsteps, fine_ticks);
+        return;
+    }
+
+    long steps = static_cast<long>(grams * steps_per_gram);
+    startMotion(steps * STEPPER_MAX_MICROSTEPS, steps_per_gram, 1, 0);
 }
 
 void StepperPowderDispenser::spin(int steps) {
     if (!s_isEnabled || steps <= 0) return;
 
-    Serial.printf("Spinning %d steps\n", steps);
-    digitalWrite(s_dir_pin, s_dispense_is_CW ? HIGH : LOW); // Set direction
+    LOG_EVENT(LOG_STEPPER_SPIN, s_powder_name, steps);
+    s_dir.on(); // Set direction
 
     s_steps_till_vibration = s_steps_per_vibration;
 
-    s_steps_remaining = steps;
-    s_stepStartTime = micros();
+    startMotion(static_cast<long>(steps) * STEPPER_MAX_MICROSTEPS, s_steps_per_gram, 1, 0);
 }
 
 void StepperPowderDispenser::vibrate() {
+    vibrate(s_vibration_cycles);
+}
+
+void StepperPowderDispenser::vibrate(int cycles) {
     if (!s_isEnabled) return;
 
-    for (int x = 0; x < 60; x++) {
-        digitalWrite(s_dir_pin, LOW); // Set direction to LOW
-        delay(1); // Wait for DIR pin to stabilize
+    // Called outside a move right after enable(), the driver may still be waking
+    if (s_waking) {
+        unsigned long awake_us = hal::micros() - s_wake_start_us;
+        if (awake_us < STEPPER_WAKE_US) hal::delayUs(STEPPER_WAKE_US - awake_us);
+        s_waking = false;
+    }
+
+    // Outside a move the column was just loosened; the next one owes no vibration for it
+    if (s_ticks_remaining <= 0) s_steps_till_vibration = s_steps_per_vibration;
+
+    // Same stroke at any resolution, and the rotor comes back to where it was
+    int pulses = 3 * s_microsteps;
+    int half_period = 1000 / s_microsteps;
+
+    for (int x = 0; x < cycles; x++) {
+        s_dir.write(LOW); // Set direction to LOW
+        hal::delayMs(1); // Wait for DIR pin to stabilize
 
         // Spin the stepper motor for 10 steps
-        for (int i = 0; i < 3; i++) {
-            digitalWrite(s_step_pin, HIGH);
-            delayMicroseconds(1000);
-            digitalWrite(s_step_pin, LOW);
-            delayMicroseconds(1000);
+        for (int i = 0; i < pulses; i++) {
+            s_step.on();
+            hal::delayUs(half_period);
+            s_step.off();
+            hal::delayUs(half_period);
         }
 
         // Wait for the motor to stop
-        delay(4);
+        hal::delayMs(4);
 
-        digitalWrite(s_dir_pin, HIGH); // Set direction to HIGH
-        delay(2); // Wait for DIR pin to stabilize
+        s_dir.write(HIGH); // Set direction to HIGH
+        hal::delayMs(2); // Wait for DIR pin to stabilize
         
         // Spin the stepper motor for 10 steps
-        for (int i = 0; i < 3; i++) {
-            digitalWrite(s_step_pin, HIGH);
-            delayMicroseconds(1000);
-            digitalWrite(s_step_pin, LOW);
-            delayMicroseconds(1000);
+        for (int i = 0; i < pulses; i++) {
+            s_step.on();
+            hal::delayUs(half_period);
+            s_step.off();
+            hal::delayUs(half_period);
         }
 
-        delay(5);
+        hal::delayMs(5);
     }
 }
 
 void StepperPowderDispenser::update() {
-    if (!s_isEnabled || s_steps_remaining <= 0) return;
+    if (!s_isEnabled || s_ticks_remaining <= 0) {
+        if (s_holding) updateIdlePower();
+        return;
+    }
 
-    unsigned long currentTime = micros();
+    unsigned long currentTime = hal::micros();
 
     if (!s_isPulsing) {
+        if (s_waking) {
+            if (currentTime - s_wake_start_us < STEPPER_WAKE_US) return;
+            s_waking = false;
+        }
+
         // Check if enough time passed since last step start
         if ((currentTime - s_stepStartTime) >= s_step_interval) {
-            digitalWrite(s_step_pin, HIGH);
+            selectResolution();
+            s_step.on();
             s_pulseStartTime = currentTime;
             s_isPulsing = true;
             s_stepStartTime = currentTime; // Reset timing for next step
+
+            if (s_first_step_pending) {
+                s_first_step_pending = false;
+                s_last_wake_latency_us = currentTime - s_motion_request_us;
+                if (s_last_wake_latency_us > s_max_wake_latency_us) s_max_wake_latency_us = s_last_wake_latency_us;
+                s_total_wake_latency_us += s_last_wake_latency_us;
+                s_latency_count++;
+            }
         }
     } else {
         // Check if pulse duration completed
         if ((currentTime - s_pulseStartTime) >= s_pulse_duration) {
-            digitalWrite(s_step_pin, LOW);
+            s_step.off();
             s_isPulsing = false;
-            s_steps_remaining--;
+
+            int ticks = STEPPER_MAX_MICROSTEPS / s_microsteps;
+            s_ticks_remaining -= ticks;
+            s_position_ticks += ticks;
+            s_grams_dispensed += s_grams_per_step * ticks / STEPPER_MAX_MICROSTEPS;
+            if (s_first_gram_pending && s_grams_dispensed - s_motion_start_grams >= 1.0f) {
+                s_first_gram_pending = false;
+                s_first_gram_ms = hal::millis();
+                s_first_gram_count++;
+            }
+            if (s_ticks_remaining <= 0) {
+                s_ticks_remaining = 0;
+                LOG_EVENT(LOG_STEPPER_DONE, s_powder_name, static_cast<unsigned long>(s_vibration_count));
+            }
+
+            // Vibration is scheduled in full steps, whatever the resolution
+            s_tick_phase += ticks;
+            if (s_tick_phase < STEPPER_MAX_MICROSTEPS) return;
+            s_tick_phase -= STEPPER_MAX_MICROSTEPS;
+
+            s_steps_since_decision++;
             s_steps_till_vibration--;
             if (s_steps_till_vibration <= 0) {
-                vibrate();
-                s_steps_till_vibration = s_steps_per_vibration;
-                digitalWrite(s_dir_pin, s_dispense_is_CW ? HIGH : LOW); // Set direction
-                delay(100); // Wait for the powder to settle
+                VibrationPolicy* policy = getVibrationPolicy();
+                VibrationContext ctx = makeVibrationContext();
+
+                int cycles = policy->vibrationCycles(ctx);
+                if (cycles > 0) {
+                    unsigned long vibrationStart = hal::micros();
+                    vibrate(cycles);
+                    s_dir.on(); // Set direction
+                    hal::delayMs(100); // Wait for the powder to settle
+                    s_vibration_time_us += hal::micros() - vibrationStart;
+                    s_vibration_count++;
+                    s_has_flow_signal = false; // The flow it acted on is history, wait for the next report
+                }
+
+                s_steps_till_vibration = policy->stepsUntilNextDecision(ctx);
+                s_steps_since_decision = 0;
             }
         }
     }
 }
 
+unsigned long StepperPowderDispenser::getMicrosUntilNextEdge() {
+    if (!s_isEnabled || s_ticks_remaining <= 0) return ULONG_MAX;
+
+    unsigned long now = hal::micros();
+    unsigned long since;
+    unsigned long wait;
+    if (s_isPulsing) {
+        since = now - s_pulseStartTime;
+        wait = s_pulse_duration;
+    } else if (s_waking) {
+        since = now - s_wake_start_us;
+        wait = STEPPER_WAKE_US;
+    } else {
+        since = now - s_stepStartTime;
+        wait = s_step_interval;
+    }
+    return since < wait ? wait - since : 0;
+}
+
 bool StepperPowderDispenser::isDispensing() {
-    return s_steps_remaining > 0;
+    return s_ticks_remaining > 0;
 }
 
 String StepperPowderDispenser::getPowderName() {
@@ -162,25 +417,326 @@ void StepperPowderDispenser::setPowderName(String name) {
     s_powder_name = name;
 }
 
-void StepperPowderDispenser::setStepsPerGram(int steps_per_gram) {
-    s_steps_per_gram = steps_per_gram;
+void StepperPowderDispenser::setStepsPerGram(float steps_per_gram) {
+    if (steps_per_gram > 0) {
+        s_steps_per_gram = steps_per_gram;
+        resetModel();
+    }
+}
+
+float StepperPowderDispenser::getStepsPerGram() {
+    return s_steps_per_gram;
+}
+
+void StepperPowderDispenser::setStepTiming(int step_interval, int pulse_duration) {
+    if (step_interval <= 0 || pulse_duration <= 0) return;
+
+    s_step_interval = step_interval;
+    s_pulse_duration = pulse_duration;
+}
+
+int StepperPowderDispenser::getStepInterval() {
+    return s_step_interval;
+}
+
+int StepperPowderDispenser::getPulseDuration() {
+    return s_pulse_duration;
+}
+
+int StepperPowderDispenser::getStepsPerRevolution() {
+    return s_steps_per_revolution;
+}
+
+void StepperPowderDispenser::setGramsPerRevolution(float grams_per_revolution) {
+    if (grams_per_revolution > 0) {
+        setStepsPerGram(s_steps_per_revolution / grams_per_revolution);
+    }
+}
+
+float StepperPowderDispenser::getGramsPerRevolution() {
+    if (s_steps_per_gram <= 0) return 0.0f;
+    return s_steps_per_revolution / s_steps_per_gram;
+}
+
+void StepperPowderDispenser::setMicrostepPins(int ms1_pin, int ms2_pin, int ms3_pin) {
+    int pins[3] = {ms1_pin, ms2_pin, ms3_pin};
+    s_has_microstep_pins = false;
+    for (int i = 0; i < 3; i++) {
+        s_ms_wired[i] = pins[i] != STEPPER_NO_PIN;
+        if (s_ms_wired[i]) {
+            s_ms[i].attach(pins[i]);
+            s_has_microstep_pins = true;
+        }
+    }
+    s_microsteps = 0; // Force the pins to be written
+    setResolution(1);
+}
+
+bool StepperPowderDispenser::hasMicrostepPins() {
+    return s_has_microstep_pins;
+}
+
+bool StepperPowderDispenser::setFineDispense(int microsteps, float fine_grams) {
+    int index = microstepIndex(microsteps);
+    if (index < 0 || fine_grams < 0) return false;
+
+    // Pins that are not wired are taken as pulled low, like the A4988 does
+    for (int i = 0; i < 3; i++) {
+        if ((MICROSTEP_SELECT[index] & (1 << i)) && !s_ms_wired[i]) return false;
+    }
+
+    s_fine_microsteps = microsteps;
+    s_fine_grams = fine_grams;
+    return true;
+}
+
+int StepperPowderDispenser::getFineMicrosteps() {
+    return s_fine_microsteps;
+}
+
+float StepperPowderDispenser::getFineGrams() {
+    return s_fine_grams;
+}
+
+int StepperPowderDispenser::getMicrosteps() {
+    return s_microsteps;
+}
+
+long StepperPowderDispenser::getPositionTicks() {
+    return s_position_ticks;
+}
+
+void StepperPowderDispenser::setVibrationTiming(int vibration_step_interval, int vibration_pulse_duration, int steps_per_vibration) {
+    if (vibration_step_interval <= 0 || vibration_pulse_duration <= 0 || steps_per_vibration <= 0) return;
+
+    s_vibration_step_interval = vibration_step_interval;
+    s_vibration_pulse_duration = vibration_pulse_duration;
+    s_steps_per_vibration = steps_per_vibration;
+    if (s_steps_till_vibration > s_steps_per_vibration) {
+        s_steps_till_vibration = s_steps_per_vibration;
+    }
+}
+
+int StepperPowderDispenser::getVibrationStepInterval() {
+    return s_vibration_step_interval;
+}
+
+int StepperPowderDispenser::getVibrationPulseDuration() {
+    return s_vibration_pulse_duration;
+}
+
+int StepperPowderDispenser::getStepsPerVibration() {
+    return s_steps_per_vibration;
+}
+
+bool StepperPowderDispenser::isDispenseCW() {
+    return s_dispense_is_CW;
+}
+
+void StepperPowderDispenser::setAmbientHumidity(float relative_humidity) {
+    s_ambient_humidity = relative_humidity;
+}
+
+float StepperPowderDispenser::getAmbientHumidity() {
+    return s_ambient_humidity;
+}
+
+void StepperPowderDispenser::setHumidityCompensation(bool enabled) {
+    s_humidity_compensation = enabled;
+}
+
+bool StepperPowderDispenser::isHumidityCompensated() {
+    return s_humidity_compensation;
+}
+
+HumidityCurve& StepperPowderDispenser::getHumidityCurve() {
+    return s_humidity_curve;
+}
+
+void StepperPowderDispenser::setVibrationPolicy(VibrationPolicy* policy) {
+    s_vibration_policy = policy;
+}
+
+VibrationPolicy* StepperPowderDispenser::getVibrationPolicy() {
+    static FixedVibrationPolicy fixedPolicy;
+    return s_vibration_policy != nullptr ? s_vibration_policy : &fixedPolicy;
+}
+
+void StepperPowderDispenser::reportDispensedGrams(float grams_total) {
+    // Nothing moved since the previous report: the ratio it gave still stands
+    float steps = getLastMotionSteps();
+    float expected = (steps - s_flow_steps) * s_grams_per_step;
+    if (expected <= 0.0f) return;
+
+    s_flow_ratio = (grams_total - s_flow_grams) / expected;
+    s_flow_grams = grams_total;
+    s_flow_steps = steps;
+    s_flow_report_ms = hal::millis();
+    s_has_flow_signal = true;
+}
+
+unsigned long StepperPowderDispenser::getVibrationCount() {
+    return s_vibration_count;
+}
+
+unsigned long long StepperPowderDispenser::getVibrationTimeUs() {
+    return s_vibration_time_us;
+}
+
+float StepperPowderDispenser::getGramsDispensed() {
+    return s_grams_dispensed;
+}
+
+float StepperPowderDispenser::getVibrationMsPerGram() {
+    if (s_grams_dispensed <= 0.0f) return 0.0f;
+    return (s_vibration_time_us / 1000.0f) / s_grams_dispensed;
+}
+
+void StepperPowderDispenser::resetVibrationStats() {
+    s_vibration_count = 0;
+    s_vibration_time_us = 0;
+    s_motion_start_grams -= s_grams_dispensed; // A motion under way still counts from where it started
+    s_grams_dispensed = 0.0f;
+}
+
+float StepperPowderDispenser::getEffectiveStepsPerGram() {
+    if (!s_humidity_compensation) return s_steps_per_gram;
+    return s_humidity_curve.evaluate(s_ambient_humidity, s_steps_per_gram);
 }
 
 void StepperPowderDispenser::printDebugInfo() {
-    Serial.println(F("--- Stepper Powder Dispenser Debug Info ---"));
-    Serial.print(F("Powder Name: "));
-    Serial.println(s_powder_name);
-    Serial.print(F("Steps Per Gram: "));
-    Serial.println(s_steps_per_gram, 4); // Print with 4 decimal places for precision
-    Serial.print(F("Pulse Duration (us): "));
-    Serial.println(s_pulse_duration);
-    Serial.print(F("Step Interval (us): "));
-    Serial.println(s_step_interval);
-    Serial.print(F("Steps Remaining: "));
-    Serial.println(s_steps_remaining);
-    Serial.print(F("Is Pulsing: "));
-    Serial.println(s_isPulsing ? "True" : "False");
-    Serial.print(F("Enabled: "));
-    Serial.println(s_isEnabled ? "True" : "False");
-    Serial.println(F("-----------------------------------------"));
-}
\ No newline at end of file
+    hal::println("--- Stepper Powder Dispenser Debug Info ---");
+    hal::printf("Powder Name: %s\n", s_powder_name.c_str());
+    hal::printf("Steps Per Gram: %.4f\n", s_steps_per_gram); // Print with 4 decimal places for precision
+    hal::printf("Humidity Compensation: %s\n", s_humidity_compensation ? "On" : "Off");
+    hal::printf("Effective Steps Per Gram: %.4f\n", getEffectiveStepsPerGram());
+    hal::printf("Pulse Duration (us): %d\n", s_pulse_duration);
+    hal::printf("Step Interval (us): %d\n", s_step_interval);
+    hal::printf("Grams Per Revolution: %.4f\n", getGramsPerRevolution());
+    hal::printf("Microsteps: %d (fine %d for the last %.3f g)\n", s_microsteps, s_fine_microsteps, s_fine_grams);
+    hal::printf("Steps Remaining: %.2f\n", s_ticks_remaining / static_cast<float>(STEPPER_MAX_MICROSTEPS));
+    hal::printf("Driver: %s, keeps awake %lu ms after a move, up to %.0f%% of the time\n",
+        s_awake ? (s_holding ? "holding" : "awake") : "asleep", s_keep_awake_ms, s_max_awake_duty * 100.0f);
+    hal::printf("Is Pulsing: %s\n", s_isPulsing ? "True" : "False");
+    hal::printf("Enabled: %s\n", s_isEnabled ? "True" : "False");
+    hal::println("-----------------------------------------");
+}
+
+// -------------------- Private Helper Methods --------------------
+
+VibrationContext StepperPowderDispenser::makeVibrationContext() {
+    VibrationContext ctx;
+    ctx.configured_steps_per_vibration = s_steps_per_vibration;
+    ctx.configured_cycles = s_vibration_cycles;
+    ctx.relative_humidity = s_ambient_humidity;
+    ctx.steps_remaining = s_ticks_remaining / STEPPER_MAX_MICROSTEPS;
+    ctx.steps_since_decision = s_steps_since_decision;
+    ctx.has_flow_signal = s_has_flow_signal && hal::millis() - s_flow_report_ms <= STEPPER_FLOW_SIGNAL_MS;
+    ctx.flow_ratio = ctx.has_flow_signal ? s_flow_ratio : 1.0f;
+    return ctx;
+}
+
+void StepperPowderDispenser::startMotion(long ticks, float steps_per_gram, int fine_microsteps, long fine_ticks) {
+    s_grams_per_step = steps_per_gram > 0 ? 1.0f / steps_per_gram : 0.0f;
+    s_flow_grams = 0.0f;
+    s_flow_steps = 0.0f;
+    s_has_flow_signal = false;
+    s_steps_since_decision = 0;
+
+    s_motion_start_ticks = s_position_ticks;
+    s_motion_start_grams = s_grams_dispensed;
+    s_first_gram_pending = true;
+    s_motion_request_us = hal::micros();
+    s_first_step_pending = true;
+    if (s_awake && !s_waking) s_warm_start_count++;
+    s_motion_microsteps = fine_microsteps;
+    s_fine_ticks = fine_ticks;
+    s_ticks_remaining = ticks;
+    s_stepStartTime = hal::micros();
+}
+
+void StepperPowderDispenser::selectResolution() {
+    if (!s_has_microstep_pins) return;
+
+    int wanted = 1;
+    if (s_ticks_remaining < STEPPER_MAX_MICROSTEPS) {
+        // Less than a full step left, only happens after fine steps
+        wanted = s_motion_microsteps > 1 ? s_motion_microsteps : STEPPER_MAX_MICROSTEPS;
+    } else if (s_motion_microsteps > 1 && s_ticks_remaining <= s_fine_ticks) {
+        wanted = s_motion_microsteps;
+    }
+
+    // Coarser steps only from a position they land on, finish the partial step first
+    if (wanted < s_microsteps && s_tick_phase % (STEPPER_MAX_MICROSTEPS / wanted) != 0) {
+        wanted = s_microsteps;
+    }
+
+    if (wanted != s_microsteps) setResolution(wanted);
+}
+
+void StepperPowderDispenser::setResolution(int microsteps) {
+    int index = microstepIndex(microsteps);
+    if (index < 0 || microsteps == s_microsteps) return;
+
+    for (int i = 0; i < 3; i++) {
+        if (s_ms_wired[i]) s_ms[i].set(MICROSTEP_SELECT[index] & (1 << i));
+    }
+    s_microsteps = microsteps;
+}
+
+void StepperPowderDispenser::resetModel() {
+    float gain = s_steps_per_gram > 0 ? 1.0f / s_steps_per_gram : 1.0f;
+    s_model.reset(gain, STEPPER_MODEL_GAIN_STD * gain, STEPPER_MODEL_OFFSET_STD_G, STEPPER_MODEL_NOISE_G);
+    s_model_applied = false;
+}
+
+// The steps per gram follow the model once it is trusted; the offset is applied by dispense()
+void StepperPowderDispenser::applyModel() {
+    s_model_applied = s_model.isConfident(STEPPER_MODEL_CONFIDENT);
+    if (s_model_applied) s_steps_per_gram = 1.0f / s_model.getGain();
+}
+
+// Sleeps a holding driver at the end of the window, or early if it ran hot; checked once per millisecond
+void StepperPowderDispenser::updateIdlePower() {
+    unsigned long now = hal::millis();
+    if (now == s_last_power_check_ms) return;
+    s_last_power_check_ms = now;
+
+    if (now - s_hold_start_ms >= s_keep_awake_ms) {
+        sleep();
+    } else if (getAwakeDuty() > s_max_awake_duty) {
+        s_thermal_sleep_count++;
+        sleep();
+    }
+}
+
+// Exponential average of the awake share, s_awake unchanged since s_duty_time_ms
+float StepperPowderDispenser::dutyAt(unsigned long now_ms) {
+    unsigned long elapsed = now_ms - s_duty_time_ms;
+    if (elapsed == 0) return s_awake_duty;
+
+    float target = s_awake ? 1.0f : 0.0f;
+    float decay = expf(-(elapsed / 1000.0f) / STEPPER_THERMAL_TAU_S);
+    return target + (s_awake_duty - target) * decay;
+}
+
+// Brings the average up to now, before s_awake changes
+void StepperPowderDispenser::updateDuty() {
+    unsigned long now = hal::millis();
+    s_awake_duty = dutyAt(now);
+    s_duty_time_ms = now;
+}
+
+void StepperPowderDispenser::holdOrSleep() {
+    if (!s_awake) return;
+
+    if (s_keep_awake_ms == 0) {
+        sleep();
+    } else if (getAwakeDuty() > s_max_awake_duty) {
+        s_thermal_sleep_count++;
+        sleep();
+    } else {
+        s_holding = true;
+        s_hold_start_ms = hal::millis();
+    }
+}
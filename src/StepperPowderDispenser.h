@@ -1,10 +1,43 @@
 #ifndef STEPPER_POWDER_DISPENSER_H
 #define STEPPER_POWDER_DISPENSER_H
 
-#include <Arduino.h>
+#include "Hal.h"
+#include "HumidityCompensation.h"
+#include "VibrationPolicy.h"
+#include "CalibrationEstimator.h"
+
+#define STEPPER_MAX_MICROSTEPS 16       // Finest resolution of the driver, position is kept in these ticks
+#define STEPPER_NO_PIN -1
+
+// Driver power
+#define STEPPER_WAKE_US                 5000    // SLEEP high to the first STEP the driver takes
+#define STEPPER_DEFAULT_KEEP_AWAKE_MS   3000    // Holding torque this long after a move
+#define STEPPER_DEFAULT_MAX_AWAKE_DUTY  0.5f    // Share of time awake above which the driver sleeps right after a move
+#define STEPPER_THERMAL_TAU_S           600.0f  // Time constant of the awake share, roughly the motor's thermal one
+
+// Prior of the online calibration model
+#define STEPPER_MODEL_GAIN_STD      0.1f    // Share of the calibrated grams per step
+#define STEPPER_MODEL_OFFSET_STD_G  0.5f
+#define STEPPER_MODEL_NOISE_G       0.2f
+#define STEPPER_MODEL_CONFIDENT     0.02f   // The model sizes dispenses once it knows grams per step this well
+
+// Scale feedback for the vibration policy
+#define STEPPER_FLOW_SIGNAL_MS      500     // A scale report steers the vibration this long, then the policy falls back
 
 /**
  * @brief Controls an stepper motor for powder dispensing.
+ *
+ * The driver is woken without blocking: the first STEP of a move waits out
+ * STEPPER_WAKE_US in update(), so whatever else the motion task runs keeps
+ * going, and wake() can start it ahead of a move. After a move disable()
+ * keeps the driver awake (holding torque, no wake on the next move) for the
+ * keep-awake window, unless the share of time it spent awake, averaged over
+ * STEPPER_THERMAL_TAU_S, is over the limit; sleep() powers it down at once.
+ *
+ * Weighed outcomes go into an online model of grams = gain * steps + offset.
+ * Once it knows the gain within STEPPER_MODEL_CONFIDENT it sets the steps per
+ * gram and its offset is taken off every dispense. calibrate() and
+ * setStepsPerGram() start the model over from the new value.
  */
 class StepperPowderDispenser {
 
@@ -56,16 +89,80 @@ public:
     /// @brief Allow motor to receive commands
     void enable();
 
-    /// @brief Stop motor and prevent further commands
+    /// @brief Stop motor and prevent further commands; the driver sleeps once the keep-awake window is over
     void disable();
 
+    /// @brief Stop motor and put the driver to sleep now
+    void sleep();
+
+    /// @brief Start waking the driver ahead of a move; it goes back to sleep after the keep-awake window if none comes
+    void wake();
+
+    /// @brief Whether the driver is powered (SLEEP high)
+    bool isAwake();
+
+    /**
+     * @brief Driver power policy.
+     * @param keep_awake_ms   How long the driver holds after a move, 0 to sleep right away
+     * @param max_awake_duty  Share of time awake (0..1] above which it sleeps right after a move
+     */
+    void setPowerPolicy(unsigned long keep_awake_ms, float max_awake_duty);
+    unsigned long getKeepAwakeMs();
+    float getMaxAwakeDuty();
+
+    /// @brief Share of time the driver was awake, averaged over STEPPER_THERMAL_TAU_S
+    float getAwakeDuty();
+
+    unsigned long getWakeCount();
+
+    /// @brief Moves that started on a driver that was already awake
+    unsigned long getWarmStartCount();
+
+    /// @brief Times the awake share made the driver sleep instead of holding
+    unsigned long getThermalSleepCount();
+
+    /// @brief From the start of a move to its first STEP, in microseconds
+    unsigned long getLastWakeLatencyUs();
+    unsigned long getMeanWakeLatencyUs();
+    unsigned long getMaxWakeLatencyUs();
+
+    void resetPowerStats();
+
     /**
      * @brief Set calibration ratio (steps per gram)
+     * If the ambient humidity is known, the run is also added to the humidity curve.
      * @param steps             Steps taken during calibration
      * @param grams_dispensed   Actual grams dispensed
      */
     void calibrate(int steps, float grams_dispensed);
 
+    /**
+     * @brief Fold a weighed outcome into the calibration model
+     * @param steps   Full steps the motor took
+     * @param grams   Grams that came out
+     *
+     * The model averages over whatever humidity the samples came at, so it
+     * does not add points to the humidity curve; calibrate() runs do.
+     */
+    CalibrationEstimator::Result addMeasurement(float steps, float grams);
+
+    const CalibrationEstimator& getCalibrationModel();
+
+    /// @brief Restore a stored model, false if it is not a usable one
+    bool setCalibrationModel(const CalibrationState& state);
+
+    /// @brief Whether the model sets the steps per gram and the offset
+    bool isModelApplied();
+
+    /// @brief Full steps taken by the last dispense or spin motion
+    float getLastMotionSteps();
+
+    /// @brief Motions that got to their first gram, by the calibration
+    unsigned long getFirstGramCount();
+
+    /// @brief millis() at which the last of those got there
+    unsigned long getFirstGramMs();
+
     /**
      * @brief Dispense precise amount of powder using calibration
      * @param grams  Grams to dispense
@@ -83,9 +180,18 @@ public:
      */
     void vibrate();
 
+    /**
+     * @brief Vibrates the motor back and forth
+     * @param cycles  Number of back-and-forth cycles
+     */
+    void vibrate(int cycles);
+
     /// @brief Non-blocking update to handle motor movement
     void update();
 
+    /// @brief Microseconds until update() has the next STEP edge to make, ULONG_MAX while not moving
+    unsigned long getMicrosUntilNextEdge();
+
     /// @brief Check if currently dispensing
     bool isDispensing();
 
@@ -99,7 +205,115 @@ public:
      * @brief Set the steps per gram for calibration.
      * @param steps_per_gram The new steps per gram value.
      */
-    void setStepsPerGram(int steps_per_gram);
+    void setStepsPerGram(float steps_per_gram);
+    float getStepsPerGram();
+
+    /**
+     * @brief Set the timing of the dispense motion.
+     * @param step_interval   Microseconds between steps
+     * @param pulse_duration  Duration of pulse in microseconds
+     */
+    void setStepTiming(int step_interval, int pulse_duration);
+    int getStepInterval();
+    int getPulseDuration();
+    int getStepsPerRevolution();
+
+    /**
+     * @brief Calibration as grams per full revolution, independent of the microstep resolution.
+     */
+    void setGramsPerRevolution(float grams_per_revolution);
+    float getGramsPerRevolution();
+
+    /**
+     * @brief Wire the driver's microstep select pins (A4988 MS1..MS3 table).
+     * Until this is called the driver is assumed to be hard-wired to full steps.
+     * @param ms1_pin  MS1 pin, STEPPER_NO_PIN if tied on the board
+     * @param ms2_pin  MS2 pin, STEPPER_NO_PIN if tied on the board
+     * @param ms3_pin  MS3 pin, STEPPER_NO_PIN if tied on the board
+     */
+    void setMicrostepPins(int ms1_pin, int ms2_pin, int ms3_pin);
+    bool hasMicrostepPins();
+
+    /**
+     * @brief Finish each dispense at a finer resolution.
+     * Bulk transfer runs in full steps; once fewer than fine_grams are left the
+     * driver switches to 1/microsteps steps, keeping the same step interval.
+     * @param microsteps  1 (off), 2, 4, 8 or 16
+     * @param fine_grams  Grams at the end of each dispense to run in microsteps
+     * @return false if the resolution is unsupported or the pins are not wired.
+     */
+    bool setFineDispense(int microsteps, float fine_grams);
+    int getFineMicrosteps();
+    float getFineGrams();
+
+    /// @brief Resolution the driver is set to right now, in microsteps per full step
+    int getMicrosteps();
+
+    /// @brief Rotor position since boot, in 1/STEPPER_MAX_MICROSTEPS of a full step
+    long getPositionTicks();
+
+    /**
+     * @brief Set the timing of the vibration motion.
+     * @param vibration_step_interval   Microseconds between steps in vibration motion
+     * @param vibration_pulse_duration  Duration of pulse in microseconds in vibration motion
+     * @param steps_per_vibration       How many steps to take before vibrating in dispense motion
+     */
+    void setVibrationTiming(int vibration_step_interval, int vibration_pulse_duration, int steps_per_vibration);
+    int getVibrationStepInterval();
+    int getVibrationPulseDuration();
+    int getStepsPerVibration();
+
+    /// @brief Whether the dispense motion is clockwise
+    bool isDispenseCW();
+
+    /**
+     * @brief Latest cached relative humidity, used by dispense() when compensation is on.
+     * @param relative_humidity  Humidity in %, NaN if unknown.
+     */
+    void setAmbientHumidity(float relative_humidity);
+    float getAmbientHumidity();
+
+    /// @brief Turn humidity compensation of the steps per gram on or off
+    void setHumidityCompensation(bool enabled);
+    bool isHumidityCompensated();
+
+    /// @brief Calibration samples of steps per gram over humidity
+    HumidityCurve& getHumidityCurve();
+
+    /**
+     * @brief Steps per gram that dispense() would use right now.
+     * @return The humidity curve value if compensation is on, the plain calibration otherwise.
+     */
+    float getEffectiveStepsPerGram();
+
+    /**
+     * @brief Choose when and how long to vibrate during dispense motion.
+     * @param policy  Policy to use, nullptr for the fixed one. Not owned by the dispenser.
+     */
+    void setVibrationPolicy(VibrationPolicy* policy);
+    VibrationPolicy* getVibrationPolicy();
+
+    /**
+     * @brief Feed a flow measurement (e.g. from a scale) for feedback-driven vibration.
+     * The flow ratio is taken over the steps since the previous report and holds
+     * for STEPPER_FLOW_SIGNAL_MS, or until the dispenser vibrates on it.
+     * @param grams_total  Grams dispensed since the current motion started.
+     */
+    void reportDispensedGrams(float grams_total);
+
+    /// @brief Number of vibrations since the stats were last reset
+    unsigned long getVibrationCount();
+
+    /// @brief Time spent vibrating (including settle time) in microseconds
+    unsigned long long getVibrationTimeUs();
+
+    /// @brief Grams pushed by dispense and spin motion, estimated from the calibration
+    float getGramsDispensed();
+
+    /// @brief Vibration time per gram dispensed in milliseconds
+    float getVibrationMsPerGram();
+
+    void resetVibrationStats();
 
     /**
      * @brief Prints the relevant tunable variables of the dispenser for debugging purposes.
@@ -111,6 +325,12 @@ private:
     int s_step_pin;
     int s_dir_pin;
     int s_sleep_pin;
+    hal::OutputPin s_step;               // on() = STEP high
+    hal::OutputPin s_dir;                // on() = dispensing direction
+    hal::OutputPin s_sleep;              // on() = driver awake
+    hal::OutputPin s_ms[3];              // MS1..MS3, only the wired ones are attached
+    bool s_ms_wired[3] = {false, false, false};
+    bool s_has_microstep_pins = false;
 
     // Stepper motor timing
     int s_step_interval;                // microseconds between steps
@@ -126,14 +346,89 @@ private:
     bool s_dispense_is_CW;               // steps per gram of powder dispensed
     float s_steps_per_gram;               // steps per gram of powder dispensed
     int s_steps_per_vibration;          // how many steps to take before vibrating
+    int s_vibration_cycles = VIBRATION_DEFAULT_CYCLES;
+
+    // Microstepping
+    int s_fine_microsteps = 1;          // resolution of the end of each dispense, 1 = off
+    float s_fine_grams = 0.0f;          // grams at the end of each dispense to run fine
+    int s_microsteps = 1;               // current resolution of the driver
+
+    // Vibration policy and feedback
+    VibrationPolicy* s_vibration_policy = nullptr;
+    bool s_has_flow_signal = false;     // s_flow_ratio measured in the current motion
+    float s_flow_ratio = 1.0f;          // measured / expected grams between the last two reports
+    float s_flow_grams = 0.0f;          // grams reported since the motion started
+    float s_flow_steps = 0.0f;          // full steps of the motion at that report
+    unsigned long s_flow_report_ms = 0;
+    int s_steps_since_decision = 0;
+
+    // Vibration stats
+    unsigned long s_vibration_count = 0;
+    unsigned long long s_vibration_time_us = 0;
+    float s_grams_per_step = 0.0f;      // per full step of the current motion
+    float s_grams_dispensed = 0.0f;
+
+    // Humidity compensation
+    HumidityCurve s_humidity_curve;
+    bool s_humidity_compensation = false;
+    float s_ambient_humidity = NAN;     // %RH, NaN until the first reading
     
+    // Driver power
+    unsigned long s_keep_awake_ms = STEPPER_DEFAULT_KEEP_AWAKE_MS;
+    float s_max_awake_duty = STEPPER_DEFAULT_MAX_AWAKE_DUTY;
+    bool s_awake = false;               // SLEEP is high
+    bool s_waking = false;              // awake for less than STEPPER_WAKE_US
+    bool s_holding = false;             // awake without a move, until the keep-awake window is over
+    unsigned long s_wake_start_us = 0;
+    unsigned long s_hold_start_ms = 0;
+    unsigned long s_last_power_check_ms = 0;
+    float s_awake_duty = 0.0f;          // as of s_duty_time_ms
+    unsigned long s_duty_time_ms = 0;
+    bool s_first_step_pending = false;
+    unsigned long s_motion_request_us = 0;
+
+    // Power stats
+    unsigned long s_wake_count = 0;
+    unsigned long s_warm_start_count = 0;
+    unsigned long s_thermal_sleep_count = 0;
+    unsigned long s_last_wake_latency_us = 0;
+    unsigned long s_max_wake_latency_us = 0;
+    unsigned long long s_total_wake_latency_us = 0;
+    unsigned long s_latency_count = 0;
+
+    // Online calibration
+    CalibrationEstimator s_model;
+    bool s_model_applied = false;
+    long s_motion_start_ticks = 0;      // s_position_ticks when the last motion started
+
+    // First gram of each motion
+    float s_motion_start_grams = 0.0f;  // s_grams_dispensed when the last motion started
+    bool s_first_gram_pending = false;
+    unsigned long s_first_gram_ms = 0;
+    unsigned long s_first_gram_count = 0;
+
     // State variables
-    int s_steps_till_vibration;         // steps until next vibration
-    int s_steps_remaining;              // steps remaining in dispense motion
+    int s_steps_till_vibration;         // full steps until next vibration
+    long s_ticks_remaining;             // ticks (1/STEPPER_MAX_MICROSTEPS step) remaining in the motion
+    int s_motion_microsteps = 1;        // fine resolution of the current motion
+    long s_fine_ticks = 0;              // switch to the fine resolution at this many ticks remaining
+    long s_position_ticks = 0;
+    int s_tick_phase = 0;               // ticks past the last full step, 0 when on a full step
     unsigned long s_pulseStartTime;
     unsigned long s_stepStartTime;
     bool s_isPulsing = false;         
     bool s_isEnabled = false;
+
+    VibrationContext makeVibrationContext();
+    void startMotion(long ticks, float steps_per_gram, int fine_microsteps, long fine_ticks);
+    void selectResolution();
+    void setResolution(int microsteps);
+    void resetModel();
+    void applyModel();
+    void updateIdlePower();
+    float dutyAt(unsigned long now_ms);
+    void updateDuty();
+    void holdOrSleep();
 };
 
 #endif
\ No newline at end of file
@@ -1,25 +1,40 @@
 #pragma once
 #include "AnimatedStrip.h"
+#include "LedZones.h"
 #include <FastLED.h>
 
 struct SymmetricFillAnim : public AnimatedStrip::Animation {
-    int start_index, end_index;
+    const LedZone* zone;
+    LedZone own_zone;       // Geometry of an index range, unused with a shared zone
     CRGB color;
-    float center_index;
-    float max_radius;
     const float gamma = 1.5;  // Perceptual gamma correction exponent
+    std::vector<uint8_t> alpha;   // Per zone LED, filled each frame
 
     SymmetricFillAnim(int s, int e, const CRGB& c, float duration_ms, int fps)
-        : start_index(s), end_index(e), color(c) 
+        : zone(&own_zone), color(c)
     {
-        int range = abs(end_index - start_index);
-        center_index = (start_index + end_index) / 2.0f;
-        max_radius = range / 2.0f;
+        own_zone.build(s, e);
+        init(duration_ms, fps);
+    }
 
-        total_frames = fps > 0 ? (duration_ms / 1000.0f) * fps : 1;
-        current_frame = 0;
-        frame_interval_ms = duration_ms / total_frames;
-        last_update_ms = millis();
+    /// @param z  Zone of the table, must outlive the animation
+    SymmetricFillAnim(const LedZone& z, const CRGB& c, float duration_ms, int fps)
+        : zone(&z), color(c)
+    {
+        init(duration_ms, fps);
+    }
+
+    bool getRange(int& start, int& end) const override {
+        start = zone->first;
+        end = zone->last;
+        return true;
+    }
+
+    bool retarget(int s, int e, const CRGB& c) override {
+        own_zone.build(s, e);
+        zone = &own_zone;
+        color = c;
+        return true;
     }
 
     bool update(CRGB* leds) override {
@@ -31,33 +46,42 @@ struct SymmetricFillAnim : public AnimatedStrip::Animation {
 
         // Calculate expanded radius to ensure full coverage at end
         float blur = 3.0f;
-        float radius = linear_progress * (max_radius + blur);
+        float radius = linear_progress * (zone->max_radius + blur);
 
-        for (int i = start_index; i <= end_index; ++i) {
-            float dist = fabs(i - center_index);
-            float edge_dist = dist - (radius - blur);
+        alpha.resize(zone->size());
+        for (size_t k = 0; k < zone->size(); ++k) {
+            float edge_dist = zone->distance[k] - (radius - blur);
             
             if (edge_dist <= 0) {
                 // Core region: full target color
-                leds[i] = color;
+                alpha[k] = 255;
             } 
             else if (edge_dist < blur) {
                 // Transition region: gamma-corrected blend
                 float t = 1.0f - (edge_dist / blur);
                 t = pow(t, gamma);  // Apply gamma to blend ratio
-                leds[i] = blend(leds[i], color, (uint8_t)(t * 255));
+                alpha[k] = (uint8_t)(t * 255);
+            }
+            else {
+                alpha[k] = 0;  // No change
             }
-            // Else: no change (handled implicitly)
         }
+        zone->blend(leds, color, alpha.data());
 
         // Force full coverage on final frame
         if (isFinished()) {
-            for (int i = start_index; i <= end_index; ++i) {
-                leds[i] = color;
-            }
+            zone->fill(leds, color);
         }
 
         current_frame++;
         return !isFinished();
     }
-};
\ No newline at end of file
+
+private:
+    void init(float duration_ms, int fps) {
+        total_frames = fps > 0 ? (duration_ms / 1000.0f) * fps : 1;
+        current_frame = 0;
+        frame_interval_ms = duration_ms / total_frames;
+        last_update_ms = hal::millis();
+    }
+};
@@ -0,0 +1,32 @@
+#include <TaskMailbox.h>
+
+TaskMailbox::TaskMailbox() : m_head(0), m_tail(0), m_drops(0) {}
+
+uint32_t TaskMailbox::post(Work work) {
+    uint32_t head = m_head.load(std::memory_order_relaxed);
+    if (head - m_tail.load(std::memory_order_acquire) >= TASK_MAILBOX_SIZE) {
+        m_drops++;
+        return 0;
+    }
+
+    m_slots[head % TASK_MAILBOX_SIZE] = std::move(work);
+    m_head.store(head + 1, std::memory_order_release);
+    return head + 1;
+}
+
+uint32_t TaskMailbox::drain() {
+    uint32_t tail = m_tail.load(std::memory_order_relaxed);
+
+    while (tail != m_head.load(std::memory_order_acquire)) {
+        Work work = std::move(m_slots[tail % TASK_MAILBOX_SIZE]);
+        m_slots[tail % TASK_MAILBOX_SIZE] = nullptr;
+        m_tail.store(++tail, std::memory_order_release);
+        work();
+    }
+
+    return tail;
+}
+
+uint32_t TaskMailbox::getDropCount() const {
+    return m_drops;
+}
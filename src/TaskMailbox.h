@@ -0,0 +1,47 @@
+#ifndef TASK_MAILBOX_H
+#define TASK_MAILBOX_H
+
+#include <atomic>
+#include <functional>
+#include <stdint.h>
+
+#define TASK_MAILBOX_SIZE 16
+
+/**
+ * @brief Single-producer, single-consumer queue of work items between two tasks.
+ *
+ * The producer posts closures and the consumer runs them in order from drain().
+ * Both ends only touch their own index, so neither side takes a lock. Every
+ * post gets a sequence number and drain() returns the last one it ran, which
+ * lets the consumer publish how far it got next to a state snapshot.
+ */
+class TaskMailbox {
+
+public:
+    typedef std::function<void()> Work;
+
+    TaskMailbox();
+
+    /**
+     * @brief Producer side: queues a work item.
+     * @return Sequence number of the item, 0 if the mailbox was full.
+     */
+    uint32_t post(Work work);
+
+    /**
+     * @brief Consumer side: runs every pending work item.
+     * @return Sequence number of the last item run so far.
+     */
+    uint32_t drain();
+
+    /// @brief Items rejected because the mailbox was full.
+    uint32_t getDropCount() const;
+
+private:
+    Work m_slots[TASK_MAILBOX_SIZE];
+    std::atomic<uint32_t> m_head;       // Items posted, written by the producer
+    std::atomic<uint32_t> m_tail;       // Items taken, written by the consumer
+    uint32_t m_drops;
+};
+
+#endif
@@ -0,0 +1,62 @@
+#include <VibrationPolicy.h>
+#include <math.h>
+
+// -------------------- FixedVibrationPolicy --------------------
+
+int FixedVibrationPolicy::stepsUntilNextDecision(const VibrationContext& ctx) {
+    return ctx.configured_steps_per_vibration > 0 ? ctx.configured_steps_per_vibration : 1;
+}
+
+int FixedVibrationPolicy::vibrationCycles(const VibrationContext& ctx) {
+    return ctx.configured_cycles;
+}
+
+// -------------------- HumidityScaledVibrationPolicy --------------------
+
+HumidityScaledVibrationPolicy::HumidityScaledVibrationPolicy(float dry_rh, float humid_rh, float dry_scale)
+    : m_dry_rh(dry_rh),
+      m_humid_rh(humid_rh > dry_rh ? humid_rh : dry_rh + 1.0f),
+      m_dry_scale(dry_scale > 0.0f ? (dry_scale < 1.0f ? dry_scale : 1.0f) : 0.05f)
+{}
+
+int HumidityScaledVibrationPolicy::stepsUntilNextDecision(const VibrationContext& ctx) {
+    int steps = static_cast<int>(ctx.configured_steps_per_vibration / scale(ctx) + 0.5f);
+    return steps > 0 ? steps : 1;
+}
+
+int HumidityScaledVibrationPolicy::vibrationCycles(const VibrationContext& ctx) {
+    int cycles = static_cast<int>(ctx.configured_cycles * scale(ctx) + 0.5f);
+    return cycles > 0 ? cycles : 1;
+}
+
+float HumidityScaledVibrationPolicy::scale(const VibrationContext& ctx) const {
+    // Unknown humidity: assume the worst and keep the configured vibration
+    if (isnan(ctx.relative_humidity)) return 1.0f;
+
+    float t = (ctx.relative_humidity - m_dry_rh) / (m_humid_rh - m_dry_rh);
+    if (t < 0.0f) t = 0.0f;
+    if (t > 1.0f) t = 1.0f;
+
+    return m_dry_scale + (1.0f - m_dry_scale) * t;
+}
+
+// -------------------- FlowFeedbackVibrationPolicy --------------------
+
+FlowFeedbackVibrationPolicy::FlowFeedbackVibrationPolicy(int check_steps, float clog_flow_ratio)
+    : m_check_steps(check_steps > 0 ? check_steps : 1),
+      m_clog_flow_ratio(clog_flow_ratio)
+{}
+
+int FlowFeedbackVibrationPolicy::stepsUntilNextDecision(const VibrationContext& ctx) {
+    if (!ctx.has_flow_signal) return m_fallback.stepsUntilNextDecision(ctx);
+    return m_check_steps;
+}
+
+int FlowFeedbackVibrationPolicy::vibrationCycles(const VibrationContext& ctx) {
+    if (!ctx.has_flow_signal) return m_fallback.vibrationCycles(ctx);
+
+    // Powder is still flowing, agitating would only cost time
+    if (ctx.flow_ratio >= m_clog_flow_ratio) return 0;
+
+    return ctx.configured_cycles;
+}
@@ -0,0 +1,99 @@
+#ifndef VIBRATION_POLICY_H
+#define VIBRATION_POLICY_H
+
+#define VIBRATION_DEFAULT_CYCLES 60     // Back-and-forth cycles of one anti-clog vibration
+
+/**
+ * @brief What a vibration policy knows when the dispenser asks it for a decision.
+ */
+struct VibrationContext {
+    int configured_steps_per_vibration;  // Tuned value from the dispenser config
+    int configured_cycles;               // Tuned vibration length from the dispenser config
+    float relative_humidity;             // %RH, NaN if unknown
+    int steps_remaining;                 // Steps left in the current motion
+    int steps_since_decision;            // Steps taken since the policy was last asked
+    bool has_flow_signal;                // Whether flow_ratio holds a recent measurement
+    float flow_ratio;                    // Measured / expected grams between the last two scale reports
+};
+
+/**
+ * @brief Decides when and how long a powder dispenser vibrates to break bridges.
+ *
+ * The dispenser asks the policy after every step block: vibrationCycles() says
+ * whether to vibrate now (0 skips) and stepsUntilNextDecision() how many steps
+ * to take before asking again.
+ */
+class VibrationPolicy {
+
+public:
+    virtual ~VibrationPolicy() = default;
+
+    /// @brief Steps to take before the next decision, must be > 0
+    virtual int stepsUntilNextDecision(const VibrationContext& ctx) = 0;
+
+    /// @brief Cycles to vibrate right now, 0 to skip
+    virtual int vibrationCycles(const VibrationContext& ctx) = 0;
+
+    virtual const char* getName() const = 0;
+};
+
+/**
+ * @brief Vibrates every configured number of steps with a fixed length. Original behavior.
+ */
+class FixedVibrationPolicy : public VibrationPolicy {
+
+public:
+    int stepsUntilNextDecision(const VibrationContext& ctx) override;
+    int vibrationCycles(const VibrationContext& ctx) override;
+    const char* getName() const override { return "fixed"; }
+};
+
+/**
+ * @brief Scales vibration with humidity: rare and short in dry air, the configured values when humid.
+ */
+class HumidityScaledVibrationPolicy : public VibrationPolicy {
+
+public:
+    /**
+     * @param dry_rh     At or below this %RH the powder flows freely.
+     * @param humid_rh   At or above this %RH the configured interval and length are used.
+     * @param dry_scale  Fraction of the configured vibration used in dry air (0 - 1).
+     */
+    HumidityScaledVibrationPolicy(float dry_rh = 40.0f, float humid_rh = 70.0f, float dry_scale = 0.25f);
+
+    int stepsUntilNextDecision(const VibrationContext& ctx) override;
+    int vibrationCycles(const VibrationContext& ctx) override;
+    const char* getName() const override { return "humidity"; }
+
+private:
+    float scale(const VibrationContext& ctx) const;
+
+    float m_dry_rh;
+    float m_humid_rh;
+    float m_dry_scale;
+};
+
+/**
+ * @brief Vibrates only when the measured flow drops, meaning the powder is bridging.
+ * Falls back to the fixed behavior when no flow signal is available.
+ */
+class FlowFeedbackVibrationPolicy : public VibrationPolicy {
+
+public:
+    /**
+     * @param check_steps      Steps between flow checks.
+     * @param clog_flow_ratio  Measured/expected flow below which the powder counts as bridging.
+     */
+    FlowFeedbackVibrationPolicy(int check_steps = 12, float clog_flow_ratio = 0.6f);
+
+    int stepsUntilNextDecision(const VibrationContext& ctx) override;
+    int vibrationCycles(const VibrationContext& ctx) override;
+    const char* getName() const override { return "feedback"; }
+
+private:
+    FixedVibrationPolicy m_fallback;
+    int m_check_steps;
+    float m_clog_flow_ratio;
+};
+
+#endif
@@ -0,0 +1,124 @@
+#include "Ws2812Output.h"
+
+#ifdef ARDUINO
+#include <driver/rmt.h>
+
+#define WS2812_RMT_CHANNEL RMT_CHANNEL_0
+#define WS2812_RMT_CLOCK_DIVIDER 2      // 80 MHz APB / 2
+#endif
+
+Ws2812Output::Ws2812Output(uint16_t color_order)
+    : m_order(color_order), m_timing(timingFor(WS2812_RMT_CLOCK_HZ)) {}
+
+bool Ws2812Output::begin(int pin, int num_leds) {
+    m_pin = pin;
+    m_symbols.resize(num_leds * 24);
+
+#ifdef ARDUINO
+    m_channel = WS2812_RMT_CHANNEL;
+
+    rmt_config_t config = RMT_DEFAULT_CONFIG_TX(static_cast<gpio_num_t>(pin), WS2812_RMT_CHANNEL);
+    config.clk_div = WS2812_RMT_CLOCK_DIVIDER;
+    if (rmt_config(&config) != ESP_OK || rmt_driver_install(WS2812_RMT_CHANNEL, 0, 0) != ESP_OK) {
+        hal::println("Error: RMT driver for the LED strip could not be installed");
+        return false;
+    }
+
+    // The counter clock follows the APB clock, ask instead of assuming 40 MHz
+    uint32_t clock_hz = 0;
+    if (rmt_get_counter_clock(WS2812_RMT_CHANNEL, &clock_hz) == ESP_OK && clock_hz > 0) {
+        m_timing = timingFor(clock_hz);
+        m_clockHz = clock_hz;
+    }
+#endif
+
+    m_ready = true;
+    return true;
+}
+
+bool Ws2812Output::show(const CRGB* leds, int num_leds, uint8_t brightness) {
+    if (!m_ready || num_leds <= 0) return false;
+
+    if (isBusy()) {
+        m_busy++;
+        return false;
+    }
+
+    // Nothing is in flight, so the buffer can move
+    if (m_symbols.size() < static_cast<size_t>(num_leds) * 24) m_symbols.resize(num_leds * 24);
+    size_t count = encode(leds, num_leds, brightness, m_order, m_timing, m_symbols.data());
+
+#ifdef ARDUINO
+    if (rmt_write_items(static_cast<rmt_channel_t>(m_channel),
+            reinterpret_cast<const rmt_item32_t*>(m_symbols.data()), count, false) != ESP_OK) {
+        return false;
+    }
+#endif
+
+    unsigned long bit_ticks = m_timing.t1h + m_timing.t1l;
+    if (m_timing.t0h + m_timing.t0l > bit_ticks) bit_ticks = m_timing.t0h + m_timing.t0l;
+    m_frameUs = count * bit_ticks / (m_clockHz / 1000000UL) + WS2812_RESET_US;
+    m_startUs = hal::micros();
+    m_sent = true;
+    m_frames++;
+    return true;
+}
+
+bool Ws2812Output::isBusy() {
+    if (!m_sent) return false;
+
+#ifdef ARDUINO
+    if (rmt_wait_tx_done(static_cast<rmt_channel_t>(m_channel), 0) != ESP_OK) return true;
+#endif
+
+    // Symbols are out, the line still has to stay low long enough to latch
+    return hal::micros() - m_startUs < m_frameUs;
+}
+
+unsigned long Ws2812Output::getFrameCount() const {
+    return m_frames;
+}
+
+unsigned long Ws2812Output::getBusyCount() const {
+    return m_busy;
+}
+
+unsigned long Ws2812Output::getFrameUs() const {
+    return m_frameUs;
+}
+
+size_t Ws2812Output::encode(const CRGB* leds, int num_leds, uint8_t brightness, uint16_t color_order,
+        const Ws2812Timing& timing, Ws2812Symbol* out) {
+    const uint8_t channels[3] = {
+        static_cast<uint8_t>((color_order >> 6) & 7),
+        static_cast<uint8_t>((color_order >> 3) & 7),
+        static_cast<uint8_t>(color_order & 7)
+    };
+
+    Ws2812Symbol zero = {timing.t0h, 1, timing.t0l, 0};
+    Ws2812Symbol one = {timing.t1h, 1, timing.t1l, 0};
+
+    size_t count = 0;
+    for (int i = 0; i < num_leds; i++) {
+        for (int c = 0; c < 3; c++) {
+            uint8_t value = leds[i].raw[channels[c]];
+            if (brightness != 255) value = scale8(value, brightness);
+
+            for (int bit = 7; bit >= 0; bit--) {
+                out[count++] = (value >> bit) & 1 ? one : zero;
+            }
+        }
+    }
+    return count;
+}
+
+Ws2812Timing Ws2812Output::timingFor(unsigned long clock_hz) {
+    // Round to the nearest tick, at 40 MHz a tick is 25 ns
+    unsigned long ticks_per_us = clock_hz / 1000000UL;
+    Ws2812Timing t;
+    t.t0h = (WS2812_T0H_NS * ticks_per_us + 500) / 1000;
+    t.t0l = (WS2812_T0L_NS * ticks_per_us + 500) / 1000;
+    t.t1h = (WS2812_T1H_NS * ticks_per_us + 500) / 1000;
+    t.t1l = (WS2812_T1L_NS * ticks_per_us + 500) / 1000;
+    return t;
+}
@@ -0,0 +1,110 @@
+#ifndef WS2812_OUTPUT_H
+#define WS2812_OUTPUT_H
+
+#include <FastLED.h>
+#include "Hal.h"
+#include <vector>
+
+// Wire order of the color bytes, same octal notation as FastLED's EOrder:
+// each digit is the CRGB channel (0 = r, 1 = g, 2 = b) sent first, second, third
+#define WS2812_RGB 0012
+#define WS2812_GRB 0102
+#define WS2812_BGR 0210
+
+// Bit timing of the WS2812, nanoseconds
+#define WS2812_T0H_NS 400
+#define WS2812_T0L_NS 850
+#define WS2812_T1H_NS 800
+#define WS2812_T1L_NS 450
+#define WS2812_RESET_US 300             // Low time that latches a frame (280 us on the WS2812B)
+
+#define WS2812_RMT_CLOCK_HZ 40000000UL  // RMT counter clock the timings are converted for by default
+
+/**
+ * @brief One encoded bit as the ESP32 RMT peripheral takes it (rmt_item32_t layout):
+ * high for duration0 ticks then low for duration1 ticks.
+ */
+struct Ws2812Symbol {
+    uint32_t duration0 : 15;
+    uint32_t level0 : 1;
+    uint32_t duration1 : 15;
+    uint32_t level1 : 1;
+};
+
+/// @brief High and low times of a 0 and a 1 bit in RMT ticks
+struct Ws2812Timing {
+    uint16_t t0h, t0l, t1h, t1l;
+};
+
+/**
+ * @brief Non-blocking WS2812 output.
+ *
+ * show() converts the frame into RMT symbols and hands them to the RMT
+ * peripheral, which clocks them out by DMA/interrupt while the caller goes on;
+ * FastLED.show() instead keeps the calling task until the frame is out. The
+ * symbol buffer belongs to the transmission in flight, so a frame that arrives
+ * while the previous one is still going out is refused (show() returns false)
+ * and the caller retries later.
+ *
+ * On the host there is no RMT: show() still encodes, and the frame counts as
+ * in flight for its wire time on the virtual clock.
+ */
+class Ws2812Output {
+
+public:
+    /**
+     * @param color_order  WS2812_GRB, WS2812_BGR, ...
+     */
+    Ws2812Output(uint16_t color_order = WS2812_GRB);
+
+    /**
+     * @brief Sets up the RMT channel on a pin and sizes the symbol buffer.
+     * @return false if the RMT driver could not be installed.
+     */
+    bool begin(int pin, int num_leds);
+
+    /**
+     * @brief Starts sending a frame and returns right away.
+     * @param brightness  Scale applied to every channel, like FastLED.setBrightness()
+     * @return false if the previous frame is still being sent (nothing was done).
+     */
+    bool show(const CRGB* leds, int num_leds, uint8_t brightness = 255);
+
+    /// @brief Whether the last frame is still being sent or latched
+    bool isBusy();
+
+    /// @brief Frames sent and frames refused because the output was busy
+    unsigned long getFrameCount() const;
+    unsigned long getBusyCount() const;
+
+    /// @brief Wire time of one frame including the latch, in microseconds
+    unsigned long getFrameUs() const;
+
+    /**
+     * @brief Encodes a frame into one symbol per bit, MSB first, in color_order.
+     * @param out  Room for num_leds * 24 symbols
+     * @return Number of symbols written.
+     */
+    static size_t encode(const CRGB* leds, int num_leds, uint8_t brightness, uint16_t color_order,
+        const Ws2812Timing& timing, Ws2812Symbol* out);
+
+    /// @brief Bit timings for an RMT counter clock
+    static Ws2812Timing timingFor(unsigned long clock_hz);
+
+private:
+    uint16_t m_order;
+    int m_pin = -1;
+    int m_channel = 0;
+    bool m_ready = false;
+    Ws2812Timing m_timing;
+    unsigned long m_clockHz = WS2812_RMT_CLOCK_HZ;
+    std::vector<Ws2812Symbol> m_symbols;
+
+    unsigned long m_startUs = 0;        // hal::micros() when the last frame started
+    unsigned long m_frameUs = 0;
+    bool m_sent = false;
+    unsigned long m_frames = 0;
+    unsigned long m_busy = 0;
+};
+
+#endif
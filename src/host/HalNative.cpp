@@ -0,0 +1,219 @@
+#include "HalNative.h"
+#include "EventLog.h"
+#include <chrono>
+
+namespace hal {
+namespace native {
+
+static uint64_t s_now_us = 0;
+static uint64_t s_blocked_us = 0;
+
+static int s_levels[HAL_NATIVE_MAX_PINS] = {0};
+static int s_modes[HAL_NATIVE_MAX_PINS] = {0};
+static int s_input_levels[HAL_NATIVE_MAX_PINS] = {0};
+static uint32_t s_rising_edges[HAL_NATIVE_MAX_PINS] = {0};
+static uint64_t s_write_count = 0;
+
+static bool s_recording = false;
+static std::vector<GpioEvent> s_events;
+static GpioListener s_listener = nullptr;
+static void* s_listener_context = nullptr;
+
+static PulseSource s_pulse_source = nullptr;
+static void* s_pulse_context = nullptr;
+
+static LogSink s_log_sink = nullptr;
+static void* s_log_context = nullptr;
+static bool s_log_enabled = true;
+
+static bool validPin(int pin) {
+    return pin >= 0 && pin < HAL_NATIVE_MAX_PINS;
+}
+
+uint64_t nowUs() {
+    return s_now_us;
+}
+
+void setTimeUs(uint64_t time_us) {
+    s_now_us = time_us;
+}
+
+void advanceUs(uint64_t delta_us) {
+    s_now_us += delta_us;
+}
+
+uint64_t blockedUs() {
+    return s_blocked_us;
+}
+
+int pinLevel(int pin) {
+    return validPin(pin) ? s_levels[pin] : LOW;
+}
+
+int pinModeOf(int pin) {
+    return validPin(pin) ? s_modes[pin] : 0;
+}
+
+uint32_t risingEdges(int pin) {
+    return validPin(pin) ? s_rising_edges[pin] : 0;
+}
+
+uint64_t writeCount() {
+    return s_write_count;
+}
+
+void setRecording(bool enabled) {
+    s_recording = enabled;
+}
+
+const std::vector<GpioEvent>& events() {
+    return s_events;
+}
+
+void clearEvents() {
+    s_events.clear();
+}
+
+void setGpioListener(GpioListener listener, void* context) {
+    s_listener = listener;
+    s_listener_context = context;
+}
+
+void setInputLevel(int pin, int level) {
+    if (validPin(pin)) s_input_levels[pin] = level;
+}
+
+void setPulseSource(PulseSource source, void* context) {
+    s_pulse_source = source;
+    s_pulse_context = context;
+}
+
+void setLogSink(LogSink sink, void* context) {
+    s_log_sink = sink;
+    s_log_context = context;
+}
+
+void setLogEnabled(bool enabled) {
+    s_log_enabled = enabled;
+}
+
+void reset() {
+    s_now_us = 0;
+    s_blocked_us = 0;
+    for (int i = 0; i < HAL_NATIVE_MAX_PINS; i++) {
+        s_levels[i] = LOW;
+        s_modes[i] = 0;
+        s_input_levels[i] = LOW;
+        s_rising_edges[i] = 0;
+    }
+    s_write_count = 0;
+    s_events.clear();
+}
+
+static void emit(const char* text) {
+    if (!s_log_enabled) return;
+
+    if (s_log_sink != nullptr) {
+        s_log_sink(text, s_log_context);
+    } else {
+        fputs(text, stdout);
+    }
+}
+
+static void emitRecord(const uint8_t* record, uint16_t length, void* context) {
+    char line[320];
+    EventLog::formatText(record, length, line, sizeof(line));
+    emit(line);
+}
+
+void drainEventLog() {
+    eventLog.drain(emitRecord, nullptr);
+}
+
+} // namespace native
+
+// -------------------- HAL implementation --------------------
+
+unsigned long millis() {
+    return static_cast<unsigned long>(native::s_now_us / 1000ULL);
+}
+
+unsigned long micros() {
+    return static_cast<unsigned long>(native::s_now_us);
+}
+
+uint64_t micros64() {
+    return native::s_now_us;
+}
+
+void delayMs(unsigned long ms) {
+    native::s_now_us += ms * 1000ULL;
+    native::s_blocked_us += ms * 1000ULL;
+}
+
+void delayUs(unsigned int us) {
+    native::s_now_us += us;
+    native::s_blocked_us += us;
+}
+
+uint32_t cycles() {
+    // Real time, not virtual: the profiler measures what the code costs on the host
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now).count());
+}
+
+uint32_t cpuMhz() {
+    return 1000;
+}
+
+void gpioMode(int pin, int mode) {
+    if (native::validPin(pin)) native::s_modes[pin] = mode;
+}
+
+void gpioWrite(int pin, int level) {
+    native::s_write_count++;
+    if (!native::validPin(pin)) return;
+
+    level = level ? HIGH : LOW;
+    if (native::s_levels[pin] == level) return;
+
+    native::s_levels[pin] = level;
+    if (level == HIGH) native::s_rising_edges[pin]++;
+
+    if (native::s_recording) {
+        native::s_events.push_back({native::s_now_us, pin, level});
+    }
+    if (native::s_listener != nullptr) {
+        native::s_listener(pin, level, native::s_now_us, native::s_listener_context);
+    }
+}
+
+int gpioRead(int pin) {
+    if (!native::validPin(pin)) return LOW;
+    return native::s_modes[pin] == OUTPUT ? native::s_levels[pin] : native::s_input_levels[pin];
+}
+
+uint32_t pulseCount(int pin) {
+    if (native::s_pulse_source == nullptr) return 0;
+    return native::s_pulse_source(pin, native::s_now_us, native::s_pulse_context);
+}
+
+void println(const char* line) {
+    native::emit(line);
+    native::emit("\n");
+}
+
+void println(const String& line) {
+    println(line.c_str());
+}
+
+void printf(const char* format, ...) {
+    char buffer[512];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    native::emit(buffer);
+}
+
+} // namespace hal
@@ -0,0 +1,203 @@
+#include "PlantModel.h"
+#include <algorithm>
+#include <math.h>
+
+static PlantModel* s_current = nullptr;
+
+PlantModel::PlantModel() {}
+
+PlantModel::~PlantModel() {
+    if (s_current == this) detach();
+}
+
+int PlantModel::addAuger(int step_pin, int dir_pin, int sleep_pin, int dispense_dir_level,
+    float grams_per_step, float humidity_sensitivity) {
+    Auger a;
+    a.step_pin = step_pin;
+    a.dir_pin = dir_pin;
+    a.sleep_pin = sleep_pin;
+    a.dispense_dir_level = dispense_dir_level;
+    a.grams_per_step = grams_per_step;
+    a.humidity_sensitivity = humidity_sensitivity;
+    m_augers.push_back(a);
+    return m_augers.size() - 1;
+}
+
+int PlantModel::addPump(int drive_pin, bool negated_logic, float mL_per_second, float lag_s) {
+    PumpModel p;
+    p.drive_pin = drive_pin;
+    p.negated_logic = negated_logic;
+    p.mL_per_second = mL_per_second;
+    p.lag_s = lag_s;
+    m_pumps.push_back(p);
+    return m_pumps.size() - 1;
+}
+
+void PlantModel::addFlowMeter(int pump, int pin, float pulses_per_mL) {
+    m_pumps[pump].flow_pin = pin;
+    m_pumps[pump].pulses_per_mL = pulses_per_mL;
+}
+
+void PlantModel::setColumnSettling(int auger, float settle_s, float cold_yield) {
+    m_augers[auger].settle_s = settle_s;
+    m_augers[auger].cold_yield = cold_yield;
+}
+
+void PlantModel::setLineDrain(int pump, float line_air_mL, float drain_s) {
+    m_pumps[pump].line_air_mL = line_air_mL;
+    m_pumps[pump].drain_s = drain_s > 0.0f ? drain_s : 300.0f;
+}
+
+void PlantModel::setHumidity(float base_rh, float amplitude_rh, float period_s) {
+    m_base_rh = base_rh;
+    m_amplitude_rh = amplitude_rh;
+    m_period_s = period_s > 0.0f ? period_s : 86400.0f;
+}
+
+float PlantModel::humidityAt(uint64_t time_us) const {
+    double phase = 2.0 * M_PI * (time_us / 1e6) / m_period_s;
+    return m_base_rh + m_amplitude_rh * sin(phase);
+}
+
+void PlantModel::attach() {
+    uint64_t now = hal::native::nowUs();
+
+    for (Auger& a : m_augers) {
+        a.awake = hal::native::pinLevel(a.sleep_pin) == HIGH;
+        a.awake_since_us = now;
+    }
+    for (PumpModel& p : m_pumps) {
+        p.on = hal::native::pinLevel(p.drive_pin) == (p.negated_logic ? LOW : HIGH);
+        p.last_us = now;
+        p.on_since_us = now;
+    }
+
+    s_current = this;
+    hal::native::setGpioListener(onGpio, this);
+    hal::native::setPulseSource(onPulseCount, this);
+}
+
+void PlantModel::detach() {
+    hal::native::setGpioListener(nullptr, nullptr);
+    hal::native::setPulseSource(nullptr, nullptr);
+    if (s_current == this) s_current = nullptr;
+}
+
+void PlantModel::sync() {
+    uint64_t now = hal::native::nowUs();
+    for (PumpModel& p : m_pumps) advancePump(p, now);
+}
+
+PlantModel::Auger& PlantModel::auger(int index) {
+    return m_augers[index];
+}
+
+PlantModel::PumpModel& PlantModel::pump(int index) {
+    return m_pumps[index];
+}
+
+size_t PlantModel::augerCount() const {
+    return m_augers.size();
+}
+
+size_t PlantModel::pumpCount() const {
+    return m_pumps.size();
+}
+
+PlantModel* PlantModel::current() {
+    return s_current;
+}
+
+// -------------------- Private Helper Methods --------------------
+
+void PlantModel::onGpio(int pin, int level, uint64_t time_us, void* context) {
+    static_cast<PlantModel*>(context)->handleGpio(pin, level, time_us);
+}
+
+uint32_t PlantModel::onPulseCount(int pin, uint64_t time_us, void* context) {
+    PlantModel* model = static_cast<PlantModel*>(context);
+    for (PumpModel& p : model->m_pumps) {
+        if (p.flow_pin != pin) continue;
+        model->advancePump(p, time_us);
+        return static_cast<uint32_t>(p.volume_mL * p.pulses_per_mL);
+    }
+    return 0;
+}
+
+void PlantModel::handleGpio(int pin, int level, uint64_t time_us) {
+    for (Auger& a : m_augers) {
+        if (pin == a.sleep_pin) {
+            bool awake = level == HIGH;
+            if (a.awake && !awake) a.awake_us += time_us - a.awake_since_us;
+            if (!a.awake && awake) a.awake_since_us = time_us;
+            a.awake = awake;
+        } else if (pin == a.step_pin && level == HIGH && a.awake) {
+            float rh = humidityAt(time_us);
+            float flow = a.grams_per_step * (1.0f - a.humidity_sensitivity * (rh - 50.0f)) * columnYield(a, time_us);
+            if (flow < 0.0f) flow = 0.0f;
+
+            if (hal::native::pinLevel(a.dir_pin) == a.dispense_dir_level) {
+                a.grams += flow;
+                a.steps_forward++;
+            } else {
+                a.grams -= flow;
+                if (a.grams < 0.0) a.grams = 0.0;
+                a.steps_back++;
+            }
+        }
+    }
+
+    for (PumpModel& p : m_pumps) {
+        if (pin != p.drive_pin) continue;
+
+        advancePump(p, time_us);
+        bool on = level == (p.negated_logic ? LOW : HIGH);
+        if (p.on && !on) p.on_us += time_us - p.on_since_us;
+        if (!p.on && on) p.on_since_us = time_us;
+        p.on = on;
+    }
+}
+
+// Settles toward 1 while the auger stands; the step that ends the pause gets
+// the yield of the column as it was, and loosens it a little
+float PlantModel::columnYield(Auger& a, uint64_t time_us) {
+    if (a.settle_s <= 0.0f) return 1.0f;
+
+    double pause = (time_us - a.last_step_us) / 1e6;
+    a.settled = 1.0 - (1.0 - a.settled) * exp(-pause / a.settle_s);
+    a.last_step_us = time_us;
+
+    float yield = 1.0f - a.settled * (1.0f - a.cold_yield);
+    a.settled *= PLANT_LOOSEN_PER_STEP;
+    return yield;
+}
+
+void PlantModel::advancePump(PumpModel& p, uint64_t time_us) {
+    if (time_us <= p.last_us) return;
+
+    double dt = (time_us - p.last_us) / 1e6;
+    double target = p.on ? p.mL_per_second : 0.0;
+    double volume;
+
+    if (p.lag_s <= 0.0f) {
+        p.flow = target;
+        volume = target * dt;
+    } else {
+        // Exact solution of flow' = (target - flow) / lag over dt
+        double decay = exp(-dt / p.lag_s);
+        volume = target * dt + (p.flow - target) * p.lag_s * (1.0 - decay);
+        p.flow = target + (p.flow - target) * decay;
+    }
+
+    if (p.line_air_mL > 0.0f) {
+        // The air goes out first; a stopped pump lets the line drain back
+        double air = std::min(p.air_mL, volume);
+        p.air_mL -= air;
+        p.air_pumped_mL += air;
+        volume -= air;
+        if (!p.on) p.air_mL += (p.line_air_mL - p.air_mL) * (1.0 - exp(-dt / p.drain_s));
+    }
+    p.volume_mL += volume;
+
+    p.last_us = time_us;
+}
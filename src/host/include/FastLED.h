@@ -0,0 +1,87 @@
+#ifndef HOST_FASTLED_H
+#define HOST_FASTLED_H
+
+/**
+ * @brief Minimal FastLED stand-in for the native build.
+ *
+ * Pixel math (blend8 and friends) matches FastLED bit for bit so animation
+ * output on the host is the same as on the strip. show() only counts frames.
+ */
+
+#include <stdint.h>
+
+typedef uint8_t fract8;
+
+struct CRGB {
+    union {
+        struct {
+            uint8_t r;
+            uint8_t g;
+            uint8_t b;
+        };
+        uint8_t raw[3];
+    };
+
+    enum HTMLColorCode {
+        Black  = 0x000000,
+        White  = 0xFFFFFF,
+        Red    = 0xFF0000,
+        Green  = 0x008000,
+        Blue   = 0x0000FF,
+        Orange = 0xFFA500,
+        Yellow = 0xFFFF00,
+        Purple = 0x800080
+    };
+
+    CRGB() : r(0), g(0), b(0) {}
+    CRGB(uint8_t ir, uint8_t ig, uint8_t ib) : r(ir), g(ig), b(ib) {}
+    CRGB(uint32_t colorcode) : r((colorcode >> 16) & 0xFF), g((colorcode >> 8) & 0xFF), b(colorcode & 0xFF) {}
+    CRGB(HTMLColorCode colorcode) : CRGB(static_cast<uint32_t>(colorcode)) {}
+
+    uint32_t as_uint32_t() const {
+        return (uint32_t(0xFF) << 24) | (uint32_t(r) << 16) | (uint32_t(g) << 8) | uint32_t(b);
+    }
+
+    bool operator==(const CRGB& other) const { return r == other.r && g == other.g && b == other.b; }
+    bool operator!=(const CRGB& other) const { return !(*this == other); }
+};
+
+/// @brief Same as FastLED's blend8() with FASTLED_BLEND_FIXED (the default).
+inline uint8_t blend8(uint8_t a, uint8_t b, uint8_t amountOfB) {
+    uint16_t partial = (a << 8) | b;
+    partial += (b * amountOfB);
+    partial -= (a * amountOfB);
+    return partial >> 8;
+}
+
+/// @brief Same as FastLED's scale8() with FASTLED_SCALE8_FIXED (the default).
+inline uint8_t scale8(uint8_t i, fract8 scale) {
+    return (static_cast<uint16_t>(i) * (1 + static_cast<uint16_t>(scale))) >> 8;
+}
+
+inline CRGB blend(const CRGB& p1, const CRGB& p2, fract8 amountOfP2) {
+    return CRGB(blend8(p1.r, p2.r, amountOfP2), blend8(p1.g, p2.g, amountOfP2), blend8(p1.b, p2.b, amountOfP2));
+}
+
+inline void fill_solid(CRGB* leds, int num_leds, const CRGB& color) {
+    for (int i = 0; i < num_leds; i++) leds[i] = color;
+}
+
+class CFastLED {
+
+public:
+    void show() { m_frames++; }
+    void setBrightness(uint8_t scale) { m_brightness = scale; }
+    uint8_t getBrightness() const { return m_brightness; }
+
+    /// @brief Frames shown since start, host only.
+    unsigned long getFrameCount() const { return m_frames; }
+
+private:
+    uint8_t m_brightness = 255;
+    unsigned long m_frames = 0;
+};
+
+extern CFastLED FastLED;
+
+#endif
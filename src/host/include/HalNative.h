@@ -0,0 +1,80 @@
+#ifndef HAL_NATIVE_H
+#define HAL_NATIVE_H
+
+#include "Hal.h"
+#include <stdint.h>
+#include <vector>
+
+/**
+ * @brief Control surface of the native HAL: virtual clock and recording GPIO.
+ *
+ * Time only moves when the host program advances it (or when the firmware
+ * calls delayMs()/delayUs(), which jump the clock instead of sleeping), so
+ * runs are deterministic and much faster than real time.
+ */
+namespace hal {
+namespace native {
+
+#define HAL_NATIVE_MAX_PINS 64
+
+struct GpioEvent {
+    uint64_t time_us;
+    int pin;
+    int level;
+};
+
+/// @brief Called on every gpioWrite() that changes a pin level.
+typedef void (*GpioListener)(int pin, int level, uint64_t time_us, void* context);
+
+/// @brief Pulses counted on an input pin up to time_us, for hal::pulseCount().
+typedef uint32_t (*PulseSource)(int pin, uint64_t time_us, void* context);
+
+/// @brief Receives every line the firmware logs.
+typedef void (*LogSink)(const char* text, void* context);
+
+// ——— Virtual clock ———
+uint64_t nowUs();
+void setTimeUs(uint64_t time_us);
+void advanceUs(uint64_t delta_us);
+
+/// @brief Total virtual time the firmware spent inside delayMs()/delayUs().
+uint64_t blockedUs();
+
+// ——— Recording GPIO ———
+int pinLevel(int pin);
+int pinModeOf(int pin);
+
+/// @brief Rising edges seen on a pin since the last reset().
+uint32_t risingEdges(int pin);
+
+/// @brief gpioWrite() calls, including ones that did not change the level.
+uint64_t writeCount();
+
+/// @brief Keep a list of every level change; off by default since long runs would fill memory.
+void setRecording(bool enabled);
+const std::vector<GpioEvent>& events();
+void clearEvents();
+
+void setGpioListener(GpioListener listener, void* context);
+
+/// @brief Level returned by gpioRead() for an input pin.
+void setInputLevel(int pin, int level);
+
+/// @brief Where hal::pulseCount() gets its counts; without one every pin counts 0.
+void setPulseSource(PulseSource source, void* context);
+
+// ——— Logger ———
+/// @brief Route log output somewhere else; nullptr restores stdout.
+void setLogSink(LogSink sink, void* context);
+void setLogEnabled(bool enabled);
+
+/// @brief Formats every pending event log record into the log output, like the ESP32 log task.
+void drainEventLog();
+
+/// @brief Clock back to 0, all pins LOW and counters cleared. Listener and log sink are kept.
+void reset();
+
+} // namespace native
+} // namespace hal
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+/**
+ * @brief Minimal subset of the Arduino core needed to build the firmware classes on Linux.
+ *
+ * Only types and macros live here. Clock, GPIO and logging go through Hal.h.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdio.h>
+#include <string>
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT  0x01
+#define OUTPUT 0x03
+
+#define F(string_literal) (string_literal)
+
+template<class T, class L, class H>
+inline T constrain(T value, L low, H high) {
+    return value < low ? low : (value > high ? high : value);
+}
+
+/**
+ * @brief std::string backed stand-in for the Arduino String class.
+ */
+class String {
+
+public:
+    String() {}
+    String(const char* c) : m_s(c != nullptr ? c : "") {}
+    String(const std::string& s) : m_s(s) {}
+    explicit String(char c) : m_s(1, c) {}
+    explicit String(int value) : m_s(std::to_string(value)) {}
+    explicit String(unsigned int value) : m_s(std::to_string(value)) {}
+    explicit String(long value) : m_s(std::to_string(value)) {}
+    explicit String(unsigned long value) : m_s(std::to_string(value)) {}
+    explicit String(float value, unsigned int decimals = 2) { setFloat(value, decimals); }
+    explicit String(double value, unsigned int decimals = 2) { setFloat(value, decimals); }
+
+    const char* c_str() const { return m_s.c_str(); }
+    unsigned int length() const { return m_s.length(); }
+    bool isEmpty() const { return m_s.empty(); }
+    void reserve(unsigned int size) { m_s.reserve(size); }
+
+    char charAt(unsigned int index) const { return index < m_s.size() ? m_s[index] : 0; }
+    char operator[](unsigned int index) const { return charAt(index); }
+
+    bool equals(const String& other) const { return m_s == other.m_s; }
+    bool operator==(const String& other) const { return m_s == other.m_s; }
+    bool operator==(const char* other) const { return m_s == (other != nullptr ? other : ""); }
+    bool operator!=(const String& other) const { return m_s != other.m_s; }
+    bool operator<(const String& other) const { return m_s < other.m_s; }
+    bool startsWith(const String& prefix) const { return m_s.compare(0, prefix.m_s.size(), prefix.m_s) == 0; }
+
+    int indexOf(char c, unsigned int from = 0) const {
+        size_t p = m_s.find(c, from);
+        return p == std::string::npos ? -1 : static_cast<int>(p);
+    }
+
+    String substring(unsigned int from) const {
+        return from < m_s.size() ? String(m_s.substr(from)) : String();
+    }
+
+    String substring(unsigned int from, unsigned int to) const {
+        if (from > to) { unsigned int t = from; from = to; to = t; }
+        if (from >= m_s.size()) return String();
+        return String(m_s.substr(from, to - from));
+    }
+
+    void trim() {
+        size_t first = m_s.find_first_not_of(" \t\r\n");
+        if (first == std::string::npos) { m_s.clear(); return; }
+        size_t last = m_s.find_last_not_of(" \t\r\n");
+        m_s = m_s.substr(first, last - first + 1);
+    }
+
+    long toInt() const { return atol(m_s.c_str()); }
+    float toFloat() const { return static_cast<float>(atof(m_s.c_str())); }
+
+    String& operator+=(const String& other) { m_s += other.m_s; return *this; }
+    String& operator+=(const char* other) { if (other != nullptr) m_s += other; return *this; }
+    bool concat(const char* cstr, unsigned int length) { if (cstr == nullptr) return false; m_s.append(cstr, length); return true; }
+    String& operator+=(char c) { m_s += c; return *this; }
+    String& operator+=(int value) { m_s += std::to_string(value); return *this; }
+    String& operator+=(unsigned int value) { m_s += std::to_string(value); return *this; }
+    String& operator+=(long value) { m_s += std::to_string(value); return *this; }
+    String& operator+=(unsigned long value) { m_s += std::to_string(value); return *this; }
+    String& operator+=(float value) { return *this += String(value); }
+    String& operator+=(double value) { return *this += String(value); }
+
+    const std::string& str() const { return m_s; }
+
+private:
+    void setFloat(double value, unsigned int decimals) {
+        char buffer[48];
+        snprintf(buffer, sizeof(buffer), "%.*f", decimals, value);
+        m_s = buffer;
+    }
+
+    std::string m_s;
+};
+
+inline String operator+(const String& a, const String& b) { String r(a); r += b; return r; }
+inline String operator+(const String& a, const char* b) { String r(a); r += b; return r; }
+inline String operator+(const char* a, const String& b) { String r(a); r += b; return r; }
+
+#endif
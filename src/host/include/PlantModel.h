@@ -0,0 +1,127 @@
+#ifndef PLANT_MODEL_H
+#define PLANT_MODEL_H
+
+#include "HalNative.h"
+#include <vector>
+
+#define PLANT_LOOSEN_PER_STEP 0.97f     // Share of the settling a step leaves
+
+/**
+ * @brief Simple physical models of the machine, driven by the recording GPIO.
+ *
+ * - Auger: every STEP rising edge with the driver awake moves grams_per_step of
+ *   powder, forward or back depending on DIR. Flow drops as humidity rises.
+ *   Optionally the column settles while the auger stands, so the first turns
+ *   after a pause give less; every step, either way, loosens it again.
+ * - Pump: first-order lag between the drive pin and the flow, integrated
+ *   exactly between pin changes. A flow meter on a pump sends pulses_per_mL
+ *   pulses per mL through it, coasting included, to hal::pulseCount().
+ *   Optionally the line drains back while the pump is off; the air that takes
+ *   its place is pumped out before any fluid comes.
+ * - Humidity: slow sinusoid around a base value, fed to the DHT hook.
+ */
+class PlantModel {
+
+public:
+    struct Auger {
+        int step_pin;
+        int dir_pin;
+        int sleep_pin;
+        int dispense_dir_level;         // DIR level of the dispense motion
+        float grams_per_step;           // at 50 %RH
+        float humidity_sensitivity;     // relative flow change per %RH above 50
+        float settle_s = 0.0f;          // time constant of the column settling, 0 = never settles
+        float cold_yield = 1.0f;        // share of the flow a fully settled column gives
+
+        double grams = 0.0;
+        uint32_t steps_forward = 0;
+        uint32_t steps_back = 0;
+        uint64_t awake_us = 0;
+        uint64_t awake_since_us = 0;
+        bool awake = false;
+        double settled = 0.0;           // 0 loose .. 1 fully settled, as of last_step_us
+        uint64_t last_step_us = 0;
+    };
+
+    struct PumpModel {
+        int drive_pin;
+        bool negated_logic;
+        float mL_per_second;            // real flow once up to speed
+        float lag_s;                    // time constant of the flow
+        int flow_pin = -1;              // flow meter output, -1 without one
+        float pulses_per_mL = 0.0f;
+        float line_air_mL = 0.0f;       // air in a fully drained line, 0 = never drains
+        float drain_s = 300.0f;         // time constant of the draining
+
+        double air_mL = 0.0;            // in the line right now
+        double air_pumped_mL = 0.0;     // pushed out ahead of the fluid, in total
+        double volume_mL = 0.0;
+        double flow = 0.0;              // mL/s right now
+        bool on = false;
+        uint64_t last_us = 0;
+        uint64_t on_us = 0;
+        uint64_t on_since_us = 0;
+    };
+
+    PlantModel();
+    ~PlantModel();
+
+    /// @return Index of the model
+    int addAuger(int step_pin, int dir_pin, int sleep_pin, int dispense_dir_level,
+        float grams_per_step, float humidity_sensitivity = 0.0f);
+    int addPump(int drive_pin, bool negated_logic, float mL_per_second, float lag_s = 0.3f);
+
+    /// @brief Puts a flow meter on a pump; its pulses show up on pin
+    void addFlowMeter(int pump, int pin, float pulses_per_mL);
+
+    /**
+     * @param settle_s    Time constant of the column settling while the auger stands.
+     * @param cold_yield  Share of the flow a fully settled column gives (0..1].
+     */
+    void setColumnSettling(int auger, float settle_s, float cold_yield);
+
+    /**
+     * @param line_air_mL  Air in the line once it fully drained.
+     * @param drain_s      Time constant of the draining while the pump is off.
+     */
+    void setLineDrain(int pump, float line_air_mL, float drain_s);
+
+    /**
+     * @param base_rh       Mean relative humidity in %.
+     * @param amplitude_rh  Peak deviation in %.
+     * @param period_s      Period of the swing in seconds.
+     */
+    void setHumidity(float base_rh, float amplitude_rh = 0.0f, float period_s = 86400.0f);
+    float humidityAt(uint64_t time_us) const;
+
+    /// @brief Starts listening to the HAL GPIO and reads the current pin levels.
+    void attach();
+    void detach();
+
+    /// @brief Integrates the pumps up to the current virtual time.
+    void sync();
+
+    Auger& auger(int index);
+    PumpModel& pump(int index);
+    size_t augerCount() const;
+    size_t pumpCount() const;
+
+    /// @brief The currently attached model, for the C-style HAL hooks.
+    static PlantModel* current();
+
+private:
+    static void onGpio(int pin, int level, uint64_t time_us, void* context);
+    static uint32_t onPulseCount(int pin, uint64_t time_us, void* context);
+    void handleGpio(int pin, int level, uint64_t time_us);
+    void advancePump(PumpModel& p, uint64_t time_us);
+    float columnYield(Auger& a, uint64_t time_us);
+
+    std::vector<Auger> m_augers;
+    std::vector<PumpModel> m_pumps;
+
+    float m_base_rh = 50.0f;
+    float m_amplitude_rh = 0.0f;
+    float m_period_s = 86400.0f;
+};
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef HOST_PREFERENCES_H
+#define HOST_PREFERENCES_H
+
+#include "HostArduino.h"
+#include <map>
+#include <string>
+#include <vector>
+
+/**
+ * @brief In-memory stand-in for the ESP32 Preferences (NVS) library.
+ *
+ * Contents live as long as the process, shared by every instance like NVS is.
+ */
+class Preferences {
+
+public:
+    bool begin(const char* name, bool read_only = false) {
+        m_namespace = name != nullptr ? name : "";
+        m_read_only = read_only;
+        return true;
+    }
+
+    void end() {}
+
+    size_t getBytes(const char* key, void* buffer, size_t max_length) {
+        auto it = storage().find(fullKey(key));
+        if (it == storage().end() || it->second.size() > max_length) return 0;
+        memcpy(buffer, it->second.data(), it->second.size());
+        return it->second.size();
+    }
+
+    size_t putBytes(const char* key, const void* value, size_t length) {
+        if (m_read_only) return 0;
+        const uint8_t* bytes = static_cast<const uint8_t*>(value);
+        storage()[fullKey(key)] = std::vector<uint8_t>(bytes, bytes + length);
+        return length;
+    }
+
+    bool remove(const char* key) {
+        return storage().erase(fullKey(key)) > 0;
+    }
+
+private:
+    static std::map<std::string, std::vector<uint8_t>>& storage() {
+        static std::map<std::string, std::vector<uint8_t>> s_storage;
+        return s_storage;
+    }
+
+    std::string fullKey(const char* key) const {
+        return m_namespace + "/" + (key != nullptr ? key : "");
+    }
+
+    std::string m_namespace;
+    bool m_read_only = false;
+};
+
+#endif
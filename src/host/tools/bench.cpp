@@ -0,0 +1,361 @@
+// Host microbenchmarks of the firmware's hot paths, built from the same sources.
+// Prints one JSON document so two commits can be compared with a simple diff
+// or script.
+//
+//   pio run -e bench && .pio/build/bench/program [--filter strip] [--min-time-ms 200] [--repetitions 5]
+
+#include "HalNative.h"
+#include "Machine.h"
+#include "StepperPowderDispenser.h"
+#include "SymmetricFillAnim.h"
+#include "BlinkingSymetricFillAnim.h"
+#include "EventLog.h"
+#include "LedSpanKernels.h"
+#include "BroadcastHub.h"
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+struct BenchOptions {
+    std::string filter;
+    double min_time_ms = 200.0;        // per repetition
+    int repetitions = 5;
+};
+
+struct BenchResult {
+    std::string name;
+    uint64_t iterations = 0;            // per repetition
+    double median_ns = 0.0;
+    double min_ns = 0.0;
+    double max_ns = 0.0;
+};
+
+// Sink for values the compiler must not optimize away
+static volatile uint32_t benchSink = 0;
+
+static std::vector<BenchResult> results;
+
+static double nowNs() {
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * Runs op() in batches until a repetition lasts min_time_ms, then repeats that
+ * many times and keeps the per-op time of every repetition. setup() runs once
+ * before each repetition and is not timed.
+ */
+static void bench(const BenchOptions& opt, const std::string& name,
+    std::function<void()> setup, std::function<void()> op) {
+    if (!opt.filter.empty() && name.find(opt.filter) == std::string::npos) return;
+
+    // Calibrate the iteration count
+    uint64_t iterations = 1;
+    for (;;) {
+        setup();
+        double start = nowNs();
+        for (uint64_t i = 0; i < iterations; i++) op();
+        double elapsed = nowNs() - start;
+
+        if (elapsed >= opt.min_time_ms * 1e6 || iterations >= (1ULL << 32)) break;
+        iterations = elapsed > 0.0 ? std::max<uint64_t>(iterations * 2, iterations * (opt.min_time_ms * 1.2e6 / elapsed)) : iterations * 10;
+    }
+
+    std::vector<double> perOp;
+    for (int r = 0; r < opt.repetitions; r++) {
+        setup();
+        double start = nowNs();
+        for (uint64_t i = 0; i < iterations; i++) op();
+        perOp.push_back((nowNs() - start) / iterations);
+    }
+    std::sort(perOp.begin(), perOp.end());
+
+    BenchResult result;
+    result.name = name;
+    result.iterations = iterations;
+    result.median_ns = perOp[perOp.size() / 2];
+    result.min_ns = perOp.front();
+    result.max_ns = perOp.back();
+    results.push_back(result);
+
+    fprintf(stderr, "%-44s %12.1f ns/op\n", name.c_str(), result.median_ns);
+}
+
+// ——— Animation kernels ———
+
+static CRGB benchLeds[NUM_LEDS];
+
+// Forces one rendered frame per call by moving the virtual clock one interval ahead
+template<class Anim>
+static void benchAnimationKernel(const BenchOptions& opt, const std::string& name, std::function<Anim*()> make) {
+    Anim* anim = nullptr;
+
+    bench(opt, name,
+        [&] {
+            delete anim;
+            hal::native::setTimeUs(1000000);
+            anim = make();
+            anim->perpetual = true;
+            fill_solid(benchLeds, NUM_LEDS, CRGB::Black);
+        },
+        [&] {
+            hal::native::advanceUs(anim->frame_interval_ms * 1000ULL);
+            if (anim->current_frame >= anim->total_frames) anim->current_frame = 0;
+            anim->update(benchLeds);
+        });
+
+    delete anim;
+}
+
+static void benchAnimations(const BenchOptions& opt) {
+    benchAnimationKernel<SymmetricFillAnim>(opt, "anim.symmetricFill.84px", [] {
+        return new SymmetricFillAnim(0, NUM_LEDS - 1, CRGB(0x8352ff), 1000.0f, 60);
+    });
+
+    benchAnimationKernel<RadiatingSymmetricPulseAnim>(opt, "anim.radiatingPulse.84px", [] {
+        return new RadiatingSymmetricPulseAnim(0, NUM_LEDS - 1, false, 0, CRGB::Orange, 1000.0f, 60);
+    });
+
+    benchAnimationKernel<RadiatingSymmetricPulseAnim>(opt, "anim.radiatingPulseInward.84px", [] {
+        return new RadiatingSymmetricPulseAnim(0, NUM_LEDS - 1, true, 0, CRGB::Orange, 1000.0f, 60);
+    });
+}
+
+// ——— Span kernels, scalar reference against the wide path ———
+
+static void benchSpanKernels(const BenchOptions& opt) {
+    static uint8_t alpha[NUM_LEDS];
+    static CRGB other[NUM_LEDS];
+    for (int i = 0; i < NUM_LEDS; i++) {
+        alpha[i] = (i * 37) & 0xFF;
+        other[i] = CRGB(i * 3, 255 - i, i * 7);
+    }
+    auto reset = [] { fill_solid(benchLeds, NUM_LEDS, CRGB(0x204080)); };
+
+    bench(opt, "span.blend.scalar.84px", reset, [] {
+        ledspan::scalar::blendToColor(benchLeds, NUM_LEDS, CRGB::Orange, alpha);
+    });
+    bench(opt, "span.blend.wide.84px", reset, [] {
+        ledspan::wide::blendToColor(benchLeds, NUM_LEDS, CRGB::Orange, alpha);
+    });
+    bench(opt, "span.add.scalar.84px", reset, [] { ledspan::scalar::add(benchLeds, other, NUM_LEDS); });
+    bench(opt, "span.add.wide.84px", reset, [] { ledspan::wide::add(benchLeds, other, NUM_LEDS); });
+    bench(opt, "span.scale.scalar.84px", reset, [] { ledspan::scalar::scale(benchLeds, NUM_LEDS, 200); });
+    bench(opt, "span.scale.wide.84px", reset, [] { ledspan::wide::scale(benchLeds, NUM_LEDS, 200); });
+    bench(opt, "span.fill.scalar.84px", reset, [] { ledspan::scalar::fill(benchLeds, NUM_LEDS, CRGB::Purple); });
+    bench(opt, "span.fill.wide.84px", reset, [] { ledspan::wide::fill(benchLeds, NUM_LEDS, CRGB::Purple); });
+}
+
+// ——— AnimatedStrip with N concurrent animations ———
+
+static void benchStrip(const BenchOptions& opt, int count) {
+    AnimatedStrip* benchStrip = nullptr;
+
+    bench(opt, "strip.update." + std::to_string(count) + "anims",
+        [&] {
+            delete benchStrip;
+            hal::native::setTimeUs(1000000);
+            benchStrip = new AnimatedStrip(benchLeds, NUM_LEDS);
+
+            // Overlapping regions like the real tablet/bottle/front animations
+            for (int i = 0; i < count; i++) {
+                int start = (i * 13) % (NUM_LEDS / 2);
+                int end = std::min(NUM_LEDS - 1, start + 20 + (i * 7) % 40);
+                benchStrip->addAnimation(new RadiatingSymmetricPulseAnim(start, end, i % 2 == 0, 0,
+                    CRGB::Purple, 1000.0f, 60));
+            }
+        },
+        [&] {
+            hal::native::advanceUs(16000);
+            benchStrip->update();
+        });
+
+    // AnimatedStrip has no destructor, so the perpetual animations of each repetition leak
+    delete benchStrip;
+}
+
+// ——— Command parsing and dispatch ———
+
+static void benchCommands(const BenchOptions& opt) {
+    const String prepareArgs = "1, 30.00, 2, 25.00, 1.50";
+    bench(opt, "cmd.splitArgs.prepare", [] {}, [&] {
+        benchSink += splitArgs(prepareArgs).size();
+    });
+
+    const String shortArgs = "1,32.5415";
+    bench(opt, "cmd.splitArgs.short", [] {}, [&] {
+        benchSink += splitArgs(shortArgs).size();
+    });
+
+    // Logging is off, so handlers that print only pay for building the text.
+    // Requests posted to the motion or UI mailbox are run in the same op.
+    const char* commands[][2] = {
+        {"cmd.dispatch.dispenserReportGrams", "dispenserReportGrams(1,12.5)"},
+        {"cmd.dispatch.pumpSetCalibration", "pumpSetCalibration(1,1.8)"},
+        {"cmd.dispatch.rgb", "rgb(10,20,30)"},
+        {"cmd.dispatch.orderMetrics", "orderMetrics"},
+        {"cmd.dispatch.unknown", "notACommand(1,2)"},
+    };
+
+    for (auto& command : commands) {
+        const String message = command[1];
+        bench(opt, command[0], [] {}, [&] {
+            dispatchCommand(message);
+            machineUpdateUi();
+            machineUpdateMotion();
+        });
+    }
+}
+
+// ——— StepperPowderDispenser::update() ———
+
+static void benchDispenser(const BenchOptions& opt) {
+    StepperPowderDispenser* dispenser = nullptr;
+
+    auto make = [&](bool dispensing) {
+        delete dispenser;
+        hal::native::reset();
+        dispenser = new StepperPowderDispenser("Bench", 14, 13, 5, false,
+            32.5415f, 3000, 3000, 200, 1000, 100, 84);
+        dispenser->enable();
+        if (dispensing) dispenser->dispense(1.0e6f);
+    };
+
+    bench(opt, "dispenser.update.idle", [&] { make(false); }, [&] { dispenser->update(); });
+
+    // Called faster than the step interval: only the timing check runs
+    bench(opt, "dispenser.update.waiting", [&] { make(true); }, [&] { dispenser->update(); });
+
+    // One step per call, vibration decisions included
+    bench(opt, "dispenser.update.stepping", [&] { make(true); }, [&] {
+        hal::native::advanceUs(dispenser->getStepInterval());
+        dispenser->update();
+    });
+
+    delete dispenser;
+}
+
+// ——— GPIO write paths ———
+
+// On the host both end in the recording gpioWrite, so the gap is only the
+// polarity branch; on the ESP32 OutputPin is a single register store
+static void benchGpio(const BenchOptions& opt) {
+    const int pin = 14;
+    const bool negated = benchSink == 12345;    // Not known at compile time, like a config value
+    int level = LOW;
+
+    bench(opt, "gpio.gpioWrite.negated", [] { hal::native::reset(); }, [&] {
+        level = !level;
+        hal::gpioWrite(pin, negated ? !level : level);
+    });
+
+    hal::OutputPin outputPin;
+    bench(opt, "gpio.outputPin.set", [&] { hal::native::reset(); outputPin.attach(pin, negated); }, [&] {
+        level = !level;
+        outputPin.set(level);
+    });
+}
+
+// ——— Event log ———
+
+static void countRecord(const uint8_t* record, uint16_t length, void* context) {
+    benchSink += length;
+}
+
+static void benchEventLog(const BenchOptions& opt) {
+    // What a hot path pays per LOG_EVENT, drained every 16 records so the ring never fills
+    uint32_t written = 0;
+    bench(opt, "log.event.write", [] { eventLog.drain(countRecord, nullptr); }, [&] {
+        LOG_EVENT(LOG_STEPPER_SPIN, "Birdman", 1234);
+        if (++written % 16 == 0) eventLog.drain(countRecord, nullptr);
+    });
+
+    bench(opt, "log.event.filtered", [] {}, [] {
+        LOG_EVENT(LOG_STEPPER_DONE, "Birdman", 12UL);
+    });
+
+    // The deferred side: turning a record back into text on the log task
+    EventRecord record(LOG_STRIP_FILL, LOG_LEVEL_DEBUG);
+    record.putAll(26, 59, 0x8352ffUL, 1000.0f, 60);
+    char line[320];
+    bench(opt, "log.event.formatText", [] {}, [&] {
+        benchSink += EventLog::formatText(record.data(), record.length(), line, sizeof(line));
+    });
+}
+
+// ——— Broadcast hub ———
+
+static bool benchCanSend(uint32_t client_id, void* context) {
+    return client_id != 4;      // One client never has room
+}
+
+static bool benchSend(uint32_t client_id, const SharedMessage& message, void* context) {
+    benchSink += message->length();
+    return true;
+}
+
+static void benchBroadcast(const BenchOptions& opt) {
+    // A humidity reading to four clients: three send it, the backed up one coalesces it
+    BroadcastHub hub;
+    hub.setTransport(benchCanSend, benchSend, nullptr);
+    for (uint32_t id = 1; id <= 4; id++) hub.addClient(id);
+
+    String reading = String(41.2f);
+    bench(opt, "broadcast.publish.4clients", [] {}, [&] {
+        hub.publish(TOPIC_HUMIDITY, SharedMessage(new String(reading)));
+        hub.pump();
+    });
+}
+
+static bool parseOptions(int argc, char** argv, BenchOptions& opt) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (value == nullptr) return false;
+        i++;
+
+        if (arg == "--filter") opt.filter = value;
+        else if (arg == "--min-time-ms") opt.min_time_ms = atof(value);
+        else if (arg == "--repetitions") opt.repetitions = atoi(value);
+        else return false;
+    }
+    return opt.min_time_ms > 0.0 && opt.repetitions > 0;
+}
+
+int main(int argc, char** argv) {
+    BenchOptions opt;
+    if (!parseOptions(argc, argv, opt)) {
+        fprintf(stderr, "Usage: bench [--filter SUBSTRING] [--min-time-ms MS] [--repetitions N]\n");
+        return 2;
+    }
+
+    hal::native::setLogEnabled(false);
+    loopProfiler.setEnabled(false);
+    machineSetBroadcastHandler([](uint8_t topic, const String& message) { benchSink += message.length(); });
+    initConfig();
+    initCommands();
+
+    benchAnimations(opt);
+    benchSpanKernels(opt);
+    benchStrip(opt, 1);
+    benchStrip(opt, 4);
+    benchStrip(opt, 8);
+    benchStrip(opt, 16);
+    benchCommands(opt);
+    benchDispenser(opt);
+    benchGpio(opt);
+    benchEventLog(opt);
+    benchBroadcast(opt);
+
+    printf("{\"compiler\":\"%s\",\"min_time_ms\":%.0f,\"repetitions\":%d,\"benchmarks\":[",
+        __VERSION__, opt.min_time_ms, opt.repetitions);
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult& r = results[i];
+        printf("%s\n  {\"name\":\"%s\",\"iterations\":%llu,\"ns_per_op\":%.2f,\"min_ns\":%.2f,\"max_ns\":%.2f}",
+            i > 0 ? "," : "", r.name.c_str(), (unsigned long long)r.iterations, r.median_ns, r.min_ns, r.max_ns);
+    }
+    printf("\n]}\n");
+
+    return 0;
+}
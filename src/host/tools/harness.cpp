@@ -0,0 +1,703 @@
+// Native harness: runs the firmware actuator and LED classes against the
+// virtual clock and recording GPIO, and prints what the pins did.
+//
+//   pio run -e native && .pio/build/native/program
+
+#include "HalNative.h"
+#include "PlantModel.h"
+#include "Pump.h"
+#include "StepperPowderDispenser.h"
+#include "AnimatedStrip.h"
+#include "SymmetricFillAnim.h"
+#include "Ws2812Output.h"
+#include "LedSpanKernels.h"
+#include "BroadcastHub.h"
+#include "CommandCapture.h"
+#include "CalibrationEstimator.h"
+#include "HumidityCompensation.h"
+#include "IdleScheduler.h"
+#include <limits.h>
+#include <map>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#define PUMP_PIN 46
+#define STEP_PIN 14
+#define SLEEP_PIN 13
+#define DIR_PIN 5
+#define NUM_LEDS 84
+#define RGB_PIN 48
+#define FLOW_PIN 16
+#define MS1_PIN 38
+#define MS2_PIN 39
+#define MS3_PIN 40
+
+// Calls update() every tick_us of virtual time until done() or the timeout
+template<class Update, class Done>
+static uint64_t runUntil(Update update, Done done, uint64_t tick_us, uint64_t timeout_us) {
+    uint64_t start = hal::native::nowUs();
+    while (!done() && hal::native::nowUs() - start < timeout_us) {
+        update();
+        hal::native::advanceUs(tick_us);
+    }
+    return hal::native::nowUs() - start;
+}
+
+static void runPump() {
+    hal::native::reset();
+    hal::native::setRecording(true);
+
+    Pump pump("Chocolate", PUMP_PIN, 1.8f, false);
+    pump.enable();
+    pump.dispense(20.0f);
+
+    uint64_t elapsed = runUntil([&] { pump.update(); }, [&] { return !pump.isDispensing(); }, 1000, 60000000ULL);
+    hal::native::drainEventLog();
+
+    uint64_t on_us = 0;
+    uint64_t on_since = 0;
+    for (const hal::native::GpioEvent& e : hal::native::events()) {
+        if (e.pin != PUMP_PIN) continue;
+        if (e.level == HIGH) on_since = e.time_us;
+        else on_us += e.time_us - on_since;
+    }
+
+    printf("pump: 20.00 mL at 1.80 mL/s, expected %.3f s, pin on %.3f s, loop ran %.3f s\n",
+        20.0f / 1.8f, on_us / 1e6, elapsed / 1e6);
+}
+
+static void runDispenser() {
+    hal::native::reset();
+
+    StepperPowderDispenser dispenser("Birdman", STEP_PIN, SLEEP_PIN, DIR_PIN, false,
+        32.5415f, 3000, 3000, 200, 1000, 100, 84);
+    dispenser.enable();
+    dispenser.dispense(10.0f);
+
+    uint64_t elapsed = runUntil([&] { dispenser.update(); }, [&] { return !dispenser.isDispensing(); }, 100, 600000000ULL);
+    dispenser.disable();
+    hal::native::drainEventLog();
+
+    printf("dispenser: 10.00 g at 32.5415 steps/g, %u STEP edges (vibration included) in %.3f s, "
+        "%.3f s blocked in delays, %lu vibrations\n",
+        hal::native::risingEdges(STEP_PIN), elapsed / 1e6, hal::native::blockedUs() / 1e6,
+        dispenser.getVibrationCount());
+}
+
+// The three vibration policies on their own, then feedback from scale reports slower than its decisions
+static bool runVibrationPolicies() {
+    VibrationContext ctx = {84, 60, NAN, 1000, 0, false, 1.0f};
+    FixedVibrationPolicy fixed;
+    HumidityScaledVibrationPolicy humidity(40.0f, 70.0f, 0.25f);
+    FlowFeedbackVibrationPolicy feedback(12, 0.6f);
+
+    bool ok = fixed.stepsUntilNextDecision(ctx) == 84 && fixed.vibrationCycles(ctx) == 60;
+    ok = ok && humidity.stepsUntilNextDecision(ctx) == 84 && humidity.vibrationCycles(ctx) == 60;   // unknown: humid
+    ctx.relative_humidity = 30.0f;
+    ok = ok && humidity.stepsUntilNextDecision(ctx) == 336 && humidity.vibrationCycles(ctx) == 15;
+    ctx.relative_humidity = 55.0f;
+    ok = ok && humidity.stepsUntilNextDecision(ctx) == 134 && humidity.vibrationCycles(ctx) == 38;
+    ok = ok && feedback.stepsUntilNextDecision(ctx) == 84 && feedback.vibrationCycles(ctx) == 60;   // no signal: fixed
+    ctx.has_flow_signal = true;
+    ctx.flow_ratio = 0.9f;
+    ok = ok && feedback.stepsUntilNextDecision(ctx) == 12 && feedback.vibrationCycles(ctx) == 0;
+    ctx.flow_ratio = 0.3f;
+    ok = ok && feedback.vibrationCycles(ctx) == 60;
+
+    // 10 g with a scale report every 200 ms, about 65 steps, against a decision every 12
+    hal::native::reset();
+    hal::native::setLogEnabled(false);
+    auto dose = [&](VibrationPolicy* policy, float flow) {
+        StepperPowderDispenser dispenser("Birdman", STEP_PIN, SLEEP_PIN, DIR_PIN, false,
+            32.5415f, 3000, 3000, 200, 1000, 100, 84);
+        dispenser.setVibrationPolicy(policy);
+        dispenser.enable();
+        dispenser.dispense(10.0f);
+        uint64_t reported = hal::native::nowUs();
+        runUntil([&] {
+            dispenser.update();
+            if (hal::native::nowUs() - reported >= 200000) {
+                reported = hal::native::nowUs();
+                dispenser.reportDispensedGrams(dispenser.getLastMotionSteps() / 32.5415f * flow);
+            }
+        }, [&] { return !dispenser.isDispensing(); }, 100, 60000000ULL);
+        dispenser.disable();
+        return dispenser.getVibrationCount();
+    };
+    unsigned long fixedCount = dose(nullptr, 1.0f);
+    unsigned long flowing = dose(&feedback, 1.0f);
+    unsigned long clogged = dose(&feedback, 0.2f);
+    ok = ok && fixedCount >= 3 && flowing == 0 && clogged >= 1;
+
+    hal::native::drainEventLog();
+    hal::native::setLogEnabled(true);
+    printf("vibration policies: 10 g with %lu vibrations fixed, %lu on feedback while flowing, %lu while clogged, %s\n",
+        fixedCount, flowing, clogged, ok ? "ok" : "WRONG");
+    return ok;
+}
+
+// Mixed doses with fine finishing and spins: the position stays on the fine grid targets
+// and the MS pins always select the resolution the dispenser reports
+static bool runMicrostepping() {
+    hal::native::reset();
+    hal::native::setLogEnabled(false);
+
+    StepperPowderDispenser dispenser("Birdman", STEP_PIN, SLEEP_PIN, DIR_PIN, false,
+        32.5415f, 3000, 3000, 200, 1000, 100, 84);
+    dispenser.setMicrostepPins(MS1_PIN, MS2_PIN, MS3_PIN);
+    bool ok = dispenser.setFineDispense(4, 0.5f);
+
+    // MS3..MS1 levels for 1, 2, 4, 8 and 16 microsteps, as on the A4988
+    const int pinsFor[17] = {-1, 0b000, 0b001, -1, 0b010, -1, -1, -1, 0b011, -1, -1, -1, -1, -1, -1, -1, 0b111};
+    auto pinsMatch = [&] {
+        int levels = (hal::native::pinLevel(MS1_PIN) == HIGH ? 1 : 0) |
+            (hal::native::pinLevel(MS2_PIN) == HIGH ? 2 : 0) |
+            (hal::native::pinLevel(MS3_PIN) == HIGH ? 4 : 0);
+        int microsteps = dispenser.getMicrosteps();
+        return microsteps >= 1 && microsteps <= 16 && pinsFor[microsteps] == levels;
+    };
+
+    long expected = 0;
+    unsigned mismatches = 0;
+    unsigned fineFinishes = 0;
+    // Returns the resolution of the last step the move took
+    auto run = [&] {
+        int last = dispenser.getMicrosteps();
+        runUntil([&] {
+            dispenser.update();
+            if (!pinsMatch()) mismatches++;
+            if (dispenser.isDispensing()) last = dispenser.getMicrosteps();
+        }, [&] { return !dispenser.isDispensing(); }, 50, 60000000ULL);
+        dispenser.disable();
+        return last;
+    };
+    // The target dispense() rounds to: the fine grid counted from the current rotor phase
+    auto dose = [&](float grams) {
+        const long ticksPerFine = STEPPER_MAX_MICROSTEPS / dispenser.getFineMicrosteps();
+        long phase = expected % STEPPER_MAX_MICROSTEPS;
+        float target = phase + grams * dispenser.getEffectiveStepsPerGram() * STEPPER_MAX_MICROSTEPS;
+        long ticks = lroundf(target / ticksPerFine) * ticksPerFine - phase;
+        if (ticks > 0) expected += ticks;
+        dispenser.enable();
+        dispenser.dispense(grams);
+        if (run() == dispenser.getFineMicrosteps()) fineFinishes++;
+    };
+    auto spin = [&](int steps) {
+        expected += static_cast<long>(steps) * STEPPER_MAX_MICROSTEPS;
+        dispenser.enable();
+        dispenser.spin(steps);
+        run();
+    };
+
+    ok = ok && pinsMatch();
+    dose(1.37f);
+    dose(0.42f);
+    spin(7);
+    dose(2.05f);
+    dose(0.03f);
+    spin(3);
+    dose(0.81f);
+    ok = ok && dispenser.getPositionTicks() == expected && mismatches == 0 && fineFinishes == 5 && pinsMatch();
+
+    hal::native::drainEventLog();
+    hal::native::setLogEnabled(true);
+    printf("microstepping: position %ld ticks for %ld expected, %u of 5 doses finished fine, %u pin mismatches, %s\n",
+        dispenser.getPositionTicks(), expected, fineFinishes, mismatches, ok ? "ok" : "WRONG");
+    return ok;
+}
+
+// Back-to-back moves on one wake, the keep-awake window, and the awake-share limit
+static bool runDriverPower() {
+    hal::native::reset();
+    hal::native::setLogEnabled(false);
+
+    StepperPowderDispenser dispenser("Birdman", STEP_PIN, SLEEP_PIN, DIR_PIN, false,
+        32.5415f, 3000, 3000, 200, 1000, 100, 84);
+    // The motion task blocks until the next STEP edge: never later than the wake or step timing
+    unsigned long longestWaitUs = 0;
+    auto move = [&](int steps) {
+        dispenser.enable();
+        dispenser.spin(steps);
+        runUntil([&] {
+            dispenser.update();
+            unsigned long wait = dispenser.getMicrosUntilNextEdge();
+            if (dispenser.isDispensing() && wait > longestWaitUs) longestWaitUs = wait;
+        }, [&] { return !dispenser.isDispensing(); }, 100, 60000000ULL);
+        dispenser.disable();
+    };
+    auto idle = [&](uint64_t us) {
+        runUntil([&] { dispenser.update(); }, [] { return false; }, 1000, us);
+    };
+
+    move(20);
+    unsigned long coldUs = dispenser.getLastWakeLatencyUs();
+    bool holding = dispenser.isAwake();
+    idle(1000000);
+    move(20);
+    unsigned long warmUs = dispenser.getLastWakeLatencyUs();
+    unsigned wakes = hal::native::risingEdges(SLEEP_PIN);
+    bool ok = holding && wakes == 1 && dispenser.getWakeCount() == 1 && dispenser.getWarmStartCount() == 1 &&
+        coldUs >= STEPPER_WAKE_US && warmUs < coldUs && longestWaitUs <= STEPPER_WAKE_US &&
+        dispenser.getMicrosUntilNextEdge() == ULONG_MAX;
+
+    idle(STEPPER_DEFAULT_KEEP_AWAKE_MS * 1000ULL + 10000);
+    bool slept = !dispenser.isAwake();
+
+    // A long run leaves the driver over a low awake-share limit: no holding after it
+    dispenser.setPowerPolicy(STEPPER_DEFAULT_KEEP_AWAKE_MS, 0.05f);
+    move(20000);
+    ok = ok && slept && !dispenser.isAwake() && dispenser.getThermalSleepCount() == 1;
+
+    hal::native::drainEventLog();
+    hal::native::setLogEnabled(true);
+    printf("driver power: first step %lu us cold, %lu us warm, %u wake for 2 moves, "
+        "asleep after the window %s, hot driver slept at %.0f%% awake, %s\n",
+        coldUs, warmUs, wakes, slept ? "yes" : "no",
+        dispenser.getAwakeDuty() * 100.0f, ok ? "ok" : "WRONG");
+    return ok;
+}
+
+// Priming order and quiet time, no priming while an order is set up, and the powder prediction
+static bool runIdleScheduler() {
+    IdleScheduler scheduler;
+    scheduler.begin(3, 2, 0);
+    scheduler.setPrimeVolume(1, 0.0f);                  // line 1 is never primed
+    scheduler.noteActivity(1 << 0, 0, 1000);
+
+    unsigned long t = IDLE_PRIME_AFTER_MS + 1000;
+    int off = scheduler.nextPrime(true, t);             // priming is opt-in
+    scheduler.setPrimeAfter(IDLE_PRIME_AFTER_MS);
+    int first = scheduler.nextPrime(true, t);           // line 2 was unused the longest
+    int early = scheduler.nextPrime(true, t + 1000);    // the pulse restarts the quiet time
+    t += IDLE_PRIME_QUIET_MS;
+    int second = scheduler.nextPrime(true, t);
+    t += IDLE_PRIME_QUIET_MS;
+    int none = scheduler.nextPrime(true, t);
+
+    // A due line waits for the order on the tablet to be closed, then for a quiet spell
+    t += IDLE_PRIME_AFTER_MS;
+    scheduler.orderPending(t);
+    int pending = scheduler.nextPrime(true, t + IDLE_PRIME_QUIET_MS);
+    scheduler.orderClosed(t + IDLE_PRIME_QUIET_MS);
+    int closed = scheduler.nextPrime(true, t + 2 * IDLE_PRIME_QUIET_MS);
+
+    bool ok = off < 0 && first == 2 && early < 0 && second == 0 && none < 0 && pending < 0 && closed == 2;
+
+    // Recent orders weigh more; a pre-stage for the wrong powder is a miss
+    int before = scheduler.predictPowder();
+    scheduler.noteOrder(1);
+    scheduler.noteOrder(0);
+    scheduler.noteOrder(1);
+    int predicted = scheduler.predictPowder();
+    t += IDLE_SETTLE_AFTER_MS;
+    bool settled = scheduler.isSettled(predicted, t);
+    scheduler.orderPending(t);
+    scheduler.notePrestage(predicted, settled, t);
+    scheduler.orderPending(t + 2000);                   // orderAskForBottle, same order
+    scheduler.noteOrder(0);
+
+    ok = ok && before < 0 && predicted == 1 && settled && !scheduler.isSettled(1, t + 2000) &&
+        scheduler.getPrestageMisses() == 1 && scheduler.getPrestageHits() == 0;
+
+    printf("idle scheduler: primed lines %d then %d, %s while an order is pending, predicted powder %d, %s\n",
+        first, second, pending < 0 ? "none" : "one", predicted, ok ? "ok" : "WRONG");
+    return ok;
+}
+
+static void runStrip() {
+    hal::native::reset();
+    hal::native::setLogEnabled(false);
+
+    CRGB leds[NUM_LEDS];
+    AnimatedStrip strip(leds, NUM_LEDS);
+    unsigned long frames_before = FastLED.getFrameCount();
+
+    strip.startSymmetricFill(26, 59, CRGB(0x8352ff), 1000.0f, 60);
+    hal::native::advanceUs(1000);
+
+    for (int i = 0; i < 1500; i++) {
+        strip.update();
+        hal::native::advanceUs(1000);
+    }
+
+    hal::native::drainEventLog();
+    hal::native::setLogEnabled(true);
+    printf("strip: 1 s symmetric fill at 60 fps, %lu frames shown, center pixel #%06X\n",
+        FastLED.getFrameCount() - frames_before, (unsigned)(leds[42].as_uint32_t() & 0xFFFFFF));
+}
+
+// 275 mL of water by flow meter against a plant whose real flow differs from the calibration
+static float runMeteredWater(float real_mL_per_second, bool meter_wired, Pump*& out_pump) {
+    hal::native::reset();
+    hal::native::setLogEnabled(false);
+
+    PlantModel plant;
+    int water = plant.addPump(PUMP_PIN, false, real_mL_per_second, 0.0f);
+    if (meter_wired) plant.addFlowMeter(water, FLOW_PIN, 5.5f);
+    plant.attach();
+
+    static FlowMeter meters[3];
+    static int used = 0;
+    FlowMeter& meter = meters[used++];
+    meter.begin(FLOW_PIN, 5.5f);
+
+    Pump* pump = new Pump("Agua", PUMP_PIN, 32.83f, false);
+    pump->setFlowMeter(&meter);
+    pump->enable();
+    pump->dispense(275.0f);
+
+    runUntil([&] { pump->update(); }, [&] { return !pump->isDispensing(); }, 1000, 60000000ULL);
+    runUntil([&] { pump->update(); }, [] { return false; }, 1000, 3000000ULL);   // settle
+    plant.sync();
+    plant.detach();
+
+    hal::native::drainEventLog();
+    hal::native::setLogEnabled(true);
+    out_pump = pump;
+    return plant.pump(water).volume_mL;
+}
+
+static bool runFlowMeter() {
+    Pump* low;
+    Pump* silent;
+    Pump* starved;
+    float lowMl = runMeteredWater(24.0f, true, low);            // Supply pressure dropped
+    float silentMl = runMeteredWater(32.83f, false, silent);    // Meter unplugged
+    float starvedMl = runMeteredWater(18.0f, true, starved);    // Cannot reach 275 mL within 1.5x the time
+
+    bool ok = fabs(lowMl - 275.0f) < 1.0f && low->getFlowTimeoutCount() == 0 && low->getFlowFaultCount() == 0 &&
+        fabs(silentMl - 275.0f) < 1.0f && silent->getFlowFaultCount() == 1 &&
+        starved->getFlowTimeoutCount() == 1 && fabs(starved->getLastDispensedMl() - starvedMl) < 1.0f;
+
+    printf("flow meter: 275 mL at 24 mL/s gives %.1f mL, silent meter %.1f mL by time, starved line stops at %.1f mL, %s\n",
+        lowMl, silentMl, starvedMl, ok ? "ok" : "WRONG");
+    delete low;
+    delete silent;
+    delete starved;
+    return ok;
+}
+
+// One timed dispense of a flavor pump on the plant, returns what came out
+static float runTimedFlavor(Pump& pump, PlantModel& plant, int index, float milliliters) {
+    double before = plant.pump(index).volume_mL;
+    pump.enable();
+    pump.dispense(milliliters);
+    runUntil([&] { pump.update(); }, [&] { return !pump.isDispensing(); }, 1000, 60000000ULL);
+    runUntil([&] { pump.update(); }, [] { return false; }, 1000, 3000000ULL);   // settle
+    plant.sync();
+    return plant.pump(index).volume_mL - before;
+}
+
+// The estimator on noisy samples (gross outlier, step change), then a pump
+// learning its real rate from metered dispenses and timing by it without the meter
+static bool runCalibrationModel() {
+    uint32_t seed = 777;
+    auto noise = [&seed](float std) {
+        float sum = 0.0f;
+        for (int i = 0; i < 4; i++) {
+            seed = seed * 1664525UL + 1013904223UL;
+            sum += (seed >> 8) / 16777216.0f - 0.5f;
+        }
+        return sum * std * 1.7320508f;      // Sum of 4 uniforms has variance 1/3
+    };
+
+    CalibrationEstimator model;
+    model.reset(1.8f, 0.18f, 1.8f, 0.36f);
+    for (int i = 0; i < 40; i++) {
+        float seconds = 2.0f + (i * 7 % 11);
+        model.update(seconds, 2.0f * seconds - 1.5f + noise(0.3f));
+    }
+    bool ok = fabsf(model.getGain() - 2.0f) < 0.04f && fabsf(model.getOffset() + 1.5f) < 0.6f && model.isConfident(0.02f);
+    float fitGain = model.getGain();
+
+    float gainBefore = model.getGain();
+    ok = ok && model.update(10.0f, 40.0f) == CalibrationEstimator::CALIBRATION_OUTLIER && model.getGain() == gainBefore;
+
+    // New tubing: the first samples look like outliers until there is a run of them
+    bool relearned = false;
+    for (int i = 0; i < 40; i++) {
+        float seconds = 2.0f + (i * 5 % 11);
+        relearned = model.update(seconds, 1.7f * seconds - 1.5f + noise(0.3f)) == CalibrationEstimator::CALIBRATION_RELEARNED || relearned;
+    }
+    ok = ok && relearned && fabsf(model.getGain() - 1.7f) < 0.04f;
+    float driftGain = model.getGain();
+
+    hal::native::reset();
+    hal::native::setLogEnabled(false);
+
+    PlantModel plant;
+    int flavor = plant.addPump(PUMP_PIN, false, 2.0f, 0.5f);
+    plant.addFlowMeter(flavor, FLOW_PIN, 50.0f);
+    plant.attach();
+
+    static FlowMeter meter;
+    meter.begin(FLOW_PIN, 50.0f);
+
+    Pump pump("Chocolate", PUMP_PIN, 1.8f, false);
+    float plainMl = runTimedFlavor(pump, plant, flavor, 20.0f);
+
+    pump.setFlowMeter(&meter);
+    const float sizes[] = {10.0f, 20.0f, 40.0f};
+    for (int i = 0; i < 12; i++) runTimedFlavor(pump, plant, flavor, sizes[i % 3]);
+
+    // Detached while the overrun settles: no reading from the meter that is gone
+    int samples = pump.getCalibrationModel().getSampleCount();
+    pump.enable();
+    pump.dispense(20.0f);
+    runUntil([&] { pump.update(); }, [&] { return !pump.isDispensing(); }, 1000, 60000000ULL);
+    pump.setFlowMeter(nullptr);
+    runUntil([&] { pump.update(); }, [] { return false; }, 1000, 3000000ULL);
+    plant.sync();
+    ok = ok && pump.getCalibrationModel().getSampleCount() == samples;
+
+    float modelMl = runTimedFlavor(pump, plant, flavor, 20.0f);
+    ok = ok && pump.isModelApplied() && fabsf(modelMl - 20.0f) < 0.4f;
+
+    plant.detach();
+    hal::native::drainEventLog();
+    hal::native::setLogEnabled(true);
+
+    printf("calibration model: fit %.3f (true 2.000), outlier refused, relearned to %.3f (true 1.700); "
+        "20 mL timed gives %.2f mL plain, %.2f mL after %d metered samples (%.3f mL/s, offset %.2f mL), %s\n",
+        fitGain, driftGain, plainMl, modelMl, pump.getCalibrationModel().getSampleCount(),
+        pump.getCalibration(), pump.getCalibrationModel().getOffset(), ok ? "ok" : "WRONG");
+    return ok;
+}
+
+// Checks the RMT symbols bit by bit, then runs the strip through the non-blocking output
+static bool runWs2812() {
+    hal::native::reset();
+    hal::native::setLogEnabled(false);
+
+    Ws2812Timing timing = Ws2812Output::timingFor(WS2812_RMT_CLOCK_HZ);
+    bool ok = timing.t0h == 16 && timing.t0l == 34 && timing.t1h == 32 && timing.t1l == 18;
+
+    CRGB pixels[2] = {CRGB(0x12, 0x34, 0x56), CRGB(0xFF, 0x00, 0x80)};
+    Ws2812Symbol symbols[2 * 24];
+    size_t count = Ws2812Output::encode(pixels, 2, 255, WS2812_BGR, timing, symbols);
+    ok = ok && count == 2 * 24;
+
+    const uint8_t wire[6] = {0x56, 0x34, 0x12, 0x80, 0x00, 0xFF};   // b, g, r per pixel
+    for (size_t i = 0; i < count && ok; i++) {
+        bool one = (wire[i / 8] >> (7 - i % 8)) & 1;
+        const Ws2812Symbol& s = symbols[i];
+        ok = s.level0 == 1 && s.level1 == 0 &&
+            s.duration0 == (one ? timing.t1h : timing.t0h) && s.duration1 == (one ? timing.t1l : timing.t0l);
+    }
+
+    // Brightness is applied like FastLED's scale8
+    Ws2812Output::encode(pixels, 1, 128, WS2812_GRB, timing, symbols);
+    uint8_t green = 0;
+    for (int i = 0; i < 8; i++) green = (green << 1) | (symbols[i].duration0 == timing.t1h);
+    ok = ok && green == scale8(0x34, 128);
+
+    CRGB leds[NUM_LEDS];
+    AnimatedStrip strip(leds, NUM_LEDS);
+    Ws2812Output output(WS2812_BGR);
+    output.begin(RGB_PIN, NUM_LEDS);
+    strip.setOutput(&output);
+
+    strip.startSymmetricFill(26, 59, CRGB(0x8352ff), 1000.0f, 60);
+    hal::native::advanceUs(1000);
+
+    for (int i = 0; i < 1500; i++) {
+        strip.update();
+        hal::native::advanceUs(1000);
+    }
+    strip.update();
+
+    hal::native::drainEventLog();
+    hal::native::setLogEnabled(true);
+    printf("ws2812: encoding %s, %lu frames of %lu us sent, %lu refused while busy, pending %s\n",
+        ok ? "ok" : "WRONG", output.getFrameCount(), output.getFrameUs(), output.getBusyCount(),
+        strip.isShowPending() ? "yes" : "no");
+    return ok;
+}
+
+// Wide span kernels against the scalar reference (and FastLED's blend), random spans
+static bool runSpanKernels() {
+    uint32_t seed = 12345;
+    auto next = [&seed] { seed = seed * 1664525UL + 1013904223UL; return static_cast<uint8_t>(seed >> 24); };
+
+    int mismatches = 0;
+    int cases = 0;
+    for (int round = 0; round < 200; round++) {
+        size_t count = round % 41;
+        CRGB base[40], src[40], a[40], b[40];
+        uint8_t alpha[40];
+        for (size_t i = 0; i < count; i++) {
+            base[i] = CRGB(next(), next(), next());
+            src[i] = CRGB(next(), next(), next());
+            uint8_t r = next();
+            alpha[i] = r < 40 ? 0 : r > 215 ? 255 : r;   // the 0 and 255 the animations write most
+        }
+        CRGB color(next(), next(), next());
+        uint8_t factor = next();
+
+        for (int kernel = 0; kernel < 4; kernel++) {
+            memcpy(a, base, sizeof(base));
+            memcpy(b, base, sizeof(base));
+            switch (kernel) {
+                case 0: ledspan::scalar::blendToColor(a, count, color, alpha); ledspan::wide::blendToColor(b, count, color, alpha); break;
+                case 1: ledspan::scalar::add(a, src, count); ledspan::wide::add(b, src, count); break;
+                case 2: ledspan::scalar::scale(a, count, factor); ledspan::wide::scale(b, count, factor); break;
+                case 3: ledspan::scalar::fill(a, count, color); ledspan::wide::fill(b, count, color); break;
+            }
+            cases++;
+            if (memcmp(a, b, count * sizeof(CRGB)) != 0) mismatches++;
+
+            if (kernel == 0) {
+                for (size_t i = 0; i < count; i++) {
+                    if (a[i] != blend(base[i], color, alpha[i])) mismatches++;
+                }
+            }
+        }
+    }
+
+    printf("span kernels: %d random spans, wide path %s\n", cases, mismatches == 0 ? "bit exact" : "DIFFERS");
+    return mismatches == 0;
+}
+
+// Records what each client got; stalled clients report a full transport queue
+struct HubTransport {
+    std::map<uint32_t, std::vector<std::string>> received;
+    std::map<uint32_t, bool> stalled;
+};
+
+static bool hubCanSend(uint32_t client_id, void* context) {
+    return !static_cast<HubTransport*>(context)->stalled[client_id];
+}
+
+static bool hubSend(uint32_t client_id, const SharedMessage& message, void* context) {
+    static_cast<HubTransport*>(context)->received[client_id].push_back(message->c_str());
+    return true;
+}
+
+// A fast, a stalled and an orders-only client through every backpressure policy
+static bool runBroadcastHub() {
+    HubTransport transport;
+    BroadcastHub hub;
+    hub.setTransport(hubCanSend, hubSend, &transport);
+    hub.addClient(1);
+    hub.addClient(2);
+    hub.addClient(3);
+    hub.subscribe(3, BroadcastHub::parseTopics("orders"));
+    transport.stalled[2] = true;
+
+    const struct { uint8_t topic; const char* text; } sequence[] = {
+        {TOPIC_TELEMETRY, "t1"}, {TOPIC_TELEMETRY, "t2"}, {TOPIC_TELEMETRY, "t3"},
+        {TOPIC_HUMIDITY, "h1"}, {TOPIC_HUMIDITY, "h2"},     // h2 coalesces h1
+        {TOPIC_ORDERS, "o1"}, {TOPIC_ORDERS, "o2"},         // evict t1, t2
+        {TOPIC_TELEMETRY, "t4"},                            // dropped
+    };
+    for (const auto& item : sequence) {
+        hub.publish(item.topic, SharedMessage(new String(item.text)));
+        hub.pump();
+    }
+
+    transport.stalled[2] = false;
+    hub.pump();
+
+    const std::vector<std::string> slow = {"t3", "h2", "o1", "o2"};
+    const std::vector<std::string> orders = {"o1", "o2"};
+    bool ok = transport.received[1].size() == 8 && transport.received[2] == slow &&
+        transport.received[3] == orders && hub.getBackpressureCount() == 4;
+
+    hub.removeClient(2);
+    ok = ok && hub.getClientCount() == 2 && BroadcastHub::parseTopics("orders, logs") == (TOPIC_ORDERS | TOPIC_LOGS) &&
+        BroadcastHub::parseTopics("orders,tea") == 0;
+
+    printf("broadcast hub: stalled client got %lu of 8, backpressure %lu, policies %s\n",
+        (unsigned long)transport.received[2].size(), (unsigned long)hub.getBackpressureCount(), ok ? "ok" : "WRONG");
+    return ok;
+}
+
+// Overfills the capture ring, then parses the export back against what went in
+static bool runCommandCapture() {
+    static CommandCapture capture;
+    capture.setEnabled(true);
+
+    std::vector<std::pair<uint64_t, std::string>> sent;
+    for (int i = 0; i < 400; i++) {
+        char text[64];
+        snprintf(text, sizeof(text), "prepare(%d,%d.50,%d,25.00,0.00)", i % 2 + 1, 20 + i % 17, i % 3 + 1);
+        uint64_t time_us = 5000000ULL * 1000 + 1234567ULL * i;     // past the 32-bit micros() wrap
+        capture.record(time_us, text, strlen(text));
+        sent.push_back(std::make_pair(time_us, std::string(text)));
+    }
+
+    String exported = capture.exportText();
+    std::vector<std::pair<uint64_t, std::string>> parsed;
+    unsigned int from = 0;
+    while (from < exported.length()) {
+        int newline = exported.indexOf('\n', from);
+        String line = exported.substring(from, newline < 0 ? exported.length() : newline);
+        from = newline < 0 ? exported.length() : newline + 1;
+
+        uint64_t time_us;
+        String command;
+        if (CommandCapture::parseLine(line, time_us, command)) parsed.push_back(std::make_pair(time_us, std::string(command.c_str())));
+    }
+
+    bool ok = parsed.size() == capture.getCount() && capture.getCount() + capture.getEvictedCount() == sent.size() &&
+        exported.startsWith(COMMAND_TRACE_MAGIC) && capture.getUsedBytes() <= COMMAND_CAPTURE_RING_SIZE;
+    for (size_t i = 0; i < parsed.size() && ok; i++) ok = parsed[i] == sent[sent.size() - parsed.size() + i];
+
+    printf("command capture: %lu of %lu commands held (%lu bytes), export %s\n", (unsigned long)capture.getCount(),
+        (unsigned long)sent.size(), (unsigned long)capture.getUsedBytes(), ok ? "round trips" : "DIFFERS");
+    return ok;
+}
+
+// Least-squares line through known points, interpolation inside the calibrated
+// range, clamping outside it, and sample merging
+static bool runHumidityCurve() {
+    HumidityCurve curve;
+    bool ok = curve.evaluate(50.0f, 32.5f) == 32.5f;            // no samples: the fallback
+
+    // 30 + 0.1 steps/g per %RH, one point off the line by +-0.2
+    curve.addSample(70.0f, 37.0f);
+    curve.addSample(30.0f, 33.0f);
+    curve.addSample(50.0f, 35.2f);
+    curve.addSample(40.0f, 33.8f);
+    float slope = curve.getSlope();
+    float mid = curve.evaluate(45.0f, 0.0f);
+    float low = curve.evaluate(10.0f, 0.0f);
+    float high = curve.evaluate(95.0f, 0.0f);
+
+    ok = ok && fabsf(slope - 0.1f) < 0.01f && fabsf(curve.getIntercept() - 30.0f) < 0.3f &&
+        fabsf(mid - 34.5f) < 0.1f && fabsf(low - curve.evaluate(30.0f, 0.0f)) < 1e-4f &&
+        fabsf(high - curve.evaluate(70.0f, 0.0f)) < 1e-4f && curve.evaluate(NAN, 32.5f) == 32.5f &&
+        curve.getSample(0).relative_humidity == 30.0f && curve.getSample(3).relative_humidity == 70.0f;
+
+    // Within HUMIDITY_CURVE_MERGE_RH a sample replaces its neighbor; bad samples are refused
+    curve.addSample(51.0f, 35.0f);
+    ok = ok && curve.getSampleCount() == 4 && !curve.addSample(120.0f, 35.0f) && !curve.addSample(50.0f, 0.0f);
+
+    // A single sample is a flat curve
+    HumidityCurve flat;
+    flat.addSample(45.0f, 31.0f);
+    ok = ok && flat.getSlope() == 0.0f && flat.evaluate(80.0f, 0.0f) == 31.0f;
+
+    printf("humidity curve: slope %.4f steps/g per %%RH (true 0.1), %.2f at 45%%, clamped %.2f at 10%% and %.2f at 95%%, %s\n",
+        slope, mid, low, high, ok ? "ok" : "WRONG");
+    return ok;
+}
+
+int main() {
+    runPump();
+    runDispenser();
+    runStrip();
+    bool ok = runWs2812();
+    ok = runSpanKernels() && ok;
+    ok = runBroadcastHub() && ok;
+    ok = runCommandCapture() && ok;
+    ok = runFlowMeter() && ok;
+    ok = runCalibrationModel() && ok;
+    ok = runVibrationPolicies() && ok;
+    ok = runDriverPower() && ok;
+    ok = runMicrostepping() && ok;
+    ok = runIdleScheduler() && ok;
+    ok = runHumidityCurve() && ok;
+    return ok ? 0 : 1;
+}
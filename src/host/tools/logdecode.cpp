@@ -0,0 +1,119 @@
+// Decodes a binary event log capture (logMode(binary)) back into text with the
+// message catalogue in LogMessages.h. Bytes between frames, e.g. boot output
+// from the ROM, are skipped; the decoder resyncs on the frame magic.
+//
+//   pio device monitor --raw > capture.bin
+//   pio run -e logdecode && .pio/build/logdecode/program capture.bin [--min-level 1]
+
+#include "EventLog.h"
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+struct DecodeStats {
+    uint64_t records = 0;
+    uint64_t filtered = 0;
+    uint64_t skipped_bytes = 0;
+    uint64_t bad_frames = 0;
+};
+
+// Walks the arguments so a frame that only looks like one (magic inside other data) is rejected
+static bool validRecord(const uint8_t* record, size_t available, uint16_t& length) {
+    if (available < EVENT_LOG_HEADER_SIZE) return false;
+
+    length = record[0] | (record[1] << 8);
+    uint8_t flags = record[2];
+    uint8_t level = record[3];
+    uint8_t argc = record[10];
+
+    if (length < EVENT_LOG_HEADER_SIZE || length > ((EVENT_LOG_MAX_RECORD + 3) & ~3) || length % 4 != 0) return false;
+    if (length > available) return false;
+    if (flags != EVENT_LOG_FLAG_COMMITTED || level > LOG_LEVEL_ERROR) return false;
+
+    size_t pos = EVENT_LOG_HEADER_SIZE;
+    for (int i = 0; i < argc; i++) {
+        if (pos >= length) return false;
+        uint8_t tag = record[pos++];
+
+        if (tag == EVENT_LOG_ARG_STRING) {
+            if (pos >= length) return false;
+            pos += 1 + record[pos];
+        } else if (tag == EVENT_LOG_ARG_INT || tag == EVENT_LOG_ARG_UINT || tag == EVENT_LOG_ARG_FLOAT) {
+            pos += 4;
+        } else {
+            return false;
+        }
+    }
+    return pos <= length;
+}
+
+static void decode(const std::vector<uint8_t>& data, int minLevel, DecodeStats& stats) {
+    size_t pos = 0;
+    char line[320];
+
+    while (pos + 2 <= data.size()) {
+        if (data[pos] != EVENT_LOG_FRAME_MAGIC_0 || data[pos + 1] != EVENT_LOG_FRAME_MAGIC_1) {
+            pos++;
+            stats.skipped_bytes++;
+            continue;
+        }
+
+        uint16_t length = 0;
+        const uint8_t* record = &data[pos + 2];
+        if (!validRecord(record, data.size() - pos - 2, length)) {
+            pos++;
+            stats.skipped_bytes++;
+            stats.bad_frames++;
+            continue;
+        }
+
+        if (record[3] >= minLevel) {
+            EventLog::formatText(record, length, line, sizeof(line));
+            fputs(line, stdout);
+            stats.records++;
+        } else {
+            stats.filtered++;
+        }
+        pos += 2 + length;
+    }
+    stats.skipped_bytes += data.size() - pos;
+}
+
+int main(int argc, char** argv) {
+    const char* path = nullptr;
+    int minLevel = LOG_LEVEL_DEBUG;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--min-level" && i + 1 < argc) {
+            minLevel = atoi(argv[++i]);
+        } else if (path == nullptr && arg[0] != '-') {
+            path = argv[i];
+        } else {
+            fprintf(stderr, "Usage: logdecode [CAPTURE_FILE] [--min-level 0..3]  (reads stdin without a file)\n");
+            return 2;
+        }
+    }
+
+    FILE* in = path != nullptr ? fopen(path, "rb") : stdin;
+    if (in == nullptr) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return 1;
+    }
+
+    std::vector<uint8_t> data;
+    uint8_t chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), in)) > 0) {
+        data.insert(data.end(), chunk, chunk + n);
+    }
+    if (in != stdin) fclose(in);
+
+    DecodeStats stats;
+    decode(data, minLevel, stats);
+
+    fprintf(stderr, "%llu records, %llu below level %d, %llu bytes skipped, %llu bad frames\n",
+        (unsigned long long)stats.records, (unsigned long long)stats.filtered, minLevel,
+        (unsigned long long)stats.skipped_bytes, (unsigned long long)stats.bad_frames);
+    return 0;
+}
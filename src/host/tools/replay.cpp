@@ -0,0 +1,270 @@
+// Command trace replay: feeds a trace exported by captureExport (see
+// src/CommandCapture.h) into the real dispatcher and state machine under the
+// virtual clock, each command at its recorded time. Everything the firmware
+// does in response (GPIO edges, broadcasts, log output, state changes) goes
+// into one digest, so two runs of the same trace print the same digest and
+// a change that alters behavior on real traffic shows up as a different one.
+//
+//   pio run -e replay && .pio/build/replay/program trace.txt [--json] [--verbose]
+
+#include "HalNative.h"
+#include "Machine.h"
+#include "CommandCapture.h"
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+struct ReplayOptions {
+    const char* path = nullptr;
+    uint64_t fine_tick_us = 50;         // while a stepper is moving
+    uint64_t coarse_tick_us = 1000;     // pumps, LEDs and idle animations
+    float humidity = 50.0f;
+    float tail_s = 600.0f;              // longest run after the last command, until the machine is idle
+    bool json = false;
+    bool verbose = false;
+    bool profile = false;               // host cost per subsystem; loopProfile replies then change the digest
+};
+
+struct TraceCommand {
+    uint64_t time_us;
+    String text;
+};
+
+#define IDLE_JUMP_US 1000000ULL
+
+// ——— Digest ———
+// FNV-1a 64 over everything observable, in the order it happened
+
+static uint64_t digest = 0xcbf29ce484222325ULL;
+
+static void mix(const void* data, size_t length) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < length; i++) {
+        digest ^= p[i];
+        digest *= 0x100000001b3ULL;
+    }
+}
+
+template<typename T>
+static void mixValue(T value) {
+    mix(&value, sizeof(value));
+}
+
+// ——— Replay state ———
+static ReplayOptions options;
+static uint64_t gpioEdges = 0;
+static uint64_t broadcasts = 0;
+static uint64_t logChunks = 0;
+static uint64_t stateChanges = 0;
+static uint64_t loopIterations = 0;
+static int ordersFinished = 0;
+static int lastState = NOT_PREPARING;
+
+static void onGpio(int pin, int level, uint64_t time_us, void* context) {
+    mixValue('g');
+    mixValue(time_us);
+    mixValue(pin);
+    mixValue(level);
+    gpioEdges++;
+}
+
+static void onBroadcast(uint8_t topic, const String& message) {
+    mixValue('b');
+    mixValue(hal::native::nowUs());
+    mixValue(topic);
+    mix(message.c_str(), message.length());
+    broadcasts++;
+    if (message == "Order finished") ordersFinished++;
+}
+
+// Log lines carry their own virtual timestamps
+static void onLog(const char* text, void* context) {
+    mixValue('l');
+    mix(text, strlen(text));
+    logChunks++;
+    if (options.verbose) fputs(text, stdout);
+}
+
+static float readReplayHumidity() {
+    return options.humidity;
+}
+
+static void trackState() {
+    if (state == lastState) return;
+    mixValue('s');
+    mixValue(hal::native::nowUs());
+    mixValue(state);
+    lastState = state;
+    stateChanges++;
+}
+
+static void update() {
+    {
+        PROFILE_SCOPE(loopProfiler, PROBE_LOOP);
+        machineUpdate();
+    }
+    hal::native::drainEventLog();
+    loopIterations++;
+    trackState();
+}
+
+// Runs the loop up to end_us, never past it, so a command lands on its recorded microsecond
+static void runUntil(uint64_t end_us) {
+    while (hal::native::nowUs() < end_us) {
+        bool idle = !machineIsBusy() && strip.getActiveCount() == 0;
+        update();
+
+        uint64_t tick = idle ? IDLE_JUMP_US : machineIsStepping() ? options.fine_tick_us : options.coarse_tick_us;
+        hal::native::setTimeUs(std::min<uint64_t>(end_us, hal::native::nowUs() + tick));
+    }
+}
+
+// After the last command: until the machine and the strip are idle, or the tail runs out
+static void runTail(uint64_t tail_us) {
+    uint64_t end = hal::native::nowUs() + tail_us;
+    while (hal::native::nowUs() < end && (machineIsBusy() || strip.getActiveCount() > 0)) {
+        runUntil(std::min<uint64_t>(end, hal::native::nowUs() + options.coarse_tick_us));
+    }
+    update();
+}
+
+static bool loadTrace(const char* path, std::vector<TraceCommand>& commands, std::string& header) {
+    FILE* file = fopen(path, "r");
+    if (file == nullptr) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return false;
+    }
+
+    char line[512];
+    int number = 0;
+    bool ok = true;
+    while (fgets(line, sizeof(line), file) != nullptr) {
+        number++;
+        String text(line);
+        text.trim();
+
+        if (number == 1) {
+            if (strncmp(line, COMMAND_TRACE_MAGIC, strlen(COMMAND_TRACE_MAGIC)) != 0) {
+                fprintf(stderr, "%s is not a command trace (no \"%s\" header)\n", path, COMMAND_TRACE_MAGIC);
+                ok = false;
+                break;
+            }
+            header = text.c_str();
+            continue;
+        }
+
+        TraceCommand command;
+        if (!CommandCapture::parseLine(text, command.time_us, command.text)) {
+            if (text.length() > 0 && text[0] != '#') fprintf(stderr, "Line %d skipped: %s\n", number, text.c_str());
+            continue;
+        }
+        if (!commands.empty() && command.time_us < commands.back().time_us) {
+            fprintf(stderr, "Line %d goes back in time\n", number);
+            ok = false;
+            break;
+        }
+        commands.push_back(command);
+    }
+
+    fclose(file);
+    return ok;
+}
+
+static bool parseOptions(int argc, char** argv, ReplayOptions& opt) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if (arg == "--json") { opt.json = true; continue; }
+        if (arg == "--verbose") { opt.verbose = true; continue; }
+        if (arg == "--profile") { opt.profile = true; continue; }
+        if (arg.compare(0, 2, "--") != 0) {
+            if (opt.path != nullptr) return false;
+            opt.path = argv[i];
+            continue;
+        }
+
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (value == nullptr) {
+            fprintf(stderr, "Missing value for %s\n", arg.c_str());
+            return false;
+        }
+        i++;
+
+        if (arg == "--tick-us") opt.fine_tick_us = strtoull(value, nullptr, 10);
+        else if (arg == "--coarse-tick-us") opt.coarse_tick_us = strtoull(value, nullptr, 10);
+        else if (arg == "--humidity") opt.humidity = atof(value);
+        else if (arg == "--tail-s") opt.tail_s = atof(value);
+        else {
+            fprintf(stderr, "Unknown option %s\n", arg.c_str());
+            return false;
+        }
+    }
+
+    return opt.path != nullptr && opt.fine_tick_us > 0 && opt.coarse_tick_us > 0 && opt.tail_s >= 0.0f;
+}
+
+int main(int argc, char** argv) {
+    if (!parseOptions(argc, argv, options)) {
+        fprintf(stderr,
+            "Usage: replay TRACE [--tick-us US] [--coarse-tick-us US] [--humidity RH] [--tail-s S]\n"
+            "              [--json] [--verbose] [--profile]\n");
+        return 2;
+    }
+
+    std::vector<TraceCommand> commands;
+    std::string header;
+    if (!loadTrace(options.path, commands, header)) return 2;
+
+    // Same boot as the firmware, from time 0 with the compiled-in configuration
+    hal::native::setLogSink(onLog, nullptr);
+    hal::native::setGpioListener(onGpio, nullptr);
+    machineSetBroadcastHandler(onBroadcast);
+    machineSetHumiditySensor(readReplayHumidity);
+    loopProfiler.setEnabled(options.profile);
+    initConfig();
+    initCommands();
+    loopProfiler.reset();
+
+    auto wallStart = std::chrono::steady_clock::now();
+
+    for (const TraceCommand& command : commands) {
+        runUntil(command.time_us);
+        mixValue('c');
+        mixValue(hal::native::nowUs());
+        mix(command.text.c_str(), command.text.length());
+        dispatchCommand(command.text);
+        hal::native::drainEventLog();
+        trackState();
+    }
+    runTail(static_cast<uint64_t>(options.tail_s * 1e6f));
+
+    double wallS = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+    double simS = hal::native::nowUs() / 1e6;
+
+    if (options.json) {
+        printf("{\"trace\":\"%s\",\"commands\":%u,\"orders_finished\":%d,\"sim_s\":%.3f,\"wall_s\":%.3f,"
+            "\"loop_iterations\":%llu,\"gpio_edges\":%llu,\"broadcasts\":%llu,\"log_chunks\":%llu,"
+            "\"state_changes\":%llu,\"final_state\":%d,\"busy\":%s,\"digest\":\"%016llx\"}\n",
+            options.path, (unsigned)commands.size(), ordersFinished, simS, wallS,
+            (unsigned long long)loopIterations, (unsigned long long)gpioEdges, (unsigned long long)broadcasts,
+            (unsigned long long)logChunks, (unsigned long long)stateChanges, state,
+            machineIsBusy() ? "true" : "false", (unsigned long long)digest);
+    } else {
+        printf("%s\n", header.c_str());
+        printf("replayed %u commands, %d orders finished, %.1f s simulated in %.3f s, %llu loop iterations\n",
+            (unsigned)commands.size(), ordersFinished, simS, wallS, (unsigned long long)loopIterations);
+        printf("%llu GPIO edges, %llu broadcasts, %llu log chunks, %llu state changes, final state %d%s\n",
+            (unsigned long long)gpioEdges, (unsigned long long)broadcasts, (unsigned long long)logChunks,
+            (unsigned long long)stateChanges, state, machineIsBusy() ? " (still busy)" : "");
+        printf("digest %016llx\n", (unsigned long long)digest);
+    }
+
+    if (options.profile) {
+        hal::native::setLogSink(nullptr, nullptr);
+        printf("\n");
+        loopProfiler.printReport();
+    }
+
+    return 0;
+}
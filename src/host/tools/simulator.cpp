@@ -0,0 +1,465 @@
+// Whole-machine simulator: runs the real Machine code (state machine, command
+// handlers, Pump, StepperPowderDispenser, AnimatedStrip) against the virtual
+// clock and the plant models, and reports stage latencies and utilization.
+//
+// Long gaps with --column-settle-s and --line-air-ml show what a quiet spell
+// costs the next drink; --no-prestage turns off what the firmware does about
+// it and --priming turns on the line priming it leaves off (IdleScheduler.h).
+//
+//   pio run -e simulator && .pio/build/simulator/program --orders 1000 --step-scale 2
+
+#include "HalNative.h"
+#include "PlantModel.h"
+#include "Machine.h"
+#include "StepperPowderDispenser.h"
+#include <algorithm>
+#include <chrono>
+#include <stdarg.h>
+#include <string>
+#include <vector>
+
+struct SimOptions {
+    int orders = 200;
+    uint64_t fine_tick_us = 50;         // while a stepper is moving
+    uint64_t coarse_tick_us = 1000;     // pumps, LEDs and idle animations
+    float step_scale = 1.0f;            // multiplies the dispensers' step rate
+    float think_s = 4.0f;               // user time between orderDetails and prepare
+    float gap_s = 10.0f;                // time between an order finishing and the next one
+    float humidity = 50.0f;
+    float humidity_swing = 0.0f;
+    float flow_meter = 0.0f;            // pulses per mL of a meter on the water line, 0 = none
+    float column_settle_s = 0.0f;       // powder columns settle while the augers stand, 0 = never
+    float cold_yield = 0.5f;            // share of the flow a fully settled column gives
+    float line_air_ml = 0.0f;           // air in a fully drained line, 0 = lines never drain
+    float drain_s = 300.0f;             // time constant of the lines draining
+    bool prestage = true;               // the firmware pre-stages the predicted powder
+    bool priming = false;               // prime idle lines, off in the firmware by default
+    uint32_t seed = 1;
+    bool json = false;
+    bool verbose = false;
+    bool profile = false;               // host cost of each subsystem per loop
+};
+
+#define IDLE_JUMP_US 1000000ULL
+#define SIM_FLOW_METER_PIN 16           // Free GPIO for the simulated water flow meter
+#define WATER_REQUEST_ML 275.0f         // What the state machine asks of the water pump
+
+struct OrderRecord {
+    uint64_t stage_us[ORDER_METRICS_NUM_STAGES] = {0};
+    uint64_t total_us = 0;
+    float grams_requested = 0.0f;
+    float grams_delivered = 0.0f;
+    float water_mL = 0.0f;
+    float flavor_requested = 0.0f;
+    float flavor_mL = 0.0f;
+    uint64_t first_gram_us = 0;         // prepare to the first gram out of the auger
+    float air_mL = 0.0f;                // pumped ahead of the fluid into the bottle
+};
+
+// ——— Simulation state ———
+static PlantModel plant;
+static int augerOf[2];                  // birdman, pureHealth
+static int pumpOf[5];                   // chocolate, vainilla, fresa, agua, tumeric
+static bool orderFinished = false;
+static uint64_t loopIterations = 0;
+
+static int lastState = NOT_PREPARING;
+static uint64_t stageEnteredUs = 0;
+static OrderRecord* currentRecord = nullptr;
+static int currentAuger = 0;
+static double currentGramsBefore = 0.0;
+static uint64_t currentStartUs = 0;
+
+static uint32_t rngState = 1;
+
+static uint32_t nextRandom() {
+    // xorshift32, deterministic across platforms
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    return rngState;
+}
+
+static float randomRange(float low, float high) {
+    return low + (high - low) * (nextRandom() % 10000) / 10000.0f;
+}
+
+static void onBroadcast(uint8_t topic, const String& message) {
+    if (message == "Order finished") orderFinished = true;
+}
+
+static float readSimulatedHumidity() {
+    return plant.humidityAt(hal::native::nowUs());
+}
+
+static void trackState() {
+    if (state == lastState) return;
+
+    uint64_t now = hal::native::nowUs();
+    if (currentRecord != nullptr && lastState >= 0 && lastState < ORDER_METRICS_NUM_STAGES) {
+        currentRecord->stage_us[lastState] += now - stageEnteredUs;
+    }
+
+    lastState = state;
+    stageEnteredUs = now;
+}
+
+static void step(const SimOptions& opt) {
+    {
+        PROFILE_SCOPE(loopProfiler, PROBE_LOOP);
+        machineUpdate();
+    }
+    hal::native::drainEventLog();
+    loopIterations++;
+    trackState();
+
+    if (currentRecord != nullptr && currentRecord->first_gram_us == 0 &&
+        plant.auger(currentAuger).grams - currentGramsBefore >= 1.0) {
+        currentRecord->first_gram_us = hal::native::nowUs() - currentStartUs;
+    }
+
+    hal::native::advanceUs(machineIsStepping() ? opt.fine_tick_us : opt.coarse_tick_us);
+}
+
+// Runs the loop for a span of virtual time, jumping ahead when nothing can change.
+// Jumps are capped so the power governor still sees time pass.
+static void runFor(const SimOptions& opt, uint64_t duration_us) {
+    uint64_t end = hal::native::nowUs() + duration_us;
+
+    while (hal::native::nowUs() < end) {
+        if (!machineIsBusy() && strip.getActiveCount() == 0) {
+            machineUpdate();
+            hal::native::drainEventLog();
+            loopIterations++;
+            hal::native::setTimeUs(std::min<uint64_t>(end, hal::native::nowUs() + IDLE_JUMP_US));
+            continue;
+        }
+        step(opt);
+    }
+}
+
+static bool runUntilFinished(const SimOptions& opt, uint64_t timeout_us) {
+    uint64_t end = hal::native::nowUs() + timeout_us;
+    orderFinished = false;
+
+    while (!orderFinished && hal::native::nowUs() < end) {
+        step(opt);
+    }
+    return orderFinished;
+}
+
+static void command(const char* format, ...) __attribute__((format(printf, 1, 2)));
+static void command(const char* format, ...) {
+    char buffer[128];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    dispatchCommand(String(buffer));
+}
+
+static void setupPlant(const SimOptions& opt) {
+    // Real flow is a bit off from the firmware calibration, like on the machine
+    augerOf[0] = plant.addAuger(STEPPER_B_STEP, STEPPER_B_DIR, STEPPER_B_SLEEP, LOW, 1.0f / 31.9f, 0.004f);
+    augerOf[1] = plant.addAuger(STEPPER_A_STEP, STEPPER_A_DIR, STEPPER_A_SLEEP, LOW, 1.0f / 72.5f, 0.004f);
+
+    pumpOf[0] = plant.addPump(PERISTALTIC_A, false, 1.78f);
+    pumpOf[1] = plant.addPump(PERISTALTIC_B, false, 1.55f);
+    pumpOf[2] = plant.addPump(PERISTALTIC_C, false, 1.56f);
+    pumpOf[3] = plant.addPump(WATER_PUMP, true, 32.5f, 0.5f);
+    pumpOf[4] = plant.addPump(TUMERIC, false, 8.7f);
+
+    if (opt.flow_meter > 0.0f) plant.addFlowMeter(pumpOf[3], SIM_FLOW_METER_PIN, opt.flow_meter);
+
+    for (int i = 0; i < 2 && opt.column_settle_s > 0.0f; i++) {
+        plant.setColumnSettling(augerOf[i], opt.column_settle_s, opt.cold_yield);
+    }
+    for (int i = 0; i < 5 && opt.line_air_ml > 0.0f; i++) plant.setLineDrain(pumpOf[i], opt.line_air_ml, opt.drain_s);
+
+    plant.setHumidity(opt.humidity, opt.humidity_swing, 6 * 3600.0f);
+    plant.attach();
+}
+
+static uint64_t percentile(std::vector<uint64_t> values, float p) {
+    if (values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    size_t index = static_cast<size_t>(p * (values.size() - 1) + 0.5f);
+    return values[index];
+}
+
+static bool parseOptions(int argc, char** argv, SimOptions& opt) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+        if (arg == "--json") { opt.json = true; continue; }
+        if (arg == "--verbose") { opt.verbose = true; continue; }
+        if (arg == "--profile") { opt.profile = true; continue; }
+        if (arg == "--no-prestage") { opt.prestage = false; continue; }
+        if (arg == "--priming") { opt.priming = true; continue; }
+        if (value == nullptr) {
+            fprintf(stderr, "Missing value for %s\n", arg.c_str());
+            return false;
+        }
+        i++;
+
+        if (arg == "--orders") opt.orders = atoi(value);
+        else if (arg == "--tick-us") opt.fine_tick_us = strtoull(value, nullptr, 10);
+        else if (arg == "--coarse-tick-us") opt.coarse_tick_us = strtoull(value, nullptr, 10);
+        else if (arg == "--step-scale") opt.step_scale = atof(value);
+        else if (arg == "--think-s") opt.think_s = atof(value);
+        else if (arg == "--gap-s") opt.gap_s = atof(value);
+        else if (arg == "--humidity") opt.humidity = atof(value);
+        else if (arg == "--humidity-swing") opt.humidity_swing = atof(value);
+        else if (arg == "--flow-meter") opt.flow_meter = atof(value);
+        else if (arg == "--column-settle-s") opt.column_settle_s = atof(value);
+        else if (arg == "--cold-yield") opt.cold_yield = atof(value);
+        else if (arg == "--line-air-ml") opt.line_air_ml = atof(value);
+        else if (arg == "--drain-s") opt.drain_s = atof(value);
+        else if (arg == "--seed") opt.seed = strtoul(value, nullptr, 10);
+        else {
+            fprintf(stderr, "Unknown option %s\n", arg.c_str());
+            return false;
+        }
+    }
+
+    if (opt.orders <= 0 || opt.fine_tick_us == 0 || opt.coarse_tick_us == 0 || opt.step_scale <= 0.0f ||
+        opt.cold_yield <= 0.0f || opt.cold_yield > 1.0f || opt.drain_s <= 0.0f) {
+        fprintf(stderr, "Invalid options\n");
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    SimOptions opt;
+    if (!parseOptions(argc, argv, opt)) {
+        fprintf(stderr,
+            "Usage: simulator [--orders N] [--step-scale X] [--tick-us US] [--coarse-tick-us US]\n"
+            "                 [--think-s S] [--gap-s S] [--humidity RH] [--humidity-swing RH]\n"
+            "                 [--flow-meter PULSES_PER_ML] [--column-settle-s S] [--cold-yield X]\n"
+            "                 [--line-air-ml ML] [--drain-s S] [--no-prestage] [--priming]\n"
+            "                 [--seed N] [--json] [--verbose] [--profile]\n");
+        return 2;
+    }
+
+    rngState = opt.seed != 0 ? opt.seed : 1;
+    hal::native::setLogEnabled(opt.verbose);
+    setupPlant(opt);
+
+    machineSetBroadcastHandler(onBroadcast);
+    machineSetHumiditySensor(readSimulatedHumidity);
+    initConfig();
+    initCommands();
+
+    // Faster step rate: shorter interval and pulse on both dispensers
+    const char* powderAliases[] = {"1", "2"};
+    for (const char* alias : powderAliases) {
+        StepperPowderDispenser* d = machineDispenser(alias);
+        command("dispenserSetTiming(%s,%d,%d)", alias,
+            static_cast<int>(d->getStepInterval() / opt.step_scale),
+            static_cast<int>(d->getPulseDuration() / opt.step_scale));
+    }
+
+    if (opt.flow_meter > 0.0f) {
+        command("ingredientSetFlowMeter(%c,%d,%.3f)", WATER_ALIAS, SIM_FLOW_METER_PIN, opt.flow_meter);
+    }
+
+    if (!opt.prestage) command("idleSetPrestage(0)");
+    if (opt.priming) command("idleSetPriming(%lu)", IDLE_PRIME_AFTER_MS);
+
+    const char* flavorAliases[] = {"1", "2", "3"};
+    std::vector<OrderRecord> records(opt.orders);
+    int failed = 0;
+
+    // Reading the host clock costs more than most probes measure
+    loopProfiler.setEnabled(opt.profile);
+    loopProfiler.reset();
+    powerGovernor.resetStats(hal::millis());
+    auto wallStart = std::chrono::steady_clock::now();
+    uint64_t simStart = hal::native::nowUs();
+
+    for (int i = 0; i < opt.orders; i++) {
+        OrderRecord& record = records[i];
+        int powder = nextRandom() % 2;
+        int flavor = nextRandom() % 3;
+        record.grams_requested = randomRange(25.0f, 35.0f);
+        float flavorMl = randomRange(20.0f, 40.0f);
+        record.flavor_requested = flavorMl;
+        float tumericMl = (nextRandom() % 3 == 0) ? randomRange(1.0f, 4.0f) : 0.0f;
+
+        // Same command sequence the tablet sends
+        command("orderDetails");
+        runFor(opt, static_cast<uint64_t>(opt.think_s * 0.5e6f));
+        command("orderAskForBottle");
+        runFor(opt, static_cast<uint64_t>(opt.think_s * 0.5e6f));
+
+        plant.sync();
+        double gramsBefore = plant.auger(augerOf[powder]).grams;
+        double waterBefore = plant.pump(pumpOf[3]).volume_mL;
+        double flavorBefore = plant.pump(pumpOf[flavor]).volume_mL;
+        double airBefore = 0.0;
+        for (int p = 0; p < 5; p++) airBefore += plant.pump(pumpOf[p]).air_pumped_mL;
+
+        currentRecord = &record;
+        currentAuger = augerOf[powder];
+        currentGramsBefore = gramsBefore;
+        uint64_t start = hal::native::nowUs();
+        currentStartUs = start;
+        command("prepare(%s,%.2f,%s,%.2f,%.2f)", powderAliases[powder], record.grams_requested,
+            flavorAliases[flavor], flavorMl, tumericMl);
+        trackState();
+
+        if (!runUntilFinished(opt, 600000000ULL)) failed++;
+        trackState();
+        currentRecord = nullptr;
+
+        plant.sync();
+        record.total_us = hal::native::nowUs() - start;
+        record.grams_delivered = plant.auger(augerOf[powder]).grams - gramsBefore;
+        record.water_mL = plant.pump(pumpOf[3]).volume_mL - waterBefore;
+        record.flavor_mL = plant.pump(pumpOf[flavor]).volume_mL - flavorBefore;
+        for (int p = 0; p < 5; p++) record.air_mL += plant.pump(pumpOf[p]).air_pumped_mL;
+        record.air_mL -= airBefore;
+
+        runFor(opt, static_cast<uint64_t>(opt.gap_s * 1e6f));
+    }
+
+    plant.sync();
+    uint64_t simUs = hal::native::nowUs() - simStart;
+    double wallS = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+
+    // ——— Report ———
+    static const int stageOrder[] = {START_ORDER, PROTEIN_DISPENSING, WATER_PUMPING, FLAVOR_PUMPING, TUMERIC_DISPENSING, FINISH_ORDER};
+    static const char* const stageLabels[ORDER_METRICS_NUM_STAGES] = {
+        "START_ORDER", "WATER_PUMPING", "PROTEIN_DISPENSING", "FLAVOR_PUMPING", "TUMERIC_DISPENSING", "FINISH_ORDER"
+    };
+
+    std::vector<uint64_t> totals;
+    std::vector<uint64_t> firstGrams;
+    double gramsError = 0.0;
+    double waterError = 0.0;
+    double flavorError = 0.0;
+    for (const OrderRecord& r : records) {
+        totals.push_back(r.total_us);
+        if (r.first_gram_us > 0) firstGrams.push_back(r.first_gram_us);
+        gramsError += fabs(r.grams_delivered - r.grams_requested) / r.grams_requested;
+        waterError += fabs(r.water_mL - WATER_REQUEST_ML) / WATER_REQUEST_ML;
+        flavorError += fabs(r.flavor_mL - r.flavor_requested) / r.flavor_requested;
+    }
+
+    double drinksPerHour = opt.orders * 3600e6 / simUs;
+    double busyDrinksPerHour = 3600e6 / (std::max<uint64_t>(1, percentile(totals, 0.5f)));
+
+    if (opt.json) printf("{\"orders\":%d,\"failed\":%d,\"step_scale\":%.3f,\"sim_s\":%.1f,\"wall_s\":%.3f,"
+        "\"speedup\":%.0f,\"loop_iterations\":%llu,\"drinks_per_hour\":%.1f,\"max_drinks_per_hour\":%.1f,"
+        "\"mean_dose_error\":%.4f,\"mean_water_error\":%.4f,\"mean_flavor_error\":%.4f,\"stages\":{",
+        opt.orders, failed, opt.step_scale, simUs / 1e6, wallS, simUs / 1e6 / std::max(wallS, 1e-9),
+        (unsigned long long)loopIterations, drinksPerHour, busyDrinksPerHour, gramsError / opt.orders,
+        waterError / opt.orders, flavorError / opt.orders);
+    else {
+        printf("orders %d (failed %d), step scale %.2f, %.1f s simulated in %.3f s (%.0fx), %llu loop iterations\n",
+            opt.orders, failed, opt.step_scale, simUs / 1e6, wallS, simUs / 1e6 / std::max(wallS, 1e-9),
+            (unsigned long long)loopIterations);
+        printf("throughput %.1f drinks/h with %.1f s think + %.1f s gap, %.1f drinks/h back to back\n",
+            drinksPerHour, opt.think_s, opt.gap_s, busyDrinksPerHour);
+        printf("mean powder dose error %.2f%%, water error %.2f%% (%s), flavor error %.2f%%\n\n",
+            100.0 * gramsError / opt.orders, 100.0 * waterError / opt.orders,
+            opt.flow_meter > 0.0f ? "flow meter" : "timed", 100.0 * flavorError / opt.orders);
+        printf("%-20s %10s %10s %10s %10s\n", "stage", "p50 ms", "p90 ms", "p99 ms", "max ms");
+    }
+
+    for (size_t s = 0; s < sizeof(stageOrder) / sizeof(stageOrder[0]); s++) {
+        int stage = stageOrder[s];
+        std::vector<uint64_t> values;
+        for (const OrderRecord& r : records) values.push_back(r.stage_us[stage]);
+
+        if (opt.json) {
+            printf("%s\"%s\":{\"p50_ms\":%.1f,\"p90_ms\":%.1f,\"p99_ms\":%.1f,\"max_ms\":%.1f}", s > 0 ? "," : "",
+                stageLabels[stage], percentile(values, 0.5f) / 1e3, percentile(values, 0.9f) / 1e3,
+                percentile(values, 0.99f) / 1e3, percentile(values, 1.0f) / 1e3);
+        } else {
+            printf("%-20s %10.1f %10.1f %10.1f %10.1f\n", stageLabels[stage], percentile(values, 0.5f) / 1e3,
+                percentile(values, 0.9f) / 1e3, percentile(values, 0.99f) / 1e3, percentile(values, 1.0f) / 1e3);
+        }
+    }
+
+    if (opt.json) {
+        printf("},\"total\":{\"p50_ms\":%.1f,\"p90_ms\":%.1f,\"p99_ms\":%.1f},"
+            "\"first_gram\":{\"p50_ms\":%.1f,\"p90_ms\":%.1f,\"p99_ms\":%.1f,\"max_ms\":%.1f},\"utilization\":{",
+            percentile(totals, 0.5f) / 1e3, percentile(totals, 0.9f) / 1e3, percentile(totals, 0.99f) / 1e3,
+            percentile(firstGrams, 0.5f) / 1e3, percentile(firstGrams, 0.9f) / 1e3,
+            percentile(firstGrams, 0.99f) / 1e3, percentile(firstGrams, 1.0f) / 1e3);
+    } else {
+        printf("%-20s %10.1f %10.1f %10.1f %10.1f\n", "total", percentile(totals, 0.5f) / 1e3,
+            percentile(totals, 0.9f) / 1e3, percentile(totals, 0.99f) / 1e3, percentile(totals, 1.0f) / 1e3);
+        printf("%-20s %10.1f %10.1f %10.1f %10.1f\n\n", "first gram", percentile(firstGrams, 0.5f) / 1e3,
+            percentile(firstGrams, 0.9f) / 1e3, percentile(firstGrams, 0.99f) / 1e3, percentile(firstGrams, 1.0f) / 1e3);
+        printf("%-20s %10s %12s\n", "actuator", "busy %", "delivered");
+    }
+
+    const char* augerNames[] = {"birdman", "pureHealth"};
+    const char* pumpNames[] = {"chocolate", "vainilla", "fresa", "agua", "tumeric"};
+    bool first = true;
+
+    for (int i = 0; i < 2; i++) {
+        PlantModel::Auger& a = plant.auger(augerOf[i]);
+        uint64_t awake = a.awake_us + (a.awake ? hal::native::nowUs() - a.awake_since_us : 0);
+        if (opt.json) {
+            printf("%s\"%s\":{\"busy\":%.4f,\"grams\":%.1f,\"steps\":%u}", first ? "" : ",", augerNames[i],
+                (double)awake / simUs, a.grams, a.steps_forward);
+        } else {
+            printf("%-20s %10.2f %10.1f g\n", augerNames[i], 100.0 * awake / simUs, a.grams);
+        }
+        first = false;
+    }
+
+    for (int i = 0; i < 5; i++) {
+        PlantModel::PumpModel& p = plant.pump(pumpOf[i]);
+        uint64_t on = p.on_us + (p.on ? hal::native::nowUs() - p.on_since_us : 0);
+        if (opt.json) {
+            printf(",\"%s\":{\"busy\":%.4f,\"mL\":%.1f}", pumpNames[i], (double)on / simUs, p.volume_mL);
+        } else {
+            printf("%-20s %10.2f %10.1f mL\n", pumpNames[i], 100.0 * on / simUs, p.volume_mL);
+        }
+    }
+
+    if (opt.json) {
+        printf("},\"power_ms\":{");
+    } else {
+        printf("\npower");
+    }
+
+    for (int i = 0; i < NUM_POWER_STATES; i++) {
+        unsigned long ms = powerGovernor.timeInState(i, hal::millis());
+        if (opt.json) {
+            printf("%s\"%s\":%lu", i > 0 ? "," : "", PowerGovernor::stateName(i), ms);
+        } else {
+            printf("  %s %.1f%%", PowerGovernor::stateName(i), 100.0 * ms / (simUs / 1000.0));
+        }
+    }
+
+    unsigned long primes = 0;
+    double airMl = 0.0;
+    for (int i = 0; i < 5; i++) primes += idleScheduler.getPrimeCount(i);
+    for (const OrderRecord& r : records) airMl += r.air_mL;
+
+    if (opt.json) {
+        printf("},\"idle\":{\"prestaged\":%lu,\"agitated\":%lu,\"hits\":%lu,\"misses\":%lu,"
+            "\"primes\":%lu,\"air_mL\":%.2f}}\n", idleScheduler.getPrestageCount(), idleScheduler.getAgitateCount(),
+            idleScheduler.getPrestageHits(), idleScheduler.getPrestageMisses(), primes, airMl);
+    } else {
+        printf("\nidle: %lu pre-staged (%lu agitated), %lu of %lu predictions right, %lu priming pulses, "
+            "%.1f mL of air in the drinks\n", idleScheduler.getPrestageCount(), idleScheduler.getAgitateCount(),
+            idleScheduler.getPrestageHits(), idleScheduler.getPrestageHits() + idleScheduler.getPrestageMisses(),
+            primes, airMl);
+    }
+
+    if (opt.profile) {
+        hal::native::setLogEnabled(true);
+        printf("\n");
+        loopProfiler.printReport();
+    }
+
+    return failed > 0 ? 1 : 0;
+}
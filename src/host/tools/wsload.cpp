@@ -0,0 +1,1105 @@
+// WebSocket load generator: opens several clients against the /ws protocol of
+// the firmware, replays a mixed command stream at a fixed offered rate and
+// reports command round trips, throughput and the server's memory growth.
+//
+// Without --connect it forks a stand-in server on 127.0.0.1: the real
+// dispatcher and state machine, the real BroadcastHub, and a minimal HTTP
+// upgrade and RFC 6455 framing in place of AsyncWebServer. Commands go through
+// a queue bounded like machineTasksPostCommand() and subscribe() belongs to
+// the connection as in main.cpp, so dropped commands and backpressure behave
+// as on the ESP32. Its virtual clock follows the wall clock, and a blocking
+// delay in the firmware (readHumidity takes a second) is slept for real.
+// With --connect HOST:PORT the same load goes to a machine on the network.
+//
+// Replies are broadcasts, which every subscribed client gets. One more
+// connection, the monitor, matches each reply to the oldest unanswered
+// request of its kind. A round trip runs from the time the command was due,
+// not from when it went out, so a stalled server shows up in the tail instead
+// of slowing the load down. Server memory is the stand-in's RSS, or the free
+// heap from taskStats on a real machine.
+//
+//   pio run -e wsload && .pio/build/wsload/program [--clients N] [--duration S] [--rate HZ]
+//   pio run -e wsload && .pio/build/wsload/program --serve 8080      (stand-in only)
+
+#include "HalNative.h"
+#include "Machine.h"
+#include "BroadcastHub.h"
+#include "EventLog.h"
+#include "CommandCapture.h"
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+// Mirrors of the ESP32 limits (MachineTasks.h and AsyncWebSocket), which do not build on the host
+#define STANDIN_COMMAND_QUEUE   8       // COMMAND_QUEUE_LENGTH
+#define STANDIN_COMMAND_MAX     192     // COMMAND_MAX_LENGTH
+#define STANDIN_WS_QUEUE        32      // WS_MAX_QUEUED_MESSAGES of a client
+#define STANDIN_PERIOD_MS       5       // CONTROL_PERIOD_MS
+#define STANDIN_MAX_CLIENTS     16      // Connections beyond this are refused
+#define WS_MAX_FRAME            65536   // Longest frame either side accepts
+
+#define RSS_SAMPLE_US           250000ULL
+#define HANDSHAKE_TIMEOUT_MS    2000
+
+struct LoadOptions {
+    int clients = 4;
+    float duration_s = 10.0f;
+    float warmup_s = 1.0f;              // load runs but nothing is counted yet
+    float rate = 10.0f;                 // commands per second per client
+    int window = 4;                     // unanswered requests per client before it holds back
+    int timeout_ms = 5000;              // a request unanswered this long is lost
+    std::string subscribe = "all";      // topics of the load clients; the monitor always takes all
+    std::string mix;                    // name:weight,... instead of the default mix
+    const char* trace = nullptr;        // commands of a captureExport trace instead of the mix
+    std::string host;                   // --connect; empty for the stand-in
+    int port = 0;
+    int serve_port = -1;                // --serve: only run the stand-in
+    unsigned seed = 1;
+    bool json = false;
+    bool verbose = false;
+};
+
+// What a command answers with; the monitor tells replies apart by how they start
+struct ReplyKind {
+    const char* command;
+    const char* prefix;                 // nullptr: a bare number (humidity)
+};
+
+static const ReplyKind replyKinds[] = {
+    {"orderMetrics",    "{\"metrics\":\"orders\""},
+    {"powerStats",      "{\"power\":"},
+    {"idleStats",       "{\"idle\":"},
+    {"logStats",        "{\"eventLog\":"},
+    {"loopProfile",     "{\"loopProfile\":"},
+    {"broadcastStats",  "{\"broadcast\":"},
+    {"taskStats",       "{\"tasks\":"},
+    {"configShow",      "{\"config\":"},
+    {"readHumidity",    nullptr},
+};
+#define NUM_REPLY_KINDS (int)(sizeof(replyKinds) / sizeof(replyKinds[0]))
+#define KIND_TASK_STATS 6
+
+// Tablet traffic while nobody orders: telemetry polls and order screen animations.
+// readHumidity is left out, it holds the control task for a second and would be all the tail shows.
+static const char* const DEFAULT_MIX = "orderMetrics:4,powerStats:3,idleStats:2,logStats:1,loopProfile:1,"
+    "orderProgressBar:4,orderDetails:2,orderCanceled:2";
+
+struct MixEntry {
+    std::string command;                // sent as command()
+    int weight;
+};
+
+static uint64_t wallStartUs = 0;
+
+static uint64_t wallUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count() - wallStartUs;
+}
+
+static int kindOfCommand(const std::string& text) {
+    std::string name = text.substr(0, text.find('('));
+    for (int k = 0; k < NUM_REPLY_KINDS; k++) {
+        if (name == replyKinds[k].command) return k;
+    }
+    return -1;
+}
+
+static int kindOfReply(const std::string& text) {
+    for (int k = 0; k < NUM_REPLY_KINDS; k++) {
+        const char* prefix = replyKinds[k].prefix;
+        if (prefix != nullptr ? text.compare(0, strlen(prefix), prefix) == 0
+                              : !text.empty() && (isdigit((unsigned char)text[0]) || text[0] == '-')) {
+            return k;
+        }
+    }
+    return -1;
+}
+
+// ——— SHA-1 and base64, for Sec-WebSocket-Accept ———
+
+static uint32_t rotl(uint32_t x, int n) {
+    return (x << n) | (x >> (32 - n));
+}
+
+static void sha1(const std::string& data, uint8_t digest[20]) {
+    uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+
+    std::string m = data;
+    uint64_t bits = static_cast<uint64_t>(data.size()) * 8;
+    m += static_cast<char>(0x80);
+    while (m.size() % 64 != 56) m += '\0';
+    for (int i = 7; i >= 0; i--) m += static_cast<char>(bits >> (i * 8));
+
+    for (size_t chunk = 0; chunk < m.size(); chunk += 64) {
+        uint32_t w[80];
+        for (int i = 0; i < 16; i++) {
+            const uint8_t* p = reinterpret_cast<const uint8_t*>(m.data() + chunk + i * 4);
+            w[i] = (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+        }
+        for (int i = 16; i < 80; i++) w[i] = rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int i = 0; i < 80; i++) {
+            uint32_t f, k;
+            if (i < 20) { f = (b & c) | (~b & d); k = 0x5A827999; }
+            else if (i < 40) { f = b ^ c ^ d; k = 0x6ED9EBA1; }
+            else if (i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+            else { f = b ^ c ^ d; k = 0xCA62C1D6; }
+            uint32_t t = rotl(a, 5) + f + e + k + w[i];
+            e = d; d = c; c = rotl(b, 30); b = a; a = t;
+        }
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+    }
+
+    for (int i = 0; i < 20; i++) digest[i] = static_cast<uint8_t>(h[i / 4] >> (24 - (i % 4) * 8));
+}
+
+static std::string base64(const uint8_t* data, size_t length) {
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    for (size_t i = 0; i < length; i += 3) {
+        uint32_t v = (uint32_t)data[i] << 16;
+        if (i + 1 < length) v |= (uint32_t)data[i + 1] << 8;
+        if (i + 2 < length) v |= data[i + 2];
+        out += alphabet[(v >> 18) & 63];
+        out += alphabet[(v >> 12) & 63];
+        out += i + 1 < length ? alphabet[(v >> 6) & 63] : '=';
+        out += i + 2 < length ? alphabet[v & 63] : '=';
+    }
+    return out;
+}
+
+static std::string websocketAccept(const std::string& key) {
+    uint8_t digest[20];
+    sha1(key + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11", digest);
+    return base64(digest, sizeof(digest));
+}
+
+// ——— Connections and frames ———
+
+#define WS_TEXT     0x1
+#define WS_CLOSE    0x8
+#define WS_PING     0x9
+#define WS_PONG     0xA
+
+struct Connection {
+    int fd = -1;
+    uint32_t id = 0;
+    bool open = false;                  // upgraded to WebSocket
+    bool closing = false;               // close once the queued frames are written
+    std::string in;
+    std::deque<std::string> out;        // frames, the first one partly written
+    size_t written = 0;
+    uint64_t frames_in = 0;
+    uint64_t bytes_in = 0;
+};
+
+static void setNonBlocking(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+// Clients mask what they send (RFC 6455 5.3), servers do not
+static std::string encodeFrame(uint8_t opcode, const std::string& payload, bool masked) {
+    std::string frame;
+    frame += static_cast<char>(0x80 | opcode);
+
+    uint8_t mask_bit = masked ? 0x80 : 0;
+    size_t n = payload.size();
+    if (n < 126) {
+        frame += static_cast<char>(mask_bit | n);
+    } else if (n < 65536) {
+        frame += static_cast<char>(mask_bit | 126);
+        frame += static_cast<char>(n >> 8);
+        frame += static_cast<char>(n);
+    } else {
+        frame += static_cast<char>(mask_bit | 127);
+        for (int i = 7; i >= 0; i--) frame += static_cast<char>(static_cast<uint64_t>(n) >> (i * 8));
+    }
+
+    if (!masked) return frame + payload;
+
+    uint8_t key[4];
+    uint32_t r = static_cast<uint32_t>(rand());
+    for (int i = 0; i < 4; i++) key[i] = static_cast<uint8_t>(r >> (i * 8));
+    frame.append(reinterpret_cast<const char*>(key), 4);
+    for (size_t i = 0; i < n; i++) frame += static_cast<char>(payload[i] ^ key[i % 4]);
+    return frame;
+}
+
+/**
+ * Takes one frame off the front of the buffer.
+ * @return 1 with a frame, 0 if it is not complete yet, -1 if it is too long.
+ */
+static int decodeFrame(std::string& buffer, uint8_t& opcode, bool& final, std::string& payload) {
+    if (buffer.size() < 2) return 0;
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(buffer.data());
+
+    final = (p[0] & 0x80) != 0;
+    opcode = p[0] & 0x0F;
+    bool masked = (p[1] & 0x80) != 0;
+    uint64_t n = p[1] & 0x7F;
+    size_t header = 2;
+
+    if (n == 126) {
+        if (buffer.size() < 4) return 0;
+        n = (uint64_t)p[2] << 8 | p[3];
+        header = 4;
+    } else if (n == 127) {
+        if (buffer.size() < 10) return 0;
+        n = 0;
+        for (int i = 0; i < 8; i++) n = n << 8 | p[2 + i];
+        header = 10;
+    }
+    if (n > WS_MAX_FRAME) return -1;
+
+    size_t mask_at = header;
+    if (masked) header += 4;
+    if (buffer.size() < header + n) return 0;
+
+    payload.assign(buffer, header, n);
+    if (masked) {
+        for (size_t i = 0; i < n; i++) payload[i] ^= p[mask_at + i % 4];
+    }
+    buffer.erase(0, header + n);
+    return 1;
+}
+
+static void queueFrame(Connection& c, uint8_t opcode, const std::string& payload, bool masked) {
+    c.out.push_back(encodeFrame(opcode, payload, masked));
+}
+
+// Writes what the socket takes; false once the peer is gone
+static bool flush(Connection& c) {
+    while (!c.out.empty()) {
+        const std::string& frame = c.out.front();
+        ssize_t n = send(c.fd, frame.data() + c.written, frame.size() - c.written, MSG_NOSIGNAL);
+        if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK;
+
+        c.written += n;
+        if (c.written < frame.size()) return true;
+        c.out.pop_front();
+        c.written = 0;
+    }
+    return !c.closing;
+}
+
+// Appends what arrived; false once the peer is gone
+static bool receive(Connection& c) {
+    char buffer[4096];
+    for (;;) {
+        ssize_t n = recv(c.fd, buffer, sizeof(buffer), 0);
+        if (n > 0) {
+            c.in.append(buffer, n);
+            c.bytes_in += n;
+            continue;
+        }
+        return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+}
+
+static std::string headerValue(const std::string& request, const char* name) {
+    std::string lower = request;
+    std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+    std::string key = std::string("\r\n") + name + ":";
+    std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+
+    size_t at = lower.find(key);
+    if (at == std::string::npos) return "";
+    size_t start = request.find_first_not_of(' ', at + key.size());
+    size_t end = request.find("\r\n", start);
+    return request.substr(start, end - start);
+}
+
+// ——— Stand-in server ———
+
+static std::map<uint32_t, Connection> serverConnections;
+static std::deque<std::string> commandQueue;
+static BroadcastHub hub;
+static uint32_t nextClientId = 1;
+static uint32_t droppedCommands = 0;
+static uint64_t dispatchedCommands = 0;
+static volatile sig_atomic_t stopRequested = 0;
+
+static long rssKb(pid_t pid) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/statm", (int)pid);
+    FILE* file = fopen(path, "r");
+    if (file == nullptr) return -1;
+
+    long pages = 0, resident = 0;
+    int fields = fscanf(file, "%ld %ld", &pages, &resident);
+    fclose(file);
+    return fields == 2 ? resident * (sysconf(_SC_PAGESIZE) / 1024) : -1;
+}
+
+// AsyncWebSocketClient::queueIsFull(), as clientCanSend() in main.cpp
+static bool standInCanSend(uint32_t client_id, void* context) {
+    auto it = serverConnections.find(client_id);
+    return it == serverConnections.end() || (it->second.open && it->second.out.size() < STANDIN_WS_QUEUE);
+}
+
+static bool standInSend(uint32_t client_id, const SharedMessage& message, void* context) {
+    auto it = serverConnections.find(client_id);
+    if (it == serverConnections.end()) return false;
+    queueFrame(it->second, WS_TEXT, message->c_str(), false);
+    return true;
+}
+
+static void standInPublish(uint8_t topic, const String& message) {
+    hub.publish(topic, SharedMessage(new String(message)));
+}
+
+static float standInHumidity() {
+    return 50.0f;
+}
+
+// As machineTasksPostCommand(): the text is copied into a bounded queue or dropped
+static void postCommand(const std::string& text) {
+    if (text.size() >= STANDIN_COMMAND_MAX || commandQueue.size() >= STANDIN_COMMAND_QUEUE) {
+        droppedCommands++;
+        return;
+    }
+    commandQueue.push_back(text);
+}
+
+// As handleSubscribe() in main.cpp
+static void handleSubscribe(Connection& c, const std::string& text) {
+    size_t close = text.find(')');
+    String list = text.substr(10, close == std::string::npos ? std::string::npos : close - 10);
+    list.trim();
+    uint8_t topics = list == "none" ? 0 : BroadcastHub::parseTopics(list);
+
+    if (topics == 0 && list != "none") {
+        queueFrame(c, WS_TEXT, ("Unknown topic in: " + list + " (orders, telemetry, humidity, logs, all, none)").c_str(), false);
+    } else {
+        hub.subscribe(c.id, topics);
+    }
+}
+
+static bool handleUpgrade(Connection& c) {
+    size_t end = c.in.find("\r\n\r\n");
+    if (end == std::string::npos) return c.in.size() < 8192;
+
+    std::string request = c.in.substr(0, end + 2);
+    c.in.erase(0, end + 4);
+    std::string key = headerValue(request, "Sec-WebSocket-Key");
+
+    if (request.compare(0, 8, "GET /ws ") != 0 || key.empty()) {
+        c.out.push_back("HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+        c.closing = true;
+        return true;
+    }
+
+    c.out.push_back("HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+        "Sec-WebSocket-Accept: " + websocketAccept(key) + "\r\n\r\n");
+    c.open = true;
+    if (!hub.addClient(c.id, TOPIC_ALL)) {
+        fprintf(stderr, "WebSocket client #%u gets no broadcasts, %d clients tracked\n",
+            (unsigned)c.id, BROADCAST_MAX_CLIENTS);
+    }
+    return true;
+}
+
+// False once the connection should go
+static bool handleServerInput(Connection& c) {
+    if (!c.open && !c.closing && !handleUpgrade(c)) return false;
+    if (!c.open) return true;
+
+    uint8_t opcode;
+    bool final;
+    std::string payload;
+    int result;
+    while ((result = decodeFrame(c.in, opcode, final, payload)) > 0) {
+        c.frames_in++;
+        if (opcode == WS_CLOSE) {
+            queueFrame(c, WS_CLOSE, "", false);
+            c.closing = true;
+            return true;
+        }
+        if (opcode == WS_PING) queueFrame(c, WS_PONG, payload, false);
+
+        // Like handleWebSocketMessage(): whole text frames only
+        if (opcode != WS_TEXT || !final) continue;
+
+        if (payload.size() > 10 && payload.size() < STANDIN_COMMAND_MAX && payload.compare(0, 10, "subscribe(") == 0) {
+            handleSubscribe(c, payload);
+        } else {
+            postCommand(payload);
+        }
+    }
+    return result == 0;
+}
+
+// Virtual time follows the wall clock; a delay the firmware took moves it ahead, so wait for the wall clock
+static void syncClock(uint64_t start_us) {
+    uint64_t wall = wallUs() - start_us;
+    uint64_t now = hal::native::nowUs();
+    if (now < wall) hal::native::setTimeUs(wall);
+    else if (now > wall + 1000) usleep(static_cast<useconds_t>(now - wall));
+}
+
+static void onStopSignal(int signal) {
+    stopRequested = 1;
+}
+
+static void initStandIn(bool verbose) {
+    hal::native::setLogEnabled(verbose);
+    machineSetBroadcastHandler(standInPublish);
+    machineSetHumiditySensor(standInHumidity);
+    hub.setTransport(standInCanSend, standInSend, nullptr);
+    initConfig();
+    initCommands();
+
+    // Same shape as the MachineTasks reply, with the process RSS where the ESP32 has its free heap
+    machineAddCommand("taskStats", [](const String& args) {
+        String out = "{\"tasks\":{},\"dropped_commands\":" + String(static_cast<unsigned long>(droppedCommands));
+        out += ",\"dropped_broadcasts\":0";
+        out += ",\"dropped_requests\":" + String(static_cast<unsigned long>(machineDroppedRequests()));
+        out += ",\"dispatched\":" + String(static_cast<unsigned long>(dispatchedCommands));
+        out += ",\"rss_kb\":" + String(rssKb(getpid())) + "}";
+        standInPublish(TOPIC_TELEMETRY, out);
+    });
+
+    machineAddCommand("broadcastStats", [](const String& args) {
+        standInPublish(TOPIC_TELEMETRY, hub.statsJson());
+    });
+
+    machineAddCommand("broadcastStatsReset", [](const String& args) {
+        hub.resetStats();
+    });
+}
+
+// One thread does what the network, control, motion and UI tasks share on the ESP32
+static void runStandIn(int listen_fd, bool verbose) {
+    signal(SIGTERM, onStopSignal);
+    signal(SIGINT, onStopSignal);
+    initStandIn(verbose);
+    uint64_t start = wallUs();
+
+    std::vector<pollfd> fds;
+    std::vector<uint32_t> ids;
+    while (!stopRequested) {
+        fds.clear();
+        ids.clear();
+        fds.push_back({listen_fd, POLLIN, 0});
+        for (auto& entry : serverConnections) {
+            fds.push_back({entry.second.fd, static_cast<short>(POLLIN | (entry.second.out.empty() ? 0 : POLLOUT)), 0});
+            ids.push_back(entry.first);
+        }
+
+        int timeout = !commandQueue.empty() || machineIsStepping() ? 0 : machineIsBusy() ? 1 : STANDIN_PERIOD_MS;
+        if (poll(fds.data(), fds.size(), timeout) < 0 && errno != EINTR) break;
+
+        if (fds[0].revents & POLLIN) {
+            int fd = accept(listen_fd, nullptr, nullptr);
+            if (fd >= 0 && serverConnections.size() >= STANDIN_MAX_CLIENTS) {
+                close(fd);
+            } else if (fd >= 0) {
+                setNonBlocking(fd);
+                Connection& c = serverConnections[nextClientId];
+                c.fd = fd;
+                c.id = nextClientId++;
+            }
+        }
+
+        for (size_t i = 1; i < fds.size(); i++) {
+            if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            Connection& c = serverConnections[ids[i - 1]];
+            if (!receive(c) || !handleServerInput(c)) {
+                c.closing = true;
+                c.out.clear();
+            }
+        }
+
+        // The control task takes one command per wake, then runs the state machine
+        if (!commandQueue.empty()) {
+            std::string text = commandQueue.front();
+            commandQueue.pop_front();
+            LOG_EVENT(LOG_COMMAND, text.c_str());
+            dispatchCommand(String(text));
+            dispatchedCommands++;
+        }
+        syncClock(start);
+        machineUpdate();
+        hal::native::drainEventLog();
+        syncClock(start);
+
+        hub.pump();
+        for (auto it = serverConnections.begin(); it != serverConnections.end();) {
+            if (flush(it->second)) {
+                ++it;
+                continue;
+            }
+            hub.removeClient(it->first);
+            close(it->second.fd);
+            it = serverConnections.erase(it);
+        }
+    }
+
+    for (auto& entry : serverConnections) close(entry.second.fd);
+}
+
+static int listenOn(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 || listen(fd, 16) < 0) {
+        fprintf(stderr, "Cannot listen on 127.0.0.1:%d: %s\n", port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    setNonBlocking(fd);
+    return fd;
+}
+
+static int boundPort(int fd) {
+    sockaddr_in address = {};
+    socklen_t length = sizeof(address);
+    getsockname(fd, reinterpret_cast<sockaddr*>(&address), &length);
+    return ntohs(address.sin_port);
+}
+
+// ——— Load generator ———
+
+#define REQUEST_STATS_START -1          // The monitor's own taskStats, before and after the measurement
+#define REQUEST_STATS_END   -2
+
+struct Request {
+    int client;                         // or REQUEST_STATS_*
+    uint64_t due_us;
+};
+
+struct LoadClient {
+    Connection conn;
+    uint64_t next_due_us = 0;
+    int outstanding = 0;
+    size_t cursor = 0;                  // next trace command
+    bool stalled = false;               // the window is full and a command is due
+};
+
+struct KindStats {
+    uint64_t sent = 0;
+    uint64_t lost = 0;
+    std::vector<uint64_t> round_trips;
+};
+
+static LoadOptions options;
+static std::vector<LoadClient> clients;
+static Connection monitor;
+static std::deque<Request> pending[NUM_REPLY_KINDS];
+static KindStats kindStats[NUM_REPLY_KINDS];
+static std::vector<uint64_t> roundTrips;
+static std::string statsStart, statsEnd;
+static uint64_t measureFromUs = 0;
+static uint64_t commandsSent = 0;
+static uint64_t fireAndForget = 0;
+static uint64_t unmatchedReplies = 0;
+static uint64_t lostRequests = 0;
+static uint64_t windowStalls = 0;
+
+static int connectTo(const std::string& host, int port) {
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* found = nullptr;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &found) != 0) return -1;
+
+    int fd = -1;
+    for (addrinfo* a = found; a != nullptr && fd < 0; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) < 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(found);
+    return fd;
+}
+
+// Blocking upgrade, then the socket goes non-blocking with any early frames left in c.in
+static bool openWebSocket(Connection& c, const std::string& host, int port) {
+    c.fd = connectTo(host, port);
+    if (c.fd < 0) return false;
+
+    uint8_t nonce[16];
+    for (int i = 0; i < 16; i++) nonce[i] = static_cast<uint8_t>(rand());
+    std::string key = base64(nonce, sizeof(nonce));
+    std::string request = "GET /ws HTTP/1.1\r\nHost: " + host + "\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+        "Sec-WebSocket-Key: " + key + "\r\nSec-WebSocket-Version: 13\r\n\r\n";
+    if (send(c.fd, request.data(), request.size(), MSG_NOSIGNAL) != (ssize_t)request.size()) return false;
+
+    uint64_t deadline = wallUs() + HANDSHAKE_TIMEOUT_MS * 1000ULL;
+    size_t end;
+    while ((end = c.in.find("\r\n\r\n")) == std::string::npos) {
+        pollfd p = {c.fd, POLLIN, 0};
+        int left = static_cast<int>((deadline - std::min(deadline, wallUs())) / 1000);
+        if (left <= 0 || poll(&p, 1, left) <= 0) return false;
+
+        char buffer[1024];
+        ssize_t n = recv(c.fd, buffer, sizeof(buffer), 0);
+        if (n <= 0) return false;
+        c.in.append(buffer, n);
+    }
+
+    std::string response = c.in.substr(0, end + 2);
+    c.in.erase(0, end + 4);
+    if (response.compare(0, 12, "HTTP/1.1 101") != 0 || headerValue(response, "Sec-WebSocket-Accept") != websocketAccept(key)) {
+        fprintf(stderr, "No WebSocket upgrade: %s\n", response.substr(0, response.find('\r')).c_str());
+        return false;
+    }
+
+    setNonBlocking(c.fd);
+    c.open = true;
+    return true;
+}
+
+static void sendText(Connection& c, const std::string& text) {
+    queueFrame(c, WS_TEXT, text, true);
+    flush(c);
+}
+
+static std::vector<MixEntry> parseMix(const std::string& list) {
+    std::vector<MixEntry> mix;
+    size_t start = 0;
+    while (start < list.size()) {
+        size_t end = list.find(',', start);
+        std::string item = list.substr(start, end == std::string::npos ? std::string::npos : end - start);
+        size_t colon = item.find(':');
+        MixEntry entry = {item.substr(0, colon), colon == std::string::npos ? 1 : atoi(item.c_str() + colon + 1)};
+        if (!entry.command.empty() && entry.weight > 0) mix.push_back(entry);
+        if (end == std::string::npos) break;
+        start = end + 1;
+    }
+    return mix;
+}
+
+static bool loadTrace(const char* path, std::vector<std::string>& commands) {
+    FILE* file = fopen(path, "r");
+    if (file == nullptr) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return false;
+    }
+
+    char line[512];
+    while (fgets(line, sizeof(line), file) != nullptr) {
+        uint64_t time_us;
+        String command;
+        if (CommandCapture::parseLine(String(line), time_us, command)) commands.push_back(command.c_str());
+    }
+    fclose(file);
+
+    if (commands.empty()) fprintf(stderr, "No commands in %s\n", path);
+    return !commands.empty();
+}
+
+static void issue(int client, const std::string& command, uint64_t due_us) {
+    LoadClient& lc = clients[client];
+    sendText(lc.conn, command);
+    bool counted = due_us >= measureFromUs;
+    if (counted) commandsSent++;
+
+    int kind = kindOfCommand(command);
+    if (kind < 0) {
+        if (counted) fireAndForget++;
+        return;
+    }
+    pending[kind].push_back({client, due_us});
+    lc.outstanding++;
+    if (counted) kindStats[kind].sent++;
+}
+
+// The monitor sees every reply once; it answers the oldest request of its kind.
+// A command the server dropped leaves its request at the front until it times
+// out, so the reply to the next one of that kind is credited to it meanwhile.
+static void handleReply(const std::string& text, uint64_t now_us) {
+    int kind = kindOfReply(text);
+    if (kind < 0 || pending[kind].empty()) {
+        if (kind >= 0) unmatchedReplies++;
+        return;
+    }
+
+    Request request = pending[kind].front();
+    pending[kind].pop_front();
+    if (request.client == REQUEST_STATS_START) statsStart = text;
+    if (request.client == REQUEST_STATS_END) statsEnd = text;
+    if (request.client < 0) return;
+
+    clients[request.client].outstanding--;
+    if (request.due_us < measureFromUs) return;
+    uint64_t round_trip = now_us - request.due_us;
+    roundTrips.push_back(round_trip);
+    kindStats[kind].round_trips.push_back(round_trip);
+}
+
+static void expireRequests(uint64_t now_us) {
+    for (int k = 0; k < NUM_REPLY_KINDS; k++) {
+        while (!pending[k].empty() && pending[k].front().due_us + options.timeout_ms * 1000ULL < now_us) {
+            Request request = pending[k].front();
+            pending[k].pop_front();
+            if (request.client < 0) continue;
+
+            clients[request.client].outstanding--;
+            if (request.due_us >= measureFromUs) {
+                kindStats[k].lost++;
+                lostRequests++;
+            }
+        }
+    }
+}
+
+// Reads every socket; the load clients only count what they get
+static bool service(int timeout_ms) {
+    std::vector<pollfd> fds;
+    fds.push_back({monitor.fd, static_cast<short>(POLLIN | (monitor.out.empty() ? 0 : POLLOUT)), 0});
+    for (LoadClient& lc : clients) {
+        fds.push_back({lc.conn.fd, static_cast<short>(POLLIN | (lc.conn.out.empty() ? 0 : POLLOUT)), 0});
+    }
+    if (poll(fds.data(), fds.size(), timeout_ms) < 0 && errno != EINTR) return false;
+
+    uint8_t opcode;
+    bool final;
+    std::string payload;
+    for (size_t i = 0; i < fds.size(); i++) {
+        Connection& c = i == 0 ? monitor : clients[i - 1].conn;
+        if (!flush(c)) return false;
+        if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+        if (!receive(c)) {
+            fprintf(stderr, "Server closed connection %u\n", (unsigned)i);
+            return false;
+        }
+
+        int result;
+        while ((result = decodeFrame(c.in, opcode, final, payload)) > 0) {
+            c.frames_in++;
+            if (opcode == WS_PING) queueFrame(c, WS_PONG, payload, true);
+            if (opcode == WS_TEXT && i == 0) handleReply(payload, wallUs());
+        }
+        if (result < 0) return false;
+    }
+    return true;
+}
+
+// taskStats through the monitor, for the dropped commands and the server's memory; the reply lands in statsStart or statsEnd
+static void requestTaskStats(int which) {
+    pending[KIND_TASK_STATS].push_back({which, wallUs()});
+    sendText(monitor, "taskStats()");
+}
+
+static double jsonNumber(const std::string& json, const char* key) {
+    std::string pattern = std::string("\"") + key + "\":";
+    size_t at = json.find(pattern);
+    return at == std::string::npos ? -1.0 : atof(json.c_str() + at + pattern.size());
+}
+
+static uint64_t percentile(std::vector<uint64_t> values, float p) {
+    if (values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    size_t index = static_cast<size_t>(p * (values.size() - 1) + 0.5f);
+    return values[index];
+}
+
+static bool parseOptions(int argc, char** argv, LoadOptions& opt) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if (arg == "--json") { opt.json = true; continue; }
+        if (arg == "--verbose") { opt.verbose = true; continue; }
+
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (value == nullptr) {
+            fprintf(stderr, "Missing value for %s\n", arg.c_str());
+            return false;
+        }
+        i++;
+
+        if (arg == "--clients") opt.clients = atoi(value);
+        else if (arg == "--duration") opt.duration_s = atof(value);
+        else if (arg == "--warmup") opt.warmup_s = atof(value);
+        else if (arg == "--rate") opt.rate = atof(value);
+        else if (arg == "--window") opt.window = atoi(value);
+        else if (arg == "--timeout-ms") opt.timeout_ms = atoi(value);
+        else if (arg == "--subscribe") opt.subscribe = value;
+        else if (arg == "--mix") opt.mix = value;
+        else if (arg == "--trace") opt.trace = value;
+        else if (arg == "--seed") opt.seed = strtoul(value, nullptr, 10);
+        else if (arg == "--serve") opt.serve_port = atoi(value);
+        else if (arg == "--connect") {
+            std::string target = value;
+            size_t colon = target.rfind(':');
+            opt.host = target.substr(0, colon);
+            opt.port = colon == std::string::npos ? 80 : atoi(target.c_str() + colon + 1);
+            if (opt.host.empty() || opt.port <= 0) return false;
+        } else {
+            fprintf(stderr, "Unknown option %s\n", arg.c_str());
+            return false;
+        }
+    }
+
+    return opt.clients > 0 && opt.duration_s > 0.0f && opt.warmup_s >= 0.0f && opt.rate > 0.0f &&
+        opt.window > 0 && opt.timeout_ms > 0;
+}
+
+static void printReport(const std::string& target, double window_s, long rss_start, long rss_end, long rss_peak) {
+    uint64_t answered = roundTrips.size();
+    uint64_t received = 0, bytes = 0;
+    for (const LoadClient& lc : clients) {
+        received += lc.conn.frames_in;
+        bytes += lc.conn.bytes_in;
+    }
+
+    double dropped = statsEnd.empty() || statsStart.empty() ? -1.0 :
+        jsonNumber(statsEnd, "dropped_commands") - jsonNumber(statsStart, "dropped_commands");
+    bool standIn = options.host.empty();
+    double heapStart = jsonNumber(statsStart, "free_heap");
+    double heapEnd = jsonNumber(statsEnd, "free_heap");
+
+    if (options.json) {
+        printf("{\"target\":\"%s\",\"clients\":%d,\"rate\":%.2f,\"window_s\":%.3f,\"sent\":%llu,"
+            "\"fire_and_forget\":%llu,\"answered\":%llu,\"lost\":%llu,\"unmatched\":%llu,\"window_stalls\":%llu,"
+            "\"commands_per_s\":%.2f,\"replies_per_s\":%.2f,\"broadcasts_received\":%llu,\"broadcast_bytes\":%llu,"
+            "\"dropped_commands\":%.0f,\"round_trip_ms\":{\"p50\":%.3f,\"p90\":%.3f,\"p99\":%.3f,\"max\":%.3f},",
+            target.c_str(), options.clients, options.rate, window_s, (unsigned long long)commandsSent,
+            (unsigned long long)fireAndForget, (unsigned long long)answered, (unsigned long long)lostRequests,
+            (unsigned long long)unmatchedReplies, (unsigned long long)windowStalls, commandsSent / window_s,
+            answered / window_s, (unsigned long long)received, (unsigned long long)bytes, dropped,
+            percentile(roundTrips, 0.5f) / 1e3, percentile(roundTrips, 0.9f) / 1e3,
+            percentile(roundTrips, 0.99f) / 1e3, percentile(roundTrips, 1.0f) / 1e3);
+
+        printf("\"commands\":{");
+        bool first = true;
+        for (int k = 0; k < NUM_REPLY_KINDS; k++) {
+            const KindStats& s = kindStats[k];
+            if (s.sent == 0) continue;
+            printf("%s\"%s\":{\"sent\":%llu,\"lost\":%llu,\"p50_ms\":%.3f,\"p99_ms\":%.3f,\"max_ms\":%.3f}",
+                first ? "" : ",", replyKinds[k].command, (unsigned long long)s.sent, (unsigned long long)s.lost,
+                percentile(s.round_trips, 0.5f) / 1e3, percentile(s.round_trips, 0.99f) / 1e3,
+                percentile(s.round_trips, 1.0f) / 1e3);
+            first = false;
+        }
+
+        if (standIn) {
+            printf("},\"memory\":{\"rss_start_kb\":%ld,\"rss_end_kb\":%ld,\"rss_peak_kb\":%ld,\"growth_kb\":%ld}}\n",
+                rss_start, rss_end, rss_peak, rss_end - rss_start);
+        } else {
+            printf("},\"memory\":{\"free_heap_start\":%.0f,\"free_heap_end\":%.0f,\"growth\":%.0f}}\n",
+                heapStart, heapEnd, heapStart >= 0 && heapEnd >= 0 ? heapStart - heapEnd : -1.0);
+        }
+        return;
+    }
+
+    printf("%d clients against %s, %.1f commands/s each (window %d), %.1f s measured\n",
+        options.clients, target.c_str(), options.rate, options.window, window_s);
+    printf("sent %llu commands (%llu without reply), %llu answered, %llu lost, %llu unmatched replies, %llu window stalls\n",
+        (unsigned long long)commandsSent, (unsigned long long)fireAndForget, (unsigned long long)answered,
+        (unsigned long long)lostRequests, (unsigned long long)unmatchedReplies, (unsigned long long)windowStalls);
+    printf("throughput %.1f commands/s, %.1f replies/s; load clients received %llu broadcasts (%.1f kB)\n",
+        commandsSent / window_s, answered / window_s, (unsigned long long)received, bytes / 1024.0);
+
+    printf("\n%-20s %8s %8s %10s %10s %10s %10s\n", "round trip (ms)", "sent", "lost", "p50", "p90", "p99", "max");
+    for (int k = 0; k < NUM_REPLY_KINDS; k++) {
+        const KindStats& s = kindStats[k];
+        if (s.sent == 0) continue;
+        printf("%-20s %8llu %8llu %10.2f %10.2f %10.2f %10.2f\n", replyKinds[k].command, (unsigned long long)s.sent,
+            (unsigned long long)s.lost, percentile(s.round_trips, 0.5f) / 1e3, percentile(s.round_trips, 0.9f) / 1e3,
+            percentile(s.round_trips, 0.99f) / 1e3, percentile(s.round_trips, 1.0f) / 1e3);
+    }
+    printf("%-20s %8llu %8llu %10.2f %10.2f %10.2f %10.2f\n\n", "all", (unsigned long long)(answered + lostRequests),
+        (unsigned long long)lostRequests, percentile(roundTrips, 0.5f) / 1e3, percentile(roundTrips, 0.9f) / 1e3,
+        percentile(roundTrips, 0.99f) / 1e3, percentile(roundTrips, 1.0f) / 1e3);
+
+    if (dropped >= 0) printf("server dropped %.0f commands (queue full or too long)\n", dropped);
+    else printf("server dropped commands: unknown, taskStats not answered\n");
+
+    if (standIn) {
+        printf("server RSS %ld kB -> %ld kB (%+ld kB, peak %ld kB)\n", rss_start, rss_end, rss_end - rss_start, rss_peak);
+    } else if (heapStart >= 0 && heapEnd >= 0) {
+        printf("server free heap %.0f -> %.0f bytes (%+.0f)\n", heapStart, heapEnd, heapEnd - heapStart);
+    }
+}
+
+int main(int argc, char** argv) {
+    if (!parseOptions(argc, argv, options)) {
+        fprintf(stderr,
+            "Usage: wsload [--clients N] [--duration S] [--warmup S] [--rate HZ] [--window N] [--timeout-ms MS]\n"
+            "              [--subscribe TOPICS] [--mix NAME:WEIGHT,...] [--trace FILE] [--seed N]\n"
+            "              [--connect HOST:PORT] [--json] [--verbose]\n"
+            "       wsload --serve PORT [--verbose]\n");
+        return 2;
+    }
+    wallStartUs = wallUs();
+    srand(options.seed);
+
+    if (options.serve_port >= 0) {
+        int fd = listenOn(options.serve_port);
+        if (fd < 0) return 1;
+        printf("Stand-in serving ws://127.0.0.1:%d/ws\n", boundPort(fd));
+        fflush(stdout);
+        runStandIn(fd, options.verbose);
+        return 0;
+    }
+
+    // The command stream: a weighted mix, or a trace played round robin across the clients
+    std::vector<MixEntry> mix = parseMix(options.mix.empty() ? DEFAULT_MIX : options.mix);
+    std::vector<std::string> trace;
+    if (options.trace != nullptr && !loadTrace(options.trace, trace)) return 2;
+    if (mix.empty()) {
+        fprintf(stderr, "Empty command mix\n");
+        return 2;
+    }
+    std::vector<int> weights;
+    for (const MixEntry& entry : mix) weights.push_back(entry.weight);
+    std::mt19937 random(options.seed);
+    std::discrete_distribution<int> pick(weights.begin(), weights.end());
+
+    // The stand-in gets its own process, so its RSS is the server's alone
+    pid_t server = -1;
+    std::string target;
+    if (options.host.empty()) {
+        int fd = listenOn(0);
+        if (fd < 0) return 1;
+        options.host = "127.0.0.1";
+        options.port = boundPort(fd);
+
+        server = fork();
+        if (server == 0) {
+            prctl(PR_SET_PDEATHSIG, SIGTERM);
+            runStandIn(fd, options.verbose);
+            _exit(0);
+        }
+        close(fd);
+        target = "stand-in " + options.host + ":" + std::to_string(options.port);
+        options.host.clear();
+    } else {
+        target = options.host + ":" + std::to_string(options.port);
+    }
+    std::string host = options.host.empty() ? "127.0.0.1" : options.host;
+
+    if (options.clients + 1 > BROADCAST_MAX_CLIENTS) {
+        fprintf(stderr, "Note: %d connections, the hub tracks %d; the last ones get no broadcasts\n",
+            options.clients + 1, BROADCAST_MAX_CLIENTS);
+    }
+
+    // The monitor connects first so it is always one of the tracked clients
+    int status = 0;
+    clients.resize(options.clients);
+    bool connected = openWebSocket(monitor, host, options.port);
+    if (connected) sendText(monitor, "subscribe(all)");
+    for (int i = 0; connected && i < options.clients; i++) {
+        connected = openWebSocket(clients[i].conn, host, options.port);
+        if (connected) sendText(clients[i].conn, "subscribe(" + options.subscribe + ")");
+    }
+    if (!connected) {
+        fprintf(stderr, "Cannot open a WebSocket to %s:%d\n", host.c_str(), options.port);
+        status = 1;
+    }
+
+    if (status == 0) {
+        uint64_t interval = static_cast<uint64_t>(1e6 / options.rate);
+        uint64_t start = wallUs();
+        for (int i = 0; i < options.clients; i++) {
+            clients[i].next_due_us = start + interval * i / options.clients;
+            clients[i].cursor = i;
+        }
+        measureFromUs = start + static_cast<uint64_t>(options.warmup_s * 1e6f);
+        uint64_t stopAt = measureFromUs + static_cast<uint64_t>(options.duration_s * 1e6f);
+
+        long rssStart = -1, rssEnd = -1, rssPeak = -1;
+        uint64_t nextRssSample = 0;
+        bool measuring = false;
+
+        while (status == 0 && wallUs() < stopAt) {
+            uint64_t now = wallUs();
+            if (!measuring && now >= measureFromUs) {
+                measuring = true;
+                requestTaskStats(REQUEST_STATS_START);
+                if (server > 0) rssStart = rssPeak = rssKb(server);
+            }
+            if (server > 0 && measuring && now >= nextRssSample) {
+                rssPeak = std::max(rssPeak, rssKb(server));
+                nextRssSample = now + RSS_SAMPLE_US;
+            }
+
+            uint64_t nextDue = stopAt;
+            for (int i = 0; i < options.clients; i++) {
+                LoadClient& lc = clients[i];
+                while (lc.next_due_us <= now) {
+                    if (lc.outstanding >= options.window) {
+                        if (!lc.stalled && lc.next_due_us >= measureFromUs) windowStalls++;
+                        lc.stalled = true;
+                        break;
+                    }
+                    lc.stalled = false;
+                    std::string command = trace.empty() ? mix[pick(random)].command + "()" : trace[lc.cursor % trace.size()];
+                    lc.cursor += trace.empty() ? 1 : options.clients;
+                    issue(i, command, lc.next_due_us);
+                    lc.next_due_us += interval;
+                }
+                nextDue = std::min(nextDue, lc.next_due_us);
+            }
+
+            expireRequests(now);
+            int wait = nextDue > now ? static_cast<int>((nextDue - now + 999) / 1000) : 1;
+            if (!service(std::min(wait, 10))) status = 1;
+        }
+
+        // Let the requests in flight finish or time out
+        uint64_t drainUntil = wallUs() + options.timeout_ms * 1000ULL;
+        auto inFlight = [] {
+            for (const LoadClient& lc : clients) {
+                if (lc.outstanding > 0) return true;
+            }
+            return false;
+        };
+        while (status == 0 && inFlight() && wallUs() < drainUntil) {
+            if (!service(10)) status = 1;
+            expireRequests(wallUs());
+        }
+        expireRequests(UINT64_MAX / 2);
+
+        double windowS = (stopAt - measureFromUs) / 1e6;
+        if (status == 0) {
+            requestTaskStats(REQUEST_STATS_END);
+            uint64_t deadline = wallUs() + options.timeout_ms * 1000ULL;
+            while (statsEnd.empty() && wallUs() < deadline && service(10)) {}
+
+            if (server > 0) {
+                rssEnd = rssKb(server);
+                rssPeak = std::max(rssPeak, rssEnd);
+            }
+            printReport(target, windowS, rssStart, rssEnd, rssPeak);
+        }
+    }
+
+    close(monitor.fd);
+    for (LoadClient& lc : clients) {
+        if (lc.conn.fd >= 0) close(lc.conn.fd);
+    }
+    if (server > 0) {
+        kill(server, SIGTERM);
+        waitpid(server, nullptr, 0);
+    }
+    return status;
+}